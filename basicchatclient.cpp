@@ -19,7 +19,20 @@ void BasicChatClient::handleRequest(const string &rawMessage, boost::shared_ptr<
 	 * model, but also the object that receives incoming messages which can be legitimately processed by the controller
 	 * that is responsible for issuing commands.
 	 */
-	controller_->processIncomingMessage(rawMessage, remoteEndpoint);
+	controller_->processIncomingMessage(rawMessage, *remoteEndpoint);
+}
+
+void BasicChatClient::handleRequest(const Datagram &datagram) {
+	// same as above, but without copying the datagram out of its receive buffer
+	controller_->processIncomingMessage(datagram);
+}
+
+void BasicChatClient::reportResolutionFailure(const string &id, const string &hostname, const string &port, const string &error) {
+	if (controller_) {
+		controller_->processResolutionFailure(id, hostname, port, error);
+	} else {
+		cerr << "Cannot resolve " << hostname << ":" << port << " for " << id << ": " << error << endl;
+	}
 }
 
 }
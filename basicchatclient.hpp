@@ -8,11 +8,22 @@
 
 #pragma once
 
+#include <deque>
 #include <algorithm>
 #include <iostream>
+#include <sstream>
 
 #include "server.hpp"
+#include "fanout.hpp"
 #include "peerlist.hpp"
+#include "groupindex.hpp"
+#include "resolver.hpp"
+#include "contactdatabase.hpp"
+#include "journal.hpp"
+#include "historystore.hpp"
+#include "friendlog.hpp"
+#include "chatprotocol.hpp"
+#include "wiremessage.hpp"
 
 using namespace std;
 
@@ -21,68 +32,351 @@ namespace openchat {
 class Controller;
 
 /**
- * BasicChatClient implements the fundamental framework for chat
+ * BasicChatClient implements the fundamental framework for chat.  Its contacts and groups may be
+ * changed by the input thread and by request handlers at the same time.
  */
 class BasicChatClient : public Server {
 public:
-	BasicChatClient(const string &id, int port) : Server(port), id_(id) { }
-	virtual ~BasicChatClient() { }
+	BasicChatClient(const string &id, int port, const ServerOptions &options = ServerOptions())
+		: Server(port, options), id_(id), greeting_(false), journal_(0), history_(0),
+		  resolver_(options.resolverThreadCount, options.resolverCacheTimeout, options.resolverFailureTimeout),
+		  friends_(peers_), strangers_(peers_), fanout_(*this) {
+		peers_.setResolver(&resolver_, boost::bind(&BasicChatClient::reportResolutionFailure, this, _1, _2, _3, _4));
+	}
+	virtual ~BasicChatClient() {
+		// no lookup may finish into a half destroyed client
+		resolver_.stop();
+	}
 
-	void addFriend(const string &id, const string &hostname, const string &port) {
-		friends_.addPeer(id, hostname, port, ioService_);
+	// the address is resolved in the background when the friend is first sent to; false if id already is one
+	bool addFriend(const string &id, const string &hostname, const string &port) {
+		if (!friends_.addPeer(id, hostname, port))
+			return false;
+		friendLog_.recordAdd(id, hostname, port);
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_ADD_FRIEND, id, hostname, port));
+		if (greeting_) {
+			friends_.sendTo(id, *this, ChatProtocol::wrapHelloMessage(id_, BinaryProtocol::version, getFeatures(), false));
+		}
+		return true;
 	}
 
-	void deleteFriend(const string &id) {
-		friends_.deletePeer(id);
+	// false if id is not a friend
+	bool deleteFriend(const string &id) {
+		PeerHandle peer = friends_.getPeer(id);
+		udp::endpoint endpoint = getResolvedEndpoint(peer);
+		if (!friends_.deletePeer(id))
+			return false;
+		forgetEndpoint(peer, endpoint);
+		friendLog_.recordRemove(id);
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_DELETE_FRIEND, id));
+		boost::mutex::scoped_lock lock(replicasMutex_);
+		friendReplicas_.erase(id);
+		return true;
 	}
 
-	void addStranger(const string &id, const string &hostname, const string &port) {
-		strangers_.addPeer(id, hostname, port, ioService_);
+	// strangers are kept up to maxStrangers, the oldest ones being forgotten; false if id already is one
+	bool addStranger(const string &id, const string &hostname, const string &port) {
+		if (!strangers_.addPeer(id, hostname, port))
+			return false;
+		limitStrangers(id);
+		return true;
+	}
+
+	// a stranger is reached where its message came from, there is nothing to resolve
+	bool addStranger(const string &id, const udp::endpoint &remoteEndpoint) {
+		ostringstream port;
+		port << remoteEndpoint.port();
+		if (!strangers_.addPeer(id, remoteEndpoint.address().to_string(), port.str(), remoteEndpoint))
+			return false;
+		limitStrangers(id);
+		return true;
 	}
 
 	void deleteStranger(const string &id) {
-		friends_.deletePeer(id);
+		PeerHandle peer = strangers_.getPeer(id);
+		udp::endpoint endpoint = getResolvedEndpoint(peer);
+		if (strangers_.deletePeer(id))
+			forgetEndpoint(peer, endpoint);
+	}
+
+	// false if the group already exists
+	bool addGroup(const string &id) {
+		if (!groups_.addGroup(id))
+			return false;
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_ADD_GROUP, id));
+		return true;
+	}
+
+	// false if there is no such group
+	bool deleteGroup(const string &id) {
+		vector<PeerHandle> members;
+		if (!groups_.deleteGroup(id, members))
+			return false;
+		for (vector<PeerHandle>::const_iterator iter = members.begin(); iter != members.end(); ++iter) {
+			peers_.release(*iter);
+		}
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_DELETE_GROUP, id));
+		return true;
+	}
+
+	// a group holds a reference to each of its members' handles; false if nothing was added
+	bool addGroupMember(const string &groupID, const string &memberID) {
+		// only friends can be members, and only of groups that exist
+		PeerHandle peer = friends_.getPeer(memberID);
+		if (peer == PeerTable::invalidHandle)
+			return false;
+		peers_.retain(peer);
+		if (!groups_.addMember(groupID, peer)) {
+			peers_.release(peer);
+			return false;
+		}
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_ADD_GROUP_MEMBER, groupID, memberID));
+		return true;
+	}
+
+	// false if memberID is not a member of the group
+	bool deleteGroupMember(const string &groupID, const string &memberID) {
+		PeerHandle peer = peers_.find(memberID);
+		if (peer == PeerTable::invalidHandle || !groups_.deleteMember(groupID, peer))
+			return false;
+		peers_.release(peer);
+		record(ContactDatabase::encodeMutation(ContactDatabase::MUTATION_DELETE_GROUP_MEMBER, groupID, memberID));
+		return true;
+	}
+
+	/**
+	 * Record every change to friends and groups in journal from now on; a change returns once it
+	 * is on disk.  Null stops recording.
+	 */
+	void setJournal(Journal *journal) {
+		journal_ = journal;
+	}
+
+	// keep the messages sent and received in history from now on; null stops keeping them
+	void setHistory(HistoryStore *history) {
+		history_ = history;
+	}
+
+	HistoryStore *getHistory() const {
+		return history_;
+	}
+
+	// keep a message in the history, if there is one; this only queues it for writing
+	void recordMessage(const string &conversation, HistoryStore::Direction direction, const string &fromID, const string &text) {
+		HistoryStore *history = history_;
+		if (history)
+			history->append(conversation, direction, fromID, text);
+	}
+
+	// redo a change read back from the journal; false if the record is not understood
+	bool applyMutation(const string &mutation) {
+		ContactDatabase::MutationType type;
+		string first, second, third;
+		if (!ContactDatabase::decodeMutation(mutation, type, first, second, third))
+			return false;
+		switch (type) {
+		case ContactDatabase::MUTATION_ADD_FRIEND:
+			addFriend(first, second, third);
+			break;
+		case ContactDatabase::MUTATION_DELETE_FRIEND:
+			deleteFriend(first);
+			break;
+		case ContactDatabase::MUTATION_ADD_GROUP:
+			addGroup(first);
+			break;
+		case ContactDatabase::MUTATION_DELETE_GROUP:
+			deleteGroup(first);
+			break;
+		case ContactDatabase::MUTATION_ADD_GROUP_MEMBER:
+			addGroupMember(first, second);
+			break;
+		case ContactDatabase::MUTATION_DELETE_GROUP_MEMBER:
+			deleteGroupMember(first, second);
+			break;
+		}
+		return true;
 	}
 
-	void addGroup(const string &id, const PeerList &group = PeerList()) {
-		groups_.insert(make_pair(id, group));
+	void sendToFriend(const string &id, const WireMessage &message) {
+		friends_.sendTo(id, *this, message);
 	}
 
-	void deleteGroup(const string &id) {
-		groups_.erase(id);
+	// the broadcasts below return at once, a FanOut sends them in the background
+	void sendToAllFriends(const WireMessage &message) {
+		vector<FanOut::Recipient> recipients;
+		vector<PeerHandle> unresolved;
+		friends_.collectRecipients(recipients, unresolved);
+		broadcast(message, recipients, unresolved);
 	}
 
-	void addGroupMember(const string &groupID, const string &memberID) {
-		groups_[groupID].addPeer(memberID, friends_.getPeer(memberID));
+	void sendToStranger(const string &id, const WireMessage &message) {
+		strangers_.sendTo(id, *this, message);
 	}
 
-	void deleteGroupMember(const string &groupID, const string &memberID) {
-		groups_[groupID].deletePeer(memberID);
+	void sendToAllStrangers(const WireMessage &message) {
+		vector<FanOut::Recipient> recipients;
+		vector<PeerHandle> unresolved;
+		strangers_.collectRecipients(recipients, unresolved);
+		broadcast(message, recipients, unresolved);
 	}
 
-	void sendToFriend(const string &id, const string &message) {
-		friends_.sendTo(id, serverSocket_, message);
+	void sendToGroup(const string &groupID, const WireMessage &message) {
+		GroupIndex::membersType members = groups_.getMembers(groupID);
+		if (!members)
+			return;
+		vector<PeerHandle> handles;
+		members->appendTo(handles);
+		vector<FanOut::Recipient> recipients;
+		vector<PeerHandle> unresolved;
+		collectRecipients(handles, recipients, unresolved);
+		broadcast(message, recipients, unresolved);
 	}
 
-	void sendToAllFriends(const string &message) {
-		friends_.sendToAll(serverSocket_, message);
+	void sendToAll(const WireMessage &message) {
+		vector<FanOut::Recipient> recipients;
+		vector<PeerHandle> unresolved;
+		friends_.collectRecipients(recipients, unresolved);
+		strangers_.collectRecipients(recipients, unresolved);
+		broadcast(message, recipients, unresolved);
 	}
 
-	void sendToStranger(const string &id, const string &message) {
-		strangers_.sendTo(id, serverSocket_, message);
+	// wait for the broadcasts still being sent, at most shutdownTimeout milliseconds
+	bool waitForBroadcasts() {
+		return fanout_.wait(options_.shutdownTimeout);
 	}
 
-	void sendToAllStrangers(const string &message) {
-		strangers_.sendToAll(serverSocket_, message);
+	// broadcast statistics
+	size_t getBroadcastCount() const { return fanout_.getCompletedCount(); }
+	size_t getBroadcastSentCount() const { return fanout_.getSentCount(); }
+	size_t getBroadcastFailedCount() const { return fanout_.getFailedCount(); }
+
+	// address resolution statistics
+	size_t getResolverHitCount() const { return resolver_.getHitCount(); }
+	size_t getResolverMissCount() const { return resolver_.getMissCount(); }
+	size_t getResolverFailureCount() const { return resolver_.getFailureCount(); }
+	size_t getDroppedSendCount() const { return peers_.getDroppedSendCount(); }
+
+	// compression statistics, for the whole process; the ratio is output over input bytes, times in microseconds
+	size_t getCompressedMessageCount() const { return Compressor::getStatistics().compressed.load(); }
+	size_t getIncompressibleMessageCount() const { return Compressor::getStatistics().incompressible.load(); }
+	size_t getCompressionInputBytes() const { return Compressor::getStatistics().inputBytes.load(); }
+	size_t getCompressionOutputBytes() const { return Compressor::getStatistics().outputBytes.load(); }
+	size_t getCompressionTime() const { return Compressor::getStatistics().compressionTime.load(); }
+	size_t getDecompressionTime() const { return Compressor::getStatistics().decompressionTime.load(); }
+
+	/**
+	 * Announce our protocol version and features to every friend, and from now on to every friend added.
+	 * Friends that understand the hello answer with theirs; the others simply ignore it.
+	 */
+	void greetFriends() {
+		greeting_ = true;
+		friends_.sendToAll(*this, ChatProtocol::wrapHelloMessage(id_, BinaryProtocol::version, getFeatures(), false));
 	}
 
-	void sendToGroup(const string &groupID, const string &message) {
-		groups_[groupID].sendToAll(serverSocket_, message);
+	void greet(const udp::endpoint &remoteEndpoint, bool isReply) {
+		sendDatagram(ChatProtocol::wrapHelloMessage(id_, BinaryProtocol::version, getFeatures(), isReply), remoteEndpoint);
 	}
 
-	void sendToAll(const string &message) {
-		sendToAllFriends(message);
-		sendToAllStrangers(message);
+	/**
+	 * Remember what a contact has announced in its hello; false if the ID is not a contact reached
+	 * at remoteEndpoint, for the ID is only what the hello says
+	 */
+	bool setPeerFeatures(const string &id, const udp::endpoint &remoteEndpoint, unsigned features) {
+		PeerHandle peer = peers_.find(id);
+		if (peer == PeerTable::invalidHandle || !(friends_.contains(peer) || strangers_.contains(peer)) || !isAt(peer, remoteEndpoint))
+			return false;
+		peers_.setFeatures(peer, features);
+		return true;
+	}
+
+	unsigned getFeatures() const {
+		// bundles are always unpacked, whether we send any is up to coalescingLatency
+		return FEATURE_BINARY | (options_.reliableDelivery ? FEATURE_RELIABLE : 0) | FEATURE_COALESCING |
+		       (options_.compression ? FEATURE_COMPRESSION : 0) | FEATURE_FRIEND_SYNC;
+	}
+
+	/**
+	 * Our side of friend list sync (see FriendLog): the changes since a version a peer has seen, or
+	 * if it is too far behind, our friend list in pages of friendPageSize, in ID order
+	 */
+	static const size_t friendPageSize = 64;
+
+	boost::uint32_t getFriendLogEpoch() const { return friendLog_.getEpoch(); }
+
+	bool getFriendChangesSince(boost::uint32_t version, vector<FriendEntry> &changes, boost::uint32_t &current) const {
+		return friendLog_.getChangesSince(version, changes, current);
+	}
+
+	// the page of friends after the ID after (all if it is empty), and the version it is of; true if more follow
+	bool getFriendListPage(const string &after, vector<FriendEntry> &page, boost::uint32_t &version) const {
+		return friendLog_.getPage(after, friendPageSize, page, version);
+	}
+
+	/**
+	 * Our side as the one asking: a friend's friend list is kept in a FriendListReplica, and only
+	 * what changed since is asked for the next time.  A friend that does not keep a FriendLog is
+	 * asked for the whole list.
+	 */
+	void requestFriendList(const string &id) {
+		PeerHandle peer = friends_.getPeer(id);
+		if (peer == PeerTable::invalidHandle || !(peers_.getFeatures(peer) & FEATURE_FRIEND_SYNC)) {
+			friends_.sendTo(id, *this, FriendListExtractionWireMessage(id));
+			return;
+		}
+		boost::uint32_t epoch, version;
+		{
+			boost::mutex::scoped_lock lock(replicasMutex_);
+			FriendListReplica &replica = friendReplicas_[id];
+			epoch = replica.getEpoch();
+			version = replica.getVersion();
+		}
+		string after;
+		friends_.sendTo(id, *this, FriendSyncWireMessage(epoch, version, after));
+	}
+
+	// ask for the page after the ID after, in a full sync
+	void requestFriendListPage(const string &id, const string &after) {
+		friends_.sendTo(id, *this, FriendSyncWireMessage(0, 0, after));
+	}
+
+	/**
+	 * Apply what a friend has sent; see FriendListReplica.  Only a friend whose list was asked
+	 * for has a replica, what arrives for any other ID is not applied.
+	 */
+	bool applyFriendChanges(const string &id, boost::uint32_t epoch, boost::uint32_t base, boost::uint32_t version,
+	                        const vector<FriendEntry> &changes, size_t &friendCount) {
+		boost::mutex::scoped_lock lock(replicasMutex_);
+		map<string, FriendListReplica>::iterator iter = friendReplicas_.find(id);
+		if (iter == friendReplicas_.end())
+			return false;
+		bool applied = iter->second.applyChanges(epoch, base, version, changes);
+		friendCount = iter->second.getEntries().size();
+		return applied;
+	}
+
+	bool applyFriendPage(const string &id, boost::uint32_t epoch, boost::uint32_t version, bool first, bool more,
+	                     const vector<FriendEntry> &entries, boost::uint32_t &pageVersion, string &cursor) {
+		boost::mutex::scoped_lock lock(replicasMutex_);
+		map<string, FriendListReplica>::iterator iter = friendReplicas_.find(id);
+		cursor.clear();
+		if (iter == friendReplicas_.end())
+			return false;
+		bool complete = iter->second.applyPage(epoch, version, first, more, entries, pageVersion);
+		cursor = iter->second.getPagingCursor();
+		return complete;
+	}
+
+	// the last complete copy of a friend's friend list, in ID order, and its version
+	vector<FriendEntry> getFriendListReplica(const string &id, boost::uint32_t &version) const {
+		boost::mutex::scoped_lock lock(replicasMutex_);
+		vector<FriendEntry> entries;
+		map<string, FriendListReplica>::const_iterator iter = friendReplicas_.find(id);
+		version = 0;
+		if (iter != friendReplicas_.end()) {
+			entries.assign(iter->second.getEntries().begin(), iter->second.getEntries().end());
+			version = iter->second.getVersion();
+		}
+		return entries;
 	}
 
 	vector<string> getFriendsIDs() const {
@@ -94,16 +388,21 @@ public:
 	}
 
 	vector<string> getGroupsIDs() const {
-		vector<string> ids;
-		for (map<string, PeerList>::const_iterator iter = groups_.begin(); iter != groups_.end(); ++iter) {
-			ids.push_back(iter->first);
-		}
-		return ids;
+		return groups_.getGroupIDs();
 	}
 
 	vector<string> getGroupMemberIDs(const string &id) const {
-		map<string, PeerList>::const_iterator iter = groups_.find(id);
-		return iter->second.getPeerIDs();
+		GroupIndex::membersType members = groups_.getMembers(id);
+		return members ? getIDs(*members) : vector<string>();
+	}
+
+	// members of one group that are not in another, e.g. to reach the people a group message missed
+	vector<string> getGroupMemberIDsNotIn(const string &id, const string &otherID) const {
+		GroupIndex::membersType members = groups_.getMembers(id);
+		if (!members)
+			return vector<string>();
+		GroupIndex::membersType others = groups_.getMembers(otherID);
+		return getIDs(others ? HandleSet::difference(*members, *others) : *members);
 	}
 
 	vector<string> getAllIDs() const {
@@ -121,24 +420,108 @@ public:
 	}
 
 	pair<string, string> getFriendHostnameAndPort(const string &id) const {
-		PeerList::peerPointerType peer = friends_.getPeer(id);
-		return make_pair(peer->getHostname(), peer->getPort());
+		PeerHandle peer = friends_.getPeer(id);
+		if (peer == PeerTable::invalidHandle)
+			return pair<string, string>();
+		PeerTable::ReadSection section(peers_);
+		const PeerTable::Address &address = peers_.getAddress(peer);
+		return make_pair(address.hostname, address.port);
 	}
 
 	bool hasFriend(const string &id) const {
 		return friends_.hasPeer(id);
 	}
 
+	// whether id is a friend whose address has been resolved to endpoint, as replies come from there
+	bool isFriendAt(const string &id, const udp::endpoint &endpoint) const {
+		PeerHandle peer = friends_.getPeer(id);
+		return peer != PeerTable::invalidHandle && isAt(peer, endpoint);
+	}
+
 	bool hasStranger(const string &id) const {
 		return strangers_.hasPeer(id);
 	}
 
 	bool hasGroup(const string &id) const {
-		return groups_.find(id) != groups_.end();
+		return groups_.hasGroup(id);
 	}
 
 	bool hasGroupMember(const string &groupID, const string &memberID) const {
-		return groups_.find(groupID)->second.hasPeer(memberID);
+		PeerHandle peer = peers_.find(memberID);
+		return peer != PeerTable::invalidHandle && groups_.hasMember(groupID, peer);
+	}
+
+	/**
+	 * Add the friends and groups of a contact database in bulk.  Endpoints it has resolved are
+	 * used if they are younger than addressAge milliseconds allows, i.e. than resolverCacheTimeout;
+	 * the other friends are resolved on the first send, in parallel.
+	 */
+	void importContacts(const ContactDatabase &contacts, long addressAge) {
+		bool fresh = addressAge >= 0 && addressAge < options_.resolverCacheTimeout;
+		vector<PeerHandle> handles;
+		handles.reserve(contacts.contacts.size());
+		for (vector<ContactDatabase::Contact>::const_iterator iter = contacts.contacts.begin(); iter != contacts.contacts.end(); ++iter) {
+			PeerHandle handle = peers_.intern(iter->id);
+			if (friends_.contains(handle)) {
+				peers_.release(handle);
+				continue;
+			}
+			if (fresh && iter->resolved) {
+				peers_.setAddress(handle, iter->hostname, iter->port, iter->endpoint);
+			} else {
+				peers_.setAddress(handle, iter->hostname, iter->port);
+			}
+			handles.push_back(handle);
+			friendLog_.recordAdd(iter->id, iter->hostname, iter->port);
+		}
+		// the list takes references of its own
+		friends_.addPeers(handles);
+		for (vector<PeerHandle>::const_iterator iter = handles.begin(); iter != handles.end(); ++iter) {
+			peers_.release(*iter);
+		}
+
+		for (vector<ContactDatabase::Group>::const_iterator iter = contacts.groups.begin(); iter != contacts.groups.end(); ++iter) {
+			groups_.addGroup(iter->id);
+			vector<PeerHandle> members;
+			members.reserve(iter->memberIDs.size());
+			for (vector<string>::const_iterator member = iter->memberIDs.begin(); member != iter->memberIDs.end(); ++member) {
+				// only friends can be members
+				PeerHandle handle = friends_.getPeer(*member);
+				if (handle != PeerTable::invalidHandle)
+					members.push_back(handle);
+			}
+			vector<PeerHandle> added;
+			groups_.addMembers(iter->id, members, added);
+			for (vector<PeerHandle>::const_iterator member = added.begin(); member != added.end(); ++member) {
+				peers_.retain(*member);
+			}
+		}
+	}
+
+	// the friends, with their resolved endpoints, and the groups, in ascending order of ID
+	void exportContacts(ContactDatabase &contacts) const {
+		contacts.id = id_;
+		contacts.port = port_;
+		PeerList::snapshotType friends = friends_.snapshot();
+		PeerTable::ReadSection section(peers_);
+		contacts.contacts.resize(friends->size());
+		for (size_t i = 0; i < friends->size(); ++i) {
+			const PeerTable::Address &address = peers_.getAddress((*friends)[i]);
+			ContactDatabase::Contact &contact = contacts.contacts[i];
+			contact.id = peers_.getID((*friends)[i]);
+			contact.hostname = address.hostname;
+			contact.port = address.port;
+			contact.resolved = address.state == PeerTable::ADDRESS_RESOLVED;
+			contact.endpoint = address.endpoint;
+		}
+		sort(contacts.contacts.begin(), contacts.contacts.end(), compareContactIDs);
+
+		vector<string> groupIDs = getGroupsIDs();
+		contacts.groups.resize(groupIDs.size());
+		for (size_t i = 0; i < groupIDs.size(); ++i) {
+			contacts.groups[i].id = groupIDs[i];
+			contacts.groups[i].memberIDs = getGroupMemberIDs(groupIDs[i]);
+		}
 	}
 
 	void setMessageProcesser(boost::shared_ptr<Controller> controller) {
@@ -162,12 +545,11 @@ public:
 			size_t groupMemberCnt;
 			string memberID;
 			is >> groupMemberCnt;
-			PeerList group;
+			client.addGroup(groupID);
 			for (size_t j = 0; j < groupMemberCnt; ++j) {
 				is >> memberID;
-				group.addPeer(memberID, client.friends_.getPeer(memberID));
+				client.addGroupMember(groupID, memberID);
 			}
-			client.addGroup(groupID, group);
 		}
 
 		return is;
@@ -180,10 +562,11 @@ public:
 			os << fInfo[i].first << " " << fInfo[i].second.first << " " << fInfo[i].second.second << endl;
 		}
 		os << endl;
-		os << client.groups_.size() << endl;
-		for (map<string, PeerList>::const_iterator iter = client.groups_.begin(); iter != client.groups_.end(); ++iter) {
-			os << iter->first << " " << iter->second.getSize() << " ";
-			vector<string> members = iter->second.getPeerIDs();
+		vector<string> groupIDs = client.getGroupsIDs();
+		os << groupIDs.size() << endl;
+		for (vector<string>::const_iterator iter = groupIDs.begin(); iter != groupIDs.end(); ++iter) {
+			vector<string> members = client.getGroupMemberIDs(*iter);
+			os << *iter << " " << members.size() << " ";
 			for (size_t i = 0; i < members.size(); ++i) {
 				os << members[i] << " ";
 			}
@@ -194,17 +577,125 @@ public:
 
 	string getID() const { return id_; }
 protected:
+	void collectRecipients(const vector<PeerHandle> &handles, vector<FanOut::Recipient> &recipients, vector<PeerHandle> &unresolved) const {
+		PeerTable::ReadSection section(peers_);
+		recipients.reserve(recipients.size() + handles.size());
+		for (vector<PeerHandle>::const_iterator iter = handles.begin(); iter != handles.end(); ++iter) {
+			const PeerTable::Address &address = peers_.getAddress(*iter);
+			if (address.state == PeerTable::ADDRESS_RESOLVED) {
+				recipients.push_back(FanOut::Recipient(address.endpoint, peers_.getFeatures(*iter)));
+			} else {
+				unresolved.push_back(*iter);
+			}
+		}
+	}
+
+	// resolved recipients go to the FanOut, the others wait in the peer table for their address
+	void broadcast(const WireMessage &message, const vector<FanOut::Recipient> &recipients, const vector<PeerHandle> &unresolved) {
+		if (!recipients.empty())
+			fanout_.broadcast(message, recipients);
+		for (vector<PeerHandle>::const_iterator iter = unresolved.begin(); iter != unresolved.end(); ++iter) {
+			PeerProxy(peers_, *iter).sendMessage(*this, message);
+		}
+	}
+
+	void reportResolutionFailure(const string &id, const string &hostname, const string &port, const string &error);
+
+	// where the peer is reached, or an unspecified endpoint if that is not known yet
+	udp::endpoint getResolvedEndpoint(PeerHandle peer) const {
+		PeerTable::ReadSection section(peers_);
+		const PeerTable::Address &address = peers_.getAddress(peer);
+		return address.state == PeerTable::ADDRESS_RESOLVED ? address.endpoint : udp::endpoint();
+	}
+
+	// once a deleted peer is no contact at all, nothing negotiated with it is kept for its endpoint
+	void forgetEndpoint(PeerHandle peer, const udp::endpoint &endpoint) {
+		if (endpoint != udp::endpoint() && !friends_.contains(peer) && !strangers_.contains(peer))
+			disableCoalescing(endpoint);
+	}
+
+	// whether the peer's address has been resolved to endpoint
+	bool isAt(PeerHandle peer, const udp::endpoint &endpoint) const {
+		PeerTable::ReadSection section(peers_);
+		const PeerTable::Address &address = peers_.getAddress(peer);
+		return address.state == PeerTable::ADDRESS_RESOLVED && address.endpoint == endpoint;
+	}
+
+	// remember when a stranger came, and forget the oldest ones beyond maxStrangers
+	void limitStrangers(const string &id) {
+		boost::mutex::scoped_lock lock(strangersMutex_);
+		PeerHandle handle = strangers_.getPeer(id);
+		if (handle != PeerTable::invalidHandle)
+			strangerOrder_.push_back(handle);
+		while (strangers_.getSize() > options_.maxStrangers && !strangerOrder_.empty()) {
+			PeerHandle peer = strangerOrder_.front();
+			udp::endpoint endpoint = getResolvedEndpoint(peer);
+			if (strangers_.deletePeer(peer))
+				forgetEndpoint(peer, endpoint);
+			strangerOrder_.pop_front();
+		}
+		// strangers deleted by hand leave their handles behind, drop them once they pile up
+		if (strangerOrder_.size() > 2 * options_.maxStrangers) {
+			deque<PeerHandle> order;
+			for (deque<PeerHandle>::const_iterator iter = strangerOrder_.begin(); iter != strangerOrder_.end(); ++iter) {
+				if (strangers_.contains(*iter))
+					order.push_back(*iter);
+			}
+			strangerOrder_.swap(order);
+		}
+	}
+
+	void record(const string &mutation) {
+		Journal *journal = journal_;
+		if (journal)
+			journal->append(mutation);
+	}
+
+	static bool compareContactIDs(const ContactDatabase::Contact &a, const ContactDatabase::Contact &b) {
+		return a.id < b.id;
+	}
+
+	vector<string> getIDs(const HandleSet &members) const {
+		vector<PeerHandle> handles;
+		members.appendTo(handles);
+		vector<string> ids;
+		ids.reserve(handles.size());
+		for (vector<PeerHandle>::const_iterator iter = handles.begin(); iter != handles.end(); ++iter) {
+			ids.push_back(peers_.getID(*iter));
+		}
+		sort(ids.begin(), ids.end());
+		return ids;
+	}
+
 	virtual void handleRequest(const string &rawMessage, boost::shared_ptr<udp::endpoint> remoteEndpoint);
+	virtual void handleRequest(const Datagram &datagram);
 
 	string id_;
+	boost::atomic<bool> greeting_;
+	boost::atomic<Journal *> journal_;
+	boost::atomic<HistoryStore *> history_;
 
+	// looks contacts' addresses up; declared before peers_, which refers to it
+	Resolver resolver_;
+
+	// every contact is interned once; the lists below refer to it by handle
+	PeerTable peers_;
 	PeerList friends_;
 	PeerList strangers_;
+	boost::mutex strangersMutex_;
+	deque<PeerHandle> strangerOrder_; // the strangers, oldest first; guarded by strangersMutex_
+
+	// groups, by member handle
+	GroupIndex groups_;
 
-	// groups
-	map<string, PeerList> groups_;
+	// versions our friend list for friends keeping a copy of it, and the copies we keep of theirs
+	FriendLog friendLog_;
+	mutable boost::mutex replicasMutex_;
+	map<string, FriendListReplica> friendReplicas_;
 
 	boost::shared_ptr<Controller> controller_;
+
+	FanOut fanout_;
 };
 
 }
@@ -0,0 +1,284 @@
+/*
+ * batchedsocket.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <poll.h>
+#endif
+
+#include "datagrampool.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * BatchedReceiver receives up to batchSize datagrams per recvmmsg call, straight into Datagrams
+ * taken from a DatagramPool.  Where recvmmsg is not available (non-Linux, or ENOSYS at run time)
+ * it falls back to one recvfrom per call.
+ */
+class BatchedReceiver : private boost::noncopyable {
+public:
+	BatchedReceiver(DatagramPool &pool, size_t batchSize)
+		: pool_(pool), batchSize_(batchSize == 0 ? 1 : batchSize), datagrams_(batchSize_), batchSupported_(true)
+#ifdef __linux__
+		  , headers_(batchSize_), iovecs_(batchSize_), addresses_(batchSize_)
+#endif
+	{ }
+
+	/**
+	 * Wait at most timeout milliseconds for datagrams and receive as many as are ready (up to batchSize).
+	 * Returns the number of datagrams received, 0 on timeout, and throws on socket errors.
+	 * The received datagrams are taken with takeDatagram() before the next call.
+	 */
+	size_t receive(udp::socket &socket, int timeout) {
+		for (size_t i = 0; i < batchSize_; ++i) {
+			if (!datagrams_[i])
+				datagrams_[i] = pool_.acquire();
+		}
+#ifdef __linux__
+		int fd = socket.native_handle();
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int ready = ::poll(&pfd, 1, timeout);
+		if (ready < 0 && errno != EINTR)
+			throw boost::system::system_error(errno, boost::system::system_category());
+		if (ready <= 0)
+			return 0;
+		if (pfd.revents & (POLLERR | POLLNVAL))
+			throw boost::system::system_error(EBADF, boost::system::system_category());
+
+		if (batchSupported_) {
+			for (size_t i = 0; i < batchSize_; ++i) {
+				iovecs_[i].iov_base = datagrams_[i]->getBuffer();
+				iovecs_[i].iov_len = datagrams_[i]->getCapacity();
+				memset(&headers_[i], 0, sizeof(mmsghdr));
+				headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+				headers_[i].msg_hdr.msg_iovlen = 1;
+				headers_[i].msg_hdr.msg_name = &addresses_[i];
+				headers_[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+			}
+			int n = ::recvmmsg(fd, &headers_[0], batchSize_, MSG_DONTWAIT, 0);
+			if (n >= 0) {
+				for (int i = 0; i < n; ++i) {
+					setEndpoint(*datagrams_[i], &addresses_[i], headers_[i].msg_hdr.msg_namelen);
+					datagrams_[i]->setSize(headers_[i].msg_len, (headers_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0);
+				}
+				return n;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			if (errno != ENOSYS)
+				throw boost::system::system_error(errno, boost::system::system_category());
+			batchSupported_ = false;
+		}
+
+		Datagram &datagram = *datagrams_[0];
+		sockaddr_storage address;
+		socklen_t addressLength = sizeof(address);
+		ssize_t len = ::recvfrom(fd, datagram.getBuffer(), datagram.getCapacity(), MSG_DONTWAIT | MSG_TRUNC,
+		                         (sockaddr *)&address, &addressLength);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			throw boost::system::system_error(errno, boost::system::system_category());
+		}
+		setEndpoint(datagram, &address, addressLength);
+		datagram.setSize(min((size_t)len, datagram.getCapacity()), (size_t)len > datagram.getCapacity());
+		return 1;
+#else
+		// no batching and no way to wait with a timeout: block for exactly one datagram
+		Datagram &datagram = *datagrams_[0];
+		boost::system::error_code error;
+		size_t len = socket.receive_from(boost::asio::buffer(datagram.getBuffer(), datagram.getCapacity()),
+		                                 datagram.getRemoteEndpoint(), 0, error);
+		if (error && error != boost::asio::error::message_size)
+			throw boost::system::system_error(error);
+		datagram.setSize(len, error == boost::asio::error::message_size);
+		return 1;
+#endif
+	}
+
+	DatagramPointer takeDatagram(size_t i) {
+		DatagramPointer datagram;
+		datagram.swap(datagrams_[i]);
+		return datagram;
+	}
+
+	bool isBatchSupported() const { return batchSupported_; }
+private:
+	static void setEndpoint(Datagram &datagram, const void *address, size_t length) {
+		udp::endpoint &endpoint = datagram.getRemoteEndpoint();
+		length = min(length, (size_t)endpoint.capacity());
+		memcpy(endpoint.data(), address, length);
+		endpoint.resize(length);
+	}
+
+	DatagramPool &pool_;
+	const size_t batchSize_;
+	vector<DatagramPointer> datagrams_;
+	bool batchSupported_;
+#ifdef __linux__
+	vector<mmsghdr> headers_;
+	vector<iovec> iovecs_;
+	vector<sockaddr_storage> addresses_;
+#endif
+};
+
+/**
+ * BatchedSender queues outgoing datagrams and flushes them with one sendmmsg call once batchSize
+ * of them are queued or the oldest has waited flushLatency microseconds, whichever comes first.
+ * Without sendmmsg every queued datagram is flushed with its own sendto.
+ */
+class BatchedSender : private boost::noncopyable {
+public:
+	BatchedSender(udp::socket &socket, size_t batchSize, long flushLatency)
+		: socket_(socket), batchSize_(batchSize == 0 ? 1 : batchSize), flushLatency_(flushLatency),
+		  stopping_(false), batchSupported_(true), flushedBatches_(0), flushedDatagrams_(0), failedDatagrams_(0) { }
+
+	~BatchedSender() {
+		stop();
+	}
+
+	void start() {
+		stopping_ = false;
+		flusher_ = boost::thread(boost::bind(&BatchedSender::flushLoop, this));
+	}
+
+	// flush whatever is still queued and stop the flusher
+	void stop() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			condition_.notify_all();
+		}
+		if (flusher_.joinable())
+			flusher_.join();
+	}
+
+	void send(const string &payload, const udp::endpoint &remoteEndpoint) {
+		boost::mutex::scoped_lock lock(mutex_);
+		if (queue_.empty())
+			oldest_ = boost::get_system_time();
+		queue_.push_back(OutgoingDatagram());
+		queue_.back().payload = payload;
+		queue_.back().remoteEndpoint = remoteEndpoint;
+		if (queue_.size() >= batchSize_ || queue_.size() == 1)
+			condition_.notify_one();
+	}
+
+	// statistics
+	size_t getFlushedBatchCount() const { boost::mutex::scoped_lock lock(mutex_); return flushedBatches_; }
+	size_t getFlushedDatagramCount() const { boost::mutex::scoped_lock lock(mutex_); return flushedDatagrams_; }
+	size_t getFailedDatagramCount() const { boost::mutex::scoped_lock lock(mutex_); return failedDatagrams_; }
+private:
+	struct OutgoingDatagram {
+		string payload;
+		udp::endpoint remoteEndpoint;
+	};
+
+	void flushLoop() {
+		vector<OutgoingDatagram> batch;
+		boost::mutex::scoped_lock lock(mutex_);
+		while (true) {
+			while (!stopping_ && queue_.size() < batchSize_) {
+				if (queue_.empty()) {
+					condition_.wait(lock);
+				} else if (!condition_.timed_wait(lock, oldest_ + boost::posix_time::microseconds(flushLatency_))) {
+					break; // the oldest datagram has waited long enough
+				}
+			}
+			if (queue_.empty() && stopping_)
+				return;
+			batch.swap(queue_);
+			oldest_ = boost::get_system_time();
+			lock.unlock();
+			size_t failed = flush(batch);
+			lock.lock();
+			++flushedBatches_;
+			flushedDatagrams_ += batch.size();
+			failedDatagrams_ += failed;
+			batch.clear();
+		}
+	}
+
+	// returns the number of datagrams that could not be sent
+	size_t flush(const vector<OutgoingDatagram> &batch) {
+		size_t failed = 0;
+		size_t sent = 0;
+#ifdef __linux__
+		if (batchSupported_) {
+			int fd = socket_.native_handle();
+			vector<mmsghdr> headers(min(batch.size(), batchSize_));
+			vector<iovec> iovecs(headers.size());
+			while (sent < batch.size()) {
+				size_t count = min(batch.size() - sent, headers.size());
+				for (size_t i = 0; i < count; ++i) {
+					const OutgoingDatagram &datagram = batch[sent + i];
+					iovecs[i].iov_base = const_cast<char *>(datagram.payload.data());
+					iovecs[i].iov_len = datagram.payload.size();
+					memset(&headers[i], 0, sizeof(mmsghdr));
+					headers[i].msg_hdr.msg_iov = &iovecs[i];
+					headers[i].msg_hdr.msg_iovlen = 1;
+					headers[i].msg_hdr.msg_name = const_cast<sockaddr *>(datagram.remoteEndpoint.data());
+					headers[i].msg_hdr.msg_namelen = datagram.remoteEndpoint.size();
+				}
+				int n = ::sendmmsg(fd, &headers[0], count, 0);
+				if (n > 0) {
+					sent += n;
+				} else if (n < 0 && errno == ENOSYS) {
+					batchSupported_ = false;
+					break;
+				} else if (n < 0 && errno == EINTR) {
+					continue;
+				} else {
+					// skip the datagram the kernel refused and carry on with the rest
+					++sent;
+					++failed;
+				}
+			}
+		}
+#endif
+		for (; sent < batch.size(); ++sent) {
+			boost::system::error_code error;
+			socket_.send_to(boost::asio::buffer(batch[sent].payload), batch[sent].remoteEndpoint, 0, error);
+			if (error)
+				++failed;
+		}
+		return failed;
+	}
+
+	udp::socket &socket_;
+	const size_t batchSize_;
+	const long flushLatency_;
+
+	mutable boost::mutex mutex_;
+	boost::condition_variable condition_;
+	vector<OutgoingDatagram> queue_;
+	boost::system_time oldest_;
+	bool stopping_;
+	boost::thread flusher_;
+
+	bool batchSupported_; // only touched by the flusher thread
+	size_t flushedBatches_;
+	size_t flushedDatagrams_;
+	size_t failedDatagrams_;
+};
+
+}
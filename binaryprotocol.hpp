@@ -0,0 +1,334 @@
+/*
+ * binaryprotocol.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "compression.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * BinaryProtocol is the compact framing used between peers that both understand it (see the
+ * _HELLO_ negotiation in ChatProtocol).  A message is a fixed header
+ *
+ *     magic (2) | version (1) | type (1) | flags (2) | length (4)
+ *
+ * followed by length bytes of fields; a string field is a 2-byte length and its bytes, a count
+ * is 4 bytes.  All integers are big-endian.  Encoding writes into a caller-provided buffer and
+ * decoding hands out string_refs into the received bytes, so neither allocates.
+ *
+ * Between peers that have agreed on compression, a message of at least compressionThreshold bytes
+ * may have its fields compressed (see Compressor): it is flagged FLAG_COMPRESSED, and its fields
+ * are replaced by their length (4) and the compressed bytes.  Such peers flag every message they
+ * send FLAG_ACCEPTS_COMPRESSION, so that a reply to it may be compressed too.
+ */
+class BinaryProtocol {
+public:
+	enum MessageType {
+		TYPE_PLAIN = 1,
+		TYPE_FRIEND_EXTRACTION = 2,
+		TYPE_FRIEND_EX_RESPONSE = 3,
+		TYPE_FRIEND_SYNC = 4,
+		TYPE_FRIEND_DELTA = 5,
+		TYPE_FRIEND_PAGE = 6
+	};
+
+	enum Flag {
+		FLAG_COMPRESSED = 1 << 0,
+		FLAG_ACCEPTS_COMPRESSION = 1 << 1
+	};
+
+	static const unsigned char version = 1;
+	static const size_t headerSize = 10;
+	static const size_t compressionThreshold = 256;
+	static const size_t maxDecompressedSize = 16 << 20;
+
+	/**
+	 * A decoded header together with a cursor over its fields
+	 */
+	class Reader {
+	public:
+		// a compressed message may not decompress to more than maxSize bytes
+		explicit Reader(size_t maxSize = maxDecompressedSize)
+			: maxSize_(maxSize), type_(0), flags_(0), position_(0), end_(0), valid_(false), data_(0) { }
+
+		// parse the header; false if this is not a well-formed binary message of a known version
+		bool open(const char *data, size_t size) {
+			valid_ = false;
+			if (!isBinaryMessage(data, size) || size < headerSize)
+				return false;
+			const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+			if (bytes[2] != version)
+				return false;
+			type_ = bytes[3];
+			flags_ = readUint16(bytes + 4);
+			boost::uint32_t length = readUint32(bytes + 6);
+			if (length > size - headerSize)
+				return false;
+			data_ = data;
+			position_ = headerSize;
+			end_ = headerSize + length;
+			if (flags_ & FLAG_COMPRESSED) {
+				// the fields are read from the decompressed copy
+				if (length < 4)
+					return false;
+				size_t originalSize = readUint32(bytes + headerSize);
+				if (originalSize > maxSize_ || originalSize > Compressor::maxExpansion * (length - 4) ||
+				    !Compressor::decompress(data + headerSize + 4, length - 4, originalSize, decompressed_))
+					return false;
+				data_ = decompressed_.data();
+				position_ = 0;
+				end_ = decompressed_.size();
+			}
+			valid_ = true;
+			return true;
+		}
+
+		bool nextField(boost::string_ref &field) {
+			if (!valid_ || end_ - position_ < 2)
+				return valid_ = false;
+			size_t length = readUint16(reinterpret_cast<const unsigned char *>(data_ + position_));
+			position_ += 2;
+			if (end_ - position_ < length)
+				return valid_ = false;
+			field = boost::string_ref(data_ + position_, length);
+			position_ += length;
+			return true;
+		}
+
+		bool nextCount(boost::uint32_t &count) {
+			if (!valid_ || end_ - position_ < 4)
+				return valid_ = false;
+			count = readUint32(reinterpret_cast<const unsigned char *>(data_ + position_));
+			position_ += 4;
+			return true;
+		}
+
+		// a count and as many (id, hostname, port) fields, as putFriendEntries writes them
+		bool nextFriendEntries(vector<pair<string, pair<string, string> > > &entries) {
+			boost::uint32_t count;
+			if (!nextCount(count))
+				return false;
+			entries.clear();
+			boost::string_ref id, hostname, port;
+			for (boost::uint32_t i = 0; i < count; ++i) {
+				if (!nextField(id) || !nextField(hostname) || !nextField(port))
+					return false;
+				entries.push_back(make_pair(id.to_string(), make_pair(hostname.to_string(), port.to_string())));
+			}
+			return true;
+		}
+
+		unsigned getType() const { return type_; }
+		unsigned getFlags() const { return flags_; }
+		bool isValid() const { return valid_; }
+	private:
+		const size_t maxSize_;
+		unsigned type_;
+		unsigned flags_;
+		size_t position_;
+		size_t end_;
+		bool valid_;
+		const char *data_;
+		string decompressed_;
+	};
+
+	static bool isBinaryMessage(const char *data, size_t size) {
+		// text messages always start with a printable tag, so the magic can never be confused with one
+		return size >= 2 && (unsigned char)data[0] == magic0 && (unsigned char)data[1] == magic1;
+	}
+
+	/**
+	 * Encoders return the number of bytes written, or 0 if the message does not fit into capacity
+	 * or a field is longer than a string field can hold.
+	 */
+	static size_t encodePlainChatMessage(char *buffer, size_t capacity, boost::string_ref fromID, boost::string_ref message) {
+		Writer writer(buffer, capacity, TYPE_PLAIN);
+		writer.putField(fromID);
+		writer.putField(message);
+		return writer.finish();
+	}
+
+	static size_t encodeFriendListExtractionMessage(char *buffer, size_t capacity, boost::string_ref id) {
+		Writer writer(buffer, capacity, TYPE_FRIEND_EXTRACTION);
+		writer.putField(id);
+		return writer.finish();
+	}
+
+	static size_t encodeFriendListExtractionResponseMessage(char *buffer, size_t capacity, boost::string_ref id,
+	                                                         const vector<pair<string, pair<string, string> > > &info) {
+		Writer writer(buffer, capacity, TYPE_FRIEND_EX_RESPONSE);
+		writer.putField(id);
+		writer.putCount(info.size());
+		for (size_t i = 0; i < info.size(); ++i) {
+			writer.putField(info[i].first);
+			writer.putField(info[i].second.first);
+			writer.putField(info[i].second.second);
+		}
+		return writer.finish();
+	}
+
+	// see ChatProtocol for the friend list sync messages; a removal in a delta has an empty hostname and port
+	static size_t encodeFriendSyncMessage(char *buffer, size_t capacity, boost::uint32_t epoch, boost::uint32_t version, boost::string_ref after) {
+		Writer writer(buffer, capacity, TYPE_FRIEND_SYNC);
+		writer.putCount(epoch);
+		writer.putCount(version);
+		writer.putField(after);
+		return writer.finish();
+	}
+
+	static size_t encodeFriendDeltaMessage(char *buffer, size_t capacity, boost::string_ref id, boost::uint32_t epoch, boost::uint32_t base,
+	                                       boost::uint32_t version, const vector<pair<string, pair<string, string> > > &changes) {
+		Writer writer(buffer, capacity, TYPE_FRIEND_DELTA);
+		writer.putField(id);
+		writer.putCount(epoch);
+		writer.putCount(base);
+		writer.putCount(version);
+		putFriendEntries(writer, changes);
+		return writer.finish();
+	}
+
+	static size_t encodeFriendPageMessage(char *buffer, size_t capacity, boost::string_ref id, boost::uint32_t epoch, boost::uint32_t version,
+	                                      bool first, bool more, const vector<pair<string, pair<string, string> > > &entries) {
+		Writer writer(buffer, capacity, TYPE_FRIEND_PAGE);
+		writer.putField(id);
+		writer.putCount(epoch);
+		writer.putCount(version);
+		writer.putCount((first ? 1 : 0) | (more ? 2 : 0));
+		putFriendEntries(writer, entries);
+		return writer.finish();
+	}
+
+	/**
+	 * The message to send to a peer that has agreed on compression: message itself, flagged as
+	 * accepting compression, with its fields compressed if it is large enough for it to pay.
+	 */
+	static string compressMessage(const string &message) {
+		if (!isBinaryMessage(message.data(), message.size()) || message.size() < headerSize)
+			return message;
+		string result;
+		string fields;
+		if (message.size() >= compressionThreshold &&
+		    Compressor::compress(message.data() + headerSize, message.size() - headerSize, fields) &&
+		    fields.size() + 4 < message.size() - headerSize) {
+			result.assign(message, 0, headerSize);
+			unsigned char *header = reinterpret_cast<unsigned char *>(&result[0]);
+			writeUint16(header + 4, readUint16(header + 4) | FLAG_COMPRESSED | FLAG_ACCEPTS_COMPRESSION);
+			writeUint32(header + 6, 4 + fields.size());
+			result.resize(headerSize + 4);
+			writeUint32(reinterpret_cast<unsigned char *>(&result[headerSize]), message.size() - headerSize);
+			result.append(fields);
+		} else {
+			result = message;
+			unsigned char *header = reinterpret_cast<unsigned char *>(&result[0]);
+			writeUint16(header + 4, readUint16(header + 4) | FLAG_ACCEPTS_COMPRESSION);
+		}
+		return result;
+	}
+
+	// upper bounds for sizing encode buffers
+	static size_t getPlainChatMessageSize(boost::string_ref fromID, boost::string_ref message) {
+		return headerSize + 2 + fromID.size() + 2 + message.size();
+	}
+
+	static size_t getFriendListExtractionResponseMessageSize(boost::string_ref id, const vector<pair<string, pair<string, string> > > &info) {
+		size_t size = headerSize + 2 + id.size() + 4;
+		for (size_t i = 0; i < info.size(); ++i) {
+			size += 6 + info[i].first.size() + info[i].second.first.size() + info[i].second.second.size();
+		}
+		return size;
+	}
+
+	// for the delta and page messages, which carry three more counts
+	static size_t getFriendSyncResponseMessageSize(boost::string_ref id, const vector<pair<string, pair<string, string> > > &entries) {
+		return getFriendListExtractionResponseMessageSize(id, entries) + 12;
+	}
+private:
+	static const unsigned char magic0 = 0xC0;
+	static const unsigned char magic1 = 0xCA;
+
+	class Writer {
+	public:
+		Writer(char *buffer, size_t capacity, MessageType type)
+			: buffer_(reinterpret_cast<unsigned char *>(buffer)), capacity_(capacity), position_(headerSize), ok_(capacity >= headerSize) {
+			if (ok_) {
+				buffer_[0] = magic0;
+				buffer_[1] = magic1;
+				buffer_[2] = version;
+				buffer_[3] = (unsigned char)type;
+				writeUint16(buffer_ + 4, 0);
+			}
+		}
+
+		void putField(boost::string_ref field) {
+			if (!ok_ || field.size() > 0xFFFF || capacity_ - position_ < 2 + field.size()) {
+				ok_ = false;
+				return;
+			}
+			writeUint16(buffer_ + position_, field.size());
+			memcpy(buffer_ + position_ + 2, field.data(), field.size());
+			position_ += 2 + field.size();
+		}
+
+		void putCount(size_t count) {
+			if (!ok_ || capacity_ - position_ < 4) {
+				ok_ = false;
+				return;
+			}
+			writeUint32(buffer_ + position_, count);
+			position_ += 4;
+		}
+
+		size_t finish() {
+			if (!ok_)
+				return 0;
+			writeUint32(buffer_ + 6, position_ - headerSize);
+			return position_;
+		}
+	private:
+		unsigned char *buffer_;
+		size_t capacity_;
+		size_t position_;
+		bool ok_;
+	};
+
+	static void putFriendEntries(Writer &writer, const vector<pair<string, pair<string, string> > > &entries) {
+		writer.putCount(entries.size());
+		for (size_t i = 0; i < entries.size(); ++i) {
+			writer.putField(entries[i].first);
+			writer.putField(entries[i].second.first);
+			writer.putField(entries[i].second.second);
+		}
+	}
+
+	static boost::uint16_t readUint16(const unsigned char *p) {
+		return (boost::uint16_t)((p[0] << 8) | p[1]);
+	}
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+	static void writeUint16(unsigned char *p, boost::uint16_t value) {
+		p[0] = (unsigned char)(value >> 8);
+		p[1] = (unsigned char)value;
+	}
+	static void writeUint32(unsigned char *p, boost::uint32_t value) {
+		p[0] = (unsigned char)(value >> 24);
+		p[1] = (unsigned char)(value >> 16);
+		p[2] = (unsigned char)(value >> 8);
+		p[3] = (unsigned char)value;
+	}
+};
+
+}
@@ -0,0 +1,119 @@
+/*
+ * boundedqueue.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * OverflowPolicy decides what a producer does when a bounded queue is full
+ */
+enum OverflowPolicy {
+	OVERFLOW_DROP,       // discard the new element
+	OVERFLOW_BLOCK,      // wait until a consumer makes room
+	OVERFLOW_SHED_OLDEST // discard the oldest queued element to make room for the new one
+};
+
+/**
+ * BoundedQueue is a fixed-capacity lock-free multi-producer/multi-consumer queue.
+ * Every cell carries a sequence number telling producers and consumers whose turn it is,
+ * so both sides only contend on a single atomic counter each (Vyukov's bounded queue).
+ * The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class BoundedQueue : private boost::noncopyable {
+public:
+	explicit BoundedQueue(size_t capacity) : cells_(roundUpToPowerOfTwo(capacity)), mask_(cells_.size() - 1),
+		enqueuePos_(0), dequeuePos_(0) {
+		for (size_t i = 0; i < cells_.size(); ++i) {
+			cells_[i].sequence.store(i, boost::memory_order_relaxed);
+		}
+	}
+
+	// returns false if the queue is full
+	bool tryPush(const T &value) {
+		Cell *cell;
+		size_t pos = enqueuePos_.load(boost::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			size_t sequence = cell->sequence.load(boost::memory_order_acquire);
+			long diff = (long)sequence - (long)pos;
+			if (diff == 0) {
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueuePos_.load(boost::memory_order_relaxed);
+			}
+		}
+		cell->value = value;
+		cell->sequence.store(pos + 1, boost::memory_order_release);
+		return true;
+	}
+
+	// returns false if the queue is empty
+	bool tryPop(T &value) {
+		Cell *cell;
+		size_t pos = dequeuePos_.load(boost::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			size_t sequence = cell->sequence.load(boost::memory_order_acquire);
+			long diff = (long)sequence - (long)(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeuePos_.load(boost::memory_order_relaxed);
+			}
+		}
+		value = cell->value;
+		cell->value = T(); // release whatever the element holds on to
+		cell->sequence.store(pos + mask_ + 1, boost::memory_order_release);
+		return true;
+	}
+
+	// approximate number of queued elements, exact when the queue is quiescent
+	size_t getSize() const {
+		size_t enqueued = enqueuePos_.load(boost::memory_order_relaxed);
+		size_t dequeued = dequeuePos_.load(boost::memory_order_relaxed);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+	size_t getCapacity() const { return cells_.size(); }
+private:
+	struct Cell {
+		boost::atomic<size_t> sequence;
+		T value;
+		Cell() : sequence(0) { }
+		Cell(const Cell &other) : sequence(other.sequence.load()), value(other.value) { }
+	};
+
+	static size_t roundUpToPowerOfTwo(size_t n) {
+		size_t size = 2;
+		while (size < n) size <<= 1;
+		return size;
+	}
+
+	vector<Cell> cells_;
+	const size_t mask_;
+	// keep the two hot counters on separate cache lines
+	char pad0_[64];
+	boost::atomic<size_t> enqueuePos_;
+	char pad1_[64];
+	boost::atomic<size_t> dequeuePos_;
+	char pad2_[64];
+};
+
+}
@@ -9,26 +9,41 @@
 #pragma once
 
 #include <string>
-#include <fstream>
+#include <cctype>
+#include <iostream>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/trim.hpp>
-
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "basicchatclient.hpp"
+#include "contactstore.hpp"
+#include "historystore.hpp"
 #include "controller.hpp"
 #include "view.hpp"
+#include "scriptreader.hpp"
 
 namespace openchat {
 
+/**
+ * ChatFramework wires model, view and controller together around a configuration file, whose
+ * contacts a ContactStore loads, journals and compacts.  Messages are kept by a HistoryStore in
+ * the directory beside it.  options tune the client's server, see ServerOptions.
+ */
 class ChatFramework {
 public:
-	ChatFramework(const string &fileName, istream &is) : fileName_(fileName), is_(is) {
-		ifstream ifs(fileName_.c_str());
-		ifs >> id_ >> port_;
-		model_ = boost::shared_ptr<BasicChatClient>(new BasicChatClient(id_, port_));
-		ifs >> *model_;
-		ifs.close();
+	ChatFramework(const string &fileName, istream &is, const ServerOptions &options = ServerOptions())
+		: fileName_(fileName), is_(is), store_(fileName), history_(fileName + ".history") {
+		ContactDatabase contacts;
+		long addressAge;
+		store_.load(contacts, addressAge);
+		id_ = contacts.id;
+		port_ = contacts.port;
+		model_ = boost::shared_ptr<BasicChatClient>(new BasicChatClient(id_, port_, options));
+		model_->importContacts(contacts, addressAge);
+		store_.open(*model_);
+		if (history_.open())
+			model_->setHistory(&history_);
 
 		view_ = boost::shared_ptr<View>(new View(model_));
 		controller_ = boost::shared_ptr<Controller>(new Controller(model_, view_, is_));
@@ -36,19 +51,26 @@ public:
 	}
 
 	~ChatFramework() {
-		ofstream ofs(fileName_.c_str());
-		ofs << id_ << " " << port_ << endl << endl;
-		ofs << *model_;
-		ofs.close();
+		// every change is in the journal already, there is nothing left to write
+		store_.close();
+		model_->setHistory(0);
+		history_.close();
 	}
 
 	void addViewObserver(boost::shared_ptr<ViewObserver> observer) const {
 		view_->addObserver(observer);
 	}
 
+	// present from a background writer, see View::startWriter; after adding the observers
+	void startViewWriter(size_t capacity, OverflowPolicy policy, long flushInterval) const {
+		view_->startWriter(capacity, policy, flushInterval);
+	}
+
 	void run() const {
 		// run the chat client
 		boost::thread clientThread(boost::bind(&BasicChatClient::run, model_));
+		// let the friends know which protocol features we understand
+		model_->greetFriends();
 		// begin processing user input
 		view_->presentLine("CPSC427 OOP Final Project\nFei Huang\nWelcome to OpenChat");
 		view_->presentLine("");
@@ -61,13 +83,73 @@ public:
 			boost::trim(input);
 			processMore = controller_->processUserInput(input);
 		} while (processMore);
-		// clean up: stop the client and wait the thread to join
+		// clean up: let the last broadcasts go out, stop the client and wait the thread to join
+		model_->waitForBroadcasts();
 		model_->stop();
 		clientThread.join();
+		view_->stopWriter();
+	}
+
+	/**
+	 * Run the commands of a script, a file or "-" for the input stream, without any prompts, up
+	 * to its end or an "exit".  Blank lines and lines starting with "#" are skipped.  A command
+	 * that fails is reported to errors as "error<TAB>line<TAB>reason", and a summary line follows
+	 * the last command.  Returns the number of commands that failed, or -1 if the script cannot
+	 * be read.
+	 */
+	long runBatch(const string &source, ostream &errors) const {
+		ScriptReader script(source, is_);
+		if (!script.isOpen()) {
+			errors << "error\t0\tcannot read " << source << endl;
+			return -1;
+		}
+		controller_->setPrompting(false);
+		boost::thread clientThread(boost::bind(&BasicChatClient::run, model_));
+		model_->greetFriends();
+
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		size_t commandCount = 0, errorCount = 0;
+		boost::string_ref line;
+		string input;
+		while (script.next(line)) {
+			while (!line.empty() && isspace((unsigned char)line[0])) {
+				line.remove_prefix(1);
+			}
+			while (!line.empty() && isspace((unsigned char)line[line.size() - 1])) {
+				line.remove_suffix(1);
+			}
+			if (line.empty() || line[0] == '#')
+				continue;
+			input.assign(line.data(), line.size());
+			++commandCount;
+			bool processMore = controller_->processUserInput(input);
+			if (!controller_->getLastError().empty()) {
+				++errorCount;
+				errors << "error\t" << script.getLineNumber() << "\t" << controller_->getLastError() << "\n";
+			}
+			if (!processMore)
+				break;
+		}
+		double seconds = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+		errors << "summary\tcommands=" << commandCount << "\terrors=" << errorCount << "\tseconds=" << seconds
+		       << "\tcommands_per_second=" << (seconds > 0 ? (size_t)(commandCount / seconds) : commandCount) << endl;
+
+		model_->waitForBroadcasts();
+		model_->stop();
+		clientThread.join();
+		view_->stopWriter();
+		if (view_->getQueueCapacity() > 0) {
+			errors << "view\twritten=" << view_->getWrittenCount() << "\tdropped=" << view_->getDroppedCount()
+			       << "\tmax_queue_depth=" << view_->getMaxQueueDepth() << "\tmax_write_latency_us=" << view_->getMaxWriteLatency()
+			       << "\tmean_write_latency_us=" << view_->getWriteLatency() / max<size_t>(view_->getWrittenCount(), 1) << endl;
+		}
+		return (long)errorCount;
 	}
 private:
 	string fileName_;
 	istream &is_;
+	ContactStore store_;
+	HistoryStore history_;
 	string id_;
 	int port_;
 	boost::shared_ptr<BasicChatClient> model_;
@@ -76,5 +158,3 @@ private:
 };
 
 }
-
-
@@ -11,6 +11,13 @@
 #include <string>
 #include <sstream>
 #include <utility>
+#include <vector>
+#include <cstring>
+#include <boost/utility/string_ref.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -22,6 +29,109 @@ namespace {
  */
 class ChatProtocol {
 public:
+	enum MessageType {
+		MESSAGE_UNKNOWN,
+		MESSAGE_PLAIN,
+		MESSAGE_FRIEND_EXTRACTION,
+		MESSAGE_FRIEND_EX_RESPONSE,
+		MESSAGE_HELLO,
+		MESSAGE_FRIEND_SYNC,
+		MESSAGE_FRIEND_DELTA,
+		MESSAGE_FRIEND_PAGE
+	};
+
+	/**
+	 * Recognise the tag of a raw message in a single pass, without building any string.  The tags
+	 * are told apart by their second character, the friend list tags by their ninth (and the two
+	 * extraction tags by their eleventh), so only one candidate is ever compared.  Same rule as the
+	 * is*Message methods: the tag must be followed by at least one more character.
+	 */
+	static MessageType classify(boost::string_ref rawMessage) {
+		if (rawMessage.size() < 2 || rawMessage[0] != '_')
+			return MESSAGE_UNKNOWN;
+		switch (rawMessage[1]) {
+		case 'P':
+			return matchesTag(rawMessage, "_PLAIN_", 7) ? MESSAGE_PLAIN : MESSAGE_UNKNOWN;
+		case 'H':
+			return matchesTag(rawMessage, "_HELLO_", 7) ? MESSAGE_HELLO : MESSAGE_UNKNOWN;
+		case 'F':
+			if (rawMessage.size() <= 8)
+				return MESSAGE_UNKNOWN;
+			switch (rawMessage[8]) {
+			case 'E':
+				if (rawMessage.size() > 10 && rawMessage[10] == 'T')
+					return matchesTag(rawMessage, "_FRIEND_EXTRACTION_", 19) ? MESSAGE_FRIEND_EXTRACTION : MESSAGE_UNKNOWN;
+				return matchesTag(rawMessage, "_FRIEND_EX_RESPONSE_", 20) ? MESSAGE_FRIEND_EX_RESPONSE : MESSAGE_UNKNOWN;
+			case 'S':
+				return matchesTag(rawMessage, "_FRIEND_SYNC_", 13) ? MESSAGE_FRIEND_SYNC : MESSAGE_UNKNOWN;
+			case 'D':
+				return matchesTag(rawMessage, "_FRIEND_DELTA_", 14) ? MESSAGE_FRIEND_DELTA : MESSAGE_UNKNOWN;
+			case 'P':
+				return matchesTag(rawMessage, "_FRIEND_PAGE_", 13) ? MESSAGE_FRIEND_PAGE : MESSAGE_UNKNOWN;
+			default:
+				return MESSAGE_UNKNOWN;
+			}
+		default:
+			return MESSAGE_UNKNOWN;
+		}
+	}
+
+	/**
+	 * Tokenizer walks a raw message the way the istringstream based parsers do (tokens are separated by
+	 * whitespace, the rest of a line may be taken as a whole) but hands out views into the message.
+	 */
+	class Tokenizer {
+	public:
+		Tokenizer(boost::string_ref text) : text_(text), position_(0) { }
+
+		bool next(boost::string_ref &token) {
+			skipSpaces();
+			size_t begin = position_;
+			while (position_ < text_.size() && !isSpace(text_[position_])) ++position_;
+			token = text_.substr(begin, position_ - begin);
+			return !token.empty();
+		}
+
+		// like "iss >> ws; getline(iss, rest)"
+		boost::string_ref rest() {
+			skipSpaces();
+			const char *begin = text_.data() + position_;
+			const char *newline = static_cast<const char *>(memchr(begin, '\n', text_.size() - position_));
+			size_t length = newline ? newline - begin : text_.size() - position_;
+			position_ += length;
+			return boost::string_ref(begin, length);
+		}
+	private:
+		static bool isSpace(char c) {
+			return c == ' ' || (c >= '\t' && c <= '\r');
+		}
+		void skipSpaces() {
+			while (position_ < text_.size() && isSpace(text_[position_])) ++position_;
+		}
+
+		boost::string_ref text_;
+		size_t position_;
+	};
+
+	/**
+	 * FriendInfoReader iterates over the (id, hostname, port) triples of a friend list extraction response
+	 */
+	class FriendInfoReader {
+	public:
+		// fromID is set to the ID of the friend who sent the list
+		FriendInfoReader(boost::string_ref rawMessage, boost::string_ref &fromID) : tokenizer_(rawMessage) {
+			boost::string_ref tag;
+			tokenizer_.next(tag);
+			tokenizer_.next(fromID);
+		}
+
+		bool next(boost::string_ref &id, boost::string_ref &hostname, boost::string_ref &port) {
+			return tokenizer_.next(id) && tokenizer_.next(hostname) && tokenizer_.next(port);
+		}
+	private:
+		Tokenizer tokenizer_;
+	};
+
 	/**
 	 * Plain chat message
 	 */
@@ -30,18 +140,24 @@ public:
 	}
 
 	static bool isPlainChatMessage(const string &rawMessage) {
-		return rawMessage.size() > getPlainMessageTag().size() &&
-		       rawMessage.substr(0, getPlainMessageTag().size()) == getPlainMessageTag();
+		return classify(rawMessage) == MESSAGE_PLAIN;
+	}
+
+	// returns false if the message has no ID
+	static bool parsePlainChatMessage(boost::string_ref rawMessage, boost::string_ref &id, boost::string_ref &message) {
+		Tokenizer tokenizer(rawMessage);
+		boost::string_ref tag;
+		tokenizer.next(tag); // throw the tag
+		if (!tokenizer.next(id))
+			return false;
+		message = tokenizer.rest();
+		return true;
 	}
 
 	static pair<string, string> parsePlainChatMessage(const string &rawMessage) {
-		string id, message, junk;
-		istringstream iss(rawMessage);
-		iss >> junk; // throw the tag
-		iss >> id;
-		iss >> ws;
-		getline(iss, message);
-		return make_pair(id, message);
+		boost::string_ref id, message;
+		parsePlainChatMessage(rawMessage, id, message);
+		return make_pair(id.to_string(), message.to_string());
 	}
 
 	/**
@@ -52,8 +168,7 @@ public:
 	}
 
 	static bool isFriendListExtractionMessage(const string &rawMessage) {
-		return rawMessage.size() > getFriendListExtractionMessageTag().size() &&
-			   rawMessage.substr(0, getFriendListExtractionMessageTag().size()) == getFriendListExtractionMessageTag();
+		return classify(rawMessage) == MESSAGE_FRIEND_EXTRACTION;
 	}
 
 	/**
@@ -69,24 +184,186 @@ public:
 	}
 
 	static bool isFriendListExtractionResponseMessage(const string &rawMessage) {
-		return rawMessage.size() > getFriendListExtractionResponseMessageTag().size() &&
-			   rawMessage.substr(0, getFriendListExtractionResponseMessageTag().size()) == getFriendListExtractionResponseMessageTag();
+		return classify(rawMessage) == MESSAGE_FRIEND_EX_RESPONSE;
 	}
 
 	static pair<string, vector<pair<string, pair<string, string> > > > parseFriendListExtractionResponseMessage(const string &rawMessage) {
-		string junk;
-		istringstream iss(rawMessage);
-		iss >> junk; // throw the tag
-		string fromID;
-		iss >> fromID;
+		boost::string_ref fromID, id, hostname, port;
+		FriendInfoReader reader(rawMessage, fromID);
 		vector<pair<string, pair<string, string> > > info;
-		string id, hostname, port;
-		while (iss >> id >> hostname >> port) {
-			info.push_back(make_pair(id, make_pair(hostname, port)));
+		while (reader.next(id, hostname, port)) {
+			info.push_back(make_pair(id.to_string(), make_pair(hostname.to_string(), port.to_string())));
 		}
-		return make_pair(fromID, info);
+		return make_pair(fromID.to_string(), info);
+	}
+
+	/**
+	 * Friend list sync message: asking a friend for the changes to its friend list since version of
+	 * epoch, or, if after is given, for the page of a full sync following that ID
+	 */
+	static string wrapFriendSyncMessage(unsigned epoch, unsigned version, const string &after) {
+		ostringstream oss;
+		oss << getFriendSyncMessageTag() << " " << epoch << " " << version;
+		if (!after.empty())
+			oss << " " << after;
+		return oss.str();
+	}
+
+	// returns false if the message is malformed
+	static bool parseFriendSyncMessage(boost::string_ref rawMessage, unsigned &epoch, unsigned &version, boost::string_ref &after) {
+		Tokenizer tokenizer(rawMessage);
+		boost::string_ref tag, token;
+		tokenizer.next(tag); // throw the tag
+		if (!tokenizer.next(token) || !parseNumber(token, epoch) || !tokenizer.next(token) || !parseNumber(token, version))
+			return false;
+		if (!tokenizer.next(after))
+			after = boost::string_ref();
+		return true;
+	}
+
+	/**
+	 * Friend list delta message: the changes from version base to version, "+ id hostname port" for
+	 * a friend added or changed, "- id" for one removed (an empty hostname in the parsed list)
+	 */
+	static string wrapFriendDeltaMessage(const string &id, unsigned epoch, unsigned base, unsigned version,
+	                                     const vector<pair<string, pair<string, string> > > &changes) {
+		ostringstream oss;
+		oss << getFriendDeltaMessageTag() << " " << id << " " << epoch << " " << base << " " << version;
+		for (size_t i = 0; i < changes.size(); ++i) {
+			if (changes[i].second.first.empty()) {
+				oss << " - " << changes[i].first;
+			} else {
+				oss << " + " << changes[i].first << " " << changes[i].second.first << " " << changes[i].second.second;
+			}
+		}
+		return oss.str();
+	}
+
+	static bool parseFriendDeltaMessage(boost::string_ref rawMessage, boost::string_ref &fromID, unsigned &epoch, unsigned &base,
+	                                    unsigned &version, vector<pair<string, pair<string, string> > > &changes) {
+		Tokenizer tokenizer(rawMessage);
+		boost::string_ref tag, token, id, hostname, port;
+		tokenizer.next(tag); // throw the tag
+		if (!tokenizer.next(fromID) || !tokenizer.next(token) || !parseNumber(token, epoch) || !tokenizer.next(token) ||
+		    !parseNumber(token, base) || !tokenizer.next(token) || !parseNumber(token, version))
+			return false;
+		changes.clear();
+		while (tokenizer.next(token)) {
+			if (token == "-" && tokenizer.next(id)) {
+				changes.push_back(make_pair(id.to_string(), pair<string, string>()));
+			} else if (token == "+" && tokenizer.next(id) && tokenizer.next(hostname) && tokenizer.next(port)) {
+				changes.push_back(make_pair(id.to_string(), make_pair(hostname.to_string(), port.to_string())));
+			} else {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Friend list page message: a page of a full sync at version, in ID order; first if it is the
+	 * first page, more if others follow
+	 */
+	static string wrapFriendPageMessage(const string &id, unsigned epoch, unsigned version, bool first, bool more,
+	                                    const vector<pair<string, pair<string, string> > > &entries) {
+		ostringstream oss;
+		oss << getFriendPageMessageTag() << " " << id << " " << epoch << " " << version << " " << (first ? 1 : 0) << " " << (more ? 1 : 0);
+		for (size_t i = 0; i < entries.size(); ++i) {
+			oss << " " << entries[i].first << " " << entries[i].second.first << " " << entries[i].second.second;
+		}
+		return oss.str();
+	}
+
+	static bool parseFriendPageMessage(boost::string_ref rawMessage, boost::string_ref &fromID, unsigned &epoch, unsigned &version,
+	                                   bool &first, bool &more, vector<pair<string, pair<string, string> > > &entries) {
+		Tokenizer tokenizer(rawMessage);
+		boost::string_ref tag, token, id, hostname, port;
+		unsigned firstFlag, moreFlag;
+		tokenizer.next(tag); // throw the tag
+		if (!tokenizer.next(fromID) || !tokenizer.next(token) || !parseNumber(token, epoch) || !tokenizer.next(token) ||
+		    !parseNumber(token, version) || !tokenizer.next(token) || !parseNumber(token, firstFlag) || !tokenizer.next(token) ||
+		    !parseNumber(token, moreFlag))
+			return false;
+		first = firstFlag != 0;
+		more = moreFlag != 0;
+		entries.clear();
+		while (tokenizer.next(id)) {
+			if (!tokenizer.next(hostname) || !tokenizer.next(port))
+				return false;
+			entries.push_back(make_pair(id.to_string(), make_pair(hostname.to_string(), port.to_string())));
+		}
+		return true;
+	}
+
+	/**
+	 * Hello message: announcing the protocol version and features a peer understands.  Peers that do not
+	 * know the tag ignore it and keep talking plain text; a hello that is not a reply asks for one back.
+	 */
+	struct Hello {
+		string id;
+		unsigned version;
+		unsigned features;
+		bool isReply;
+	};
+
+	static string wrapHelloMessage(const string &id, unsigned version, unsigned features, bool isReply) {
+		ostringstream oss;
+		oss << getHelloMessageTag() << " " << id << " " << version << " " << features << " " << (isReply ? 1 : 0);
+		return oss.str();
+	}
+
+	static bool isHelloMessage(const string &rawMessage) {
+		return classify(rawMessage) == MESSAGE_HELLO;
+	}
+
+	static Hello parseHelloMessage(boost::string_ref rawMessage) {
+		Hello hello;
+		hello.version = hello.features = 0;
+		int isReply = 0;
+		string junk;
+		istringstream iss(rawMessage.to_string());
+		iss >> junk; // throw the tag
+		iss >> hello.id >> hello.version >> hello.features >> isReply;
+		hello.isReply = isReply != 0;
+		return hello;
 	}
 private:
+	// a decimal number that fits into an unsigned
+	static bool parseNumber(boost::string_ref token, unsigned &value) {
+		if (token.empty() || token.size() > 10)
+			return false;
+		unsigned long long result = 0;
+		for (size_t i = 0; i < token.size(); ++i) {
+			if (token[i] < '0' || token[i] > '9')
+				return false;
+			result = result * 10 + (token[i] - '0');
+		}
+		if (result > 0xFFFFFFFFull)
+			return false;
+		value = (unsigned)result;
+		return true;
+	}
+
+	// true if rawMessage starts with the tag and has something after it
+	static bool matchesTag(boost::string_ref rawMessage, const char *tag, size_t tagLength) {
+		if (rawMessage.size() <= tagLength)
+			return false;
+#ifdef __SSE2__
+		if (rawMessage.size() >= 16 && tagLength <= 32) {
+			// compare the first 16 bytes at once, then whatever is left of the tag
+			char padded[16] = { 0 };
+			memcpy(padded, tag, min<size_t>(tagLength, 16));
+			__m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rawMessage.data()));
+			__m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(padded));
+			unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs));
+			unsigned wanted = tagLength >= 16 ? 0xFFFFu : (1u << tagLength) - 1;
+			return (mask & wanted) == wanted &&
+			       (tagLength <= 16 || memcmp(rawMessage.data() + 16, tag + 16, tagLength - 16) == 0);
+		}
+#endif
+		return memcmp(rawMessage.data(), tag, tagLength) == 0;
+	}
+
 	// the rule is no tag should be a prefix of any other
 	static string getPlainMessageTag() {
 		return "_PLAIN_";
@@ -97,6 +374,18 @@ private:
 	static string getFriendListExtractionResponseMessageTag() {
 		return "_FRIEND_EX_RESPONSE_";
 	}
+	static string getHelloMessageTag() {
+		return "_HELLO_";
+	}
+	static string getFriendSyncMessageTag() {
+		return "_FRIEND_SYNC_";
+	}
+	static string getFriendDeltaMessageTag() {
+		return "_FRIEND_DELTA_";
+	}
+	static string getFriendPageMessageTag() {
+		return "_FRIEND_PAGE_";
+	}
 };
 
 }
@@ -0,0 +1,286 @@
+/*
+ * coalescing.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * CoalescingProtocol packs several small payloads headed to the same endpoint into one datagram,
+ * a bundle:
+ *
+ *     magic (2) | version (1) | reserved (1) | { length (2) | payload }...
+ *
+ * It sits below everything else: each payload unpacked from a bundle is handled as if it had
+ * arrived in a datagram of its own.
+ */
+class CoalescingProtocol {
+public:
+	static const unsigned char version = 1;
+	static const size_t headerSize = 4;
+	static const size_t entryHeaderSize = 2;
+
+	static bool isBundle(const char *data, size_t size) {
+		return size >= 2 && (unsigned char)data[0] == magic0 && (unsigned char)data[1] == magic1;
+	}
+
+	static string makeHeader() {
+		string header(headerSize, '\0');
+		header[0] = (char)magic0;
+		header[1] = (char)magic1;
+		header[2] = (char)version;
+		return header;
+	}
+
+	static void appendEntry(string &bundle, const string &payload) {
+		bundle.push_back((char)(payload.size() >> 8));
+		bundle.push_back((char)payload.size());
+		bundle.append(payload);
+	}
+
+	/**
+	 * Reader walks the payloads of a bundle; a bundle cut short, or of another version, yields
+	 * the payloads that are whole and then stops
+	 */
+	class Reader {
+	public:
+		Reader(const char *data, size_t size) : data_(data), size_(size), position_(headerSize) {
+			if (!isBundle(data, size) || size < headerSize || (unsigned char)data[2] != version)
+				position_ = size_;
+		}
+
+		bool next(const char *&payload, size_t &length) {
+			if (size_ - position_ < entryHeaderSize)
+				return false;
+			const unsigned char *p = reinterpret_cast<const unsigned char *>(data_ + position_);
+			length = ((size_t)p[0] << 8) | p[1];
+			if (size_ - position_ - entryHeaderSize < length)
+				return false;
+			payload = data_ + position_ + entryHeaderSize;
+			position_ += entryHeaderSize + length;
+			return true;
+		}
+	private:
+		const char *data_;
+		size_t size_;
+		size_t position_;
+	};
+private:
+	static const unsigned char magic0 = 0xC0;
+	static const unsigned char magic1 = 0xB5;
+};
+
+/**
+ * Coalescer holds small outgoing payloads to endpoints that unpack bundles, one bundle per
+ * endpoint, and hands a bundle to the send callback once the next payload would not fit into
+ * maxDatagramSize bytes or its first payload has waited latency microseconds, whichever comes
+ * first.  A bundle holding a single payload is sent as that payload, so a lone message costs
+ * nothing but the wait.
+ *
+ * Payloads to an endpoint leave in the order they were given, coalesced or not: one too large to
+ * join a bundle first flushes the bundle waiting for its endpoint.  An endpoint nothing has been
+ * sent to for idleTimeout milliseconds is no longer coalesced to, until it is enabled again.
+ */
+class Coalescer : private boost::noncopyable {
+public:
+	// puts a datagram on the wire
+	typedef boost::function<void (const string &, const udp::endpoint &)> sendCallbackType;
+
+	Coalescer(sendCallbackType send, size_t maxDatagramSize, long latency, long idleTimeout)
+		: send_(send), maxDatagramSize_(maxDatagramSize), latency_(latency), idleTimeout_(idleTimeout),
+		  lastSweep_(boost::get_system_time()), nextSequence_(0), stopping_(true), coalescedCount_(0), bundleCount_(0) { }
+
+	~Coalescer() {
+		stop();
+	}
+
+	void start() {
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = false;
+		flusher_ = boost::thread(boost::bind(&Coalescer::flushLoop, this));
+	}
+
+	// send what is waiting and stop coalescing; later payloads are not taken
+	void stop() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			condition_.notify_all();
+		}
+		if (flusher_.joinable())
+			flusher_.join();
+	}
+
+	// coalesce what is sent to remoteEndpoint from now on; it must unpack bundles
+	void enable(const udp::endpoint &remoteEndpoint) {
+		boost::mutex::scoped_lock lock(mutex_);
+		boost::system_time now = boost::get_system_time();
+		endpoints_[remoteEndpoint] = now;
+		sweep(now);
+	}
+
+	// send to remoteEndpoint uncoalesced from now on; what is waiting for it still goes out
+	void disable(const udp::endpoint &remoteEndpoint) {
+		boost::mutex::scoped_lock lock(mutex_);
+		endpoints_.erase(remoteEndpoint);
+	}
+
+	/**
+	 * Take payload into the bundle for remoteEndpoint; false if it is not to be coalesced, and is
+	 * for the caller to send, which it may do right away.
+	 */
+	bool send(const string &payload, const udp::endpoint &remoteEndpoint) {
+		string full;
+		bool taken = true;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			map<udp::endpoint, boost::system_time>::iterator endpoint = endpoints_.find(remoteEndpoint);
+			if (stopping_ || endpoint == endpoints_.end())
+				return false;
+			boost::system_time now = boost::get_system_time();
+			endpoint->second = now;
+			sweep(now);
+			map<udp::endpoint, Bundle>::iterator iter = bundles_.find(remoteEndpoint);
+			size_t needed = CoalescingProtocol::entryHeaderSize + payload.size();
+			if (CoalescingProtocol::headerSize + needed > maxDatagramSize_) {
+				taken = false; // too large, but what is waiting has to go first
+			} else if (iter != bundles_.end() && iter->second.data.size() + needed <= maxDatagramSize_) {
+				CoalescingProtocol::appendEntry(iter->second.data, payload);
+				++iter->second.count;
+				return true;
+			}
+			if (iter != bundles_.end()) {
+				takeBundle(iter->second, full);
+				bundles_.erase(iter);
+			}
+			if (taken) {
+				Bundle &bundle = bundles_[remoteEndpoint];
+				bundle.data = CoalescingProtocol::makeHeader();
+				CoalescingProtocol::appendEntry(bundle.data, payload);
+				bundle.count = 1;
+				bundle.sequence = nextSequence_++;
+				deadlines_.push_back(Deadline(now + boost::posix_time::microseconds(latency_), remoteEndpoint, bundle.sequence));
+				if (deadlines_.size() == 1)
+					condition_.notify_one();
+			}
+		}
+		if (!full.empty())
+			send_(full, remoteEndpoint);
+		return taken;
+	}
+
+	// statistics: payloads sent inside bundles of two or more, and such bundles sent
+	size_t getCoalescedCount() const { return coalescedCount_.load(); }
+	size_t getBundleCount() const { return bundleCount_.load(); }
+private:
+	struct Bundle {
+		string data;
+		size_t count;
+		boost::uint64_t sequence;
+	};
+
+	// when the bundle of an endpoint started with sequence is due; bundles flushed early leave theirs behind
+	struct Deadline {
+		Deadline(const boost::system_time &t, const udp::endpoint &e, boost::uint64_t s) : time(t), endpoint(e), sequence(s) { }
+		boost::system_time time;
+		udp::endpoint endpoint;
+		boost::uint64_t sequence;
+	};
+
+	// called with mutex_ held: forget the endpoints that have not been sent to for idleTimeout
+	void sweep(const boost::system_time &now) {
+		if (now - lastSweep_ < boost::posix_time::milliseconds(idleTimeout_ / 4 + 1))
+			return;
+		lastSweep_ = now;
+		for (map<udp::endpoint, boost::system_time>::iterator iter = endpoints_.begin(); iter != endpoints_.end(); ) {
+			if (now - iter->second > boost::posix_time::milliseconds(idleTimeout_))
+				endpoints_.erase(iter++);
+			else
+				++iter;
+		}
+	}
+
+	// the datagram to send for a bundle
+	void takeBundle(Bundle &bundle, string &datagram) {
+		if (bundle.count == 1) {
+			datagram = bundle.data.substr(CoalescingProtocol::headerSize + CoalescingProtocol::entryHeaderSize);
+		} else {
+			datagram.swap(bundle.data);
+			coalescedCount_ += bundle.count;
+			++bundleCount_;
+		}
+	}
+
+	void flushLoop() {
+		vector<pair<string, udp::endpoint> > due;
+		boost::mutex::scoped_lock lock(mutex_);
+		for (;;) {
+			while (deadlines_.empty() && !stopping_) {
+				condition_.wait(lock);
+			}
+			if (deadlines_.empty())
+				return;
+			boost::system_time now = boost::get_system_time();
+			while (!deadlines_.empty() && (stopping_ || deadlines_.front().time <= now)) {
+				const Deadline &deadline = deadlines_.front();
+				map<udp::endpoint, Bundle>::iterator iter = bundles_.find(deadline.endpoint);
+				if (iter != bundles_.end() && iter->second.sequence == deadline.sequence) {
+					due.push_back(make_pair(string(), deadline.endpoint));
+					takeBundle(iter->second, due.back().first);
+					bundles_.erase(iter);
+				}
+				deadlines_.pop_front();
+			}
+			if (due.empty()) {
+				// every deadline may have been for a bundle sent already, when it filled up
+				if (!deadlines_.empty())
+					condition_.timed_wait(lock, deadlines_.front().time);
+				continue;
+			}
+			lock.unlock();
+			for (size_t i = 0; i < due.size(); ++i) {
+				send_(due[i].first, due[i].second);
+			}
+			due.clear();
+			lock.lock();
+		}
+	}
+
+	sendCallbackType send_;
+	const size_t maxDatagramSize_;
+	const long latency_;
+	const long idleTimeout_;
+
+	boost::mutex mutex_;
+	boost::condition_variable condition_;
+	map<udp::endpoint, boost::system_time> endpoints_; // coalesced to, with when each was last sent to
+	boost::system_time lastSweep_;
+	map<udp::endpoint, Bundle> bundles_;
+	deque<Deadline> deadlines_; // in order of time, for the latency is the same for all
+	boost::uint64_t nextSequence_;
+	bool stopping_;
+	boost::thread flusher_;
+
+	boost::atomic<size_t> coalescedCount_;
+	boost::atomic<size_t> bundleCount_;
+};
+
+}
@@ -10,24 +10,36 @@
 
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/date_time/c_local_time_adjustor.hpp>
 
 #include "view.hpp"
 #include "basicchatclient.hpp"
 #include "chatprotocol.hpp"
+#include "historystore.hpp"
+#include "commandpool.hpp"
 
 using namespace std;
 
 namespace openchat {
 
 /**
- * Command encapsulates the operation on the chat client, using Command Pattern
+ * Command encapsulates the operation on the chat client, using Command Pattern.  Commands are
+ * created in their controller's CommandPool, new (pool) SomeCommand(...), and refer to its model
+ * and view, which the controller outlives them holding.
  */
 class Command {
 public:
-	Command(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
-		: model_(model), view_(view), is_(is), name_(name) { }
+	Command(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
+		: model_(model.get()), view_(view.get()), is_(is), name_(name) { }
 	virtual ~Command() { }
+
+	static void *operator new(size_t size, CommandPool &pool) { return pool.allocate(size); }
+	static void operator delete(void *object, CommandPool &) { CommandPool::release(object); }
+	static void operator delete(void *object) { CommandPool::release(object); }
+
 	string getName() const { return name_; }
 
 	// present information on View before executing the command
@@ -44,8 +56,8 @@ public:
 	// present information on View after executing the command
 	virtual void showAfterExecution() const = 0;
 protected:
-	boost::shared_ptr<BasicChatClient> model_;
-	boost::shared_ptr<View> view_;
+	BasicChatClient *model_;
+	View *view_;
 	istream &is_;
 	string name_;
 };
@@ -55,7 +67,7 @@ protected:
  */
 class NullCommand : public Command {
 public:
-	NullCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
+	NullCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
 		: Command(model, view, is, name) { }
 	virtual void showBeforeExecution() const { }
 	virtual void execute() { }
@@ -70,7 +82,7 @@ public:
  */
 class FriendCommand : public Command {
 public:
-	FriendCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
+	FriendCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
 		: Command(model, view, is, name) { }
 
 	virtual void showBeforeExecution() const {
@@ -88,7 +100,7 @@ public:
  */
 class StrangerCommand : public Command {
 public:
-	StrangerCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
+	StrangerCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
 		: Command(model, view, is, name) { }
 
 	virtual void showBeforeExecution() const {
@@ -106,7 +118,7 @@ public:
  */
 class GroupCommand : public Command {
 public:
-	GroupCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
+	GroupCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
 		: Command(model, view, is, name) { }
 
 	virtual void showBeforeExecution() const {
@@ -124,7 +136,7 @@ public:
  */
 class ShowGroupCommand : public Command {
 public:
-	ShowGroupCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ShowGroupCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					 const string &id)
 		: Command(model, view, is, name), id_(id) { }
 
@@ -146,7 +158,7 @@ private:
  */
 class ShowSelfCommand : public Command {
 public:
-	ShowSelfCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name)
+	ShowSelfCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name)
 			: Command(model, view, is, name) { }
 	virtual void showBeforeExecution() const { }
 	virtual void execute() { }
@@ -163,7 +175,7 @@ public:
  */
 class ToCommand : public Command {
 public:
-	ToCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 			  const string &toID, const string &fromID, const string &message)
 		: Command(model, view, is, name), toID_(toID), fromID_(fromID), message_(message) { }
 protected:
@@ -177,12 +189,13 @@ protected:
  */
 class ToFriendCommand : public ToCommand {
 public:
-	ToFriendCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToFriendCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 			        const string &toID, const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, toID, fromID, message) { }
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToFriend(toID_, ChatProtocol::wrapPlainChatMessage(fromID_, message_));
+		model_->sendToFriend(toID_, PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::peerConversation(toID_), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
@@ -192,12 +205,13 @@ public:
  */
 class ToStrangerCommand : public ToCommand {
 public:
-	ToStrangerCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToStrangerCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 			          const string &toID, const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, toID, fromID, message) { }
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToStranger(toID_, ChatProtocol::wrapPlainChatMessage(fromID_, message_));
+		model_->sendToStranger(toID_, PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::peerConversation(toID_), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
@@ -207,13 +221,14 @@ public:
  */
 class ToAllFriendsCommand : public ToCommand {
 public:
-	ToAllFriendsCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToAllFriendsCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 				        const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, "", fromID, message) { }
 
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToAllFriends(ChatProtocol::wrapPlainChatMessage(fromID_, message_));
+		model_->sendToAllFriends(PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::broadcastConversation(), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
@@ -223,13 +238,14 @@ public:
  */
 class ToAllStrangersCommand : public ToCommand {
 public:
-	ToAllStrangersCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToAllStrangersCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 				        const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, "", fromID, message) { }
 
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToAllStrangers(ChatProtocol::wrapPlainChatMessage(fromID_, message_));
+		model_->sendToAllStrangers(PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::broadcastConversation(), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
@@ -239,13 +255,14 @@ public:
  */
 class ToGroupCommand : public ToCommand {
 public:
-	ToGroupCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToGroupCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 				   const string &groupID, const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, groupID, fromID, message) { }
 
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToGroup(toID_, ChatProtocol::wrapPlainChatMessage(fromID_, message_));
+		model_->sendToGroup(toID_, PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::groupConversation(toID_), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
@@ -255,26 +272,165 @@ public:
  */
 class ToAllCommand : public ToCommand {
 public:
-	ToAllCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ToAllCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 			     const string &fromID, const string &message)
 		: ToCommand(model, view, is, name, "", fromID, message) { }
 
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		string message = ChatProtocol::wrapPlainChatMessage(fromID_, message_);
-		model_->sendToAllFriends(message);
-		model_->sendToAllStrangers(message);
+		model_->sendToAll(PlainChatWireMessage(fromID_, message_));
+		model_->recordMessage(HistoryStore::broadcastConversation(), HistoryStore::DIRECTION_SENT, fromID_, message_);
 	}
 	virtual void showAfterExecution() const { }
 };
 
 
+/**
+ * HistoryCommand shows messages of a conversation kept by the history store: a contact's ID, a
+ * group's ID prefixed with "#", or "*" for the messages sent to everybody
+ */
+class HistoryCommand : public Command {
+public:
+	HistoryCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
+	               const string &conversation)
+		: Command(model, view, is, name), conversation_(conversation) { }
+
+	virtual void showBeforeExecution() const { }
+	virtual void execute() { }
+
+	// the conversation a command argument names
+	static string getConversation(const string &argument) {
+		if (argument == HistoryStore::broadcastConversation())
+			return argument;
+		if (!argument.empty() && argument[0] == '#')
+			return HistoryStore::groupConversation(argument.substr(1));
+		return HistoryStore::peerConversation(argument);
+	}
+
+	/**
+	 * Parse a local time, "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS", into microseconds since the epoch;
+	 * false if it is neither.
+	 */
+	static bool parseTime(const string &text, boost::int64_t &time) {
+		boost::posix_time::ptime local;
+		try {
+			if (text.size() == 10) {
+				local = boost::posix_time::ptime(boost::gregorian::from_simple_string(text));
+			} else {
+				local = boost::posix_time::from_iso_extended_string(text);
+			}
+		} catch (exception &) {
+			return false;
+		}
+		if (local.is_special())
+			return false;
+		time = (local - getEpoch()).total_microseconds() - getLocalOffset();
+		return true;
+	}
+protected:
+	void presentEntries(const vector<HistoryStore::Entry> &entries) const {
+		if (entries.empty()) {
+			view_->presentLine("No messages.");
+			return;
+		}
+		for (vector<HistoryStore::Entry>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+			boost::posix_time::ptime local = getEpoch() + boost::posix_time::seconds((long)((iter->time + getLocalOffset()) / 1000000));
+			string when = boost::posix_time::to_iso_extended_string(local);
+			when[10] = ' '; // "YYYY-MM-DD HH:MM:SS"
+			if (iter->direction == HistoryStore::DIRECTION_SENT) {
+				string to = iter->conversation == HistoryStore::broadcastConversation() ? "all" : iter->conversation.substr(1);
+				view_->presentLine("[" + when + "] [To " + to + "]: " + iter->text);
+			} else {
+				view_->presentLine("[" + when + "] [From " + iter->fromID + "]: " + iter->text);
+			}
+		}
+	}
+
+	static boost::posix_time::ptime getEpoch() {
+		return boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+	}
+
+	// microseconds local time is ahead of UTC
+	static boost::int64_t getLocalOffset() {
+		boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+		return (boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(now) - now).total_microseconds();
+	}
+
+	string conversation_;
+};
+
+/**
+ * ScrollCommand shows the last messages of a conversation
+ */
+class ScrollCommand : public HistoryCommand {
+public:
+	ScrollCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
+	              const string &conversation, size_t count)
+		: HistoryCommand(model, view, is, name, conversation), count_(count) { }
+
+	virtual void showAfterExecution() const {
+		HistoryStore *history = model_->getHistory();
+		if (history)
+			presentEntries(history->getLast(conversation_, count_));
+	}
+private:
+	size_t count_;
+};
+
+/**
+ * RangeCommand shows the messages of a conversation within a period of time
+ */
+class RangeCommand : public HistoryCommand {
+public:
+	RangeCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
+	             const string &conversation, boost::int64_t from, boost::int64_t to)
+		: HistoryCommand(model, view, is, name, conversation), from_(from), to_(to) { }
+
+	virtual void showAfterExecution() const {
+		HistoryStore *history = model_->getHistory();
+		if (history)
+			presentEntries(history->getRange(conversation_, from_, to_));
+	}
+private:
+	boost::int64_t from_;
+	boost::int64_t to_;
+};
+
+/**
+ * SearchCommand shows the newest messages, of any conversation, containing every word searched for
+ */
+class SearchCommand : public HistoryCommand {
+public:
+	SearchCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
+	              const string &query)
+		: HistoryCommand(model, view, is, name, ""), query_(query) { }
+
+	virtual void showAfterExecution() const {
+		HistoryStore *history = model_->getHistory();
+		if (!history)
+			return;
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		vector<HistoryStore::Entry> entries = history->search(query_, maxResults);
+		long elapsed = (long)(boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+		// oldest first, as the other history commands show them
+		presentEntries(vector<HistoryStore::Entry>(entries.rbegin(), entries.rend()));
+		ostringstream oss;
+		oss << entries.size() << (entries.size() == 1 ? " match" : " matches") << " in " << elapsed / 1000 << "." << elapsed / 100 % 10 << " ms.";
+		view_->presentLine(oss.str());
+	}
+private:
+	static const size_t maxResults = 20;
+
+	string query_;
+};
+
+
 /**
  * AddFriendCommand adds and connects a friend
  */
 class AddFriendCommand : public Command {
 public:
-	AddFriendCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	AddFriendCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					const string &id, const string &hostname, const string &port)
 		: Command(model, view, is, name), id_(id), hostname_(hostname), port_(port) { }
 
@@ -300,7 +456,7 @@ private:
  */
 class DeleteFriendCommand : public Command {
 public:
-	DeleteFriendCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	DeleteFriendCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					    const string &id)
 		: Command(model, view, is, name), id_(id) {
 		pair<string, string> hostnameAndPort = model_->getFriendHostnameAndPort(id_);
@@ -330,7 +486,7 @@ private:
  */
 class AddGroupCommand : public Command {
 public:
-	AddGroupCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	AddGroupCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					const string &id)
 		: Command(model, view, is, name), id_(id) { }
 
@@ -354,7 +510,7 @@ private:
  */
 class DeleteGroupCommand : public Command {
 public:
-	DeleteGroupCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	DeleteGroupCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					   const string &id)
 		: Command(model, view, is, name), id_(id) { }
 
@@ -383,7 +539,7 @@ private:
  */
 class AddGroupMemberCommand : public Command {
 public:
-	AddGroupMemberCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	AddGroupMemberCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					      const string &groupID, const string &memberID)
 		: Command(model, view, is, name), groupID_(groupID), memberID_(memberID) { }
 
@@ -408,7 +564,7 @@ private:
  */
 class DeleteGroupMemberCommand : public Command {
 public:
-	DeleteGroupMemberCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	DeleteGroupMemberCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					         const string &groupID, const string &memberID)
 		: Command(model, view, is, name), groupID_(groupID), memberID_(memberID) { }
 
@@ -434,12 +590,12 @@ private:
  */
 class ExtractFriendFriendsCommand : public Command {
 public:
-	ExtractFriendFriendsCommand(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is, const string &name,
+	ExtractFriendFriendsCommand(const boost::shared_ptr<BasicChatClient> &model, const boost::shared_ptr<View> &view, istream &is, const string &name,
 					            const string &id)
 		: Command(model, view, is, name), id_(id) { }
 	virtual void showBeforeExecution() const { }
 	virtual void execute() {
-		model_->sendToFriend(id_, ChatProtocol::wrapFriendListExtractionMessage(id_));
+		model_->requestFriendList(id_);
 	}
 	virtual void showAfterExecution() const { }
 private:
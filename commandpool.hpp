@@ -0,0 +1,132 @@
+/*
+ * commandpool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * CommandPool is the memory a controller's commands live in: blocks of blockSize bytes, carved
+ * out of slabs of blocksPerSlab and kept on a free list once released, so the steady stream of
+ * commands reuses the blocks of those that have left the history instead of going to the heap.
+ * The pool only grows to the most blocks ever in use at once, which a bounded history bounds.
+ *
+ * Every block starts with a header naming the pool it came from, so a block can be released
+ * knowing only its address; objects too large for a block come from the heap with the same
+ * header, naming no pool.  A pool is used by one thread, and must outlive what it holds.
+ */
+class CommandPool : private boost::noncopyable {
+public:
+	static const size_t blockSize = 256;
+	static const size_t blocksPerSlab = 64;
+
+	CommandPool() : free_(0), blockCount_(0), blocksInUse_(0) { }
+	~CommandPool() {
+		for (size_t i = 0; i < slabs_.size(); ++i) {
+			::operator delete(slabs_[i]);
+		}
+	}
+
+	void *allocate(size_t size) {
+		if (size > blockSize - headerSize) {
+			Header *header = static_cast<Header *>(::operator new(headerSize + size));
+			header->pool = 0;
+			return reinterpret_cast<char *>(header) + headerSize;
+		}
+		if (free_ == 0)
+			grow();
+		Header *header = free_;
+		free_ = header->next;
+		header->pool = this;
+		++blocksInUse_;
+		return reinterpret_cast<char *>(header) + headerSize;
+	}
+
+	// release what allocate returned, from whichever pool it came
+	static void release(void *object) {
+		if (object == 0)
+			return;
+		Header *header = reinterpret_cast<Header *>(static_cast<char *>(object) - headerSize);
+		CommandPool *pool = header->pool;
+		if (pool == 0) {
+			::operator delete(header);
+			return;
+		}
+		header->next = pool->free_;
+		pool->free_ = header;
+		--pool->blocksInUse_;
+	}
+
+	size_t getBlockCount() const { return blockCount_; }
+	size_t getBlocksInUse() const { return blocksInUse_; }
+
+	/**
+	 * Allocator puts what a container or a shared_ptr allocates (the reference count of a command,
+	 * say) into the pool as well
+	 */
+	template <class T>
+	class Allocator {
+	public:
+		typedef T value_type;
+		typedef T *pointer;
+		typedef const T *const_pointer;
+		typedef T &reference;
+		typedef const T &const_reference;
+		typedef size_t size_type;
+		typedef ptrdiff_t difference_type;
+		template <class U> struct rebind { typedef Allocator<U> other; };
+
+		explicit Allocator(CommandPool &pool) : pool_(&pool) { }
+		template <class U> Allocator(const Allocator<U> &other) : pool_(other.getPool()) { }
+
+		pointer allocate(size_type n, const void * = 0) { return static_cast<pointer>(pool_->allocate(n * sizeof(T))); }
+		void deallocate(pointer p, size_type) { CommandPool::release(p); }
+		void construct(pointer p, const T &value) { new (p) T(value); }
+		void destroy(pointer p) { p->~T(); }
+		pointer address(reference x) const { return &x; }
+		const_pointer address(const_reference x) const { return &x; }
+		size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+		CommandPool *getPool() const { return pool_; }
+		template <class U> bool operator==(const Allocator<U> &other) const { return pool_ == other.getPool(); }
+		template <class U> bool operator!=(const Allocator<U> &other) const { return pool_ != other.getPool(); }
+	private:
+		CommandPool *pool_;
+	};
+private:
+	// a block in use names its pool, a free one the next free block
+	union Header {
+		CommandPool *pool;
+		Header *next;
+		long double alignment; // what an object placed after the header needs
+	};
+	static const size_t headerSize = sizeof(Header);
+
+	void grow() {
+		char *slab = static_cast<char *>(::operator new(blockSize * blocksPerSlab));
+		slabs_.push_back(slab);
+		for (size_t i = blocksPerSlab; i > 0; --i) {
+			Header *header = reinterpret_cast<Header *>(slab + (i - 1) * blockSize);
+			header->next = free_;
+			free_ = header;
+		}
+		blockCount_ += blocksPerSlab;
+	}
+
+	vector<char *> slabs_;
+	Header *free_;
+	size_t blockCount_;
+	size_t blocksInUse_;
+};
+
+}
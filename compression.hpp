@@ -0,0 +1,260 @@
+/*
+ * compression.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * Compressor is a small LZ77 compressor in the manner of LZ4: the output is a run of sequences
+ *
+ *     token (1) | [literal length] | literals | offset (2) | [match length]
+ *
+ * where the token holds the literal length in its high nibble and the match length, less
+ * minMatch, in its low one, either nibble being 15 when more length bytes follow (255 each, then
+ * the rest).  The last sequence has literals only.  Matches may reach back up to 64 KiB, into a
+ * preset dictionary of what peers keep saying (protocol tags, hostnames, port prefixes, common
+ * chat words) as if it came right before the data, so even short messages find matches.
+ *
+ * Both sides must use the same dictionary, which is why it is part of the protocol version.
+ */
+class Compressor {
+public:
+	static const size_t minMatch = 4;
+	static const size_t maxOffset = 0xFFFF;
+	// no input byte stands for more output bytes than this, see readLength
+	static const size_t maxExpansion = 255;
+
+	/**
+	 * Compress size bytes of data into compressed; false, leaving compressed undefined, if the
+	 * result would not be smaller than the input.
+	 */
+	static bool compress(const char *data, size_t size, string &compressed) {
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		const string &dictionary = getDictionary();
+		// the dictionary and the data as one window, so matches need not care where they are
+		string window;
+		window.reserve(dictionary.size() + size);
+		window.append(dictionary);
+		window.append(data, size);
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(window.data());
+		size_t end = window.size();
+
+		vector<boost::uint32_t> table(getDictionaryTable());
+		compressed.clear();
+		compressed.reserve(size);
+		size_t anchor = dictionary.size();
+		size_t position = dictionary.size();
+		while (position + minMatch <= end) {
+			boost::uint32_t sequence = readUint32(bytes + position);
+			boost::uint32_t &slot = table[hash(sequence)];
+			size_t candidate = slot;
+			slot = (boost::uint32_t)position;
+			if (candidate >= position || position - candidate > maxOffset || readUint32(bytes + candidate) != sequence) {
+				++position;
+				continue;
+			}
+			size_t length = minMatch;
+			while (position + length < end && bytes[candidate + length] == bytes[position + length]) {
+				++length;
+			}
+			putSequence(compressed, bytes + anchor, position - anchor, position - candidate, length);
+			if (compressed.size() >= size)
+				return record(false, size, 0, start);
+			position += length;
+			anchor = position;
+			// what the match covered is worth remembering too
+			if (position - 2 + minMatch <= end)
+				table[hash(readUint32(bytes + position - 2))] = (boost::uint32_t)(position - 2);
+		}
+		putLiterals(compressed, bytes + anchor, end - anchor);
+		return record(compressed.size() < size, size, compressed.size(), start);
+	}
+
+	/**
+	 * Decompress size bytes of data, which must give exactly originalSize bytes, into original;
+	 * false if the data is malformed, or claims an originalSize it cannot possibly give.
+	 */
+	static bool decompress(const char *data, size_t size, size_t originalSize, string &original) {
+		if (originalSize > maxExpansion * size)
+			return false;
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		const string &dictionary = getDictionary();
+		string window;
+		window.reserve(dictionary.size() + originalSize);
+		window.append(dictionary);
+		size_t limit = dictionary.size() + originalSize;
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		const unsigned char *end = p + size;
+		bool ok = false;
+		while (p < end) {
+			unsigned token = *p++;
+			size_t literals = token >> 4;
+			if (literals == 15 && !readLength(p, end, literals))
+				break;
+			if ((size_t)(end - p) < literals || limit - window.size() < literals)
+				break;
+			window.append(reinterpret_cast<const char *>(p), literals);
+			p += literals;
+			if (p == end) {
+				ok = true; // the last sequence
+				break;
+			}
+			if (end - p < 2)
+				break;
+			size_t offset = ((size_t)p[0] << 8) | p[1];
+			p += 2;
+			size_t length = token & 15;
+			if (length == 15 && !readLength(p, end, length))
+				break;
+			length += minMatch;
+			if (offset == 0 || offset > window.size() || limit - window.size() < length)
+				break;
+			// byte by byte, for a match may overlap what it produces
+			size_t from = window.size() - offset;
+			for (size_t i = 0; i < length; ++i) {
+				window.push_back(window[from + i]);
+			}
+		}
+		ok = ok && window.size() == limit;
+		if (ok)
+			original.assign(window, dictionary.size(), originalSize);
+		boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+		Statistics &statistics = getStatistics();
+		statistics.decompressed += ok ? 1 : 0;
+		statistics.decompressionTime += elapsed.total_microseconds();
+		return ok;
+	}
+
+	/**
+	 * What compression has done in this process so far: messages compressed, and given up on
+	 * for not getting any smaller; bytes in and out; microseconds spent both ways
+	 */
+	struct Statistics {
+		Statistics() : compressed(0), incompressible(0), inputBytes(0), outputBytes(0), compressionTime(0),
+		               decompressed(0), decompressionTime(0) { }
+		boost::atomic<size_t> compressed;
+		boost::atomic<size_t> incompressible;
+		boost::atomic<size_t> inputBytes;  // of the messages compressed
+		boost::atomic<size_t> outputBytes;
+		boost::atomic<size_t> compressionTime;
+		boost::atomic<size_t> decompressed;
+		boost::atomic<size_t> decompressionTime;
+	};
+
+	static Statistics &getStatistics() {
+		static Statistics statistics;
+		return statistics;
+	}
+
+	static const string &getDictionary() {
+		static const string dictionary(
+			"  about again all also am and are around back be because been before but by can come could day did do doing "
+			"don't done for from get go going good got had has have he hello her here hey hi him his home how I I'm if in "
+			"is it it's just know last let like look make me meet more morning much my need new night no not now of ok "
+			"okay on one or our out people please right said say see she should so some soon sorry still sure talk tell "
+			"than thank thanks that that's the their them then there they think this time to today tomorrow too up us "
+			"very want was we week well were what when where which who why will with work would yeah yes yet you your "
+			"The Thanks Hello Hi OK Yes No What How I'll you're we're can't didn't isn't won't wasn't "
+			"!!! ... ?? :) :( :D lol haha http:// https:// www. .com .org .net .edu "
+			"0.0.0.0 127.0.0.1 192.168.0. 192.168.1. 10.0.0. 172.16. localhost localdomain "
+			"_HELLO_ _PLAIN_ _FRIEND_EXTRACTION_ _FRIEND_EX_RESPONSE_ "
+			" 8000 8080 9000 9001 9002 9100 9101 9102 9200 ");
+		return dictionary;
+	}
+private:
+	static const size_t hashBits = 12;
+
+	static size_t hash(boost::uint32_t sequence) {
+		return (sequence * 2654435761u) >> (32 - hashBits);
+	}
+
+	// the hash table primed with every position of the dictionary, built once
+	static const vector<boost::uint32_t> &getDictionaryTable() {
+		static const vector<boost::uint32_t> table(buildDictionaryTable());
+		return table;
+	}
+
+	static vector<boost::uint32_t> buildDictionaryTable() {
+		const string &dictionary = getDictionary();
+		// no position is past the dictionary's end, so an unset slot never passes for a match
+		vector<boost::uint32_t> table((size_t)1 << hashBits, 0xFFFFFFFFu);
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(dictionary.data());
+		for (size_t position = 0; position + minMatch <= dictionary.size(); ++position) {
+			table[hash(readUint32(bytes + position))] = (boost::uint32_t)position;
+		}
+		return table;
+	}
+
+	static bool record(bool compressed, size_t inputSize, size_t outputSize, const boost::posix_time::ptime &start) {
+		Statistics &statistics = getStatistics();
+		if (compressed) {
+			++statistics.compressed;
+			statistics.inputBytes += inputSize;
+			statistics.outputBytes += outputSize;
+		} else {
+			++statistics.incompressible;
+		}
+		statistics.compressionTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+		return compressed;
+	}
+
+	static void putSequence(string &out, const unsigned char *literals, size_t literalLength, size_t offset, size_t matchLength) {
+		size_t extra = matchLength - minMatch;
+		out.push_back((char)(((literalLength < 15 ? literalLength : 15) << 4) | (extra < 15 ? extra : 15)));
+		if (literalLength >= 15)
+			putLength(out, literalLength - 15);
+		out.append(reinterpret_cast<const char *>(literals), literalLength);
+		out.push_back((char)(offset >> 8));
+		out.push_back((char)offset);
+		if (extra >= 15)
+			putLength(out, extra - 15);
+	}
+
+	static void putLiterals(string &out, const unsigned char *literals, size_t literalLength) {
+		out.push_back((char)((literalLength < 15 ? literalLength : 15) << 4));
+		if (literalLength >= 15)
+			putLength(out, literalLength - 15);
+		out.append(reinterpret_cast<const char *>(literals), literalLength);
+	}
+
+	static void putLength(string &out, size_t length) {
+		while (length >= 255) {
+			out.push_back((char)255);
+			length -= 255;
+		}
+		out.push_back((char)length);
+	}
+
+	// adds the extra length bytes to length; false if they run past end
+	static bool readLength(const unsigned char *&p, const unsigned char *end, size_t &length) {
+		for (;;) {
+			if (p == end)
+				return false;
+			unsigned byte = *p++;
+			length += byte;
+			if (byte != 255)
+				return true;
+		}
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		boost::uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+};
+
+}
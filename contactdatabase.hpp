@@ -0,0 +1,378 @@
+/*
+ * contactdatabase.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * ContactDatabase is a client's configuration in plain form: its own ID and port, its friends
+ * and its groups.  It is read from the text configuration file in a single pass over the raw
+ * bytes, or from a binary snapshot that also remembers the friends' resolved endpoints, so a
+ * later start needs neither a tokenizer nor a name lookup.
+ *
+ * A snapshot records the size and modification time of the configuration file it was taken
+ * with, and is only used while the configuration still matches them.  It also records the
+ * generation of the journal that continues it, see ContactStore.
+ */
+class ContactDatabase {
+public:
+	struct Contact {
+		Contact() : resolved(false) { }
+		string id;
+		string hostname;
+		string port;
+		bool resolved; // endpoint holds the address hostname and port resolved to
+		udp::endpoint endpoint;
+	};
+
+	struct Group {
+		string id;
+		vector<string> memberIDs;
+	};
+
+	// changes to the contacts, as recorded in the journal
+	enum MutationType {
+		MUTATION_ADD_FRIEND = 1,       // id, hostname, port
+		MUTATION_DELETE_FRIEND = 2,    // id
+		MUTATION_ADD_GROUP = 3,        // id
+		MUTATION_DELETE_GROUP = 4,     // id
+		MUTATION_ADD_GROUP_MEMBER = 5, // group id, member id
+		MUTATION_DELETE_GROUP_MEMBER = 6
+	};
+
+	static const boost::uint32_t snapshotVersion = 2;
+
+	ContactDatabase() : port(0), journalGeneration(0) { }
+
+	/**
+	 * Parse the text configuration: "id port", the number of friends followed by "id hostname
+	 * port" for each, then the number of groups followed by "id count member..." for each.
+	 * Whatever is well formed up to the first error is kept; false if there was an error.  The
+	 * counts are not trusted for reserving, a short file may claim any number of entries.
+	 */
+	bool parseConfiguration(const char *data, size_t size) {
+		Tokenizer tokens(data, size);
+		boost::string_ref token;
+		if (!tokens.next(token))
+			return false;
+		id.assign(token.data(), token.size());
+		size_t value;
+		if (!tokens.nextNumber(value))
+			return false;
+		port = (int)value;
+
+		size_t friendCount;
+		if (!tokens.nextNumber(friendCount))
+			return false;
+		for (size_t i = 0; i < friendCount; ++i) {
+			boost::string_ref contactID, hostname, contactPort;
+			if (!tokens.next(contactID) || !tokens.next(hostname) || !tokens.next(contactPort))
+				return false;
+			contacts.push_back(Contact());
+			contacts.back().id.assign(contactID.data(), contactID.size());
+			contacts.back().hostname.assign(hostname.data(), hostname.size());
+			contacts.back().port.assign(contactPort.data(), contactPort.size());
+		}
+
+		size_t groupCount;
+		if (!tokens.nextNumber(groupCount))
+			return false;
+		for (size_t i = 0; i < groupCount; ++i) {
+			boost::string_ref groupID;
+			size_t memberCount;
+			if (!tokens.next(groupID) || !tokens.nextNumber(memberCount))
+				return false;
+			groups.push_back(Group());
+			groups.back().id.assign(groupID.data(), groupID.size());
+			for (size_t j = 0; j < memberCount; ++j) {
+				boost::string_ref memberID;
+				if (!tokens.next(memberID))
+					return false;
+				groups.back().memberIDs.push_back(string(memberID.data(), memberID.size()));
+			}
+		}
+		return true;
+	}
+
+	// the text configuration, as parseConfiguration reads it
+	string formatConfiguration() const {
+		ostringstream os;
+		os << id << " " << port << endl << endl;
+		os << contacts.size() << endl;
+		for (vector<Contact>::const_iterator iter = contacts.begin(); iter != contacts.end(); ++iter) {
+			os << iter->id << " " << iter->hostname << " " << iter->port << endl;
+		}
+		os << endl;
+		os << groups.size() << endl;
+		for (vector<Group>::const_iterator iter = groups.begin(); iter != groups.end(); ++iter) {
+			os << iter->id << " " << iter->memberIDs.size() << " ";
+			for (size_t i = 0; i < iter->memberIDs.size(); ++i) {
+				os << iter->memberIDs[i] << " ";
+			}
+			os << endl;
+		}
+		return os.str();
+	}
+
+	// a journal record for one change; fields not used by the type are left empty
+	static string encodeMutation(MutationType type, const string &first, const string &second = string(), const string &third = string()) {
+		string record(1, (char)type);
+		appendString(record, first);
+		appendString(record, second);
+		appendString(record, third);
+		return record;
+	}
+
+	static bool decodeMutation(const string &record, MutationType &type, string &first, string &second, string &third) {
+		Reader reader(record.data(), record.size());
+		unsigned char value;
+		if (!reader.readByte(value) || value < MUTATION_ADD_FRIEND || value > MUTATION_DELETE_GROUP_MEMBER)
+			return false;
+		type = (MutationType)value;
+		return reader.readString(first) && reader.readString(second) && reader.readString(third) && reader.remaining() == 0;
+	}
+
+	/**
+	 * Encode a snapshot, tied to the configuration file's size and modification time; writtenTime
+	 * (milliseconds since the epoch) tells a later start how old the resolved endpoints are.
+	 */
+	string encodeSnapshot(boost::uint64_t configSize, boost::int64_t configModificationTime, boost::int64_t writtenTime) const {
+		string buffer(getSnapshotMagic(), snapshotMagicSize);
+		appendUint32(buffer, snapshotVersion);
+		appendUint64(buffer, configSize);
+		appendUint64(buffer, (boost::uint64_t)configModificationTime);
+		appendUint64(buffer, (boost::uint64_t)writtenTime);
+		appendUint64(buffer, journalGeneration);
+		appendString(buffer, id);
+		appendUint32(buffer, (boost::uint32_t)port);
+		appendUint32(buffer, (boost::uint32_t)contacts.size());
+		for (vector<Contact>::const_iterator iter = contacts.begin(); iter != contacts.end(); ++iter) {
+			appendString(buffer, iter->id);
+			appendString(buffer, iter->hostname);
+			appendString(buffer, iter->port);
+			// only IPv4 endpoints are kept, which is all the resolver produces
+			bool resolved = iter->resolved && iter->endpoint.address().is_v4();
+			buffer.push_back(resolved ? 1 : 0);
+			appendUint32(buffer, resolved ? (boost::uint32_t)iter->endpoint.address().to_v4().to_ulong() : 0);
+			appendUint16(buffer, resolved ? iter->endpoint.port() : 0);
+		}
+		appendUint32(buffer, (boost::uint32_t)groups.size());
+		for (vector<Group>::const_iterator iter = groups.begin(); iter != groups.end(); ++iter) {
+			appendString(buffer, iter->id);
+			appendUint32(buffer, (boost::uint32_t)iter->memberIDs.size());
+			for (size_t i = 0; i < iter->memberIDs.size(); ++i) {
+				appendString(buffer, iter->memberIDs[i]);
+			}
+		}
+		return buffer;
+	}
+
+	/**
+	 * Decode a snapshot in place; false if it is damaged, of another version, or was not taken
+	 * with a configuration file of this size and modification time.
+	 */
+	bool decodeSnapshot(const char *data, size_t size, boost::uint64_t configSize, boost::int64_t configModificationTime,
+	                    boost::int64_t &writtenTime) {
+		Reader reader(data, size);
+		if (size < snapshotMagicSize || memcmp(data, getSnapshotMagic(), snapshotMagicSize) != 0)
+			return false;
+		reader.skip(snapshotMagicSize);
+		boost::uint32_t version, ownPort, contactCount, groupCount;
+		boost::uint64_t size64, modificationTime, written, generation;
+		if (!reader.readUint32(version) || version != snapshotVersion)
+			return false;
+		if (!reader.readUint64(size64) || !reader.readUint64(modificationTime) || !reader.readUint64(written) ||
+		    !reader.readUint64(generation))
+			return false;
+		if (size64 != configSize || (boost::int64_t)modificationTime != configModificationTime)
+			return false;
+		writtenTime = (boost::int64_t)written;
+
+		ContactDatabase decoded;
+		decoded.journalGeneration = generation;
+		if (!reader.readString(decoded.id) || !reader.readUint32(ownPort) || !reader.readUint32(contactCount))
+			return false;
+		decoded.port = (int)ownPort;
+		// every contact takes at least 19 bytes, so a damaged count cannot make us reserve much
+		if (contactCount > reader.remaining() / 19)
+			return false;
+		decoded.contacts.resize(contactCount);
+		for (vector<Contact>::iterator iter = decoded.contacts.begin(); iter != decoded.contacts.end(); ++iter) {
+			unsigned char resolved;
+			boost::uint32_t address;
+			boost::uint16_t endpointPort;
+			if (!reader.readString(iter->id) || !reader.readString(iter->hostname) || !reader.readString(iter->port) ||
+			    !reader.readByte(resolved) || !reader.readUint32(address) || !reader.readUint16(endpointPort))
+				return false;
+			iter->resolved = resolved != 0;
+			if (iter->resolved)
+				iter->endpoint = udp::endpoint(address_v4(address), endpointPort);
+		}
+		if (!reader.readUint32(groupCount) || groupCount > reader.remaining() / 8)
+			return false;
+		decoded.groups.resize(groupCount);
+		for (vector<Group>::iterator iter = decoded.groups.begin(); iter != decoded.groups.end(); ++iter) {
+			boost::uint32_t memberCount;
+			if (!reader.readString(iter->id) || !reader.readUint32(memberCount) || memberCount > reader.remaining() / 4)
+				return false;
+			iter->memberIDs.resize(memberCount);
+			for (size_t i = 0; i < memberCount; ++i) {
+				if (!reader.readString(iter->memberIDs[i]))
+					return false;
+			}
+		}
+		if (reader.remaining() != 0)
+			return false;
+		swap(decoded);
+		return true;
+	}
+
+	void swap(ContactDatabase &other) {
+		id.swap(other.id);
+		std::swap(port, other.port);
+		std::swap(journalGeneration, other.journalGeneration);
+		contacts.swap(other.contacts);
+		groups.swap(other.groups);
+	}
+
+	string id;
+	int port;
+	boost::uint64_t journalGeneration; // the journal that continues this snapshot
+	vector<Contact> contacts;
+	vector<Group> groups;
+private:
+	static const size_t snapshotMagicSize = 4;
+	static const char *getSnapshotMagic() { return "OCDB"; } // OpenChat contact database
+
+	// whitespace separated tokens of a buffer, without copying them
+	class Tokenizer {
+	public:
+		Tokenizer(const char *data, size_t size) : position_(data), end_(data + size) { }
+
+		bool next(boost::string_ref &token) {
+			while (position_ != end_ && isSpace(*position_)) {
+				++position_;
+			}
+			if (position_ == end_)
+				return false;
+			const char *begin = position_;
+			while (position_ != end_ && !isSpace(*position_)) {
+				++position_;
+			}
+			token = boost::string_ref(begin, position_ - begin);
+			return true;
+		}
+
+		bool nextNumber(size_t &value) {
+			boost::string_ref token;
+			if (!next(token))
+				return false;
+			value = 0;
+			for (size_t i = 0; i < token.size(); ++i) {
+				if (token[i] < '0' || token[i] > '9')
+					return false;
+				value = value * 10 + (token[i] - '0');
+			}
+			return true;
+		}
+	private:
+		static bool isSpace(char c) {
+			return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+		}
+
+		const char *position_;
+		const char *end_;
+	};
+
+	// bounds checked reading of the snapshot's big-endian fields
+	class Reader {
+	public:
+		Reader(const char *data, size_t size) : position_((const unsigned char *)data), end_((const unsigned char *)data + size) { }
+
+		size_t remaining() const { return end_ - position_; }
+		void skip(size_t count) { position_ += count; }
+
+		bool readByte(unsigned char &value) {
+			if (remaining() < 1)
+				return false;
+			value = *position_++;
+			return true;
+		}
+
+		bool readUint16(boost::uint16_t &value) {
+			if (remaining() < 2)
+				return false;
+			value = (boost::uint16_t)((position_[0] << 8) | position_[1]);
+			position_ += 2;
+			return true;
+		}
+
+		bool readUint32(boost::uint32_t &value) {
+			if (remaining() < 4)
+				return false;
+			value = ((boost::uint32_t)position_[0] << 24) | ((boost::uint32_t)position_[1] << 16) |
+			        ((boost::uint32_t)position_[2] << 8) | position_[3];
+			position_ += 4;
+			return true;
+		}
+
+		bool readUint64(boost::uint64_t &value) {
+			boost::uint32_t high, low;
+			if (!readUint32(high) || !readUint32(low))
+				return false;
+			value = ((boost::uint64_t)high << 32) | low;
+			return true;
+		}
+
+		bool readString(string &value) {
+			boost::uint32_t length;
+			if (!readUint32(length) || remaining() < length)
+				return false;
+			value.assign((const char *)position_, length);
+			position_ += length;
+			return true;
+		}
+	private:
+		const unsigned char *position_;
+		const unsigned char *end_;
+	};
+
+	static void appendUint16(string &buffer, boost::uint16_t value) {
+		buffer.push_back((char)(value >> 8));
+		buffer.push_back((char)value);
+	}
+
+	static void appendUint32(string &buffer, boost::uint32_t value) {
+		buffer.push_back((char)(value >> 24));
+		buffer.push_back((char)(value >> 16));
+		buffer.push_back((char)(value >> 8));
+		buffer.push_back((char)value);
+	}
+
+	static void appendUint64(string &buffer, boost::uint64_t value) {
+		appendUint32(buffer, (boost::uint32_t)(value >> 32));
+		appendUint32(buffer, (boost::uint32_t)value);
+	}
+
+	static void appendString(string &buffer, const string &value) {
+		appendUint32(buffer, (boost::uint32_t)value.size());
+		buffer.append(value);
+	}
+};
+
+}
@@ -0,0 +1,225 @@
+/*
+ * contactstore.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "basicchatclient.hpp"
+#include "contactdatabase.hpp"
+#include "journal.hpp"
+#include "mappedfile.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * ContactStore keeps a client's contacts on disk, next to its configuration file:
+ *
+ *   <config>           the text configuration, as of the last compaction
+ *   <config>.snapshot  the same in binary, with resolved addresses, see ContactDatabase
+ *   <config>.journal   every change since, see Journal
+ *
+ * Every change is journaled as it is made, so a crash loses nothing and closing costs nothing.
+ * Once the journal has grown past compactionThreshold bytes a background thread folds it into a
+ * new configuration and snapshot, which keeps recovery time bounded.
+ *
+ * The journal is rotated before the contacts are exported, so a change is always in the snapshot,
+ * in the new journal or in both.  Replaying a change the snapshot already holds is harmless, for
+ * each change sets a friend, group or membership to a state rather than altering it.  That is
+ * also why, when the configuration has been edited by hand and the snapshot no longer matches, the
+ * journal is replayed on top of the edited configuration.
+ */
+class ContactStore : private boost::noncopyable {
+public:
+	ContactStore(const string &configFileName, size_t compactionThreshold = 1 << 20)
+		: configFileName_(configFileName), compactionThreshold_(compactionThreshold),
+		  journal_(configFileName + ".journal"), minGeneration_(0), snapshotLoaded_(false), client_(0), stopping_(false),
+		  compactionRequested_(false), oldPending_(false), replayed_(0), compactions_(0) { }
+
+	~ContactStore() {
+		close();
+	}
+
+	/**
+	 * Read the contacts from the snapshot, or from the text configuration if there is no snapshot
+	 * matching it.  addressAge is set to the age in milliseconds of the resolved addresses, -1 if
+	 * there are none.
+	 */
+	void load(ContactDatabase &contacts, long &addressAge) {
+		MappedFile config(configFileName_);
+		MappedFile snapshot(getSnapshotFileName());
+		boost::int64_t writtenTime;
+		if (snapshot.exists() && contacts.decodeSnapshot(snapshot.data(), snapshot.size(), config.size(),
+		                                                  config.getModificationTime(), writtenTime)) {
+			addressAge = (long)(getCurrentTime() - writtenTime);
+			minGeneration_ = contacts.journalGeneration;
+			snapshotLoaded_ = true;
+		} else {
+			contacts.parseConfiguration(config.data(), config.size());
+			addressAge = -1;
+			minGeneration_ = 0; // the whole journal, on top of the configuration
+			snapshotLoaded_ = false;
+		}
+	}
+
+	/**
+	 * Replay the journal into client, which must hold what load() read, then journal the client's
+	 * changes and start compacting in the background.
+	 */
+	void open(BasicChatClient &client) {
+		boost::uint64_t generation = minGeneration_;
+		replayed_ = Journal::replay(journal_.getFileName(), minGeneration_, boost::bind(&BasicChatClient::applyMutation, &client, _1), generation);
+		journal_.open(generation);
+		client_ = &client;
+		client.setJournal(&journal_);
+		// fold what was replayed in right away, and snapshot a configuration that has none
+		compactionRequested_ = replayed_ > 0 || !snapshotLoaded_;
+		stopping_ = false;
+		compactor_ = boost::thread(boost::bind(&ContactStore::compactInBackground, this));
+	}
+
+	// stop journaling; everything journaled is on disk already, so this takes no time
+	void close() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			condition_.notify_all();
+		}
+		if (compactor_.joinable())
+			compactor_.join();
+		if (client_) {
+			client_->setJournal(0);
+			client_ = 0;
+		}
+		journal_.close();
+	}
+
+	// fold the journal into a new configuration and snapshot now; false if they could not be written
+	bool compact() {
+		boost::mutex::scoped_lock lock(compactionMutex_);
+		if (!client_)
+			return false;
+		// rotate first: whatever the export below misses is in the new journal.  After a failed
+		// export the ".old" journal still holds what the files lack and must not be rotated over;
+		// the current journal is replayed on top of the snapshot instead, which is harmless.
+		boost::uint64_t generation;
+		if (oldPending_) {
+			generation = journal_.getGeneration();
+		} else if (journal_.rotate(generation)) {
+			oldPending_ = true;
+		} else {
+			return false;
+		}
+		ContactDatabase contacts;
+		client_->exportContacts(contacts);
+		contacts.journalGeneration = generation;
+
+		boost::uint64_t configSize;
+		boost::int64_t configModificationTime;
+		if (!writeFile(configFileName_, contacts.formatConfiguration()) ||
+		    !MappedFile::getStatus(configFileName_, configSize, configModificationTime) ||
+		    !writeFile(getSnapshotFileName(), contacts.encodeSnapshot(configSize, configModificationTime, getCurrentTime()))) {
+			return false;
+		}
+		journal_.removeOld();
+		oldPending_ = false;
+		++compactions_;
+		return true;
+	}
+
+	// statistics
+	size_t getReplayedCount() const { return replayed_; }
+	size_t getCompactionCount() const { return compactions_.load(); }
+	size_t getJournalSize() const { return journal_.getSize(); }
+	size_t getJournalSyncCount() const { return journal_.getSyncCount(); }
+private:
+	// after a failure compaction is retried, after a second at first and at most a minute apart
+	void compactInBackground() {
+		boost::mutex::scoped_lock lock(mutex_);
+		boost::posix_time::ptime retryTime = boost::posix_time::microsec_clock::universal_time();
+		long backoff = 0;
+		while (!stopping_) {
+			boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+			if (now >= retryTime && (compactionRequested_ || journal_.getSize() > compactionThreshold_)) {
+				compactionRequested_ = false;
+				lock.unlock();
+				bool compacted = compact();
+				lock.lock();
+				if (!compacted) {
+					compactionRequested_ = true;
+					backoff = backoff == 0 ? 1000 : min(backoff * 2, 60000L);
+					retryTime = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(backoff);
+				} else {
+					backoff = 0;
+				}
+				continue;
+			}
+			condition_.timed_wait(lock, boost::posix_time::milliseconds(500));
+		}
+	}
+
+	string getSnapshotFileName() const {
+		return configFileName_ + ".snapshot";
+	}
+
+	// milliseconds since the epoch
+	static boost::int64_t getCurrentTime() {
+		return (boost::int64_t)time(0) * 1000;
+	}
+
+	// replace a file as a whole: written aside, synced, then renamed over it
+	static bool writeFile(const string &fileName, const string &contents) {
+		string temporaryFileName = fileName + ".tmp";
+		FILE *file = fopen(temporaryFileName.c_str(), "wb");
+		if (!file)
+			return false;
+		bool ok = fwrite(contents.data(), 1, contents.size(), file) == contents.size() && fflush(file) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+		ok = ok && fsync(fileno(file)) == 0;
+#endif
+		ok = fclose(file) == 0 && ok;
+		if (!ok || rename(temporaryFileName.c_str(), fileName.c_str()) != 0) {
+			remove(temporaryFileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	const string configFileName_;
+	const size_t compactionThreshold_;
+	Journal journal_;
+	boost::uint64_t minGeneration_; // journals older than this are in the snapshot
+	bool snapshotLoaded_;
+	BasicChatClient *client_;
+
+	boost::mutex mutex_;
+	boost::condition_variable condition_;
+	bool stopping_;
+	bool compactionRequested_;
+	boost::thread compactor_;
+
+	boost::mutex compactionMutex_;
+	bool oldPending_; // the ".old" journal holds changes the configuration and snapshot lack
+
+	size_t replayed_;
+	boost::atomic<size_t> compactions_;
+};
+
+}
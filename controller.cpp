@@ -8,67 +8,265 @@
 
 #include "controller.hpp"
 #include "chatprotocol.hpp"
+#include "binaryprotocol.hpp"
+#include "wiremessage.hpp"
 
 #include <sstream>
+#include <typeinfo>
 #include <utility>
+#include <cstring>
+#include <cstdlib>
 
 namespace openchat {
 
-void Controller::processIncomingMessage(const string &rawMessage, boost::shared_ptr<udp::endpoint> remoteEndpoint) {
+void Controller::processIncomingMessage(const Datagram &datagram) {
+	// both formats are parsed in place, in the receive buffer
+	if (BinaryProtocol::isBinaryMessage(datagram.getData(), datagram.getSize())) {
+		processIncomingBinaryMessage(datagram.getData(), datagram.getSize(), datagram.getRemoteEndpoint());
+	} else {
+		processIncomingTextMessage(boost::string_ref(datagram.getData(), datagram.getSize()), datagram.getRemoteEndpoint());
+	}
+}
+
+void Controller::processIncomingMessage(const string &rawMessage, const udp::endpoint &remoteEndpoint) {
+	if (BinaryProtocol::isBinaryMessage(rawMessage.data(), rawMessage.size())) {
+		processIncomingBinaryMessage(rawMessage.data(), rawMessage.size(), remoteEndpoint);
+	} else {
+		processIncomingTextMessage(rawMessage, remoteEndpoint);
+	}
+}
+
+void Controller::processIncomingTextMessage(boost::string_ref rawMessage, const udp::endpoint &remoteEndpoint) {
 	// parse incoming message
-	if (ChatProtocol::isPlainChatMessage(rawMessage)) {
-		pair<string, string> idMessage = ChatProtocol::parsePlainChatMessage(rawMessage);
-		view_->presentLine("[From " + idMessage.first + "]: " + idMessage.second);
-		// if the message is from nowhere, add it to the stranger list
-		if (!model_->hasFriend(idMessage.first) && !model_->hasStranger(idMessage.first)) {
-			string hostname, port;
-			hostname = remoteEndpoint->address().to_string();
-			ostringstream oss;
-			oss << remoteEndpoint->port();
-			port = oss.str();
-			model_->addStranger(idMessage.first, hostname, port);
-			view_->presentLine("ID: " + idMessage.first + " has been added to stranger list.");
+	switch (ChatProtocol::classify(rawMessage)) {
+	case ChatProtocol::MESSAGE_PLAIN: {
+		boost::string_ref id, message;
+		if (ChatProtocol::parsePlainChatMessage(rawMessage, id, message)) {
+			processPlainChatMessage(id, message, remoteEndpoint);
+		}
+		break;
+	}
+	case ChatProtocol::MESSAGE_FRIEND_EXTRACTION:
+		processFriendListExtractionMessage(remoteEndpoint, 0);
+		break;
+	case ChatProtocol::MESSAGE_FRIEND_EX_RESPONSE: {
+		boost::string_ref fromID, id, hostname, port;
+		ChatProtocol::FriendInfoReader reader(rawMessage, fromID);
+		vector<pair<string, pair<string, string> > > info;
+		while (reader.next(id, hostname, port)) {
+			info.push_back(make_pair(id.to_string(), make_pair(hostname.to_string(), port.to_string())));
+		}
+		processFriendListExtractionResponseMessage(fromID, info);
+		break;
+	}
+	case ChatProtocol::MESSAGE_FRIEND_SYNC: {
+		unsigned epoch, version;
+		boost::string_ref after;
+		if (ChatProtocol::parseFriendSyncMessage(rawMessage, epoch, version, after)) {
+			processFriendSyncMessage(epoch, version, after, remoteEndpoint, 0);
+		}
+		break;
+	}
+	case ChatProtocol::MESSAGE_FRIEND_DELTA: {
+		boost::string_ref fromID;
+		unsigned epoch, base, version;
+		vector<FriendEntry> changes;
+		if (ChatProtocol::parseFriendDeltaMessage(rawMessage, fromID, epoch, base, version, changes)) {
+			processFriendDeltaMessage(fromID, epoch, base, version, changes, remoteEndpoint);
+		}
+		break;
+	}
+	case ChatProtocol::MESSAGE_FRIEND_PAGE: {
+		boost::string_ref fromID;
+		unsigned epoch, version;
+		bool first, more;
+		vector<FriendEntry> entries;
+		if (ChatProtocol::parseFriendPageMessage(rawMessage, fromID, epoch, version, first, more, entries)) {
+			processFriendPageMessage(fromID, epoch, version, first, more, entries, remoteEndpoint);
+		}
+		break;
+	}
+	case ChatProtocol::MESSAGE_HELLO: {
+		ChatProtocol::Hello hello = ChatProtocol::parseHelloMessage(rawMessage);
+		// only agree on the binary format with peers speaking our version of it
+		unsigned features = hello.version == BinaryProtocol::version ? hello.features : 0;
+		features &= model_->getFeatures();
+		// a hello from anywhere but a contact's own endpoint changes nothing and gets no answer
+		if (!model_->setPeerFeatures(hello.id, remoteEndpoint, features))
+			break;
+		if (features & FEATURE_RELIABLE)
+			model_->enableReliableDelivery(remoteEndpoint);
+		if (features & FEATURE_COALESCING)
+			model_->enableCoalescing(remoteEndpoint);
+		if (!hello.isReply) {
+			model_->greet(remoteEndpoint, true);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void Controller::processIncomingBinaryMessage(const char *data, size_t size, const udp::endpoint &remoteEndpoint) {
+	BinaryProtocol::Reader reader(model_->getMaxMessageSize());
+	if (!reader.open(data, size))
+		return;
+	boost::string_ref first, second, third;
+	// a list is worth compressing for a requester that takes it
+	unsigned format = FEATURE_BINARY;
+	if (reader.getFlags() & BinaryProtocol::FLAG_ACCEPTS_COMPRESSION)
+		format |= model_->getFeatures() & FEATURE_COMPRESSION;
+	boost::uint32_t epoch, base, version, flags;
+	vector<FriendEntry> entries;
+	switch (reader.getType()) {
+	case BinaryProtocol::TYPE_PLAIN:
+		if (reader.nextField(first) && reader.nextField(second)) {
+			processPlainChatMessage(first, second, remoteEndpoint);
 		}
-		view_->present(">>> "); // begin a new line
-	} else if (ChatProtocol::isFriendListExtractionMessage(rawMessage)) {
-		vector<pair<string, pair<string, string> > > info = model_->getFriendListInformation();
-		// send the information back
-		model_->sendTo(ChatProtocol::wrapFriendListExtractionResponseMessage(model_->getID(), info), remoteEndpoint);
-	} else if (ChatProtocol::isFriendListExtractionResponseMessage(rawMessage)) {
-		pair<string, vector<pair<string, pair<string, string> > > > idInfo = ChatProtocol::parseFriendListExtractionResponseMessage(rawMessage);
-		vector<pair<string, pair<string, string> > > &info = idInfo.second;
-		// present the information to view
-		view_->presentLine("Friend list of [ID=" + idInfo.first + "]:");
-		for (size_t i = 0; i != info.size(); ++i) {
-			string id, hostname, port;
-			id = info[i].first;
-			hostname = info[i].second.first;
-			port = info[i].second.second;
-			view_->presentLine("[ID=" + id + "], [hostname=" + hostname + "], [port=" + port + "]");
+		break;
+	case BinaryProtocol::TYPE_FRIEND_EXTRACTION:
+		processFriendListExtractionMessage(remoteEndpoint, format);
+		break;
+	case BinaryProtocol::TYPE_FRIEND_EX_RESPONSE: {
+		boost::uint32_t count;
+		if (!reader.nextField(first) || !reader.nextCount(count))
+			break;
+		vector<pair<string, pair<string, string> > > info;
+		for (boost::uint32_t i = 0; i < count && reader.nextField(second); ++i) {
+			boost::string_ref hostname, port;
+			if (!reader.nextField(hostname) || !reader.nextField(port))
+				break;
+			info.push_back(make_pair(second.to_string(), make_pair(hostname.to_string(), port.to_string())));
+		}
+		processFriendListExtractionResponseMessage(first, info);
+		break;
+	}
+	case BinaryProtocol::TYPE_FRIEND_SYNC:
+		if (reader.nextCount(epoch) && reader.nextCount(version) && reader.nextField(first)) {
+			processFriendSyncMessage(epoch, version, first, remoteEndpoint, format);
 		}
-		view_->present(">>> "); // begin a new line
+		break;
+	case BinaryProtocol::TYPE_FRIEND_DELTA:
+		if (reader.nextField(first) && reader.nextCount(epoch) && reader.nextCount(base) && reader.nextCount(version) &&
+		    reader.nextFriendEntries(entries)) {
+			processFriendDeltaMessage(first, epoch, base, version, entries, remoteEndpoint);
+		}
+		break;
+	case BinaryProtocol::TYPE_FRIEND_PAGE:
+		if (reader.nextField(first) && reader.nextCount(epoch) && reader.nextCount(version) && reader.nextCount(flags) &&
+		    reader.nextFriendEntries(entries)) {
+			processFriendPageMessage(first, epoch, version, (flags & 1) != 0, (flags & 2) != 0, entries, remoteEndpoint);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void Controller::processPlainChatMessage(boost::string_ref fromID, boost::string_ref message, const udp::endpoint &remoteEndpoint) {
+	string id = fromID.to_string();
+	view_->notify(MessageReceivedEvent(fromID, message));
+	model_->recordMessage(HistoryStore::peerConversation(id), HistoryStore::DIRECTION_RECEIVED, id, message.to_string());
+	// if the message is from nowhere, add it to the stranger list
+	// reply where the message came from, no need to resolve anything
+	if (!model_->hasFriend(id) && model_->addStranger(id, remoteEndpoint)) {
+		view_->notify(StrangerAddedEvent(id));
+	}
+	presentPrompt(); // begin a new line
+}
+
+void Controller::processResolutionFailure(const string &id, const string &hostname, const string &port, const string &error) {
+	view_->presentLine("Cannot resolve " + hostname + ":" + port + " for ID: " + id + " (" + error + "), messages to it are dropped.");
+	presentPrompt();
+}
+
+void Controller::processFriendListExtractionMessage(const udp::endpoint &remoteEndpoint, unsigned format) {
+	vector<pair<string, pair<string, string> > > info = model_->getFriendListInformation();
+	// send the information back, in the format the request came in
+	string id = model_->getID();
+	FriendListExtractionResponseWireMessage response(id, info);
+	model_->sendDatagram(response.getEncoding(format), remoteEndpoint);
+}
+
+void Controller::processFriendListExtractionResponseMessage(boost::string_ref fromID, const vector<pair<string, pair<string, string> > > &info) {
+	// present the information to view
+	view_->notify(FriendListReceivedEvent(fromID.to_string(), info));
+	presentPrompt(); // begin a new line
+}
+
+void Controller::processFriendSyncMessage(unsigned epoch, unsigned version, boost::string_ref after, const udp::endpoint &remoteEndpoint,
+                                          unsigned format) {
+	string id = model_->getID();
+	vector<FriendEntry> entries;
+	boost::uint32_t current;
+	// only the changes if the requester's copy is recent enough, otherwise the whole list, a page at a time
+	if (after.empty() && epoch == model_->getFriendLogEpoch() && model_->getFriendChangesSince(version, entries, current)) {
+		FriendDeltaWireMessage response(id, epoch, version, current, entries);
+		model_->sendDatagram(response.getEncoding(format), remoteEndpoint);
+		return;
 	}
+	bool more = model_->getFriendListPage(after.to_string(), entries, current);
+	FriendPageWireMessage response(id, model_->getFriendLogEpoch(), current, after.empty(), more, entries);
+	model_->sendDatagram(response.getEncoding(format), remoteEndpoint);
+}
+
+void Controller::processFriendDeltaMessage(boost::string_ref fromID, unsigned epoch, unsigned base, unsigned version,
+                                           const vector<FriendEntry> &changes, const udp::endpoint &remoteEndpoint) {
+	string id = fromID.to_string();
+	// the ID is only what the message says, it must come from where that friend is
+	if (!model_->isFriendAt(id, remoteEndpoint))
+		return;
+	size_t friendCount;
+	if (!model_->applyFriendChanges(id, epoch, base, version, changes, friendCount)) {
+		// the changes do not apply to our copy, start over with the whole list
+		model_->requestFriendListPage(id, string());
+		return;
+	}
+	view_->notify(FriendListChangedEvent(id, changes, friendCount));
+	presentPrompt(); // begin a new line
+}
+
+void Controller::processFriendPageMessage(boost::string_ref fromID, unsigned epoch, unsigned version, bool first, bool more,
+                                          const vector<FriendEntry> &entries, const udp::endpoint &remoteEndpoint) {
+	string id = fromID.to_string();
+	if (!model_->isFriendAt(id, remoteEndpoint))
+		return;
+	boost::uint32_t pageVersion;
+	string cursor;
+	if (!model_->applyFriendPage(id, epoch, version, first, more, entries, pageVersion, cursor)) {
+		// the list is presented once the last page is in
+		if (more && !cursor.empty())
+			model_->requestFriendListPage(id, cursor);
+		return;
+	}
+	boost::uint32_t replicaVersion;
+	processFriendListExtractionResponseMessage(fromID, model_->getFriendListReplica(id, replicaVersion));
+	// the list changed while it was being paged through, what changed is due yet
+	if (pageVersion != replicaVersion)
+		model_->requestFriendList(id);
 }
 
 bool Controller::processUserInput(const string &input) {
+	lastError_.clear();
+	CommandLine line(input);
+	const CommandEntry *entry = findCommand(line.getVerb());
 	/**
 	 * Some inputs (commands) are special, because they query the information of the program rather than
 	 * doing anything actually, so they are handled specially.
 	 */
-	if (input == "help") {
+	switch (entry != 0 && !line.hasArguments() ? entry->builtin : BUILTIN_NONE) {
+	case BUILTIN_HELP:
 		for (map<string, string>::const_iterator iter = commandDescriptions_.begin(); iter != commandDescriptions_.end(); ++iter) {
 			view_->presentLine(iter->first + ": " + iter->second);
 		}
 		return true;
-	}
-	if (input == "history") {
-		for (vector<boost::shared_ptr<Command> >::reverse_iterator riter = commandHistory_.rbegin();
-																   riter != commandHistory_.rend(); ++riter) {
+	case BUILTIN_HISTORY:
+		for (CommandHistory::reverse_iterator riter = commandHistory_.rbegin(); riter != commandHistory_.rend(); ++riter) {
 			view_->presentLine((*riter)->getName());
 		}
 		return true;
-	}
-	if (input == "undo") {
+	case BUILTIN_UNDO:
 		if (commandHistory_.empty()) {
 			view_->presentLine("No command to undo.");
 		} else {
@@ -76,240 +274,296 @@ bool Controller::processUserInput(const string &input) {
 			command->undo();
 		}
 		return true;
-	}
-	if (input == "exit") {
+	case BUILTIN_EXIT:
 		view_->presentLine("Bye bye");
 		return false;
+	default:
+		break;
 	}
 
 	// process commands
-	boost::shared_ptr<Command> command = createCommand(input);
+	boost::shared_ptr<Command> command = createCommand(input, entry, line);
 	command->showBeforeExecution();
 	command->execute();
 	command->showAfterExecution();
+	view_->notify(CommandResultEvent(input, lastError_));
 	// if the command is not NullCommand, add it to the history
-	if (typeid(command).name() != typeid(NullCommand).name()) {
+	if (typeid(*command) != typeid(NullCommand)) {
 		commandHistory_.push_back(command);
 	}
 	return true;
 }
 
+const Controller::CommandEntry Controller::commandTable_[] = {
+	{"help", 0, 0, 0, BUILTIN_HELP},
+	{"history", 0, 0, 0, BUILTIN_HISTORY},
+	{"undo", 0, 0, 0, BUILTIN_UNDO},
+	{"exit", 0, 0, 0, BUILTIN_EXIT},
+	{"friend", "friend", "show the list of friends' IDs.", &Controller::parseFriendCommand, BUILTIN_NONE},
+	{"stranger", "stranger", "show the list of strangers' IDs.", &Controller::parseStrangerCommand, BUILTIN_NONE},
+	{"group", "group", "show the list of groups.", &Controller::parseGroupCommand, BUILTIN_NONE},
+	{"group", "group [ID]", "show the list of members of the group with ID [ID].", &Controller::parseGroupCommand, BUILTIN_NONE},
+	{"self", "self", "show the information of self.", &Controller::parseSelfCommand, BUILTIN_NONE},
+	{"to", "to [ID] [message]", "send [message] to the contact with ID [ID].", &Controller::parseToCommand, BUILTIN_NONE},
+	{"tofriends", "tofriends [message]", "send [message] to all friends.", &Controller::parseToFriendsCommand, BUILTIN_NONE},
+	{"tostrangers", "tostrangers [message]", "send [message] to all strangers.", &Controller::parseToStrangersCommand, BUILTIN_NONE},
+	{"togroup", "togroup [GroupID] [message]", "send [message] to the members of the group with ID [GroupID].",
+	 &Controller::parseToGroupCommand, BUILTIN_NONE},
+	{"toall", "toall [message]", "send [message] to all.", &Controller::parseToAllCommand, BUILTIN_NONE},
+	{"+friend", "+friend [ID] [hostname] [port]", "add the friend with ID [ID] and address [hostname]:[port]",
+	 &Controller::parseAddFriendCommand, BUILTIN_NONE},
+	{"-friend", "-friend [ID]", "delete the friend with ID [ID].", &Controller::parseDeleteFriendCommand, BUILTIN_NONE},
+	{"+group", "+group [ID]", "add the group with ID [ID].", &Controller::parseAddGroupCommand, BUILTIN_NONE},
+	{"-group", "-group [ID]", "delete the group with ID [ID].", &Controller::parseDeleteGroupCommand, BUILTIN_NONE},
+	{"+member", "+member [GroupID] [MemberID]", "add a member with ID [MemberID] to the group with ID [GroupID].",
+	 &Controller::parseAddMemberCommand, BUILTIN_NONE},
+	{"-member", "-member [GroupID] [MemberID]", "delete a member with ID [MemberID] from the group with ID [GroupID].",
+	 &Controller::parseDeleteMemberCommand, BUILTIN_NONE},
+	{"friends", "friends [ID]", "show the information of the friend list of the friend with ID [ID].",
+	 &Controller::parseFriendsCommand, BUILTIN_NONE},
+	{"scroll", "scroll [ID] [N]",
+	 "show the last [N] messages with the contact with ID [ID], with the group if [ID] is #[GroupID], or sent to all if [ID] is *.",
+	 &Controller::parseScrollCommand, BUILTIN_NONE},
+	{"range", "range [ID] [from] [to]",
+	 "show the messages with [ID], as for scroll, from local time [from] up to [to] (YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS; [to] defaults to now).",
+	 &Controller::parseRangeCommand, BUILTIN_NONE},
+	{"search", "search [words]", "show the newest messages, with anyone, containing all of [words].", &Controller::parseSearchCommand, BUILTIN_NONE}
+};
+
+const size_t Controller::commandTableSize = sizeof(commandTable_) / sizeof(commandTable_[0]);
+
 void Controller::initCommandDescriptions() {
 	// add command name - command description pairs
-	commandDescriptions_["friend"] = "show the list of friends' IDs.";
-	commandDescriptions_["stranger"] = "show the list of strangers' IDs.";
-	commandDescriptions_["group"] = "show the list of groups.";
-	commandDescriptions_["group [ID]"] = "show the list of members of the group with ID [ID].";
-	commandDescriptions_["self"] = "show the information of self.";
-	commandDescriptions_["to [ID] [message]"] = "send [message] to the contact with ID [ID].";
-	commandDescriptions_["tofriends [message]"] = "send [message] to all friends.";
-	commandDescriptions_["tostrangers [message]"] = "send [message] to all strangers.";
-	commandDescriptions_["togroup [GroupID] [message]"] = "send [message] to the members of the group with ID [GroupID].";
-	commandDescriptions_["toall [message]"] = "send [message] to all.";
-	commandDescriptions_["+friend [ID] [hostname] [port]"] = "add the friend with ID [ID] and address [hostname]:[port]";
-	commandDescriptions_["-friend [ID]"] = "delete the friend with ID [ID].";
-	commandDescriptions_["+group [ID]"] = "add the group with ID [ID].";
-	commandDescriptions_["-group [ID]"] = "delete the group with ID [ID].";
-	commandDescriptions_["+member [GroupID] [MemberID]"] = "add a member with ID [MemberID] to the group with ID [GroupID].";
-	commandDescriptions_["-member [GroupID] [MemberID]"] = "delete a member with ID [MemberID] from the group with ID [GroupID].";
-	commandDescriptions_["friends [ID]"] = "show the information of the friend list of the friend with ID [ID].";
-}
-
-boost::shared_ptr<Command> Controller::createCommand(const string &commandName) {
-	Command *command;
-	// simple commands, just one string, no need for further parsing
-	if (commandName == "friend") command = new FriendCommand(model_, view_, is_, commandName);
-	else if (commandName == "stranger") command = new StrangerCommand(model_, view_, is_, commandName);
-	else if (commandName == "group") command = new GroupCommand(model_, view_, is_, commandName);
-	else if (commandName == "self") command = new ShowSelfCommand(model_, view_, is_, commandName);
-	// complex commands, need parsing
-	else if (commandName.size() > 3 && commandName.substr(0, 2) == "to" && commandName[2] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "to"
-		string id;
-		iss >> id;
-		string message;
-		iss >> ws; // consume all leading spaces
-		getline(iss, message); // all the rest is message
-		// check if id exists in the friend or stranger list
-		if (model_->hasFriend(id)) {
-			command = new ToFriendCommand(model_, view_, is_, commandName, id, model_->getID(), message);
-		} else if (model_->hasStranger(id)) {
-			command = new ToStrangerCommand(model_, view_, is_, commandName, id, model_->getID(), message);
-		} else {
-			view_->presentLine("ID: " + id + " not found.");
-			command = new NullCommand(model_, view_, is_, commandName);
-		}
-	}
-	else if (commandName.size() > 6 && commandName.substr(0, 5) == "group" && commandName[5] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "group"
-		string id;
-		iss >> id;
-		// check if group id exists
-		if (model_->hasGroup(id)) {
-			command = new ShowGroupCommand(model_, view_, is_, commandName, id);
-		} else {
-			view_->presentLine("Group ID: " + id + " not found.");
-			command = new NullCommand(model_, view_, is_, commandName);
-		}
+	for (size_t i = 0; i < commandTableSize; ++i) {
+		if (commandTable_[i].usage != 0)
+			commandDescriptions_[commandTable_[i].usage] = commandTable_[i].description;
 	}
-	else if (commandName.size() > 10 && commandName.substr(0, 9) == "tofriends" && commandName[9] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "tofriends"
-		string message;
-		iss >> ws;
-		getline(iss, message);
-		command = new ToAllFriendsCommand(model_, view_, is_, commandName, model_->getID(), message);
-	}
-	else if (commandName.size() > 12 && commandName.substr(0, 11) == "tostrangers" && commandName[11] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "tostrangers"
-		string message;
-		iss >> ws;
-		getline(iss, message);
-		command = new ToAllStrangersCommand(model_, view_, is_, commandName, model_->getID(), message);
-	}
-	else if (commandName.size() > 8 && commandName.substr(0, 7) == "togroup" && commandName[7] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "togroup"
-		string groupID, message;
-		iss >> groupID;
-		iss >> ws;
-		getline(iss, message);
-		// check if groupID exists
-		if (model_->hasGroup(groupID)) {
-			command = new ToGroupCommand(model_, view_, is_, commandName, groupID, model_->getID(), message);
-		} else {
-			view_->presentLine("Group ID: " + groupID + " not found.");
-			command = new NullCommand(model_, view_, is_, commandName);
-		}
-	}
-	else if (commandName.size() > 6 && commandName.substr(0, 5) == "toall" && commandName[5] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "toall"
-		string message;
-		iss >> ws;
-		getline(iss, message);
-		command = new ToAllCommand(model_, view_, is_, commandName, model_->getID(), message);
-	}
-	else if (commandName.size() > 8 && (commandName.substr(0, 7) == "+friend" || commandName.substr(0, 7) == "-friend") && commandName[7] == ' ') {
-		istringstream iss(commandName);
-		string name;
-		iss >> name;
-		string id, hostname, port;
-		iss >> id >> hostname >> port;
-		if (name == "+friend") {
-			// check if id exists in the friend list
-			if (model_->hasFriend(id)) {
-				view_->presentLine("ID: " + id + " has been in the friend list.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			} else if (model_->getID() == id) {
-				view_->presentLine("ID: " + id + " is yourself.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			} else {
-				command = new AddFriendCommand(model_, view_, is_, commandName, id, hostname, port);
-			}
-		} else { // name == "-friend"
-			// check if id exists in the friend list
-			if (model_->hasFriend(id)) {
-				command = new DeleteFriendCommand(model_, view_, is_, commandName, id);
-			} else {
-				view_->presentLine("ID: " + id + " not found.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			}
-		}
+}
+
+size_t Controller::hashVerb(boost::string_ref verb, unsigned seed) {
+	// FNV-1a, starting from the seed
+	boost::uint32_t hash = 2166136261u ^ seed;
+	for (size_t i = 0; i < verb.size(); ++i) {
+		hash = (hash ^ (unsigned char)verb[i]) * 16777619u;
 	}
-	else if (commandName.size() > 7 && (commandName.substr(0, 6) == "+group" || commandName.substr(0, 6) == "-group") && commandName[6] == ' ') {
-		istringstream iss(commandName);
-		string name;
-		iss >> name;
-		string id;
-		iss >> id;
-		if (name == "+group") {
-			// check if id exists in the group list
-			if (model_->hasGroup(id)) {
-				view_->presentLine("Group ID: " + id + " has been in the group list.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			} else {
-				command = new AddGroupCommand(model_, view_, is_, commandName, id);
-			}
-		} else { // name == "-group"
-			if (model_->hasGroup(id)) {
-				command = new DeleteGroupCommand(model_, view_, is_, commandName, id);
-			} else {
-				view_->presentLine("Group ID: " + id + " not found.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			}
-		}
+	return hash ^ (hash >> 16);
+}
+
+/**
+ * The rows of commandTable_ by hashVerb: the table is small and fixed, so it is built once with the
+ * first seed under which no two verbs share a slot, and a lookup is one hash and one comparison.
+ */
+const Controller::CommandIndex &Controller::getCommandIndex() {
+	static const CommandIndex index(buildCommandIndex());
+	return index;
+}
+
+Controller::CommandIndex Controller::buildCommandIndex() {
+	size_t size = 16;
+	while (size < commandTableSize * 4) {
+		size <<= 1;
 	}
-	else if (commandName.size() > 8 && (commandName.substr(0, 7) == "+member" || commandName.substr(0, 7) == "-member") && commandName[7] == ' ') {
-		istringstream iss(commandName);
-		string name, groupID, memberID;
-		iss >> name >> groupID >> memberID;
-		if (name == "+member") {
-			// check if group exists
-			if (model_->hasGroup(groupID)) {
-				// check if id exists in the group
-				if (model_->hasGroupMember(groupID, memberID)) {
-					view_->presentLine("ID: " + memberID + " has been in the group with ID: " + groupID + ".");
-					command = new NullCommand(model_, view_, is_, commandName);
-				} else {
-					// check if id exists in the friend list
-					if (model_->hasFriend(memberID)) {
-						command = new AddGroupMemberCommand(model_, view_, is_, commandName, groupID, memberID);
-					} else {
-						view_->presentLine("ID: " + memberID + " not found.");
-						command = new NullCommand(model_, view_, is_, commandName);
-					}
-				}
-			} else {
-				view_->presentLine("Group ID: " + groupID + " not found.");
-				command = new NullCommand(model_, view_, is_, commandName);
+	CommandIndex index;
+	for (index.seed = 1; ; ++index.seed) {
+		index.slots.assign(size, (const CommandEntry *)0);
+		bool perfect = true;
+		for (size_t i = 0; i < commandTableSize && perfect; ++i) {
+			const CommandEntry *&slot = index.slots[hashVerb(commandTable_[i].verb, index.seed) & (size - 1)];
+			// a verb's later rows are usages only, its first row stays
+			if (slot == 0) {
+				slot = &commandTable_[i];
+			} else if (strcmp(slot->verb, commandTable_[i].verb) != 0) {
+				perfect = false;
 			}
-		} else { // name == "-member"
-			// check if group exists
-			if (model_->hasGroup(groupID)) {
-				// check if id exists in the group
-				if (model_->hasGroupMember(groupID, memberID)) {
-					command = new DeleteGroupMemberCommand(model_, view_, is_, commandName, groupID, memberID);
-				} else {
-					view_->presentLine("ID: " + memberID + " is not found in the group with ID: " + groupID + ".");
-					command = new NullCommand(model_, view_, is_, commandName);
-				}
-			} else {
-				view_->presentLine("Group ID: " + groupID + " not found.");
-				command = new NullCommand(model_, view_, is_, commandName);
-			}
-		}
-	}
-	else if (commandName.size() > 8 && commandName.substr(0, 7) == "friends" && commandName[7] == ' ') {
-		istringstream iss(commandName);
-		string junk;
-		iss >> junk; // skip "friends"
-		string id;
-		iss >> id;
-		// check if id exists in the friend list
-		if (model_->hasFriend(id)) {
-			command = new ExtractFriendFriendsCommand(model_, view_, is_, commandName, id);
-		} else {
-			view_->presentLine("ID: " + id + " is not a friend.");
-			command = new NullCommand(model_, view_, is_, commandName);
 		}
+		if (perfect)
+			return index;
 	}
+}
+
+const Controller::CommandEntry *Controller::findCommand(boost::string_ref verb) {
+	const CommandIndex &index = getCommandIndex();
+	const CommandEntry *entry = index.slots[hashVerb(verb, index.seed) & (index.slots.size() - 1)];
+	return entry != 0 && verb == entry->verb ? entry : 0;
+}
+
+boost::shared_ptr<Command> Controller::createCommand(const string &commandName, const CommandEntry *entry, const CommandLine &line) {
+	Command *command = 0;
+	if (entry != 0 && entry->parser != 0)
+		command = (this->*entry->parser)(commandName, line);
 	// invalid commandName
-	else {
-		view_->presentLine("Command: " + commandName + " not found or not understandable.");
-		command = new NullCommand(model_, view_, is_, commandName);
+	if (command == 0) {
+		command = reject(commandName, "Command: " + commandName + " not found or not understandable.");
 	}
+	// the reference count goes into the pool too
+	return boost::shared_ptr<Command>(command, boost::checked_deleter<Command>(), CommandPool::Allocator<Command>(commandPool_));
+}
+
+Command *Controller::reject(const string &commandName, const string &reason) {
+	lastError_ = reason;
+	return new (commandPool_) NullCommand(model_, view_, is_, commandName);
+}
+
+// simple commands, just one string, no need for further parsing; 0 means the line is not understood
+Command *Controller::parseFriendCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? 0 : new (commandPool_) FriendCommand(model_, view_, is_, commandName);
+}
+
+Command *Controller::parseStrangerCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? 0 : new (commandPool_) StrangerCommand(model_, view_, is_, commandName);
+}
+
+Command *Controller::parseSelfCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? 0 : new (commandPool_) ShowSelfCommand(model_, view_, is_, commandName);
+}
+
+// complex commands, need parsing
+Command *Controller::parseGroupCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return new (commandPool_) GroupCommand(model_, view_, is_, commandName);
+	string id = line.getArgument(0);
+	// check if group id exists
+	if (model_->hasGroup(id))
+		return new (commandPool_) ShowGroupCommand(model_, view_, is_, commandName, id);
+	return reject(commandName, "Group ID: " + id + " not found.");
+}
+
+Command *Controller::parseToCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	string message = line.getRest(1); // all the rest is message
+	// check if id exists in the friend or stranger list
+	if (model_->hasFriend(id))
+		return new (commandPool_) ToFriendCommand(model_, view_, is_, commandName, id, model_->getID(), message);
+	if (model_->hasStranger(id))
+		return new (commandPool_) ToStrangerCommand(model_, view_, is_, commandName, id, model_->getID(), message);
+	return reject(commandName, "ID: " + id + " not found.");
+}
+
+Command *Controller::parseToFriendsCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? new (commandPool_) ToAllFriendsCommand(model_, view_, is_, commandName, model_->getID(), line.getRest(0)) : 0;
+}
+
+Command *Controller::parseToStrangersCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? new (commandPool_) ToAllStrangersCommand(model_, view_, is_, commandName, model_->getID(), line.getRest(0)) : 0;
+}
+
+Command *Controller::parseToGroupCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string groupID = line.getArgument(0);
+	// check if groupID exists
+	if (model_->hasGroup(groupID))
+		return new (commandPool_) ToGroupCommand(model_, view_, is_, commandName, groupID, model_->getID(), line.getRest(1));
+	return reject(commandName, "Group ID: " + groupID + " not found.");
+}
+
+Command *Controller::parseToAllCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? new (commandPool_) ToAllCommand(model_, view_, is_, commandName, model_->getID(), line.getRest(0)) : 0;
+}
+
+Command *Controller::parseAddFriendCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	// check if id exists in the friend list
+	if (model_->hasFriend(id))
+		return reject(commandName, "ID: " + id + " has been in the friend list.");
+	if (model_->getID() == id)
+		return reject(commandName, "ID: " + id + " is yourself.");
+	return new (commandPool_) AddFriendCommand(model_, view_, is_, commandName, id, line.getArgument(1), line.getArgument(2));
+}
+
+Command *Controller::parseDeleteFriendCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	// check if id exists in the friend list
+	if (model_->hasFriend(id))
+		return new (commandPool_) DeleteFriendCommand(model_, view_, is_, commandName, id);
+	return reject(commandName, "ID: " + id + " not found.");
+}
+
+Command *Controller::parseAddGroupCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	// check if id exists in the group list
+	if (model_->hasGroup(id))
+		return reject(commandName, "Group ID: " + id + " has been in the group list.");
+	return new (commandPool_) AddGroupCommand(model_, view_, is_, commandName, id);
+}
+
+Command *Controller::parseDeleteGroupCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	if (model_->hasGroup(id))
+		return new (commandPool_) DeleteGroupCommand(model_, view_, is_, commandName, id);
+	return reject(commandName, "Group ID: " + id + " not found.");
+}
+
+Command *Controller::parseAddMemberCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string groupID = line.getArgument(0), memberID = line.getArgument(1);
+	// check if group exists
+	if (!model_->hasGroup(groupID))
+		return reject(commandName, "Group ID: " + groupID + " not found.");
+	// check if id exists in the group
+	if (model_->hasGroupMember(groupID, memberID))
+		return reject(commandName, "ID: " + memberID + " has been in the group with ID: " + groupID + ".");
+	// check if id exists in the friend list
+	if (model_->hasFriend(memberID))
+		return new (commandPool_) AddGroupMemberCommand(model_, view_, is_, commandName, groupID, memberID);
+	return reject(commandName, "ID: " + memberID + " not found.");
+}
+
+Command *Controller::parseDeleteMemberCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string groupID = line.getArgument(0), memberID = line.getArgument(1);
+	// check if group exists
+	if (!model_->hasGroup(groupID))
+		return reject(commandName, "Group ID: " + groupID + " not found.");
+	// check if id exists in the group
+	if (model_->hasGroupMember(groupID, memberID))
+		return new (commandPool_) DeleteGroupMemberCommand(model_, view_, is_, commandName, groupID, memberID);
+	return reject(commandName, "ID: " + memberID + " is not found in the group with ID: " + groupID + ".");
+}
+
+Command *Controller::parseFriendsCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string id = line.getArgument(0);
+	// check if id exists in the friend list
+	if (model_->hasFriend(id))
+		return new (commandPool_) ExtractFriendFriendsCommand(model_, view_, is_, commandName, id);
+	return reject(commandName, "ID: " + id + " is not a friend.");
+}
+
+Command *Controller::parseScrollCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	size_t count = strtoul(line.getArgument(1).c_str(), 0, 10);
+	if (count > 0)
+		return new (commandPool_) ScrollCommand(model_, view_, is_, commandName, HistoryCommand::getConversation(line.getArgument(0)), count);
+	return reject(commandName, "Usage: scroll [ID] [N], with [N] greater than 0.");
+}
+
+Command *Controller::parseRangeCommand(const string &commandName, const CommandLine &line) {
+	if (!line.hasArguments())
+		return 0;
+	string from = line.getArgument(1), to = line.getArgument(2);
+	boost::int64_t fromTime, toTime = HistoryStore::getCurrentTime() + 1;
+	if (HistoryCommand::parseTime(from, fromTime) && (to.empty() || HistoryCommand::parseTime(to, toTime)))
+		return new (commandPool_) RangeCommand(model_, view_, is_, commandName, HistoryCommand::getConversation(line.getArgument(0)), fromTime, toTime);
+	return reject(commandName, "Usage: range [ID] [from] [to], times as YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS.");
+}
 
-	return boost::shared_ptr<Command>(command);
+Command *Controller::parseSearchCommand(const string &commandName, const CommandLine &line) {
+	return line.hasArguments() ? new (commandPool_) SearchCommand(model_, view_, is_, commandName, line.getRest(0)) : 0;
 }
 
 }
@@ -11,6 +11,8 @@
 #include <vector>
 #include <map>
 #include <boost/shared_ptr.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include "basicchatclient.hpp"
 #include "view.hpp"
@@ -20,21 +22,86 @@ using namespace std;
 
 namespace openchat {
 
+/**
+ * CommandLine splits a line of user input into its verb and arguments in a single pass, referring
+ * into the line instead of copying it.  Only the first maxWords words are remembered, which is all
+ * any command needs; the rest of the line is still there for getRest.
+ */
+class CommandLine {
+public:
+	static const size_t maxWords = 4;
+
+	explicit CommandLine(boost::string_ref line) : line_(line), wordCount_(0) {
+		size_t i = 0;
+		while (wordCount_ < maxWords) {
+			while (i < line.size() && isSpace(line[i])) {
+				++i;
+			}
+			if (i == line.size())
+				break;
+			size_t start = i;
+			while (i < line.size() && !isSpace(line[i])) {
+				++i;
+			}
+			words_[wordCount_++] = line.substr(start, i - start);
+		}
+	}
+
+	boost::string_ref getVerb() const { return wordCount_ > 0 ? words_[0] : boost::string_ref(); }
+
+	// whether there is anything after the verb
+	bool hasArguments() const { return wordCount_ > 1; }
+
+	// the index-th argument after the verb, empty if there is none
+	string getArgument(size_t index) const {
+		return index + 1 < wordCount_ ? words_[index + 1].to_string() : string();
+	}
+
+	// the line from the index-th argument on, as typed; empty if there is none
+	string getRest(size_t index) const {
+		if (index + 1 >= wordCount_)
+			return string();
+		return string(words_[index + 1].data(), line_.data() + line_.size());
+	}
+private:
+	static bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+	}
+
+	boost::string_ref line_;
+	boost::string_ref words_[maxWords];
+	size_t wordCount_;
+};
+
 /**
  * Controller is the "controller" in MVC architecture and is responsible for manipulating Client's state
  */
 class Controller {
 public:
-	Controller(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is)
-		: model_(model), view_(view), is_(is) {
+	// the last historyDepth commands are kept for "history" and "undo"
+	static const size_t defaultHistoryDepth = 1000;
+
+	Controller(boost::shared_ptr<BasicChatClient> model, boost::shared_ptr<View> view, istream &is,
+	           size_t historyDepth = defaultHistoryDepth)
+		: model_(model), view_(view), is_(is), prompting_(true), commandHistory_(historyDepth) {
 		initCommandDescriptions();
 	}
 	virtual ~Controller() { }
 
-	void processIncomingMessage(const string &rawMessage, boost::shared_ptr<udp::endpoint> remoteEndpoint);
+	void processIncomingMessage(const string &rawMessage, const udp::endpoint &remoteEndpoint);
+	void processIncomingMessage(const Datagram &datagram);
 
 	bool processUserInput(const string &input);
 
+	// why the last input made no command, empty if it did
+	const string &getLastError() const { return lastError_; }
+
+	// whether to prompt for the next input after presenting an incoming message; set before the client runs
+	void setPrompting(bool prompting) { prompting_ = prompting; }
+
+	// a contact's address could not be looked up, what was sent to it is lost
+	void processResolutionFailure(const string &id, const string &hostname, const string &port, const string &error);
+
 	// print the basic instruction to users
 	void presentOpeningLine() const {
 		view_->presentLine("Type \"help\" for usage, \"history\" for checking command history, \"undo\" for undoing the last command, and \"exit\" for leaving.");
@@ -43,16 +110,95 @@ private:
 	boost::shared_ptr<BasicChatClient> model_;
 	boost::shared_ptr<View> view_;
 	istream &is_;
+	bool prompting_;
+	string lastError_;
+
+	// the commands live here, so it is declared before anything holding them
+	CommandPool commandPool_;
 
-	// store the history of used commands, supporting undo operation
-	vector<boost::shared_ptr<Command> > commandHistory_;
+	// store the history of used commands, supporting undo operation; the oldest command goes
+	// once the history is full, and with it its block of commandPool_
+	typedef boost::circular_buffer<boost::shared_ptr<Command> > CommandHistory;
+	CommandHistory commandHistory_;
 
 	// store the description of commands
 	map<string, string> commandDescriptions_;
 	void initCommandDescriptions();
 
+	/**
+	 * Every command is a row of commandTable_: its verb, usage and description for "help", and
+	 * the parser that makes the Command of a line (a verb may have several rows, for several
+	 * usages, the first one's parser taking them all).  The inputs handled by processUserInput
+	 * itself are rows too, with no parser, so a line is looked up exactly once.
+	 */
+	enum Builtin {
+		BUILTIN_NONE,
+		BUILTIN_HELP,
+		BUILTIN_HISTORY,
+		BUILTIN_UNDO,
+		BUILTIN_EXIT
+	};
+	typedef Command *(Controller::*CommandParser)(const string &commandName, const CommandLine &line);
+	struct CommandEntry {
+		const char *verb;
+		const char *usage; // 0 for the rows not listed by "help"
+		const char *description;
+		CommandParser parser;
+		Builtin builtin;
+	};
+	static const CommandEntry commandTable_[];
+	static const size_t commandTableSize;
+
+	// the row of a verb, or 0; see buildCommandIndex
+	struct CommandIndex {
+		unsigned seed;
+		vector<const CommandEntry *> slots;
+	};
+	static const CommandEntry *findCommand(boost::string_ref verb);
+	static const CommandIndex &getCommandIndex();
+	static CommandIndex buildCommandIndex();
+	static size_t hashVerb(boost::string_ref verb, unsigned seed);
+
 	// create a command for certain command name, using Factory Method Pattern
-	boost::shared_ptr<Command> createCommand(const string &commandName);
+	boost::shared_ptr<Command> createCommand(const string &commandName, const CommandEntry *entry, const CommandLine &line);
+
+	// the parsers of commandTable_; reject records why a line makes no command, presented as its result
+	Command *reject(const string &commandName, const string &reason);
+	Command *parseFriendCommand(const string &commandName, const CommandLine &line);
+	Command *parseStrangerCommand(const string &commandName, const CommandLine &line);
+	Command *parseGroupCommand(const string &commandName, const CommandLine &line);
+	Command *parseSelfCommand(const string &commandName, const CommandLine &line);
+	Command *parseToCommand(const string &commandName, const CommandLine &line);
+	Command *parseToFriendsCommand(const string &commandName, const CommandLine &line);
+	Command *parseToStrangersCommand(const string &commandName, const CommandLine &line);
+	Command *parseToGroupCommand(const string &commandName, const CommandLine &line);
+	Command *parseToAllCommand(const string &commandName, const CommandLine &line);
+	Command *parseAddFriendCommand(const string &commandName, const CommandLine &line);
+	Command *parseDeleteFriendCommand(const string &commandName, const CommandLine &line);
+	Command *parseAddGroupCommand(const string &commandName, const CommandLine &line);
+	Command *parseDeleteGroupCommand(const string &commandName, const CommandLine &line);
+	Command *parseAddMemberCommand(const string &commandName, const CommandLine &line);
+	Command *parseDeleteMemberCommand(const string &commandName, const CommandLine &line);
+	Command *parseFriendsCommand(const string &commandName, const CommandLine &line);
+	Command *parseScrollCommand(const string &commandName, const CommandLine &line);
+	Command *parseRangeCommand(const string &commandName, const CommandLine &line);
+	Command *parseSearchCommand(const string &commandName, const CommandLine &line);
+
+	// handle incoming messages once they have been decoded, whatever format they came in
+	void presentPrompt() const {
+		if (prompting_)
+			view_->present(">>> ");
+	}
+	void processIncomingTextMessage(boost::string_ref rawMessage, const udp::endpoint &remoteEndpoint);
+	void processIncomingBinaryMessage(const char *data, size_t size, const udp::endpoint &remoteEndpoint);
+	void processPlainChatMessage(boost::string_ref fromID, boost::string_ref message, const udp::endpoint &remoteEndpoint);
+	void processFriendListExtractionMessage(const udp::endpoint &remoteEndpoint, unsigned format);
+	void processFriendListExtractionResponseMessage(boost::string_ref fromID, const vector<pair<string, pair<string, string> > > &info);
+	void processFriendSyncMessage(unsigned epoch, unsigned version, boost::string_ref after, const udp::endpoint &remoteEndpoint, unsigned format);
+	void processFriendDeltaMessage(boost::string_ref fromID, unsigned epoch, unsigned base, unsigned version, const vector<FriendEntry> &changes,
+	                               const udp::endpoint &remoteEndpoint);
+	void processFriendPageMessage(boost::string_ref fromID, unsigned epoch, unsigned version, bool first, bool more,
+	                              const vector<FriendEntry> &entries, const udp::endpoint &remoteEndpoint);
 };
 
 }
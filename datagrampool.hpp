@@ -0,0 +1,167 @@
+/*
+ * datagrampool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/noncopyable.hpp>
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+class DatagramPool;
+
+/**
+ * Datagram is a reference-counted slice of a DatagramPool slab holding one received datagram
+ * together with the endpoint it came from.  It goes back to its pool when the last reference is gone.
+ */
+class Datagram : private boost::noncopyable {
+public:
+	Datagram() : buffer_(0), capacity_(0), size_(0), truncated_(false), refCount_(0), pool_(0) { }
+
+	const char *getData() const { return buffer_; }
+	size_t getSize() const { return size_; }
+	bool isTruncated() const { return truncated_; }
+	const udp::endpoint &getRemoteEndpoint() const { return remoteEndpoint_; }
+
+	// used by the receiving side to fill the slice in place
+	char *getBuffer() { return buffer_; }
+	size_t getCapacity() const { return capacity_; }
+	udp::endpoint &getRemoteEndpoint() { return remoteEndpoint_; }
+	void setSize(size_t size, bool truncated = false) {
+		size_ = size;
+		truncated_ = truncated;
+	}
+private:
+	friend class DatagramPool;
+	friend void intrusive_ptr_add_ref(Datagram *datagram);
+	friend void intrusive_ptr_release(Datagram *datagram);
+
+	char *buffer_;
+	size_t capacity_;
+	size_t size_;
+	bool truncated_;
+	udp::endpoint remoteEndpoint_;
+	boost::atomic<int> refCount_;
+	DatagramPool *pool_;
+};
+
+typedef boost::intrusive_ptr<Datagram> DatagramPointer;
+
+/**
+ * DatagramPool hands out Datagrams carved from slabs that are allocated slabSize at a time and
+ * never freed before the pool, so once it has grown to the number of datagrams in flight,
+ * receiving costs no heap allocation at all.
+ */
+class DatagramPool : private boost::noncopyable {
+public:
+	DatagramPool(size_t datagramCapacity, size_t slabSize = 64)
+		: datagramCapacity_(datagramCapacity), slabSize_(slabSize == 0 ? 1 : slabSize),
+		  acquisitions_(0), heapAllocations_(0), inUse_(0) { }
+
+	DatagramPointer acquire() {
+		Datagram *datagram;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			if (free_.empty())
+				grow();
+			datagram = free_.back();
+			free_.pop_back();
+		}
+		datagram->setSize(0);
+		++acquisitions_;
+		++inUse_;
+		return DatagramPointer(datagram);
+	}
+
+	// a datagram too large for any slab, e.g. a reassembled message; it is freed when released
+	static DatagramPointer acquireOversized(size_t capacity) {
+		Datagram *datagram = new Datagram;
+		datagram->buffer_ = new char[max<size_t>(capacity, 1)];
+		datagram->capacity_ = capacity;
+		return DatagramPointer(datagram);
+	}
+
+	size_t getDatagramCapacity() const { return datagramCapacity_; }
+
+	// statistics
+	size_t getAcquisitionCount() const { return acquisitions_.load(); }
+	size_t getHeapAllocationCount() const { return heapAllocations_.load(); }
+	size_t getInUseCount() const { return inUse_.load(); }
+	size_t getPooledCount() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return slabs_.size() * slabSize_;
+	}
+private:
+	friend void intrusive_ptr_release(Datagram *datagram);
+
+	struct Slab {
+		boost::shared_array<char> buffers;
+		boost::shared_array<Datagram> datagrams;
+	};
+
+	// called with mutex_ held
+	void grow() {
+		Slab slab;
+		slab.buffers.reset(new char[datagramCapacity_ * slabSize_]);
+		slab.datagrams.reset(new Datagram[slabSize_]);
+		heapAllocations_ += 2;
+		if (free_.capacity() < slabSize_ * (slabs_.size() + 1)) {
+			free_.reserve(slabSize_ * (slabs_.size() + 1));
+			++heapAllocations_;
+		}
+		for (size_t i = 0; i < slabSize_; ++i) {
+			Datagram &datagram = slab.datagrams[i];
+			datagram.buffer_ = slab.buffers.get() + i * datagramCapacity_;
+			datagram.capacity_ = datagramCapacity_;
+			datagram.pool_ = this;
+			free_.push_back(&datagram);
+		}
+		if (slabs_.size() == slabs_.capacity())
+			++heapAllocations_;
+		slabs_.push_back(slab);
+	}
+
+	void release(Datagram *datagram) {
+		--inUse_;
+		boost::mutex::scoped_lock lock(mutex_);
+		free_.push_back(datagram);
+	}
+
+	const size_t datagramCapacity_;
+	const size_t slabSize_;
+	mutable boost::mutex mutex_;
+	vector<Slab> slabs_;
+	vector<Datagram *> free_;
+
+	boost::atomic<size_t> acquisitions_;
+	boost::atomic<size_t> heapAllocations_;
+	boost::atomic<size_t> inUse_;
+};
+
+inline void intrusive_ptr_add_ref(Datagram *datagram) {
+	datagram->refCount_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+inline void intrusive_ptr_release(Datagram *datagram) {
+	if (datagram->refCount_.fetch_sub(1, boost::memory_order_acq_rel) == 1) {
+		if (datagram->pool_) {
+			datagram->pool_->release(datagram);
+		} else {
+			delete[] datagram->buffer_;
+			delete datagram;
+		}
+	}
+}
+
+}
@@ -0,0 +1,49 @@
+/*
+ * datagramsender.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * DatagramSender is the interface through which peers put datagrams on the wire, so that they do
+ * not depend on how the server drives its socket (blocking, asynchronous, batched, ...)
+ */
+class DatagramSender {
+public:
+	virtual ~DatagramSender() { }
+	virtual void sendDatagram(const string &payload, const udp::endpoint &remoteEndpoint) = 0;
+
+	/**
+	 * send one payload to count endpoints; returns the number of sends that failed.
+	 * Senders that can share the payload between the sends override this.
+	 */
+	virtual size_t sendDatagrams(const boost::shared_ptr<const string> &payload, const udp::endpoint *remoteEndpoints, size_t count) {
+		size_t failed = 0;
+		for (size_t i = 0; i < count; ++i) {
+			try {
+				sendDatagram(*payload, remoteEndpoints[i]);
+			} catch (exception &e) {
+				++failed;
+			}
+		}
+		return failed;
+	}
+
+	// deliver payload reliably and in order; senders without a reliable channel send it as a plain datagram
+	virtual void sendReliableDatagram(const string &payload, const udp::endpoint &remoteEndpoint) {
+		sendDatagram(payload, remoteEndpoint);
+	}
+};
+
+}
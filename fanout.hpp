@@ -0,0 +1,179 @@
+/*
+ * fanout.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "datagramsender.hpp"
+#include "wiremessage.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * FanOut sends one message to many recipients from a background thread, so that broadcasting
+ * never holds up the caller.  The message is encoded once per format the recipients need and
+ * the encodings are shared, read-only, by every send; the recipients are resolved up front into
+ * contiguous endpoint arrays, one per encoding, which are handed to the DatagramSender in batches.
+ */
+class FanOut : private boost::noncopyable {
+public:
+	/**
+	 * A resolved recipient: where to send and what it has negotiated
+	 */
+	struct Recipient {
+		Recipient() : features(0) { }
+		Recipient(const udp::endpoint &e, unsigned f) : endpoint(e), features(f) { }
+		udp::endpoint endpoint;
+		unsigned features;
+	};
+
+	// called on the sending thread once a broadcast is done, with the number of sends that succeeded and failed
+	typedef boost::function<void (size_t, size_t)> completionType;
+
+	FanOut(DatagramSender &sender, size_t batchSize = 256)
+		: sender_(sender), batchSize_(batchSize == 0 ? 1 : batchSize), stopping_(false), busy_(false),
+		  submitted_(0), completed_(0), sent_(0), failed_(0) {
+		thread_ = boost::thread(boost::bind(&FanOut::sendLoop, this));
+	}
+
+	~FanOut() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			condition_.notify_all();
+		}
+		thread_.join();
+	}
+
+	/**
+	 * Queue message for every recipient and return immediately.  The message is encoded here,
+	 * so it need not outlive the call.
+	 */
+	void broadcast(const WireMessage &message, const vector<Recipient> &recipients, completionType onComplete = completionType()) {
+		boost::shared_ptr<Broadcast> job(new Broadcast);
+		job->onComplete = onComplete;
+		for (size_t i = 0; i < recipients.size(); ++i) {
+			unsigned features = recipients[i].features;
+			Run &run = job->runs[WireMessage::getFormat(features)][(features & FEATURE_RELIABLE) ? 1 : 0];
+			if (!run.payload)
+				run.payload.reset(new string(message.getEncoding(features)));
+			run.endpoints.push_back(recipients[i].endpoint);
+		}
+		boost::mutex::scoped_lock lock(mutex_);
+		queue_.push_back(job);
+		++submitted_;
+		condition_.notify_all();
+	}
+
+	// wait at most timeout milliseconds for every queued broadcast to be sent; false on timeout
+	bool wait(long timeout) {
+		boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+		boost::mutex::scoped_lock lock(mutex_);
+		while (!queue_.empty() || busy_) {
+			if (!idleCondition_.timed_wait(lock, deadline))
+				return false;
+		}
+		return true;
+	}
+
+	// statistics
+	size_t getSubmittedCount() const { return submitted_.load(); }
+	size_t getCompletedCount() const { return completed_.load(); }
+	size_t getSentCount() const { return sent_.load(); }
+	size_t getFailedCount() const { return failed_.load(); }
+private:
+	// the recipients sharing one encoding and one way of sending
+	struct Run {
+		boost::shared_ptr<const string> payload;
+		vector<udp::endpoint> endpoints;
+	};
+
+	struct Broadcast {
+		Run runs[WireMessage::formatCount][2]; // [format][reliable]
+		completionType onComplete;
+	};
+
+	void sendLoop() {
+		boost::mutex::scoped_lock lock(mutex_);
+		while (true) {
+			while (!stopping_ && queue_.empty()) {
+				condition_.wait(lock);
+			}
+			if (queue_.empty())
+				return;
+			boost::shared_ptr<Broadcast> job = queue_.front();
+			queue_.pop_front();
+			busy_ = true;
+			lock.unlock();
+			send(*job);
+			lock.lock();
+			busy_ = false;
+			++completed_;
+			idleCondition_.notify_all();
+		}
+	}
+
+	void send(const Broadcast &job) {
+		size_t sent = 0, failed = 0;
+		for (size_t format = 0; format < WireMessage::formatCount; ++format) {
+			for (size_t reliable = 0; reliable < 2; ++reliable) {
+				const Run &run = job.runs[format][reliable];
+				for (size_t begin = 0; begin < run.endpoints.size(); begin += batchSize_) {
+					size_t count = min(batchSize_, run.endpoints.size() - begin);
+					size_t batchFailed = 0;
+					if (reliable) {
+						for (size_t i = 0; i < count; ++i) {
+							try {
+								sender_.sendReliableDatagram(*run.payload, run.endpoints[begin + i]);
+							} catch (exception &e) {
+								++batchFailed;
+							}
+						}
+					} else {
+						batchFailed = sender_.sendDatagrams(run.payload, &run.endpoints[begin], count);
+					}
+					sent += count - batchFailed;
+					failed += batchFailed;
+					sent_ += count - batchFailed;
+					failed_ += batchFailed;
+				}
+			}
+		}
+		if (job.onComplete)
+			job.onComplete(sent, failed);
+	}
+
+	DatagramSender &sender_;
+	const size_t batchSize_;
+
+	boost::mutex mutex_;
+	boost::condition_variable condition_;
+	boost::condition_variable idleCondition_;
+	deque<boost::shared_ptr<Broadcast> > queue_;
+	bool stopping_;
+	bool busy_;
+	boost::thread thread_;
+
+	boost::atomic<size_t> submitted_;
+	boost::atomic<size_t> completed_;
+	boost::atomic<size_t> sent_;
+	boost::atomic<size_t> failed_;
+};
+
+}
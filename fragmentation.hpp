@@ -0,0 +1,263 @@
+/*
+ * fragmentation.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "datagrampool.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * FragmentProtocol splits a payload that does not fit into one datagram into fragments, each
+ * carrying a header
+ *
+ *     magic (2) | version (1) | reserved (1) | message id (4) | index (4) | count (4) | offset (4) | total length (4)
+ *
+ * followed by its slice of the payload.  It sits below ChatProtocol and BinaryProtocol: whatever
+ * comes out of the Reassembler is handled as if it had arrived in a single datagram.
+ */
+class FragmentProtocol {
+public:
+	static const unsigned char version = 1;
+	static const size_t headerSize = 24;
+
+	struct Header {
+		boost::uint32_t messageID;
+		boost::uint32_t index;
+		boost::uint32_t count;
+		boost::uint32_t offset;
+		boost::uint32_t totalLength;
+		size_t slice; // the payload bytes in every fragment but the last, which may have fewer
+	};
+
+	static bool isFragment(const char *data, size_t size) {
+		return size >= 2 && (unsigned char)data[0] == magic0 && (unsigned char)data[1] == magic1;
+	}
+
+	// number of fragments needed to send size bytes in datagrams of at most maxDatagramSize bytes
+	static size_t getFragmentCount(size_t size, size_t maxDatagramSize) {
+		size_t slice = maxDatagramSize - headerSize;
+		return (size + slice - 1) / slice;
+	}
+
+	// build fragment index of payload into fragment
+	static void makeFragment(const string &payload, boost::uint32_t messageID, size_t index, size_t maxDatagramSize, string &fragment) {
+		size_t slice = maxDatagramSize - headerSize;
+		size_t offset = index * slice;
+		size_t length = min(slice, payload.size() - offset);
+		fragment.resize(headerSize + length);
+		unsigned char *p = reinterpret_cast<unsigned char *>(&fragment[0]);
+		p[0] = magic0;
+		p[1] = magic1;
+		p[2] = version;
+		p[3] = 0;
+		writeUint32(p + 4, messageID);
+		writeUint32(p + 8, index);
+		writeUint32(p + 12, getFragmentCount(payload.size(), maxDatagramSize));
+		writeUint32(p + 16, offset);
+		writeUint32(p + 20, payload.size());
+		memcpy(p + headerSize, payload.data() + offset, length);
+	}
+
+	/**
+	 * False if the fragment is malformed.  The slice size is not sent but follows from the fragment,
+	 * and the fields must agree with it, so that the fragments of a message tile it exactly.
+	 */
+	static bool parseHeader(const char *data, size_t size, Header &header) {
+		if (!isFragment(data, size) || size < headerSize)
+			return false;
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		if (p[2] != version)
+			return false;
+		header.messageID = readUint32(p + 4);
+		header.index = readUint32(p + 8);
+		header.count = readUint32(p + 12);
+		header.offset = readUint32(p + 16);
+		header.totalLength = readUint32(p + 20);
+		size_t length = size - headerSize;
+		if (header.index >= header.count || length == 0 || header.offset > header.totalLength ||
+		    length > header.totalLength - header.offset)
+			return false;
+		if (header.index + 1 < header.count) {
+			header.slice = length;
+		} else if (header.offset + length != header.totalLength) {
+			return false; // the last fragment ends the message
+		} else if (header.index == 0) {
+			header.slice = header.totalLength;
+		} else {
+			// the offset of the last fragment is a whole number of slices
+			if (header.offset % header.index != 0)
+				return false;
+			header.slice = header.offset / header.index;
+			if (length > header.slice)
+				return false;
+		}
+		return (boost::uint64_t)header.index * header.slice == header.offset &&
+		       (header.totalLength + (boost::uint64_t)header.slice - 1) / header.slice == header.count;
+	}
+private:
+	static const unsigned char magic0 = 0xC0;
+	static const unsigned char magic1 = 0xFA;
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+	static void writeUint32(unsigned char *p, boost::uint32_t value) {
+		p[0] = (unsigned char)(value >> 24);
+		p[1] = (unsigned char)(value >> 16);
+		p[2] = (unsigned char)(value >> 8);
+		p[3] = (unsigned char)value;
+	}
+};
+
+/**
+ * Reassembler collects fragments per (sender, message id) until every byte of a message has
+ * arrived.  Memory is bounded twice: a single message may not exceed maxMessageSize, and when all
+ * partial messages together, with what tracks their fragments, would exceed maxPendingBytes the
+ * oldest ones are given up.  Partial messages that have not seen a fragment for timeout
+ * milliseconds are given up too.
+ */
+class Reassembler : private boost::noncopyable {
+public:
+	Reassembler(size_t maxMessageSize, size_t maxPendingBytes, long timeout)
+		: maxMessageSize_(maxMessageSize), maxPendingBytes_(maxPendingBytes), timeout_(timeout), pendingBytes_(0),
+		  lastSweep_(boost::posix_time::microsec_clock::universal_time()), completed_(0), expired_(0), rejected_(0) { }
+
+	/**
+	 * Add a fragment; returns the reassembled message, with the sender's endpoint, once its last
+	 * fragment has arrived, or a null pointer otherwise.
+	 */
+	DatagramPointer add(const Datagram &fragment) {
+		FragmentProtocol::Header header;
+		if (!FragmentProtocol::parseHeader(fragment.getData(), fragment.getSize(), header) || header.totalLength > maxMessageSize_) {
+			++rejected_;
+			return DatagramPointer();
+		}
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		boost::mutex::scoped_lock lock(mutex_);
+		sweep(now);
+
+		Key key(fragment.getRemoteEndpoint(), header.messageID);
+		map<Key, Partial>::iterator iter = partials_.find(key);
+		if (iter == partials_.end()) {
+			// count is at most totalLength, as a fragment carries at least one byte
+			size_t cost = header.totalLength + (header.count + 7) / 8;
+			makeRoom(cost);
+			Partial &partial = partials_[key];
+			partial.message = DatagramPool::acquireOversized(header.totalLength);
+			partial.message->getRemoteEndpoint() = fragment.getRemoteEndpoint();
+			partial.message->setSize(header.totalLength);
+			partial.received.assign(header.count, false);
+			partial.slice = header.slice;
+			partial.remaining = header.count;
+			partial.receivedBytes = 0;
+			partial.cost = cost;
+			partial.started = now;
+			pendingBytes_ += cost;
+			iter = partials_.find(key);
+		}
+		Partial &partial = iter->second;
+		if (partial.received.size() != header.count || partial.slice != header.slice ||
+		    partial.message->getSize() != header.totalLength) {
+			++rejected_; // inconsistent with the fragments seen so far
+			return DatagramPointer();
+		}
+		partial.lastUpdate = now;
+		if (!partial.received[header.index]) {
+			partial.received[header.index] = true;
+			--partial.remaining;
+			partial.receivedBytes += fragment.getSize() - FragmentProtocol::headerSize;
+			memcpy(partial.message->getBuffer() + header.offset, fragment.getData() + FragmentProtocol::headerSize,
+			       fragment.getSize() - FragmentProtocol::headerSize);
+		}
+		if (partial.remaining > 0 || partial.receivedBytes != header.totalLength)
+			return DatagramPointer();
+
+		DatagramPointer message = partial.message;
+		pendingBytes_ -= partial.cost;
+		partials_.erase(iter);
+		++completed_;
+		return message;
+	}
+
+	// statistics
+	size_t getCompletedCount() const { boost::mutex::scoped_lock lock(mutex_); return completed_; }
+	size_t getExpiredCount() const { boost::mutex::scoped_lock lock(mutex_); return expired_; }
+	size_t getRejectedCount() const { boost::mutex::scoped_lock lock(mutex_); return rejected_; }
+	size_t getPendingBytes() const { boost::mutex::scoped_lock lock(mutex_); return pendingBytes_; }
+private:
+	typedef pair<udp::endpoint, boost::uint32_t> Key;
+
+	struct Partial {
+		DatagramPointer message;
+		vector<bool> received;
+		size_t slice;
+		size_t remaining;     // fragments
+		size_t receivedBytes;
+		size_t cost;          // what the message counts for in pendingBytes_
+		boost::posix_time::ptime started;
+		boost::posix_time::ptime lastUpdate;
+	};
+
+	// called with mutex_ held: give up partial messages that have gone quiet
+	void sweep(const boost::posix_time::ptime &now) {
+		if (now - lastSweep_ < boost::posix_time::milliseconds(timeout_ / 4 + 1))
+			return;
+		lastSweep_ = now;
+		for (map<Key, Partial>::iterator iter = partials_.begin(); iter != partials_.end(); ) {
+			if (now - iter->second.lastUpdate > boost::posix_time::milliseconds(timeout_)) {
+				pendingBytes_ -= iter->second.cost;
+				++expired_;
+				partials_.erase(iter++);
+			} else {
+				++iter;
+			}
+		}
+	}
+
+	// called with mutex_ held: evict the oldest partial messages until size more bytes fit
+	void makeRoom(size_t size) {
+		while (!partials_.empty() && pendingBytes_ + size > maxPendingBytes_) {
+			map<Key, Partial>::iterator oldest = partials_.begin();
+			for (map<Key, Partial>::iterator iter = partials_.begin(); iter != partials_.end(); ++iter) {
+				if (iter->second.started < oldest->second.started)
+					oldest = iter;
+			}
+			pendingBytes_ -= oldest->second.cost;
+			++expired_;
+			partials_.erase(oldest);
+		}
+	}
+
+	const size_t maxMessageSize_;
+	const size_t maxPendingBytes_;
+	const long timeout_;
+
+	mutable boost::mutex mutex_;
+	map<Key, Partial> partials_;
+	size_t pendingBytes_;
+	boost::posix_time::ptime lastSweep_;
+
+	size_t completed_;
+	size_t expired_;
+	size_t rejected_;
+};
+
+}
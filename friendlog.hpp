@@ -0,0 +1,201 @@
+/*
+ * friendlog.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * A friend list entry, (id, (hostname, port)), as the friend list messages carry it.  As a change,
+ * an entry with an empty hostname removes the friend.
+ */
+typedef pair<string, pair<string, string> > FriendEntry;
+
+/**
+ * FriendLog versions a client's friend list for the peers that keep a copy of it: every change
+ * bumps the version and is kept in a log of the last capacity changes, so a peer that saw some
+ * version can be sent only the changes since, each friend's last change only.  A peer further
+ * behind is sent the list itself, which is kept here too, in ID order, a page at a time.
+ *
+ * Versions start over in every run of the client, so they are qualified by an epoch chosen at
+ * random; a peer holding a version of another epoch has to sync in full, as one too far behind.
+ */
+class FriendLog : private boost::noncopyable {
+public:
+	FriendLog(size_t capacity = 1024) : capacity_(capacity), epoch_(makeEpoch()), version_(0) { }
+
+	boost::uint32_t getEpoch() const { return epoch_; }
+
+	boost::uint32_t getVersion() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return version_;
+	}
+
+	void recordAdd(const string &id, const string &hostname, const string &port) {
+		record(FriendEntry(id, make_pair(hostname, port)));
+	}
+
+	void recordRemove(const string &id) {
+		record(FriendEntry(id, pair<string, string>()));
+	}
+
+	/**
+	 * The changes after version, in ID order, into changes, and the version they lead to into
+	 * current; false if the log does not reach back that far.
+	 */
+	bool getChangesSince(boost::uint32_t version, vector<FriendEntry> &changes, boost::uint32_t &current) const {
+		boost::mutex::scoped_lock lock(mutex_);
+		current = version_;
+		if (version > version_ || version_ - version > log_.size())
+			return false;
+		map<string, const FriendEntry *> latest;
+		for (size_t i = log_.size() - (version_ - version); i < log_.size(); ++i) {
+			latest[log_[i].first] = &log_[i];
+		}
+		changes.clear();
+		changes.reserve(latest.size());
+		for (map<string, const FriendEntry *>::const_iterator iter = latest.begin(); iter != latest.end(); ++iter) {
+			changes.push_back(*iter->second);
+		}
+		return true;
+	}
+
+	/**
+	 * The at most pageSize friends after the ID after (from the first if it is empty) into page,
+	 * and the version of the list into current; true if more follow.
+	 */
+	bool getPage(const string &after, size_t pageSize, vector<FriendEntry> &page, boost::uint32_t &current) const {
+		boost::mutex::scoped_lock lock(mutex_);
+		current = version_;
+		map<string, pair<string, string> >::const_iterator iter = after.empty() ? entries_.begin() : entries_.upper_bound(after);
+		page.clear();
+		for (; iter != entries_.end() && page.size() < pageSize; ++iter) {
+			page.push_back(*iter);
+		}
+		return iter != entries_.end();
+	}
+private:
+	void record(const FriendEntry &change) {
+		boost::mutex::scoped_lock lock(mutex_);
+		if (change.second.first.empty()) {
+			entries_.erase(change.first);
+		} else {
+			entries_[change.first] = change.second;
+		}
+		log_.push_back(change);
+		if (log_.size() > capacity_)
+			log_.pop_front();
+		++version_;
+	}
+
+	static boost::uint32_t makeEpoch() {
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		boost::uint64_t x = (boost::uint64_t)(now - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds();
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return (boost::uint32_t)(x ^ (x >> 31)) | 1; // never 0, which stands for no epoch at all
+	}
+
+	const size_t capacity_;
+	const boost::uint32_t epoch_;
+
+	mutable boost::mutex mutex_;
+	boost::uint32_t version_;
+	deque<FriendEntry> log_; // the changes leading to version_, the last one last
+	map<string, pair<string, string> > entries_;
+};
+
+/**
+ * FriendListReplica is the copy of a peer's friend list kept to sync with it.  A full sync comes
+ * in pages, in ID order, each asked for after the last ID of the previous one; the copy is taken
+ * over once the last page has arrived.  Pages may come from different versions of the list, so the
+ * copy is given the version of the first page and the changes since are asked for at once.
+ */
+class FriendListReplica {
+public:
+	FriendListReplica() : epoch_(0), version_(0), pagingEpoch_(0), pagingVersion_(0), paging_(false) { }
+
+	// what to ask for: 0 for the epoch if the replica has never been complete
+	boost::uint32_t getEpoch() const { return epoch_; }
+	boost::uint32_t getVersion() const { return version_; }
+	const map<string, pair<string, string> > &getEntries() const { return entries_; }
+
+	// apply the changes from base to version; false if they do not follow from what the replica holds
+	bool applyChanges(boost::uint32_t epoch, boost::uint32_t base, boost::uint32_t version, const vector<FriendEntry> &changes) {
+		// changes since an older version hold the newer ones too, each friend being set to its last state
+		if (epoch != epoch_ || base > version_ || version < version_)
+			return false;
+		for (vector<FriendEntry>::const_iterator iter = changes.begin(); iter != changes.end(); ++iter) {
+			if (iter->second.first.empty()) {
+				entries_.erase(iter->first);
+			} else {
+				entries_[iter->first] = iter->second;
+			}
+		}
+		version_ = version;
+		return true;
+	}
+
+	/**
+	 * Add a page of a full sync; first tells whether it is the first page.  Returns true once the
+	 * last page is in, when the replica has been replaced; pageVersion is then set to the version
+	 * of the last page, and if it differs from getVersion() the changes in between are due.
+	 */
+	bool applyPage(boost::uint32_t epoch, boost::uint32_t version, bool first, bool more, const vector<FriendEntry> &entries,
+	               boost::uint32_t &pageVersion) {
+		if (first) {
+			staging_.clear();
+			pagingEpoch_ = epoch;
+			pagingVersion_ = version;
+			paging_ = true;
+		} else if (!paging_ || epoch != pagingEpoch_) {
+			return false;
+		} else {
+			pagingVersion_ = min(pagingVersion_, version);
+		}
+		for (vector<FriendEntry>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+			staging_[iter->first] = iter->second;
+		}
+		if (more)
+			return false;
+		entries_.swap(staging_);
+		staging_.clear();
+		epoch_ = pagingEpoch_;
+		version_ = pagingVersion_;
+		paging_ = false;
+		pageVersion = version;
+		return true;
+	}
+
+	// the ID to ask the next page after; empty if no full sync is going on
+	string getPagingCursor() const {
+		return paging_ && !staging_.empty() ? staging_.rbegin()->first : string();
+	}
+private:
+	boost::uint32_t epoch_;
+	boost::uint32_t version_;
+	map<string, pair<string, string> > entries_;
+
+	boost::uint32_t pagingEpoch_;
+	boost::uint32_t pagingVersion_;
+	bool paging_;
+	map<string, pair<string, string> > staging_;
+};
+
+}
@@ -0,0 +1,557 @@
+/*
+ * groupindex.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "peertable.hpp"
+#include "snapshotmap.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * HandleSet is a compressed set of PeerHandles in the manner of a roaring bitmap: handles are
+ * split by the upper 8 bits of their slot into containers, each a sorted array of the lower 16
+ * bits while it holds at most 4096 of them, and a 65536-bit bitmap beyond that.  Slots are dense,
+ * so a large group costs about one bit per peer in the table and a small one two bytes per member.
+ * The generation of a handle is kept beside, in a sorted list of the members whose generation is
+ * not 0, and membership compares the full handle.
+ *
+ * A set holds at most one handle per slot: the handles it is given are references held by the
+ * caller, and a slot is only reused, with the next generation, once its last reference is gone.
+ *
+ * Containers are immutable and shared between copies; changing a copy clones only the
+ * container it touches, so a set can be copied, changed and published cheaply.
+ */
+class HandleSet {
+public:
+	HandleSet() : size_(0) { }
+
+	// a set of the given handles, in any order and possibly repeated, built in one pass
+	explicit HandleSet(vector<PeerHandle> handles) : size_(0) {
+		sort(handles.begin(), handles.end(), isBelow);
+		handles.erase(unique(handles.begin(), handles.end(), isSameSlot), handles.end());
+		vector<PeerHandle>::const_iterator iter = handles.begin();
+		while (iter != handles.end()) {
+			boost::uint8_t key = keyOf(*iter);
+			vector<PeerHandle>::const_iterator next = iter;
+			while (next != handles.end() && keyOf(*next) == key) {
+				++next;
+			}
+			add(Container::build(key, iter, next));
+			iter = next;
+		}
+	}
+
+	bool contains(PeerHandle handle) const {
+		const Container *container = findContainer(keyOf(handle));
+		return container && container->contains(handle);
+	}
+
+	// false if handle is already a member; an earlier generation of its slot is replaced
+	bool insert(PeerHandle handle) {
+		boost::uint8_t key = keyOf(handle);
+		vector<containerPointer>::iterator position = lowerBound(key);
+		if (position == containers_.end() || (*position)->key != key) {
+			boost::shared_ptr<Container> container = boost::make_shared<Container>(key);
+			container->insert(handle);
+			containers_.insert(position, container);
+		} else if ((*position)->hasValue(valueOf(handle))) {
+			if ((*position)->contains(handle))
+				return false;
+			boost::shared_ptr<Container> container = boost::make_shared<Container>(**position);
+			container->setGeneration(valueOf(handle), generationOf(handle));
+			*position = container;
+			return true;
+		} else {
+			boost::shared_ptr<Container> container = boost::make_shared<Container>(**position);
+			container->insert(handle);
+			*position = container;
+		}
+		++size_;
+		return true;
+	}
+
+	// false if handle is not a member
+	bool erase(PeerHandle handle) {
+		boost::uint8_t key = keyOf(handle);
+		vector<containerPointer>::iterator position = lowerBound(key);
+		if (position == containers_.end() || (*position)->key != key || !(*position)->contains(handle))
+			return false;
+		if ((*position)->cardinality == 1) {
+			containers_.erase(position);
+		} else {
+			boost::shared_ptr<Container> container = boost::make_shared<Container>(**position);
+			container->erase(valueOf(handle));
+			*position = container;
+		}
+		--size_;
+		return true;
+	}
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	// append the members, in ascending order of their slots
+	void appendTo(vector<PeerHandle> &handles) const {
+		handles.reserve(handles.size() + size_);
+		for (size_t i = 0; i < containers_.size(); ++i) {
+			containers_[i]->appendTo(handles);
+		}
+	}
+
+	// members of a that are not in b
+	static HandleSet difference(const HandleSet &a, const HandleSet &b) {
+		HandleSet result;
+		for (size_t i = 0; i < a.containers_.size(); ++i) {
+			const Container *other = b.findContainer(a.containers_[i]->key);
+			if (!other) {
+				result.add(a.containers_[i]); // untouched, shared
+			} else {
+				result.add(Container::combine(*a.containers_[i], *other, OPERATION_DIFFERENCE));
+			}
+		}
+		return result;
+	}
+
+	// members of both a and b
+	static HandleSet intersection(const HandleSet &a, const HandleSet &b) {
+		HandleSet result;
+		for (size_t i = 0; i < a.containers_.size(); ++i) {
+			const Container *other = b.findContainer(a.containers_[i]->key);
+			if (other)
+				result.add(Container::combine(*a.containers_[i], *other, OPERATION_INTERSECTION));
+		}
+		return result;
+	}
+
+	// members of a or b; where both hold a slot under different generations, a's handle is kept
+	static HandleSet unite(const HandleSet &a, const HandleSet &b) {
+		HandleSet result;
+		size_t i = 0, j = 0;
+		while (i < a.containers_.size() || j < b.containers_.size()) {
+			if (j == b.containers_.size() || (i < a.containers_.size() && a.containers_[i]->key < b.containers_[j]->key)) {
+				result.add(a.containers_[i++]);
+			} else if (i == a.containers_.size() || b.containers_[j]->key < a.containers_[i]->key) {
+				result.add(b.containers_[j++]);
+			} else {
+				result.add(Container::combine(*a.containers_[i++], *b.containers_[j++], OPERATION_UNION));
+			}
+		}
+		return result;
+	}
+
+	// approximate bytes used, shared containers counted in full
+	size_t getMemoryUsage() const {
+		size_t size = sizeof(*this) + containers_.capacity() * sizeof(containerPointer);
+		for (size_t i = 0; i < containers_.size(); ++i) {
+			size += sizeof(Container) + containers_[i]->array.capacity() * sizeof(boost::uint16_t) +
+			        containers_[i]->bitmap.capacity() * sizeof(boost::uint64_t) +
+			        containers_[i]->generations.capacity() * sizeof(boost::uint32_t);
+		}
+		return size;
+	}
+private:
+	enum Operation {
+		OPERATION_DIFFERENCE,
+		OPERATION_INTERSECTION,
+		OPERATION_UNION
+	};
+
+	static const size_t maxArraySize = 4096; // beyond this a bitmap (8 KiB) is smaller
+	static const size_t bitmapWords = 65536 / 64;
+
+	// a handle is its generation, then the key of its container, then its value within it
+	static boost::uint8_t keyOf(PeerHandle handle) { return (boost::uint8_t)((handle & PeerTable::slotMask) >> 16); }
+	static boost::uint16_t valueOf(PeerHandle handle) { return (boost::uint16_t)(handle & 0xFFFF); }
+	static boost::uint8_t generationOf(PeerHandle handle) { return (boost::uint8_t)(handle >> PeerTable::slotBits); }
+	static bool isBelow(PeerHandle a, PeerHandle b) {
+		return (a & PeerTable::slotMask) < (b & PeerTable::slotMask) || ((a & PeerTable::slotMask) == (b & PeerTable::slotMask) && a < b);
+	}
+	static bool isSameSlot(PeerHandle a, PeerHandle b) { return (a & PeerTable::slotMask) == (b & PeerTable::slotMask); }
+
+	struct Container {
+		Container(boost::uint8_t k) : key(k), cardinality(0) { }
+
+		// the container of handles [first, last), ascending by slot, one per slot, all of key
+		static boost::shared_ptr<Container> build(boost::uint8_t key, vector<PeerHandle>::const_iterator first,
+		                                          vector<PeerHandle>::const_iterator last) {
+			boost::shared_ptr<Container> container = boost::make_shared<Container>(key);
+			container->array.reserve(last - first);
+			for (; first != last; ++first) {
+				container->array.push_back(valueOf(*first)); // ascending, so appended in order
+				if (generationOf(*first) != 0)
+					container->generations.push_back((boost::uint32_t)valueOf(*first) << 8 | generationOf(*first));
+			}
+			container->cardinality = container->array.size();
+			if (container->cardinality > maxArraySize)
+				container->toBitmap();
+			return container;
+		}
+
+		// whether some generation of the slot is a member
+		bool hasValue(boost::uint16_t value) const {
+			if (!bitmap.empty())
+				return (bitmap[value >> 6] >> (value & 63)) & 1;
+			return binary_search(array.begin(), array.end(), value);
+		}
+
+		bool contains(PeerHandle handle) const {
+			return hasValue(valueOf(handle)) && getGeneration(valueOf(handle)) == generationOf(handle);
+		}
+
+		boost::uint8_t getGeneration(boost::uint16_t value) const {
+			vector<boost::uint32_t>::const_iterator iter = lower_bound(generations.begin(), generations.end(), (boost::uint32_t)value << 8);
+			return iter != generations.end() && (*iter >> 8) == value ? (boost::uint8_t)*iter : 0;
+		}
+
+		void setGeneration(boost::uint16_t value, boost::uint8_t generation) {
+			vector<boost::uint32_t>::iterator iter = lower_bound(generations.begin(), generations.end(), (boost::uint32_t)value << 8);
+			bool listed = iter != generations.end() && (*iter >> 8) == value;
+			if (generation == 0) {
+				if (listed)
+					generations.erase(iter);
+			} else if (listed) {
+				*iter = (boost::uint32_t)value << 8 | generation;
+			} else {
+				generations.insert(iter, (boost::uint32_t)value << 8 | generation);
+			}
+		}
+
+		// the slot of handle must not be a member yet
+		void insert(PeerHandle handle) {
+			boost::uint16_t value = valueOf(handle);
+			if (!bitmap.empty()) {
+				bitmap[value >> 6] |= (boost::uint64_t)1 << (value & 63);
+			} else {
+				array.insert(lower_bound(array.begin(), array.end(), value), value);
+				if (array.size() > maxArraySize)
+					toBitmap();
+			}
+			setGeneration(value, generationOf(handle));
+			++cardinality;
+		}
+
+		void erase(boost::uint16_t value) {
+			setGeneration(value, 0);
+			if (!bitmap.empty()) {
+				bitmap[value >> 6] &= ~((boost::uint64_t)1 << (value & 63));
+				if (cardinality - 1 <= maxArraySize) {
+					--cardinality;
+					toArray();
+					return;
+				}
+			} else {
+				array.erase(lower_bound(array.begin(), array.end(), value));
+			}
+			--cardinality;
+		}
+
+		void appendTo(vector<PeerHandle> &handles) const {
+			PeerHandle high = (PeerHandle)key << 16;
+			vector<boost::uint32_t>::const_iterator generation = generations.begin();
+			if (bitmap.empty()) {
+				for (size_t i = 0; i < array.size(); ++i) {
+					handles.push_back(withGeneration(high | array[i], generation));
+				}
+				return;
+			}
+			for (size_t word = 0; word < bitmapWords; ++word) {
+				boost::uint64_t bits = bitmap[word];
+				while (bits) {
+					handles.push_back(withGeneration(high | (PeerHandle)(word * 64 + countTrailingZeros(bits)), generation));
+					bits &= bits - 1;
+				}
+			}
+		}
+
+		// slot with its generation, taken from the list at generation, which follows the ascending slots
+		PeerHandle withGeneration(PeerHandle slot, vector<boost::uint32_t>::const_iterator &generation) const {
+			if (generation == generations.end() || *generation >> 8 != (slot & 0xFFFF))
+				return slot;
+			return (PeerHandle)(*generation++ & 0xFF) << PeerTable::slotBits | slot;
+		}
+
+		void toBitmap() {
+			bitmap.assign(bitmapWords, 0);
+			for (size_t i = 0; i < array.size(); ++i) {
+				bitmap[array[i] >> 6] |= (boost::uint64_t)1 << (array[i] & 63);
+			}
+			vector<boost::uint16_t>().swap(array);
+		}
+
+		void toArray() {
+			array.clear();
+			array.reserve(cardinality);
+			for (size_t word = 0; word < bitmapWords; ++word) {
+				boost::uint64_t bits = bitmap[word];
+				while (bits) {
+					array.push_back((boost::uint16_t)(word * 64 + countTrailingZeros(bits)));
+					bits &= bits - 1;
+				}
+			}
+			vector<boost::uint64_t>().swap(bitmap);
+		}
+
+		static boost::shared_ptr<Container> combine(const Container &a, const Container &b, Operation operation) {
+			if (!a.bitmap.empty() && !b.bitmap.empty() && a.generations.empty() && b.generations.empty()) {
+				// word at a time, every member being of generation 0
+				boost::shared_ptr<Container> result = boost::make_shared<Container>(a.key);
+				result->bitmap.resize(bitmapWords);
+				for (size_t word = 0; word < bitmapWords; ++word) {
+					boost::uint64_t bits = operation == OPERATION_DIFFERENCE ? a.bitmap[word] & ~b.bitmap[word] :
+					                       operation == OPERATION_INTERSECTION ? a.bitmap[word] & b.bitmap[word] :
+					                       a.bitmap[word] | b.bitmap[word];
+					result->bitmap[word] = bits;
+					result->cardinality += countBits(bits);
+				}
+				if (result->cardinality <= maxArraySize)
+					result->toArray();
+				return result;
+			}
+			// merged by slot, the full handles deciding whether a slot is in both
+			vector<PeerHandle> left, right, merged;
+			a.appendTo(left);
+			b.appendTo(right);
+			size_t i = 0, j = 0;
+			while (i < left.size() && j < right.size()) {
+				PeerHandle leftSlot = left[i] & PeerTable::slotMask, rightSlot = right[j] & PeerTable::slotMask;
+				if (leftSlot < rightSlot) {
+					if (operation != OPERATION_INTERSECTION)
+						merged.push_back(left[i]);
+					++i;
+				} else if (rightSlot < leftSlot) {
+					if (operation == OPERATION_UNION)
+						merged.push_back(right[j]);
+					++j;
+				} else {
+					bool same = left[i] == right[j];
+					if (operation == OPERATION_UNION || (operation == OPERATION_INTERSECTION && same) ||
+					    (operation == OPERATION_DIFFERENCE && !same))
+						merged.push_back(left[i]);
+					++i;
+					++j;
+				}
+			}
+			if (operation != OPERATION_INTERSECTION)
+				merged.insert(merged.end(), left.begin() + i, left.end());
+			if (operation == OPERATION_UNION)
+				merged.insert(merged.end(), right.begin() + j, right.end());
+			return build(a.key, merged.begin(), merged.end());
+		}
+
+		boost::uint8_t key; // upper 8 bits of the slots in this container
+		size_t cardinality;
+		vector<boost::uint16_t> array;   // sorted, while cardinality <= maxArraySize
+		vector<boost::uint64_t> bitmap;  // bitmapWords words otherwise
+		vector<boost::uint32_t> generations; // value << 8 | generation of the members not of generation 0, sorted
+	};
+
+	typedef boost::shared_ptr<const Container> containerPointer;
+
+	vector<containerPointer>::iterator lowerBound(boost::uint8_t key) {
+		vector<containerPointer>::iterator first = containers_.begin();
+		size_t count = containers_.size();
+		while (count > 0) {
+			size_t half = count / 2;
+			if (first[half]->key < key) {
+				first += half + 1;
+				count -= half + 1;
+			} else {
+				count = half;
+			}
+		}
+		return first;
+	}
+
+	const Container *findContainer(boost::uint8_t key) const {
+		vector<containerPointer>::iterator position = const_cast<HandleSet *>(this)->lowerBound(key);
+		return position != containers_.end() && (*position)->key == key ? position->get() : 0;
+	}
+
+	// append a container with a key above all present ones, unless it is empty
+	void add(const containerPointer &container) {
+		if (container->cardinality == 0)
+			return;
+		containers_.push_back(container);
+		size_ += container->cardinality;
+	}
+
+	static unsigned countTrailingZeros(boost::uint64_t bits) {
+#ifdef __GNUC__
+		return __builtin_ctzll(bits);
+#else
+		unsigned count = 0;
+		while (!(bits & 1)) {
+			bits >>= 1;
+			++count;
+		}
+		return count;
+#endif
+	}
+
+	static unsigned countBits(boost::uint64_t bits) {
+#ifdef __GNUC__
+		return __builtin_popcountll(bits);
+#else
+		unsigned count = 0;
+		for (; bits; bits &= bits - 1) {
+			++count;
+		}
+		return count;
+#endif
+	}
+
+	vector<containerPointer> containers_; // ascending by key
+	size_t size_;
+};
+
+/**
+ * GroupIndex maps group IDs to their members.  Like the other contact structures it may be read
+ * and changed from several threads: readers take an immutable snapshot of a group's members
+ * without waiting, and changing one group never copies or holds up the others.
+ */
+class GroupIndex : private boost::noncopyable {
+public:
+	typedef boost::shared_ptr<const HandleSet> membersType;
+
+	// false if the group already exists
+	bool addGroup(const string &id) {
+		return groups_.insert(id, boost::make_shared<Group>());
+	}
+
+	// false if there is no such group; the members it had are appended to members
+	bool deleteGroup(const string &id, vector<PeerHandle> &members) {
+		boost::shared_ptr<Group> group = getGroup(id);
+		if (!group)
+			return false;
+		boost::mutex::scoped_lock lock(group->writeMutex);
+		if (group->deleted || !groups_.erase(id))
+			return false;
+		// nobody adds to the group once it is marked
+		group->deleted = true;
+		group->snapshot()->appendTo(members);
+		return true;
+	}
+
+	bool hasGroup(const string &id) const {
+		return groups_.contains(id);
+	}
+
+	// false if there is no such group or the peer already is a member
+	bool addMember(const string &id, PeerHandle member) {
+		boost::shared_ptr<Group> group = getGroup(id);
+		if (!group)
+			return false;
+		boost::mutex::scoped_lock lock(group->writeMutex);
+		HandleSet next(*group->snapshot());
+		if (group->deleted || !next.insert(member))
+			return false;
+		group->publish(next);
+		return true;
+	}
+
+	/**
+	 * Add many members at once, far cheaper than one by one, appending those that were not members
+	 * yet to added; false if there is no such group
+	 */
+	bool addMembers(const string &id, const vector<PeerHandle> &members, vector<PeerHandle> &added) {
+		boost::shared_ptr<Group> group = getGroup(id);
+		if (!group)
+			return false;
+		boost::mutex::scoped_lock lock(group->writeMutex);
+		if (group->deleted)
+			return false;
+		membersType current = group->snapshot();
+		HandleSet joining(members);
+		vector<PeerHandle> handles;
+		joining.appendTo(handles);
+		for (vector<PeerHandle>::const_iterator iter = handles.begin(); iter != handles.end(); ++iter) {
+			if (!current->contains(*iter))
+				added.push_back(*iter);
+		}
+		group->publish(HandleSet::unite(*current, joining));
+		return true;
+	}
+
+	// false if there is no such group or the peer is not a member
+	bool deleteMember(const string &id, PeerHandle member) {
+		boost::shared_ptr<Group> group = getGroup(id);
+		if (!group)
+			return false;
+		boost::mutex::scoped_lock lock(group->writeMutex);
+		HandleSet next(*group->snapshot());
+		if (!next.erase(member))
+			return false;
+		group->publish(next);
+		return true;
+	}
+
+	bool hasMember(const string &id, PeerHandle member) const {
+		membersType members = getMembers(id);
+		return members && members->contains(member);
+	}
+
+	// the members of a group, or a null pointer if there is no such group
+	membersType getMembers(const string &id) const {
+		boost::shared_ptr<Group> group = getGroup(id);
+		return group ? group->snapshot() : membersType();
+	}
+
+	vector<string> getGroupIDs() const {
+		groupMapType::snapshotType groups = groups_.snapshot();
+		vector<string> ids;
+		ids.reserve(groups->size());
+		for (map<string, boost::shared_ptr<Group> >::const_iterator iter = groups->begin(); iter != groups->end(); ++iter) {
+			ids.push_back(iter->first);
+		}
+		return ids;
+	}
+
+	size_t getSize() const { return groups_.size(); }
+
+	// approximate bytes used by the member sets
+	size_t getMemoryUsage() const {
+		groupMapType::snapshotType groups = groups_.snapshot();
+		size_t size = 0;
+		for (map<string, boost::shared_ptr<Group> >::const_iterator iter = groups->begin(); iter != groups->end(); ++iter) {
+			size += sizeof(Group) + iter->first.capacity() + iter->second->snapshot()->getMemoryUsage();
+		}
+		return size;
+	}
+private:
+	struct Group {
+		Group() : members(boost::make_shared<HandleSet>()), deleted(false) { }
+		membersType snapshot() const { return boost::atomic_load(&members); }
+		void publish(const HandleSet &next) { boost::atomic_store(&members, membersType(boost::make_shared<HandleSet>(next))); }
+
+		membersType members; // only accessed through atomic_load/atomic_store
+		boost::mutex writeMutex;
+		bool deleted;        // guarded by writeMutex
+	};
+
+	typedef SnapshotMap<string, boost::shared_ptr<Group> > groupMapType;
+
+	boost::shared_ptr<Group> getGroup(const string &id) const {
+		boost::shared_ptr<Group> group;
+		groups_.find(id, group);
+		return group;
+	}
+
+	groupMapType groups_;
+};
+
+}
@@ -0,0 +1,547 @@
+/*
+ * historystore.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+#include "searchindex.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * HistoryStore keeps every message sent and received, by conversation: a contact ("@id"), a group
+ * ("#id") or the broadcasts ("*").  Messages are appended to a log split into segments of
+ * segmentSize bytes; every conversation has an index of fixed size entries, the time and the
+ * position of each of its messages, in order.  A query maps the conversation's index and
+ * binary searches it, then reads only the messages it returns, however long the log has grown.
+ *
+ * append() only queues the message: a background thread writes whatever has been queued in one
+ * batch, so recording a message never waits for the disk.  If the writer falls maxPending messages
+ * behind, further messages are dropped, and counted, rather than held up.
+ *
+ * Messages are also numbered in the order written: "messages.index" holds the position of each,
+ * and the writer feeds them to a SearchIndex, so search() finds messages by their words.  What the
+ * search index had not written out when the store was last closed is indexed again on opening.
+ */
+class HistoryStore : private boost::noncopyable {
+public:
+	enum Direction {
+		DIRECTION_RECEIVED = 0,
+		DIRECTION_SENT = 1
+	};
+
+	struct Entry {
+		boost::int64_t time; // microseconds since the epoch, UTC
+		Direction direction;
+		string conversation;
+		string fromID;
+		string text;
+	};
+
+	static string peerConversation(const string &id) { return "@" + id; }
+	static string groupConversation(const string &id) { return "#" + id; }
+	static string broadcastConversation() { return "*"; }
+
+	HistoryStore(const string &directory, size_t segmentSize = 16 << 20, size_t maxPending = 1 << 16)
+		: directory_(directory), segmentSize_(segmentSize), maxPending_(maxPending),
+		  segment_(0), segmentFile_(0), segmentOffset_(0), messagesFile_(0), messageCount_(0), indexedCount_(0),
+		  search_(directory), appended_(0), written_(0), stopping_(true),
+		  appendedCount_(0), writtenCount_(0), droppedCount_(0), batchCount_(0) { }
+
+	~HistoryStore() {
+		close();
+	}
+
+	// open the log where it ends and start the writer; false if the directory cannot be used
+	bool open() {
+#if defined(__unix__) || defined(__APPLE__)
+		mkdir(directory_.c_str(), 0755);
+#endif
+		// continue in the last segment
+		boost::uint64_t size;
+		boost::int64_t modificationTime;
+		segment_ = 0;
+		while (MappedFile::getStatus(getSegmentFileName(segment_ + 1), size, modificationTime)) {
+			++segment_;
+		}
+		if (!openSegment(segment_))
+			return false;
+
+		// a crash may have torn the last position; the message is in the log, but cannot be found
+		messageCount_ = 0;
+		if (MappedFile::getStatus(getMessagesFileName(), size, modificationTime)) {
+			messageCount_ = (boost::uint32_t)(size / messageEntrySize);
+#if defined(__unix__) || defined(__APPLE__)
+			if (size % messageEntrySize != 0 && truncate(getMessagesFileName().c_str(), messageCount_ * messageEntrySize) != 0) {
+				// positions appended after the torn one are off, searches skip what they do not match
+			}
+#endif
+		}
+		messagesFile_ = fopen(getMessagesFileName().c_str(), "ab");
+		indexedCount_ = search_.open();
+		if (indexedCount_ > messageCount_) {
+			search_.clear(); // the positions were lost, the index points at nothing
+			indexedCount_ = 0;
+		}
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = false;
+		writer_ = boost::thread(boost::bind(&HistoryStore::write, this));
+		return true;
+	}
+
+	// write what is queued and stop the writer
+	void close() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			pendingCondition_.notify_all();
+		}
+		if (writer_.joinable())
+			writer_.join();
+		search_.close();
+		if (messagesFile_) {
+			fclose(messagesFile_);
+			messagesFile_ = 0;
+		}
+		for (map<string, FILE *>::iterator iter = indexFiles_.begin(); iter != indexFiles_.end(); ++iter) {
+			fclose(iter->second);
+		}
+		indexFiles_.clear();
+		if (segmentFile_) {
+			fclose(segmentFile_);
+			segmentFile_ = 0;
+		}
+	}
+
+	// queue a message for writing; false if it was dropped
+	bool append(const string &conversation, Direction direction, const string &fromID, const string &text) {
+		Entry entry;
+		entry.time = getCurrentTime();
+		entry.direction = direction;
+		entry.conversation = conversation;
+		entry.fromID = fromID;
+		entry.text = text;
+		boost::mutex::scoped_lock lock(mutex_);
+		if (stopping_ || pending_.size() >= maxPending_) {
+			++droppedCount_;
+			return false;
+		}
+		pending_.push_back(entry);
+		++appended_;
+		++appendedCount_;
+		pendingCondition_.notify_one();
+		return true;
+	}
+
+	// the last count messages of a conversation, oldest first
+	vector<Entry> getLast(const string &conversation, size_t count) {
+		waitForWrites();
+		MappedFile index(getIndexFileName(conversation));
+		size_t entries = index.size() / indexEntrySize;
+		size_t first = entries > count ? entries - count : 0;
+		return readEntries(conversation, index, first, entries);
+	}
+
+	// the messages of a conversation from time from up to, not including, time to, at most limit of them
+	vector<Entry> getRange(const string &conversation, boost::int64_t from, boost::int64_t to, size_t limit = 1000) {
+		waitForWrites();
+		MappedFile index(getIndexFileName(conversation));
+		size_t entries = index.size() / indexEntrySize;
+		size_t first = lowerBound(index, entries, from);
+		size_t last = lowerBound(index, entries, to);
+		if (last > first + limit)
+			last = first + limit;
+		return readEntries(conversation, index, first, last);
+	}
+
+	/**
+	 * The messages, of any conversation, containing every word of query, newest first, at most
+	 * limit of them.  Words are matched whole and regardless of case, see SearchIndex.
+	 */
+	vector<Entry> search(const string &query, size_t limit = 20) {
+		waitForWrites();
+		vector<SearchIndex::DocID> messages = search_.search(query, limit);
+		vector<Entry> entries;
+		entries.reserve(messages.size());
+		MappedFile positions(getMessagesFileName());
+		FILE *file = 0;
+		boost::uint32_t openSegmentNumber = 0;
+		for (vector<SearchIndex::DocID>::const_iterator iter = messages.begin(); iter != messages.end(); ++iter) {
+			if ((size_t)(*iter + 1) * messageEntrySize > positions.size())
+				continue;
+			const unsigned char *p = (const unsigned char *)positions.data() + (size_t)*iter * messageEntrySize;
+			boost::uint32_t segment = readUint32(p);
+			if (!file || segment != openSegmentNumber) {
+				if (file)
+					fclose(file);
+				file = fopen(getSegmentFileName(segment).c_str(), "rb");
+				openSegmentNumber = segment;
+				if (!file)
+					continue;
+			}
+			Entry entry;
+			if (readRecord(file, readUint32(p + 4), entry))
+				entries.push_back(entry);
+		}
+		if (file)
+			fclose(file);
+		return entries;
+	}
+
+	static boost::int64_t getCurrentTime() {
+		static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+		return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+	}
+
+	// statistics
+	size_t getAppendedCount() const { return appendedCount_.load(); }
+	size_t getWrittenCount() const { return writtenCount_.load(); }
+	size_t getDroppedCount() const { return droppedCount_.load(); }
+	size_t getBatchCount() const { return batchCount_.load(); }
+	size_t getSearchIndexedCount() const { return search_.getIndexedCount(); }
+	size_t getSearchIndexingTime() const { return search_.getIndexingTime(); } // microseconds
+private:
+	static const size_t indexEntrySize = 16; // time (8), segment (4), offset (4)
+	static const size_t messageEntrySize = 8; // segment (4), offset (4)
+	static const size_t maxOpenIndexFiles = 256;
+
+	// the writer loop: everything queued since the last round is written with one write per file
+	void write() {
+		catchUpSearchIndex();
+		boost::mutex::scoped_lock lock(mutex_);
+		for (;;) {
+			while (pending_.empty() && !stopping_) {
+				pendingCondition_.wait(lock);
+			}
+			if (pending_.empty())
+				return;
+			vector<Entry> batch;
+			batch.swap(pending_);
+			boost::uint64_t last = appended_;
+			lock.unlock();
+
+			writeBatch(batch);
+			writtenCount_ += batch.size();
+			++batchCount_;
+
+			lock.lock();
+			written_ = last;
+			writtenCondition_.notify_all();
+		}
+	}
+
+	void writeBatch(const vector<Entry> &batch) {
+		string buffer;
+		map<string, string> indexes;
+		string positions;
+		for (vector<Entry>::const_iterator iter = batch.begin(); iter != batch.end(); ++iter) {
+			string record;
+			appendUint32(record, 0); // length, filled in below
+			appendUint64(record, (boost::uint64_t)iter->time);
+			record.push_back((char)iter->direction);
+			appendString(record, iter->conversation);
+			appendString(record, iter->fromID);
+			appendString(record, iter->text);
+			boost::uint32_t length = (boost::uint32_t)(record.size() - 4);
+			record[0] = (char)(length >> 24);
+			record[1] = (char)(length >> 16);
+			record[2] = (char)(length >> 8);
+			record[3] = (char)length;
+
+			if (segmentOffset_ + buffer.size() > 0 && segmentOffset_ + buffer.size() + record.size() > segmentSize_) {
+				flushSegment(buffer);
+				openSegment(segment_ + 1);
+			}
+
+			// times never go backwards within a conversation, so its index stays sorted
+			map<string, boost::int64_t>::iterator last = lastTimes_.find(iter->conversation);
+			if (last == lastTimes_.end())
+				last = lastTimes_.insert(make_pair(iter->conversation, getLastTime(iter->conversation))).first;
+			boost::int64_t &lastTime = last->second;
+			boost::int64_t time = iter->time > lastTime ? iter->time : lastTime;
+			lastTime = time;
+			string &index = indexes[iter->conversation];
+			appendUint64(index, (boost::uint64_t)time);
+			appendUint32(index, segment_);
+			appendUint32(index, (boost::uint32_t)(segmentOffset_ + buffer.size()));
+			appendUint32(positions, segment_);
+			appendUint32(positions, (boost::uint32_t)(segmentOffset_ + buffer.size()));
+			buffer.append(record);
+		}
+		flushSegment(buffer);
+		if (messagesFile_) {
+			fwrite(positions.data(), 1, positions.size(), messagesFile_);
+			fflush(messagesFile_);
+		}
+
+		// the records first, then the entries pointing at them
+		for (map<string, string>::const_iterator iter = indexes.begin(); iter != indexes.end(); ++iter) {
+			FILE *file = getIndexFile(iter->first);
+			if (file) {
+				fwrite(iter->second.data(), 1, iter->second.size(), file);
+				fflush(file);
+			}
+		}
+
+		for (vector<Entry>::const_iterator iter = batch.begin(); iter != batch.end(); ++iter) {
+			search_.add(messageCount_++, iter->text);
+		}
+		indexedCount_ = messageCount_;
+	}
+
+	// index the messages written before the search index was last written out
+	void catchUpSearchIndex() {
+		if (indexedCount_ >= messageCount_)
+			return;
+		MappedFile positions(getMessagesFileName());
+		FILE *file = 0;
+		boost::uint32_t openSegmentNumber = 0;
+		for (boost::uint32_t message = indexedCount_; message < messageCount_; ++message) {
+			const unsigned char *p = (const unsigned char *)positions.data() + (size_t)message * messageEntrySize;
+			boost::uint32_t segment = readUint32(p);
+			if (!file || segment != openSegmentNumber) {
+				if (file)
+					fclose(file);
+				file = fopen(getSegmentFileName(segment).c_str(), "rb");
+				openSegmentNumber = segment;
+			}
+			Entry entry;
+			// a message that cannot be read is still numbered, with no words
+			search_.add(message, file && readRecord(file, readUint32(p + 4), entry) ? entry.text : string());
+		}
+		if (file)
+			fclose(file);
+		indexedCount_ = messageCount_;
+	}
+
+	void flushSegment(string &buffer) {
+		if (segmentFile_ && !buffer.empty()) {
+			fwrite(buffer.data(), 1, buffer.size(), segmentFile_);
+			fflush(segmentFile_);
+		}
+		segmentOffset_ += buffer.size();
+		buffer.clear();
+	}
+
+	bool openSegment(boost::uint32_t segment) {
+		if (segmentFile_)
+			fclose(segmentFile_);
+		segment_ = segment;
+		segmentFile_ = fopen(getSegmentFileName(segment).c_str(), "ab");
+		if (!segmentFile_)
+			return false;
+		fseek(segmentFile_, 0, SEEK_END);
+		segmentOffset_ = (size_t)ftell(segmentFile_);
+		return true;
+	}
+
+	// the time of the last message of a conversation written before, 0 if there is none
+	boost::int64_t getLastTime(const string &conversation) const {
+		MappedFile index(getIndexFileName(conversation));
+		size_t entries = index.size() / indexEntrySize;
+		return entries ? (boost::int64_t)readUint64((const unsigned char *)index.data() + (entries - 1) * indexEntrySize) : 0;
+	}
+
+	FILE *getIndexFile(const string &conversation) {
+		map<string, FILE *>::iterator iter = indexFiles_.find(conversation);
+		if (iter != indexFiles_.end())
+			return iter->second;
+		if (indexFiles_.size() >= maxOpenIndexFiles) {
+			for (iter = indexFiles_.begin(); iter != indexFiles_.end(); ++iter) {
+				fclose(iter->second);
+			}
+			indexFiles_.clear();
+		}
+		FILE *file = fopen(getIndexFileName(conversation).c_str(), "ab");
+		if (file)
+			indexFiles_[conversation] = file;
+		return file;
+	}
+
+	void waitForWrites() {
+		boost::mutex::scoped_lock lock(mutex_);
+		boost::uint64_t target = appended_;
+		while (written_ < target) {
+			writtenCondition_.wait(lock);
+		}
+	}
+
+	// the first entry at or after time
+	static size_t lowerBound(const MappedFile &index, size_t entries, boost::int64_t time) {
+		size_t first = 0, count = entries;
+		while (count > 0) {
+			size_t half = count / 2;
+			if ((boost::int64_t)readUint64((const unsigned char *)index.data() + (first + half) * indexEntrySize) < time) {
+				first += half + 1;
+				count -= half + 1;
+			} else {
+				count = half;
+			}
+		}
+		return first;
+	}
+
+	vector<Entry> readEntries(const string &conversation, const MappedFile &index, size_t first, size_t last) const {
+		vector<Entry> entries;
+		entries.reserve(last - first);
+		FILE *file = 0;
+		boost::uint32_t openSegmentNumber = 0;
+		for (size_t i = first; i < last; ++i) {
+			const unsigned char *p = (const unsigned char *)index.data() + i * indexEntrySize;
+			boost::uint32_t segment = readUint32(p + 8);
+			boost::uint32_t offset = readUint32(p + 12);
+			if (!file || segment != openSegmentNumber) {
+				if (file)
+					fclose(file);
+				file = fopen(getSegmentFileName(segment).c_str(), "rb");
+				openSegmentNumber = segment;
+				if (!file)
+					continue;
+			}
+			Entry entry;
+			if (readRecord(file, offset, entry) && entry.conversation == conversation) {
+				entry.time = (boost::int64_t)readUint64(p); // as ordered in the index
+				entries.push_back(entry);
+			}
+		}
+		if (file)
+			fclose(file);
+		return entries;
+	}
+
+	// false if the record is not there, e.g. cut short by a crash
+	static bool readRecord(FILE *file, boost::uint32_t offset, Entry &entry) {
+		unsigned char header[4];
+		if (fseek(file, offset, SEEK_SET) != 0 || fread(header, 1, 4, file) != 4)
+			return false;
+		boost::uint32_t length = readUint32(header);
+		if (length < 8 + 1 + 12 || length > (64u << 20))
+			return false;
+		string record(length, '\0');
+		if (fread(&record[0], 1, length, file) != length)
+			return false;
+		const unsigned char *p = (const unsigned char *)record.data();
+		const unsigned char *end = p + length;
+		entry.time = (boost::int64_t)readUint64(p);
+		entry.direction = p[8] ? DIRECTION_SENT : DIRECTION_RECEIVED;
+		p += 9;
+		return readString(p, end, entry.conversation) && readString(p, end, entry.fromID) && readString(p, end, entry.text);
+	}
+
+	static bool readString(const unsigned char *&p, const unsigned char *end, string &value) {
+		if (end - p < 4)
+			return false;
+		boost::uint32_t length = readUint32(p);
+		p += 4;
+		if ((size_t)(end - p) < length)
+			return false;
+		value.assign((const char *)p, length);
+		p += length;
+		return true;
+	}
+
+	string getSegmentFileName(boost::uint32_t segment) const {
+		char name[32];
+		snprintf(name, sizeof(name), "/segment-%08u.log", (unsigned)segment);
+		return directory_ + name;
+	}
+
+	string getMessagesFileName() const {
+		return directory_ + "/messages.index";
+	}
+
+	// conversation names are escaped, so that any ID makes a valid file name
+	string getIndexFileName(const string &conversation) const {
+		static const char hex[] = "0123456789abcdef";
+		string name = directory_ + "/";
+		for (size_t i = 0; i < conversation.size(); ++i) {
+			unsigned char c = conversation[i];
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+				name.push_back(c);
+			} else {
+				name.push_back('%');
+				name.push_back(hex[c >> 4]);
+				name.push_back(hex[c & 15]);
+			}
+		}
+		return name + ".index";
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+
+	static boost::uint64_t readUint64(const unsigned char *p) {
+		return ((boost::uint64_t)readUint32(p) << 32) | readUint32(p + 4);
+	}
+
+	static void appendUint32(string &buffer, boost::uint32_t value) {
+		buffer.push_back((char)(value >> 24));
+		buffer.push_back((char)(value >> 16));
+		buffer.push_back((char)(value >> 8));
+		buffer.push_back((char)value);
+	}
+
+	static void appendUint64(string &buffer, boost::uint64_t value) {
+		appendUint32(buffer, (boost::uint32_t)(value >> 32));
+		appendUint32(buffer, (boost::uint32_t)value);
+	}
+
+	static void appendString(string &buffer, const string &value) {
+		appendUint32(buffer, (boost::uint32_t)value.size());
+		buffer.append(value);
+	}
+
+	const string directory_;
+	const size_t segmentSize_;
+	const size_t maxPending_;
+
+	// used by the writer only
+	boost::uint32_t segment_;
+	FILE *segmentFile_;
+	size_t segmentOffset_;
+	map<string, FILE *> indexFiles_;
+	map<string, boost::int64_t> lastTimes_;
+	FILE *messagesFile_;
+	boost::uint32_t messageCount_;
+	boost::uint32_t indexedCount_;
+	SearchIndex search_;
+
+	boost::mutex mutex_;
+	boost::condition_variable pendingCondition_;
+	boost::condition_variable writtenCondition_;
+	vector<Entry> pending_;
+	boost::uint64_t appended_;
+	boost::uint64_t written_;
+	bool stopping_;
+	boost::thread writer_;
+
+	boost::atomic<size_t> appendedCount_;
+	boost::atomic<size_t> writtenCount_;
+	boost::atomic<size_t> droppedCount_;
+	boost::atomic<size_t> batchCount_;
+};
+
+}
@@ -0,0 +1,346 @@
+/*
+ * journal.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <set>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * Journal is an append-only, crash-safe log of records.  Each record is framed with its length
+ * and a CRC-32, so a record torn by a crash is recognized and dropped, with everything after it.
+ *
+ * Appends are group committed: a background thread writes whatever has been appended since its
+ * last write and syncs the file once for all of it, and every append returns only once its record
+ * is on disk.  Concurrent appenders therefore share one fsync instead of paying one each.
+ *
+ * A journal file carries a generation.  rotate() sets the current file aside as the ".old" file
+ * and starts an empty one of the next generation, so a snapshot of everything up to the rotation
+ * can be written at leisure; replay() reads both files in order.
+ */
+class Journal : private boost::noncopyable {
+public:
+	// called with each record, in order
+	typedef boost::function<void (const string &)> replayCallbackType;
+
+	static const boost::uint32_t version = 1;
+	static const size_t headerSize = 16;
+
+	explicit Journal(const string &fileName)
+		: fileName_(fileName), file_(0), generation_(0), size_(0), nextSequence_(1), durableSequence_(0),
+		  writing_(false), stopping_(false), records_(0), syncs_(0), failures_(0) { }
+
+	~Journal() {
+		close();
+	}
+
+	/**
+	 * Apply the records of every journal file of generation at least minGeneration, the ".old" one
+	 * first; returns the number of records applied.  The highest generation found is left in
+	 * generation, unchanged if there is none.
+	 */
+	static size_t replay(const string &fileName, boost::uint64_t minGeneration, replayCallbackType apply, boost::uint64_t &generation) {
+		size_t count = 0;
+		size_t validSize;
+		boost::uint64_t fileGeneration;
+		if (readFile(fileName + ".old", minGeneration, apply, count, fileGeneration, validSize) && fileGeneration > generation)
+			generation = fileGeneration;
+		if (readFile(fileName, minGeneration, apply, count, fileGeneration, validSize) && fileGeneration > generation)
+			generation = fileGeneration;
+		return count;
+	}
+
+	/**
+	 * Open the journal for appending in the given generation: an existing file of that generation
+	 * is continued, without the torn tail a crash may have left, anything else is replaced.
+	 */
+	bool open(boost::uint64_t generation) {
+		close();
+		size_t count = 0;
+		size_t validSize = 0;
+		boost::uint64_t fileGeneration;
+		bool reuse = readFile(fileName_, generation, replayCallbackType(), count, fileGeneration, validSize) &&
+		             fileGeneration == generation;
+		FILE *file = 0;
+		if (reuse) {
+			truncateFile(fileName_, validSize);
+			file = fopen(fileName_.c_str(), "ab");
+		} else {
+			file = createFile(fileName_, generation);
+			validSize = headerSize;
+		}
+		if (!file)
+			return false;
+		boost::mutex::scoped_lock lock(mutex_);
+		file_ = file;
+		generation_ = generation;
+		size_ = validSize;
+		stopping_ = false;
+		writer_ = boost::thread(boost::bind(&Journal::write, this));
+		return true;
+	}
+
+	// wait for the records appended so far to reach the disk, and close the file
+	void close() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			pendingCondition_.notify_all();
+		}
+		if (writer_.joinable())
+			writer_.join();
+		boost::mutex::scoped_lock lock(mutex_);
+		if (file_) {
+			fclose(file_);
+			file_ = 0;
+		}
+	}
+
+	// append a record and wait until it is on disk; false if it could not be written
+	bool append(const string &record) {
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!file_ || stopping_)
+			return false;
+		pending_.push_back(record);
+		boost::uint64_t sequence = nextSequence_++;
+		size_ += 8 + record.size();
+		pendingCondition_.notify_one();
+		while (durableSequence_ < sequence) {
+			durableCondition_.wait(lock);
+		}
+		return failedSequences_.erase(sequence) == 0;
+	}
+
+	/**
+	 * Set the current file aside as the ".old" one, replacing an older one, and go on in a new,
+	 * empty file of the next generation, which is stored in generation.  Everything appended
+	 * before the rotation is in the ".old" file, everything after it in the new one.  False if
+	 * the file could not be set aside or replaced; then the journal goes on in the file it had.
+	 */
+	bool rotate(boost::uint64_t &generation) {
+		boost::mutex::scoped_lock lock(mutex_);
+		while (writing_ || !pending_.empty()) {
+			durableCondition_.wait(lock);
+		}
+		generation = generation_;
+		if (!file_)
+			return false;
+		fclose(file_);
+		file_ = 0;
+		string oldFileName = fileName_ + ".old";
+		if (rename(fileName_.c_str(), oldFileName.c_str()) != 0) {
+			file_ = fopen(fileName_.c_str(), "ab");
+			return false;
+		}
+		file_ = createFile(fileName_, generation_ + 1);
+		if (!file_) {
+			// keep going in the file we had; if it cannot be put back, appending fails from now on
+			if (rename(oldFileName.c_str(), fileName_.c_str()) == 0)
+				file_ = fopen(fileName_.c_str(), "ab");
+			return false;
+		}
+		generation = ++generation_;
+		size_ = headerSize;
+		return true;
+	}
+
+	// forget the ".old" file, once a snapshot holds what it recorded
+	void removeOld() {
+		remove((fileName_ + ".old").c_str());
+	}
+
+	const string &getFileName() const { return fileName_; }
+
+	boost::uint64_t getGeneration() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return generation_;
+	}
+
+	// bytes in the current file, including what is still being written
+	size_t getSize() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return size_;
+	}
+
+	// statistics
+	size_t getRecordCount() const { return records_.load(); }
+	size_t getSyncCount() const { return syncs_.load(); }
+	size_t getFailureCount() const { return failures_.load(); }
+
+	static boost::uint32_t crc32(const char *data, size_t size) {
+		static const CrcTable table;
+		boost::uint32_t crc = 0xFFFFFFFFu;
+		for (size_t i = 0; i < size; ++i) {
+			crc = table.entries[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return crc ^ 0xFFFFFFFFu;
+	}
+private:
+	// CRC-32 (IEEE 802.3), one byte at a time
+	struct CrcTable {
+		CrcTable() {
+			for (boost::uint32_t i = 0; i < 256; ++i) {
+				boost::uint32_t c = i;
+				for (int k = 0; k < 8; ++k) {
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				entries[i] = c;
+			}
+		}
+		boost::uint32_t entries[256];
+	};
+
+	// the group commit loop
+	void write() {
+		boost::mutex::scoped_lock lock(mutex_);
+		for (;;) {
+			while (pending_.empty() && !stopping_) {
+				pendingCondition_.wait(lock);
+			}
+			if (pending_.empty())
+				return;
+			vector<string> batch;
+			batch.swap(pending_);
+			boost::uint64_t last = nextSequence_ - 1;
+			FILE *file = file_;
+			writing_ = true;
+			lock.unlock();
+
+			string buffer;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				appendUint32(buffer, (boost::uint32_t)batch[i].size());
+				appendUint32(buffer, crc32(batch[i].data(), batch[i].size()));
+				buffer.append(batch[i]);
+			}
+			bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && fflush(file) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+			ok = ok && fsync(fileno(file)) == 0;
+#endif
+			++syncs_;
+			records_ += batch.size();
+
+			lock.lock();
+			if (!ok) {
+				failures_ += batch.size();
+				for (boost::uint64_t sequence = last - batch.size() + 1; sequence <= last; ++sequence) {
+					failedSequences_.insert(sequence);
+				}
+			}
+			writing_ = false;
+			durableSequence_ = last;
+			durableCondition_.notify_all();
+		}
+	}
+
+	static FILE *createFile(const string &fileName, boost::uint64_t generation) {
+		string header("OCJN", 4);
+		appendUint32(header, version);
+		appendUint32(header, (boost::uint32_t)(generation >> 32));
+		appendUint32(header, (boost::uint32_t)generation);
+		// written aside and renamed, so a crash never leaves a file without its header
+		string temporaryFileName = fileName + ".tmp";
+		FILE *file = fopen(temporaryFileName.c_str(), "wb");
+		if (!file)
+			return 0;
+		bool ok = fwrite(header.data(), 1, header.size(), file) == header.size() && fflush(file) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+		ok = ok && fsync(fileno(file)) == 0;
+#endif
+		fclose(file);
+		if (!ok || rename(temporaryFileName.c_str(), fileName.c_str()) != 0) {
+			remove(temporaryFileName.c_str());
+			return 0;
+		}
+		return fopen(fileName.c_str(), "ab");
+	}
+
+	// replay one file if its generation is at least minGeneration; false if it is missing or not a journal
+	static bool readFile(const string &fileName, boost::uint64_t minGeneration, replayCallbackType apply, size_t &count,
+	                     boost::uint64_t &generation, size_t &validSize) {
+		MappedFile file(fileName);
+		const unsigned char *data = (const unsigned char *)file.data();
+		if (file.size() < headerSize || memcmp(data, "OCJN", 4) != 0 || readUint32(data + 4) != version)
+			return false;
+		generation = ((boost::uint64_t)readUint32(data + 8) << 32) | readUint32(data + 12);
+		validSize = headerSize;
+		if (generation < minGeneration)
+			return true;
+		while (file.size() - validSize >= 8) {
+			boost::uint32_t length = readUint32(data + validSize);
+			boost::uint32_t crc = readUint32(data + validSize + 4);
+			if (file.size() - validSize - 8 < length)
+				break; // torn
+			const char *record = (const char *)data + validSize + 8;
+			if (crc32(record, length) != crc)
+				break; // torn or damaged, nothing after it can be trusted
+			if (apply)
+				apply(string(record, length));
+			++count;
+			validSize += 8 + length;
+		}
+		return true;
+	}
+
+	static void truncateFile(const string &fileName, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+		if (truncate(fileName.c_str(), size) != 0) {
+			// appending after garbage only loses what follows it at the next replay
+		}
+#endif
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+
+	static void appendUint32(string &buffer, boost::uint32_t value) {
+		buffer.push_back((char)(value >> 24));
+		buffer.push_back((char)(value >> 16));
+		buffer.push_back((char)(value >> 8));
+		buffer.push_back((char)value);
+	}
+
+	string fileName_;
+
+	mutable boost::mutex mutex_;
+	boost::condition_variable pendingCondition_;
+	boost::condition_variable durableCondition_;
+	FILE *file_;
+	boost::uint64_t generation_;
+	size_t size_;
+	vector<string> pending_;
+	boost::uint64_t nextSequence_;
+	boost::uint64_t durableSequence_;
+	set<boost::uint64_t> failedSequences_;
+	bool writing_;
+	bool stopping_;
+	boost::thread writer_;
+
+	boost::atomic<size_t> records_;
+	boost::atomic<size_t> syncs_;
+	boost::atomic<size_t> failures_;
+};
+
+}
@@ -0,0 +1,152 @@
+/*
+ * jsonlogger.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "viewobserver.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * JsonLogger writes what the View hands over as JSON, one object per line, taking the fields of an
+ * event as they are instead of the text it reads as: {"event":"message","from":"bob","text":"hi"}
+ */
+class JsonLogger : public ViewObserver {
+public:
+	JsonLogger(ostream &os) : os_(os) { }
+	virtual ~JsonLogger() { }
+
+	virtual void present(const string &message) {
+		notify(TextEvent(message, false));
+	}
+
+	virtual void presentLine(const string &message) {
+		notify(TextEvent(message, true));
+	}
+
+	virtual void notify(const ViewEvent &event) {
+		boost::mutex::scoped_lock lock(mutex_);
+		line_.clear();
+		switch (event.getType()) {
+		case ViewEvent::TEXT: {
+			const TextEvent &text = static_cast<const TextEvent &>(event);
+			line_ += "{\"event\":\"text\",\"text\":";
+			appendString(text.text);
+			if (text.line)
+				line_ += ",\"line\":true";
+			break;
+		}
+		case ViewEvent::MESSAGE_RECEIVED: {
+			const MessageReceivedEvent &message = static_cast<const MessageReceivedEvent &>(event);
+			line_ += "{\"event\":\"message\",\"from\":";
+			appendString(message.fromID);
+			line_ += ",\"text\":";
+			appendString(message.message);
+			break;
+		}
+		case ViewEvent::STRANGER_ADDED:
+			line_ += "{\"event\":\"stranger\",\"id\":";
+			appendString(static_cast<const StrangerAddedEvent &>(event).id);
+			break;
+		case ViewEvent::FRIEND_LIST_RECEIVED: {
+			const FriendListReceivedEvent &list = static_cast<const FriendListReceivedEvent &>(event);
+			line_ += "{\"event\":\"friend_list\",\"id\":";
+			appendString(list.id);
+			line_ += ",\"friends\":";
+			appendEntries(list.entries);
+			break;
+		}
+		case ViewEvent::FRIEND_LIST_CHANGED: {
+			const FriendListChangedEvent &list = static_cast<const FriendListChangedEvent &>(event);
+			line_ += "{\"event\":\"friend_list_changed\",\"id\":";
+			appendString(list.id);
+			line_ += ",\"changes\":";
+			appendEntries(list.changes);
+			line_ += ",\"count\":" + boost::lexical_cast<string>(list.friendCount);
+			break;
+		}
+		case ViewEvent::COMMAND_RESULT: {
+			const CommandResultEvent &result = static_cast<const CommandResultEvent &>(event);
+			line_ += "{\"event\":\"command\",\"command\":";
+			appendString(result.command);
+			if (!result.succeeded()) {
+				line_ += ",\"error\":";
+				appendString(result.error);
+			}
+			break;
+		}
+		default:
+			return;
+		}
+		line_ += "}\n";
+		os_ << line_;
+	}
+
+	virtual void flush() {
+		boost::mutex::scoped_lock lock(mutex_);
+		os_.flush();
+	}
+private:
+	// a JSON string, quoted and escaped
+	void appendString(boost::string_ref s) {
+		static const char hex[] = "0123456789abcdef";
+		line_ += '"';
+		for (boost::string_ref::const_iterator iter = s.begin(); iter != s.end(); ++iter) {
+			unsigned char c = *iter;
+			switch (c) {
+			case '"': line_ += "\\\""; break;
+			case '\\': line_ += "\\\\"; break;
+			case '\n': line_ += "\\n"; break;
+			case '\r': line_ += "\\r"; break;
+			case '\t': line_ += "\\t"; break;
+			default:
+				if (c < 0x20) {
+					line_ += "\\u00";
+					line_ += hex[c >> 4];
+					line_ += hex[c & 0xf];
+				} else {
+					line_ += (char)c;
+				}
+			}
+		}
+		line_ += '"';
+	}
+
+	// entries as [{"id":..,"hostname":..,"port":..}, ..], a removal having no hostname nor port
+	void appendEntries(const vector<pair<string, pair<string, string> > > &entries) {
+		line_ += '[';
+		for (size_t i = 0; i != entries.size(); ++i) {
+			if (i != 0)
+				line_ += ',';
+			line_ += "{\"id\":";
+			appendString(entries[i].first);
+			if (!entries[i].second.first.empty()) {
+				line_ += ",\"hostname\":";
+				appendString(entries[i].second.first);
+				line_ += ",\"port\":";
+				appendString(entries[i].second.second);
+			}
+			line_ += '}';
+		}
+		line_ += ']';
+	}
+
+	ostream &os_;
+	boost::mutex mutex_;
+	string line_; // the line being written, kept to reuse its memory
+};
+
+}
@@ -10,22 +10,101 @@
 #include <string>
 #include <fstream>
 #include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 #include "chatframework.hpp"
 #include "streamprinter.hpp"
+#include "jsonlogger.hpp"
+
+// the number in text, false if it is not one
+template <typename T>
+static bool parseNumber(const string &text, T &value) {
+	try {
+		value = boost::lexical_cast<T>(text);
+		return true;
+	} catch (const boost::bad_lexical_cast &) {
+		return false;
+	}
+}
 
 int main(int argc, char **argv) {
-	if (argc < 2) {
-		cout << "Usage: ./OpenChat configFileName" << endl;
+	string script, jsonLog;
+	bool asyncView = false, dropping = false, usage = argc < 2;
+	openchat::ServerOptions options;
+	for (int i = 2; i < argc && !usage; ++i) {
+		string option = argv[i];
+		if (option == "--batch" && i + 1 < argc) {
+			script = argv[++i];
+		} else if (option == "--engine=blocking") {
+			options.engine = openchat::ENGINE_BLOCKING;
+		} else if (option == "--engine=async") {
+			options.engine = openchat::ENGINE_ASYNC;
+		} else if (option == "--engine=batched") {
+			options.engine = openchat::ENGINE_BATCHED;
+		} else if (option == "--workers" && i + 1 < argc) {
+			usage = !parseNumber(argv[++i], options.workerCount) || options.workerCount == 0;
+		} else if (option == "--queue" && i + 1 < argc) {
+			usage = !parseNumber(argv[++i], options.queueCapacity) || options.queueCapacity == 0;
+		} else if (option == "--overflow=drop") {
+			options.overflowPolicy = openchat::OVERFLOW_DROP;
+		} else if (option == "--overflow=block") {
+			options.overflowPolicy = openchat::OVERFLOW_BLOCK;
+		} else if (option == "--overflow=shed-oldest") {
+			options.overflowPolicy = openchat::OVERFLOW_SHED_OLDEST;
+		} else if (option == "--coalesce" && i + 1 < argc) {
+			usage = !parseNumber(argv[++i], options.coalescingLatency) || options.coalescingLatency < 0;
+		} else if (option == "--no-reliable") {
+			options.reliableDelivery = false;
+		} else if (option == "--no-compression") {
+			options.compression = false;
+		} else if (option == "--loss" && i + 1 < argc) {
+			usage = !parseNumber(argv[++i], options.simulatedLossRate) || options.simulatedLossRate < 0 || options.simulatedLossRate > 1;
+		} else if (option == "--max-strangers" && i + 1 < argc) {
+			usage = !parseNumber(argv[++i], options.maxStrangers);
+		} else if (option == "--json-log" && i + 1 < argc) {
+			jsonLog = argv[++i];
+		} else if (option == "--async-view" || option == "--async-view=block") {
+			asyncView = true;
+		} else if (option == "--async-view=drop") {
+			asyncView = dropping = true;
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		cout << "Usage: ./OpenChat configFileName [--batch scriptFileName|-] [--async-view[=block|drop]] [--json-log fileName]\n"
+		        "         [--engine=blocking|async|batched] [--workers count] [--queue capacity] [--overflow=drop|block|shed-oldest]\n"
+		        "         [--coalesce microseconds] [--no-reliable] [--no-compression] [--loss rate] [--max-strangers count]" << endl;
 		return 0;
 	}
 	string fileName = argv[1];
-	openchat::ChatFramework framework(fileName, cin);
+	ofstream jsonLogStream; // outlives the framework, which writes to it
+	openchat::ChatFramework framework(fileName, cin, options);
+	bool batch = !script.empty();
 
-	// add cout view
-	boost::shared_ptr<openchat::StreamPrinter> coutView(new openchat::StreamPrinter(std::cout));
+	// add cout view; nobody reads a batch's output line by line, and a writer flushes on its own,
+	// so neither flushes line by line
+	boost::shared_ptr<openchat::StreamPrinter> coutView(new openchat::StreamPrinter(std::cout, !batch && !asyncView));
 	framework.addViewObserver(coutView);
+	// and a log of the events, in JSON
+	if (!jsonLog.empty()) {
+		jsonLogStream.open(jsonLog.c_str(), ios::app);
+		if (!jsonLogStream) {
+			cerr << "Cannot open " << jsonLog << endl;
+			return 1;
+		}
+		framework.addViewObserver(boost::shared_ptr<openchat::JsonLogger>(new openchat::JsonLogger(jsonLogStream)));
+	}
+	if (asyncView) {
+		// a full queue makes the presenter wait, or drops what it presents
+		framework.startViewWriter(1 << 16, dropping ? openchat::OVERFLOW_DROP : openchat::OVERFLOW_BLOCK, 50);
+	}
 
 	// launch the service
+	if (batch) {
+		long errorCount = framework.runBatch(script, cerr);
+		cout.flush();
+		return errorCount == 0 ? 0 : 1;
+	}
 	framework.run();
 
 	return 0;
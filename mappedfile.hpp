@@ -0,0 +1,119 @@
+/*
+ * mappedfile.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * MappedFile maps a whole file read-only into memory, so it can be parsed in place.  Where mmap
+ * is not available the file is read into memory instead.  A missing or empty file is simply
+ * empty.
+ */
+class MappedFile : private boost::noncopyable {
+public:
+	explicit MappedFile(const string &fileName) : data_(0), size_(0), mapped_(false), exists_(false), modificationTime_(0) {
+#if defined(__unix__) || defined(__APPLE__)
+		int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat status;
+		if (fstat(fd, &status) == 0) {
+			exists_ = true;
+			size_ = (size_t)status.st_size;
+			modificationTime_ = getModificationTime(status);
+			if (size_ > 0) {
+				void *address = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (address != MAP_FAILED) {
+					data_ = (const char *)address;
+					mapped_ = true;
+				} else {
+					size_ = 0;
+				}
+			}
+		}
+		close(fd);
+#else
+		ifstream ifs(fileName.c_str(), ios::binary);
+		if (!ifs)
+			return;
+		exists_ = true;
+		ostringstream contents;
+		contents << ifs.rdbuf();
+		contents_ = contents.str();
+		data_ = contents_.data();
+		size_ = contents_.size();
+#endif
+	}
+
+	~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+		if (mapped_)
+			munmap((void *)data_, size_);
+#endif
+	}
+
+	bool exists() const { return exists_; }
+	const char *data() const { return data_; }
+	size_t size() const { return size_; }
+
+	// nanoseconds since the epoch, 0 where unknown
+	boost::int64_t getModificationTime() const { return modificationTime_; }
+
+	/**
+	 * The size and modification time of a file without mapping it; false if it cannot be
+	 * examined.  Together they tell whether a file has changed since it was last looked at.
+	 */
+	static bool getStatus(const string &fileName, boost::uint64_t &size, boost::int64_t &modificationTime) {
+#if defined(__unix__) || defined(__APPLE__)
+		struct stat status;
+		if (stat(fileName.c_str(), &status) != 0)
+			return false;
+		size = (boost::uint64_t)status.st_size;
+		modificationTime = getModificationTime(status);
+		return true;
+#else
+		MappedFile file(fileName);
+		size = file.size();
+		modificationTime = 0;
+		return file.exists();
+#endif
+	}
+private:
+#if defined(__unix__) || defined(__APPLE__)
+	static boost::int64_t getModificationTime(const struct stat &status) {
+#ifdef __APPLE__
+		return (boost::int64_t)status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+		return (boost::int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+	}
+#endif
+
+	const char *data_;
+	size_t size_;
+	bool mapped_;
+	bool exists_;
+	boost::int64_t modificationTime_;
+	string contents_; // the file, where it could not be mapped
+};
+
+}
@@ -8,76 +8,211 @@
 
 #pragma once
 
-#include <map>
 #include <vector>
+#include <algorithm>
+#include <iterator>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
 
+#include "fanout.hpp"
 #include "peerproxy.hpp"
+#include "peertable.hpp"
 
 using namespace std;
 
 namespace openchat {
 
 /**
- * PeerList stores a list of PeerProxies and supports queries and delegations regarding them
+ * PeerList stores a list of peers and supports queries and delegations regarding them.  Peers
+ * are kept as a sorted array of PeerTable handles, so the lists of friends, strangers and every
+ * group share one entry per peer; the list holds a reference to each of its handles.  It is safe
+ * to use from several threads: every query works on one consistent, immutable snapshot of the
+ * array, and changes never hold up queries.
  */
-class PeerList {
+class PeerList : private boost::noncopyable {
 public:
-	typedef boost::shared_ptr<PeerProxy> peerPointerType;
+	typedef boost::shared_ptr<const vector<PeerHandle> > snapshotType;
 
-	void sendTo(const string &id, udp::socket &serverSocket, const string &message) const {
-		peers_.find(id)->second->sendMessage(serverSocket, message);
+	PeerList(PeerTable &table) : table_(table), members_(boost::make_shared<vector<PeerHandle> >()) { }
+
+	void sendTo(const string &id, DatagramSender &sender, const string &message) const {
+		PeerHandle handle = getPeer(id);
+		if (handle != PeerTable::invalidHandle)
+			PeerProxy(table_, handle).sendMessage(sender, message);
+	}
+
+	void sendToAll(DatagramSender &sender, const string &message) const {
+		snapshotType members = snapshot();
+		for (vector<PeerHandle>::const_iterator iter = members->begin(); iter != members->end(); ++iter) {
+			PeerProxy(table_, *iter).sendMessage(sender, message);
+		}
+	}
+
+	void sendTo(const string &id, DatagramSender &sender, const WireMessage &message) const {
+		PeerHandle handle = getPeer(id);
+		if (handle != PeerTable::invalidHandle)
+			PeerProxy(table_, handle).sendMessage(sender, message);
+	}
+
+	void sendToAll(DatagramSender &sender, const WireMessage &message) const {
+		snapshotType members = snapshot();
+		for (vector<PeerHandle>::const_iterator iter = members->begin(); iter != members->end(); ++iter) {
+			PeerProxy(table_, *iter).sendMessage(sender, message);
+		}
+	}
+
+	/**
+	 * Append the endpoint and negotiated features of every peer whose address is resolved, for a
+	 * FanOut broadcast, and the handles of the others to unresolved, to be sent to one by one.
+	 */
+	void collectRecipients(vector<FanOut::Recipient> &recipients, vector<PeerHandle> &unresolved) const {
+		snapshotType members = snapshot();
+		PeerTable::ReadSection section(table_);
+		recipients.reserve(recipients.size() + members->size());
+		for (vector<PeerHandle>::const_iterator iter = members->begin(); iter != members->end(); ++iter) {
+			const PeerTable::Address &address = table_.getAddress(*iter);
+			if (address.state == PeerTable::ADDRESS_RESOLVED) {
+				recipients.push_back(FanOut::Recipient(address.endpoint, table_.getFeatures(*iter)));
+			} else {
+				unresolved.push_back(*iter);
+			}
+		}
 	}
 
-	void sendToAll(udp::socket &serverSocket, const string &message) const {
-		for (map<string, boost::shared_ptr<PeerProxy> >::const_iterator iter = peers_.begin(); iter != peers_.end(); ++iter) {
-			iter->second->sendMessage(serverSocket, message);
+	/**
+	 * Add a peer, to be resolved on the first send; false if it already is in the list, when it keeps
+	 * the address it has
+	 */
+	bool addPeer(const string &id, const string &hostname, const string &port) {
+		PeerHandle handle = table_.intern(id);
+		bool added = !contains(handle);
+		if (added) {
+			table_.setAddress(handle, hostname, port);
+			added = addPeer(handle);
 		}
+		table_.release(handle);
+		return added;
 	}
 
-	void addPeer(const string &id, const string &hostname, const string &port, boost::asio::io_service &ioService) {
-		boost::shared_ptr<PeerProxy> peer(new PeerProxy(id, hostname, port, ioService));
-		addPeer(id, peer);
- 	}
+	// add a peer whose endpoint is already known, e.g. from a datagram it sent
+	bool addPeer(const string &id, const string &hostname, const string &port, const udp::endpoint &endpoint) {
+		PeerHandle handle = table_.intern(id);
+		bool added = !contains(handle);
+		if (added) {
+			table_.setAddress(handle, hostname, port, endpoint);
+			added = addPeer(handle);
+		}
+		table_.release(handle);
+		return added;
+	}
+
+	// false if the peer already is in the list, which otherwise takes a reference to the handle
+	bool addPeer(PeerHandle handle) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		snapshotType current = snapshot();
+		vector<PeerHandle>::const_iterator position = lower_bound(current->begin(), current->end(), handle);
+		if (position != current->end() && *position == handle)
+			return false;
+		boost::shared_ptr<vector<PeerHandle> > next = boost::make_shared<vector<PeerHandle> >();
+		next->reserve(current->size() + 1);
+		next->insert(next->end(), current->begin(), position);
+		next->push_back(handle);
+		next->insert(next->end(), position, current->end());
+		boost::atomic_store(&members_, snapshotType(next));
+		table_.retain(handle);
+		return true;
+	}
+
+	// add many peers at once, merging them in with a single copy of the list
+	void addPeers(vector<PeerHandle> handles) {
+		sort(handles.begin(), handles.end());
+		handles.erase(unique(handles.begin(), handles.end()), handles.end());
+		boost::mutex::scoped_lock lock(writeMutex_);
+		snapshotType current = snapshot();
+		boost::shared_ptr<vector<PeerHandle> > next = boost::make_shared<vector<PeerHandle> >();
+		next->reserve(current->size() + handles.size());
+		set_union(current->begin(), current->end(), handles.begin(), handles.end(), back_inserter(*next));
+		boost::atomic_store(&members_, snapshotType(next));
+		for (vector<PeerHandle>::const_iterator iter = handles.begin(); iter != handles.end(); ++iter) {
+			if (!binary_search(current->begin(), current->end(), *iter))
+				table_.retain(*iter);
+		}
+	}
 
-	void addPeer(const string &id, boost::shared_ptr<PeerProxy> peer) {
-		peers_.insert(make_pair(id, peer));
+	// false if the peer is not in the list
+	bool deletePeer(const string &id) {
+		PeerHandle handle = table_.find(id);
+		return handle != PeerTable::invalidHandle && deletePeer(handle);
 	}
 
-	void deletePeer(const string &id) {
-		peers_.erase(id);
+	bool deletePeer(PeerHandle handle) {
+		{
+			boost::mutex::scoped_lock lock(writeMutex_);
+			snapshotType current = snapshot();
+			vector<PeerHandle>::const_iterator position = lower_bound(current->begin(), current->end(), handle);
+			if (position == current->end() || *position != handle)
+				return false;
+			boost::shared_ptr<vector<PeerHandle> > next = boost::make_shared<vector<PeerHandle> >();
+			next->reserve(current->size() - 1);
+			next->insert(next->end(), current->begin(), position);
+			next->insert(next->end(), position + 1, current->end());
+			boost::atomic_store(&members_, snapshotType(next));
+		}
+		table_.release(handle);
+		return true;
 	}
 
 	bool hasPeer(const string &id) const {
-		return peers_.find(id) != peers_.end();
+		return getPeer(id) != PeerTable::invalidHandle;
+	}
+
+	// the handle of the peer with this ID, or PeerTable::invalidHandle if it is not in the list
+	PeerHandle getPeer(const string &id) const {
+		PeerHandle handle = table_.find(id);
+		return handle != PeerTable::invalidHandle && contains(handle) ? handle : PeerTable::invalidHandle;
+	}
+
+	bool contains(PeerHandle handle) const {
+		snapshotType members = snapshot();
+		return binary_search(members->begin(), members->end(), handle);
 	}
 
-	peerPointerType getPeer(const string &id) const {
-		return peers_.find(id)->second;
+	// the members, by handle, in ascending order
+	snapshotType snapshot() const {
+		return boost::atomic_load(&members_);
 	}
 
 	vector<string> getPeerIDs() const {
+		snapshotType members = snapshot();
 		vector<string> ids;
-		for (map<string, boost::shared_ptr<PeerProxy> >::const_iterator iter = peers_.begin(); iter != peers_.end(); ++iter) {
-			ids.push_back(iter->first);
+		ids.reserve(members->size());
+		for (vector<PeerHandle>::const_iterator iter = members->begin(); iter != members->end(); ++iter) {
+			ids.push_back(table_.getID(*iter));
 		}
+		sort(ids.begin(), ids.end());
 		return ids;
 	}
 
 	vector<pair<string, pair<string, string> > > getPeerListInformation() const {
+		snapshotType members = snapshot();
+		PeerTable::ReadSection section(table_);
 		vector<pair<string, pair<string, string> > > info;
-		for (map<string, boost::shared_ptr<PeerProxy> >::const_iterator iter = peers_.begin(); iter != peers_.end(); ++iter) {
-			string id = iter->first;
-			string hostname = iter->second->getHostname();
-			string port = iter->second->getPort();
-			info.push_back(make_pair(id, make_pair(hostname, port)));
+		info.reserve(members->size());
+		for (vector<PeerHandle>::const_iterator iter = members->begin(); iter != members->end(); ++iter) {
+			const PeerTable::Address &address = table_.getAddress(*iter);
+			info.push_back(make_pair(table_.getID(*iter), make_pair(address.hostname, address.port)));
 		}
+		sort(info.begin(), info.end());
 		return info;
 	}
 
-	size_t getSize() const { return peers_.size(); }
+	size_t getSize() const { return snapshot()->size(); }
 private:
-	map<string, boost::shared_ptr<PeerProxy> > peers_;
+	PeerTable &table_;
+	snapshotType members_; // only accessed through atomic_load/atomic_store
+	boost::mutex writeMutex_;
 };
 
 }
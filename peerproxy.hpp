@@ -11,42 +11,61 @@
 #include <boost/asio.hpp>
 #include <string>
 
+#include "datagramsender.hpp"
+#include "peertable.hpp"
+#include "wiremessage.hpp"
+
 using namespace std;
 using namespace boost::asio::ip;
 
 namespace openchat {
 
 /**
- * PeerProxy is a placeholder for remote peer, using Proxy Pattern
+ * PeerProxy is a placeholder for remote peer, using Proxy Pattern.  It is a lightweight view of
+ * one entry of a PeerTable, cheap to create and copy; whatever it knows lives in the table.
+ * The peer's address is resolved on the first send, and messages wait in the table until then.
  */
 class PeerProxy {
 public:
-	PeerProxy(const string &id, const string &hostname, const string &port, boost::asio::io_service &ioService) :
-		id_(id), hostname_(hostname), port_(port) {
-		try {
-			udp::resolver resolver(ioService);
-			udp::resolver::query query(udp::v4(), hostname, port);
-			receiverEndpoint_ = *resolver.resolve(query);
-			udp::socket socket(ioService);
-			socket.open(udp::v4());
-		} catch (exception &e) {
-			cerr << "Exception in player_proxy::player_proxy(): " << e.what() << endl;
-		}
+	PeerProxy(PeerTable &table, PeerHandle handle) : table_(&table), handle_(handle) { }
+
+	void sendMessage(DatagramSender &sender, const string &message) const {
+		table_->send(handle_, sender, message, false);
+	}
+
+	// send in the best format the peer has announced it understands
+	void sendMessage(DatagramSender &sender, const WireMessage &message) const {
+		unsigned features = getFeatures();
+		table_->send(handle_, sender, message.getEncoding(features), (features & FEATURE_RELIABLE) != 0);
 	}
 
-	void sendMessage(udp::socket &serverSocket, const string &message) {
-		serverSocket.send_to(boost::asio::buffer(message), receiverEndpoint_);
+	bool isResolved() const {
+		PeerTable::ReadSection section(*table_);
+		return table_->getAddress(handle_).state == PeerTable::ADDRESS_RESOLVED;
 	}
 
+	// features negotiated through hello messages, plain text only until the peer says otherwise
+	void setFeatures(unsigned features) { table_->setFeatures(handle_, features); }
+	unsigned getFeatures() const { return table_->getFeatures(handle_); }
+
 	// getters
-	string getID() const { return id_; }
-	string getHostname() const { return hostname_; }
-	string getPort() const { return port_; }
+	PeerHandle getHandle() const { return handle_; }
+	string getID() const { return table_->getID(handle_); }
+	string getHostname() const {
+		PeerTable::ReadSection section(*table_);
+		return table_->getAddress(handle_).hostname;
+	}
+	string getPort() const {
+		PeerTable::ReadSection section(*table_);
+		return table_->getAddress(handle_).port;
+	}
+	udp::endpoint getEndpoint() const {
+		PeerTable::ReadSection section(*table_);
+		return table_->getAddress(handle_).endpoint;
+	}
 private:
-	string id_;
-	string hostname_;
-	string port_;
-	udp::endpoint receiverEndpoint_;
+	PeerTable *table_;
+	PeerHandle handle_;
 };
 
 }
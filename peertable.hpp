@@ -0,0 +1,632 @@
+/*
+ * peertable.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+
+#include "datagramsender.hpp"
+#include "resolver.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * Integer naming a peer in a PeerTable: a dense slot number in the lower 24 bits and, in the
+ * upper 8, the generation of the slot, which changes whenever the slot is reused
+ */
+typedef boost::uint32_t PeerHandle;
+
+/**
+ * PeerTable interns peer IDs: an ID gets a handle, and everything known about the peer is kept
+ * column-wise (struct of arrays) under that handle.  IDs are found through an open-addressing
+ * hash table of (hash, slot) entries.
+ *
+ * A handle is reference counted: intern hands out a reference, and every list or group holding
+ * the handle keeps one.  Once the last reference is released the slot is freed and later reused
+ * with the next generation, so peers coming and going (strangers, say) do not grow the table.
+ * A released handle is no longer valid; reads of it return nothing and sends to it are dropped.
+ *
+ * Addresses are bound lazily: a peer is added with its hostname and port only, the first send
+ * to it starts a lookup with the Resolver, and what is sent meanwhile waits for the answer.
+ *
+ * Lookups and reads never take a lock.  Columns grow in fixed-size chunks that never move, and
+ * IDs, addresses and hash tables are replaced by atomic stores of pointers.  What is replaced is
+ * freed once no reader may still see it: readers hold a ReadSection, and what is retired waits
+ * out the sections of two epochs.  Writers are serialized.
+ */
+class PeerTable : private boost::noncopyable {
+public:
+	static const PeerHandle invalidHandle = 0xFFFFFFFFu;
+
+	// the slot of a handle is handle & slotMask, its generation handle >> slotBits
+	static const size_t slotBits = 24;
+	static const PeerHandle slotMask = (1u << slotBits) - 1;
+
+	enum AddressState {
+		ADDRESS_UNRESOLVED, // hostname and port known, endpoint not looked up yet
+		ADDRESS_RESOLVED,
+		ADDRESS_FAILED      // the last lookup failed, the next send tries again
+	};
+
+	/**
+	 * Where a peer is reached; replaced as a whole, never changed in place
+	 */
+	struct Address {
+		Address() : state(ADDRESS_UNRESOLVED), serial(0) { }
+		string hostname;
+		string port;
+		udp::endpoint endpoint;
+		AddressState state;
+		boost::uint64_t serial; // tells addresses apart, unlike their memory, which is reused
+	};
+
+	// called when a peer's address cannot be resolved, with its ID, hostname, port and the error
+	typedef boost::function<void (const string &, const string &, const string &, const string &)> failureCallbackType;
+
+	PeerTable() : size_(0), live_(0), used_(0), index_(new Index(initialIndexSize)), nextSerial_(1), epoch_(0), resolver_(0), droppedSends_(0) {
+		for (size_t i = 0; i < maxChunks; ++i) {
+			chunks_[i].store(0, boost::memory_order_relaxed);
+		}
+		readers_[0].store(0, boost::memory_order_relaxed);
+		readers_[1].store(0, boost::memory_order_relaxed);
+	}
+
+	~PeerTable() {
+		for (size_t i = 0; i < maxChunks; ++i) {
+			Chunk *chunk = chunks_[i].load(boost::memory_order_relaxed);
+			if (!chunk)
+				continue;
+			for (size_t j = 0; j < chunkSize; ++j) {
+				delete chunk->ids[j].load(boost::memory_order_relaxed);
+				delete chunk->addresses[j].load(boost::memory_order_relaxed);
+			}
+			delete chunk;
+		}
+		delete index_.load(boost::memory_order_relaxed);
+		for (size_t i = 0; i < retired_.size(); ++i) {
+			retired_[i].free();
+		}
+	}
+
+	/**
+	 * ReadSection keeps what a reader may see alive: references returned by getAddress are only
+	 * valid while one is held.  Sections are cheap, and may be nested.
+	 */
+	class ReadSection : private boost::noncopyable {
+	public:
+		explicit ReadSection(const PeerTable &table) : table_(table), epoch_(table.enter()) { }
+		~ReadSection() { table_.leave(epoch_); }
+	private:
+		const PeerTable &table_;
+		size_t epoch_;
+	};
+
+	/**
+	 * The handle of id, allocating one if id is not in the table, with a reference the caller
+	 * has to release
+	 */
+	PeerHandle intern(boost::string_ref id) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		boost::uint32_t hash = hashID(id);
+		PeerHandle handle = find(id, hash);
+		if (handle != invalidHandle) {
+			++getChunk(handle).refs[slotOf(handle) % chunkSize];
+			return handle;
+		}
+
+		size_t slot;
+		if (!free_.empty()) {
+			handle = free_.back();
+			free_.pop_back();
+			slot = slotOf(handle);
+			handle = ((((handle >> slotBits) + 1) & 0xFFu) << slotBits) | (PeerHandle)slot;
+		} else {
+			slot = size_.load(boost::memory_order_relaxed);
+			// the last slot is left out, so that no handle is invalidHandle
+			if (slot + 1 >= maxChunks * chunkSize)
+				throw length_error("PeerTable is full");
+			Chunk *chunk = chunks_[slot / chunkSize].load(boost::memory_order_relaxed);
+			if (!chunk) {
+				chunk = new Chunk;
+				chunks_[slot / chunkSize].store(chunk, boost::memory_order_release);
+			}
+			size_.store(slot + 1, boost::memory_order_release);
+			handle = (PeerHandle)slot;
+		}
+		Chunk &chunk = getChunk(handle);
+		chunk.ids[slot % chunkSize].store(new string(id.data(), id.size()), boost::memory_order_release);
+		chunk.refs[slot % chunkSize] = 1;
+		chunk.handles[slot % chunkSize].store(handle, boost::memory_order_release);
+
+		Index *index = index_.load(boost::memory_order_relaxed);
+		if (2 * (used_ + 1) > index->mask + 1) {
+			index = rebuild(*index);
+		}
+		// the entry is published last, so a reader that finds it also sees the ID
+		index->insert(hash, slot);
+		++used_;
+		++live_;
+		return handle;
+	}
+
+	// take another reference to a valid handle
+	void retain(PeerHandle handle) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		if (isValid(handle))
+			++getChunk(handle).refs[slotOf(handle) % chunkSize];
+	}
+
+	// give up a reference; the last one frees the handle
+	void release(PeerHandle handle) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		if (!isValid(handle))
+			return;
+		Chunk &chunk = getChunk(handle);
+		size_t slot = slotOf(handle);
+		if (--chunk.refs[slot % chunkSize] > 0)
+			return;
+		const string *id = chunk.ids[slot % chunkSize].load(boost::memory_order_relaxed);
+		index_.load(boost::memory_order_relaxed)->erase(hashID(*id), slot);
+		chunk.handles[slot % chunkSize].store(invalidHandle, boost::memory_order_release);
+		chunk.ids[slot % chunkSize].store(0, boost::memory_order_release);
+		Retired retired;
+		retired.id = id;
+		retired.address = chunk.addresses[slot % chunkSize].exchange(0, boost::memory_order_acq_rel);
+		retire(retired);
+		chunk.features[slot % chunkSize].store(0, boost::memory_order_relaxed);
+		free_.push_back(handle);
+		--live_;
+	}
+
+	// the handle of id, or invalidHandle if id is not in the table
+	PeerHandle find(boost::string_ref id) const {
+		ReadSection section(*this);
+		return find(id, hashID(id));
+	}
+
+	// false for invalidHandle and handles released since
+	bool isValid(PeerHandle handle) const {
+		size_t slot = slotOf(handle);
+		if (slot >= size_.load(boost::memory_order_acquire))
+			return false;
+		return getChunk(handle).handles[slot % chunkSize].load(boost::memory_order_acquire) == handle;
+	}
+
+	// empty if the handle is not valid
+	string getID(PeerHandle handle) const {
+		ReadSection section(*this);
+		const string *id = getIDPointer(handle);
+		return id ? *id : string();
+	}
+
+	// where the peer is reached, valid while a ReadSection is held; empty until an address has been set
+	const Address &getAddress(PeerHandle handle) const {
+		if (!isValid(handle))
+			return empty_;
+		const Address *address = getChunk(handle).addresses[slotOf(handle) % chunkSize].load(boost::memory_order_acquire);
+		// the slot may have been released and reused meanwhile
+		return address && isValid(handle) ? *address : empty_;
+	}
+
+	// set an address to be resolved on the first send
+	void setAddress(PeerHandle handle, const string &hostname, const string &port) {
+		Address *address = new Address;
+		address->hostname = hostname;
+		address->port = port;
+		publishAddress(handle, address);
+	}
+
+	// set an address whose endpoint is already known
+	void setAddress(PeerHandle handle, const string &hostname, const string &port, const udp::endpoint &endpoint) {
+		Address *address = new Address;
+		address->hostname = hostname;
+		address->port = port;
+		address->endpoint = endpoint;
+		address->state = ADDRESS_RESOLVED;
+		publishAddress(handle, address);
+	}
+
+	// look addresses up with resolver from now on, reporting failures to onFailure
+	void setResolver(Resolver *resolver, failureCallbackType onFailure) {
+		boost::mutex::scoped_lock lock(bindMutex_);
+		resolver_ = resolver;
+		onFailure_ = onFailure;
+	}
+
+	/**
+	 * Send payload to a peer through sender, reliably or not.  If the peer's address has not been
+	 * resolved yet the payload waits for the lookup, which the first such send starts; if the
+	 * lookup fails the waiting payloads are dropped and the failure is reported.
+	 */
+	void send(PeerHandle handle, DatagramSender &sender, const string &payload, bool reliable) {
+		ReadSection section(*this);
+		if (!isValid(handle)) {
+			++droppedSends_;
+			return;
+		}
+		const Address *address = &getAddress(handle);
+		if (address->state == ADDRESS_RESOLVED) {
+			dispatch(sender, payload, address->endpoint, reliable);
+			return;
+		}
+		Resolver *resolver;
+		{
+			boost::mutex::scoped_lock lock(bindMutex_);
+			address = &getAddress(handle);
+			if (address->state == ADDRESS_RESOLVED) {
+				// bound in the meantime
+				lock.unlock();
+				dispatch(sender, payload, address->endpoint, reliable);
+				return;
+			}
+			PendingPeer &pending = pending_[handle];
+			if (pending.sends.size() < maxPendingSends) {
+				pending.sends.push_back(PendingSend());
+				pending.sends.back().sender = &sender;
+				pending.sends.back().payload = boost::make_shared<string>(payload);
+				pending.sends.back().reliable = reliable;
+			} else {
+				++droppedSends_;
+			}
+			if (pending.resolving)
+				return;
+			pending.resolving = true;
+			resolver = resolver_;
+		}
+		if (resolver) {
+			resolver->resolve(address->hostname, address->port,
+			                  boost::bind(&PeerTable::bind, this, handle, address->serial, address->hostname, address->port, _1, _2));
+		} else {
+			// no resolver: look the address up right here
+			boost::system::error_code error;
+			udp::endpoint endpoint;
+			try {
+				boost::asio::io_service ioService;
+				udp::resolver blockingResolver(ioService);
+				endpoint = *blockingResolver.resolve(udp::resolver::query(udp::v4(), address->hostname, address->port));
+			} catch (boost::system::system_error &e) {
+				error = e.code();
+			}
+			bind(handle, address->serial, address->hostname, address->port, error, endpoint);
+		}
+	}
+
+	// payloads dropped because their peer had too many waiting for its address, could not be resolved, or was released
+	size_t getDroppedSendCount() const { return droppedSends_.load(); }
+
+	// protocol features negotiated with the peer, 0 for a handle not valid
+	unsigned getFeatures(PeerHandle handle) const {
+		return isValid(handle) ? getChunk(handle).features[slotOf(handle) % chunkSize].load(boost::memory_order_relaxed) : 0;
+	}
+	void setFeatures(PeerHandle handle, unsigned features) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		if (isValid(handle))
+			getChunk(handle).features[slotOf(handle) % chunkSize].store(features, boost::memory_order_relaxed);
+	}
+
+	// number of peers in the table
+	size_t getSize() const {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		return live_;
+	}
+
+	// approximate bytes used, IDs and addresses included
+	size_t getMemoryUsage() const {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		ReadSection section(*this);
+		size_t size = sizeof(*this) + free_.capacity() * sizeof(PeerHandle) + retired_.size() * sizeof(Retired);
+		size_t count = size_.load(boost::memory_order_relaxed);
+		size += ((count + chunkSize - 1) / chunkSize) * sizeof(Chunk);
+		size += sizeof(Index) + (index_.load(boost::memory_order_relaxed)->mask + 1) * sizeof(boost::uint64_t);
+		for (size_t slot = 0; slot < count; ++slot) {
+			const Chunk &chunk = *chunks_[slot / chunkSize].load(boost::memory_order_relaxed);
+			const string *id = chunk.ids[slot % chunkSize].load(boost::memory_order_relaxed);
+			if (id)
+				size += sizeof(string) + getHeapSize(*id);
+			const Address *address = chunk.addresses[slot % chunkSize].load(boost::memory_order_relaxed);
+			if (address)
+				size += sizeof(Address) + getHeapSize(address->hostname) + getHeapSize(address->port);
+		}
+		return size;
+	}
+private:
+	static const size_t chunkSize = 1024;
+	static const size_t maxChunks = 16384; // 16M peers at once
+	static const size_t initialIndexSize = 1024;
+	static const size_t maxPendingSends = 1024; // per peer, while its address is being looked up
+
+	struct PendingSend {
+		DatagramSender *sender;
+		boost::shared_ptr<const string> payload;
+		bool reliable;
+	};
+
+	struct PendingPeer {
+		PendingPeer() : resolving(false) { }
+		bool resolving;
+		vector<PendingSend> sends;
+	};
+
+	// one chunk of every column
+	struct Chunk {
+		Chunk() {
+			for (size_t i = 0; i < chunkSize; ++i) {
+				handles[i].store(invalidHandle, boost::memory_order_relaxed);
+				ids[i].store(0, boost::memory_order_relaxed);
+				addresses[i].store(0, boost::memory_order_relaxed);
+				features[i].store(0, boost::memory_order_relaxed);
+				refs[i] = 0;
+			}
+		}
+		boost::atomic<PeerHandle> handles[chunkSize]; // the handle a slot is in use under, invalidHandle if free
+		boost::atomic<const string *> ids[chunkSize];
+		boost::atomic<const Address *> addresses[chunkSize];
+		boost::atomic<unsigned> features[chunkSize];
+		size_t refs[chunkSize];                       // guarded by writeMutex_
+	};
+
+	// linear probing over entries (hash << 32 | slot + 1), 0 for an empty entry, removed ones left as tombstones
+	struct Index {
+		static const boost::uint64_t tombstone = 0xFFFFFFFFu;
+
+		Index(size_t size) : mask(size - 1), slots(new boost::atomic<boost::uint64_t>[size]) {
+			for (size_t i = 0; i < size; ++i) {
+				slots[i].store(0, boost::memory_order_relaxed);
+			}
+		}
+		~Index() {
+			delete [] slots;
+		}
+		void insert(boost::uint32_t hash, size_t slot) {
+			size_t i = hash & mask;
+			while (slots[i].load(boost::memory_order_relaxed) != 0) {
+				i = (i + 1) & mask;
+			}
+			slots[i].store(((boost::uint64_t)hash << 32) | (slot + 1), boost::memory_order_release);
+		}
+		void erase(boost::uint32_t hash, size_t slot) {
+			boost::uint64_t entry = ((boost::uint64_t)hash << 32) | (slot + 1);
+			for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+				boost::uint64_t current = slots[i].load(boost::memory_order_relaxed);
+				if (current == 0)
+					return;
+				if (current == entry) {
+					slots[i].store(tombstone, boost::memory_order_release);
+					return;
+				}
+			}
+		}
+		size_t mask;
+		boost::atomic<boost::uint64_t> *slots;
+	};
+
+	// what waits for the readers that may still see it before it is freed
+	struct Retired {
+		Retired() : epoch(0), id(0), address(0), index(0) { }
+		void free() {
+			delete id;
+			delete address;
+			delete index;
+		}
+		size_t epoch;
+		const string *id;
+		const Address *address;
+		const Index *index;
+	};
+
+	static size_t slotOf(PeerHandle handle) {
+		return handle & slotMask;
+	}
+
+	// the ID of a valid handle, or null; read within a ReadSection
+	const string *getIDPointer(PeerHandle handle) const {
+		if (!isValid(handle))
+			return 0;
+		const string *id = getChunk(handle).ids[slotOf(handle) % chunkSize].load(boost::memory_order_acquire);
+		// the slot may have been released and reused meanwhile
+		return isValid(handle) ? id : 0;
+	}
+
+	// called within a ReadSection
+	PeerHandle find(boost::string_ref id, boost::uint32_t hash) const {
+		const Index *index = index_.load(boost::memory_order_acquire);
+		for (size_t i = hash & index->mask; ; i = (i + 1) & index->mask) {
+			boost::uint64_t entry = index->slots[i].load(boost::memory_order_acquire);
+			if (entry == 0)
+				return invalidHandle;
+			if (entry != Index::tombstone && (boost::uint32_t)(entry >> 32) == hash) {
+				size_t slot = (size_t)(entry & 0xFFFFFFFFu) - 1;
+				PeerHandle handle = getChunk(slot).handles[slot % chunkSize].load(boost::memory_order_acquire);
+				const string *current = getIDPointer(handle);
+				if (current && id == boost::string_ref(*current))
+					return handle;
+			}
+		}
+	}
+
+	// called with writeMutex_ held: a table without tombstones, doubled if it is more than a quarter full
+	Index *rebuild(const Index &old) {
+		size_t size = old.mask + 1;
+		if (4 * (live_ + 1) > size)
+			size *= 2;
+		Index *index = new Index(size);
+		used_ = 0;
+		for (size_t i = 0; i <= old.mask; ++i) {
+			boost::uint64_t entry = old.slots[i].load(boost::memory_order_relaxed);
+			if (entry != 0 && entry != Index::tombstone) {
+				index->insert((boost::uint32_t)(entry >> 32), (size_t)(entry & 0xFFFFFFFFu) - 1);
+				++used_;
+			}
+		}
+		index_.store(index, boost::memory_order_release);
+		Retired retired;
+		retired.index = &old;
+		retire(retired);
+		return index;
+	}
+
+	void publishAddress(PeerHandle handle, Address *address) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		if (!isValid(handle)) {
+			delete address;
+			return;
+		}
+		address->serial = nextSerial_++;
+		Retired retired;
+		retired.address = getChunk(handle).addresses[slotOf(handle) % chunkSize].exchange(address, boost::memory_order_acq_rel);
+		// a reader may still be looking at the address replaced
+		if (retired.address)
+			retire(retired);
+	}
+
+	static void dispatch(DatagramSender &sender, const string &payload, const udp::endpoint &endpoint, bool reliable) {
+		if (reliable) {
+			sender.sendReliableDatagram(payload, endpoint);
+		} else {
+			sender.sendDatagram(payload, endpoint);
+		}
+	}
+
+	/**
+	 * The lookup of the address with serial has finished: bind it and release what waited for it.
+	 * An address is only replaced if the lookup changes it; a failure remembered by the resolver
+	 * comes back on every send, and must not cost a new address each time.
+	 */
+	void bind(PeerHandle handle, boost::uint64_t serial, const string &hostname, const string &port,
+	          const boost::system::error_code &error, const udp::endpoint &endpoint) {
+		ReadSection section(*this);
+		vector<PendingSend> sends;
+		failureCallbackType onFailure;
+		{
+			boost::mutex::scoped_lock lock(bindMutex_);
+			const Address &lookedUp = getAddress(handle);
+			AddressState state = error ? ADDRESS_FAILED : ADDRESS_RESOLVED;
+			if (isValid(handle) && lookedUp.serial == serial && (lookedUp.state != state || lookedUp.endpoint != endpoint)) {
+				Address *address = new Address(lookedUp);
+				address->endpoint = endpoint;
+				address->state = state;
+				publishAddress(handle, address);
+			}
+			map<PeerHandle, PendingPeer>::iterator iter = pending_.find(handle);
+			if (iter != pending_.end()) {
+				sends.swap(iter->second.sends);
+				pending_.erase(iter);
+			}
+			onFailure = onFailure_;
+		}
+		if (!isValid(handle)) {
+			// released while it was looked up
+			droppedSends_ += sends.size();
+			return;
+		}
+		const Address &address = getAddress(handle);
+		if (address.state == ADDRESS_UNRESOLVED) {
+			// the address changed while it was looked up, start over with the new one
+			for (size_t i = 0; i < sends.size(); ++i) {
+				send(handle, *sends[i].sender, *sends[i].payload, sends[i].reliable);
+			}
+		} else if (error) {
+			droppedSends_ += sends.size();
+			if (onFailure)
+				onFailure(getID(handle), hostname, port, error.message());
+		} else {
+			for (size_t i = 0; i < sends.size(); ++i) {
+				dispatch(*sends[i].sender, *sends[i].payload, address.endpoint, sends[i].reliable);
+			}
+		}
+	}
+
+	Chunk &getChunk(PeerHandle handle) const {
+		return *chunks_[slotOf(handle) / chunkSize].load(boost::memory_order_acquire);
+	}
+
+	// enter a read section, in the current epoch
+	size_t enter() const {
+		for (;;) {
+			size_t epoch = epoch_.load();
+			readers_[epoch & 1].fetch_add(1);
+			if (epoch_.load() == epoch)
+				return epoch;
+			// the epoch moved on meanwhile, and may be waiting for this counter to drain
+			readers_[epoch & 1].fetch_sub(1);
+		}
+	}
+
+	void leave(size_t epoch) const {
+		readers_[epoch & 1].fetch_sub(1);
+	}
+
+	/**
+	 * Called with writeMutex_ held, after what is retired has been unpublished.  Readers that may
+	 * see it are in the current epoch or the one before; the epoch moves on once the sections of
+	 * the one before have all ended, so what was retired two epochs ago can be freed.
+	 */
+	void retire(const Retired &retired) {
+		retired_.push_back(retired);
+		retired_.back().epoch = epoch_.load();
+		size_t epoch = epoch_.load();
+		if (readers_[(epoch + 1) & 1].load() == 0)
+			epoch_.store(++epoch);
+		while (!retired_.empty() && retired_.front().epoch + 2 <= epoch) {
+			retired_.front().free();
+			retired_.pop_front();
+		}
+	}
+
+	// FNV-1a
+	static boost::uint32_t hashID(boost::string_ref id) {
+		boost::uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < id.size(); ++i) {
+			hash = (hash ^ (unsigned char)id[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	static size_t getHeapSize(const string &s) {
+		// short strings live inside the string object
+		return s.capacity() > 15 ? s.capacity() + 1 : 0;
+	}
+
+	mutable boost::mutex writeMutex_;
+	boost::atomic<size_t> size_;     // slots ever used
+	boost::atomic<Chunk *> chunks_[maxChunks];
+	vector<PeerHandle> free_;        // released handles, their slots to be reused
+	size_t live_;                    // handles in use
+	size_t used_;                    // entries of the current index, tombstones included
+	boost::atomic<Index *> index_;
+	boost::uint64_t nextSerial_;
+	Address empty_;
+
+	// reclamation, see ReadSection
+	mutable boost::atomic<size_t> epoch_;
+	mutable boost::atomic<size_t> readers_[2];
+	deque<Retired> retired_;         // guarded by writeMutex_, oldest first
+
+	// lazy binding, guarded by bindMutex_
+	boost::mutex bindMutex_;
+	map<PeerHandle, PendingPeer> pending_;
+	Resolver *resolver_;
+	failureCallbackType onFailure_;
+	boost::atomic<size_t> droppedSends_;
+};
+
+}
@@ -0,0 +1,525 @@
+/*
+ * reliabletransport.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "datagrampool.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * ReliableTransport gives every remote endpoint an ordered, reliable channel on top of the
+ * plain datagrams: sequence numbers, cumulative plus selective acknowledgements, an RTO
+ * estimated from the round trip times (RFC 6298, with Karn's rule), retransmission on timeout
+ * or after three later frames have been acknowledged, and a congestion window growing in slow
+ * start and additively afterwards, halved on every loss.
+ *
+ * Frames look like
+ *
+ *     DATA: magic (2) | version (1) | kind (1) | session (4) | sequence (4) | payload
+ *     ACK:  magic (2) | version (1) | kind (1) | session (4) | next expected sequence (4) | selective bitmap (8)
+ *
+ * The session is picked at random for every channel, so a restarted peer is not taken for one
+ * replaying old sequence numbers, and changes when a channel gives up on frames its peer never
+ * acknowledged, or sends again after idleTimeout / 2 of silence.  Within a run it only grows, so
+ * frames of an earlier session still on the way are told apart from a restart and dropped.  Bit
+ * i of the selective bitmap says that frame (next expected + 1 + i) has arrived.
+ *
+ * Frames are only taken from endpoints admitted after negotiating the channel, and a channel
+ * quiet for idleTimeout is forgotten, its peer having started a new session by the time it sends
+ * again.  At most maxWaiting payloads wait for the window per channel, later ones are dropped.
+ */
+class ReliableTransport : private boost::noncopyable {
+public:
+	typedef boost::function<void (const string &, const udp::endpoint &)> wireType;
+	typedef boost::function<void (const char *, size_t, const udp::endpoint &)> deliveryType;
+
+	static const size_t headerSize = 12;
+
+	ReliableTransport(wireType wire, deliveryType deliver, long minRTO = 100, size_t maxRetransmissions = 10,
+	                  size_t maxWaiting = 4096, long idleTimeout = 300000)
+		: wire_(wire), deliver_(deliver), minRTO_(minRTO), maxRetransmissions_(maxRetransmissions),
+		  maxWaiting_(maxWaiting), idleTimeout_(idleTimeout), stopping_(false),
+		  sent_(0), retransmitted_(0), delivered_(0), abandoned_(0), dropped_(0), rejected_(0) { }
+
+	~ReliableTransport() {
+		stop();
+	}
+
+	void start() {
+		stopping_ = false;
+		timer_ = boost::thread(boost::bind(&ReliableTransport::timerLoop, this));
+	}
+
+	void stop() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+			timerCondition_.notify_all();
+		}
+		if (timer_.joinable())
+			timer_.join();
+	}
+
+	static bool isFrame(const char *data, size_t size) {
+		return size >= 4 && (unsigned char)data[0] == magic0 && (unsigned char)data[1] == magic1;
+	}
+
+	// take frames from remoteEndpoint, which has agreed to a reliable channel
+	void admit(const udp::endpoint &remoteEndpoint) {
+		boost::mutex::scoped_lock lock(mutex_);
+		admitted_.insert(remoteEndpoint);
+	}
+
+	// queue a payload for reliable, ordered delivery to remoteEndpoint, which is thereby admitted
+	void send(const string &payload, const udp::endpoint &remoteEndpoint) {
+		boost::shared_ptr<Channel> channel;
+		boost::mutex::scoped_lock lock;
+		lockChannel(remoteEndpoint, true, channel, lock);
+		if (channel->waiting.size() >= maxWaiting_) {
+			++dropped_;
+			return;
+		}
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		if (channel->unacked.empty() && channel->waiting.empty() && now - channel->lastSent > boost::posix_time::milliseconds(idleTimeout_ / 2)) {
+			// the peer may have forgotten the channel by now, start over where it would
+			renewSession(*channel);
+		}
+		channel->lastActivity = now;
+		channel->waiting.push_back(payload);
+		transmit(*channel);
+	}
+
+	// handle a DATA or ACK frame received from remoteEndpoint
+	void receive(const char *data, size_t size, const udp::endpoint &remoteEndpoint) {
+		if (!isFrame(data, size) || size < headerSize || (unsigned char)data[2] != version)
+			return;
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		boost::uint32_t session = readUint32(p + 4);
+		boost::uint32_t sequence = readUint32(p + 8);
+		boost::shared_ptr<Channel> channel;
+		boost::mutex::scoped_lock lock;
+		if (!lockChannel(remoteEndpoint, false, channel, lock)) {
+			++rejected_; // not from a peer that has negotiated a reliable channel
+			return;
+		}
+		channel->lastActivity = boost::posix_time::microsec_clock::universal_time();
+		if (p[3] == KIND_DATA) {
+			receiveData(*channel, lock, session, sequence, data + headerSize, size - headerSize, remoteEndpoint);
+		} else if (p[3] == KIND_ACK && size >= headerSize + 8) {
+			boost::uint64_t selective = ((boost::uint64_t)readUint32(p + 12) << 32) | readUint32(p + 16);
+			if (session != channel->session)
+				return; // acknowledges a session given up since
+			receiveAck(*channel, sequence, selective);
+			transmit(*channel);
+		}
+	}
+
+	// statistics
+	size_t getSentCount() const { return sent_.load(); }
+	size_t getRetransmittedCount() const { return retransmitted_.load(); }
+	size_t getDeliveredCount() const { return delivered_.load(); }
+	size_t getAbandonedCount() const { return abandoned_.load(); }
+	size_t getDroppedCount() const { return dropped_.load(); }   // payloads beyond maxWaiting
+	size_t getRejectedCount() const { return rejected_.load(); } // frames from endpoints not admitted
+	size_t getChannelCount() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return channels_.size();
+	}
+
+	// smoothed round trip time and congestion window towards an endpoint, for monitoring; 0 without a channel
+	double getSmoothedRTT(const udp::endpoint &remoteEndpoint) {
+		boost::shared_ptr<Channel> channel;
+		boost::mutex::scoped_lock lock;
+		return lockChannel(remoteEndpoint, false, channel, lock) ? channel->srtt : 0;
+	}
+	double getCongestionWindow(const udp::endpoint &remoteEndpoint) {
+		boost::shared_ptr<Channel> channel;
+		boost::mutex::scoped_lock lock;
+		return lockChannel(remoteEndpoint, false, channel, lock) ? channel->cwnd : 0;
+	}
+private:
+	enum FrameKind {
+		KIND_DATA = 1,
+		KIND_ACK = 2
+	};
+
+	static const unsigned char version = 1;
+	static const unsigned char magic0 = 0xC0;
+	static const unsigned char magic1 = 0xDE;
+	static const boost::uint32_t receiveWindow = 1024; // frames buffered ahead of the next expected one
+	static const boost::int32_t staleSessions = 16;    // renewals after which an earlier session may look like a restart
+
+	struct Outstanding {
+		string frame;
+		boost::posix_time::ptime sentAt;
+		size_t transmissions;
+		size_t laterAcks; // frames after this one acknowledged since it was sent
+	};
+
+	struct Channel {
+		Channel(const udp::endpoint &endpoint, const boost::posix_time::ptime &now)
+			: remoteEndpoint(endpoint), retired(false), lastActivity(now), session(makeSession()), nextSequence(0),
+			  cwnd(4), ssthresh(64), srtt(0), rttvar(0), rto(1000), recoveryPoint(0), lastSent(now),
+			  peerSession(0), expected(0), delivering(false) { }
+
+		boost::mutex mutex;
+		udp::endpoint remoteEndpoint;
+		bool retired;          // forgotten for being idle; whoever still holds it gets a new one
+		boost::posix_time::ptime lastActivity;
+
+		// sending half
+		boost::uint32_t session;
+		boost::uint32_t nextSequence;
+		map<boost::uint32_t, Outstanding> unacked;
+		deque<string> waiting; // payloads not sent yet because the window is full
+		double cwnd;
+		double ssthresh;
+		double srtt;           // milliseconds, 0 until the first sample
+		double rttvar;
+		double rto;
+		boost::uint32_t recoveryPoint; // no further window cut for losses below this sequence
+		boost::posix_time::ptime timerStarted;
+		boost::posix_time::ptime lastSent;
+
+		// receiving half
+		boost::uint32_t peerSession;
+		boost::uint32_t expected;
+		map<boost::uint32_t, string> outOfOrder;
+		deque<string> ready;   // in order, waiting to be delivered
+		bool delivering;       // some thread is delivering ready payloads right now
+	};
+
+	/**
+	 * The channel to remoteEndpoint, locked with lock; without create, false if the endpoint is not
+	 * admitted.  Creating a channel admits its endpoint.
+	 */
+	bool lockChannel(const udp::endpoint &remoteEndpoint, bool create, boost::shared_ptr<Channel> &channel,
+	                 boost::mutex::scoped_lock &lock) {
+		for (;;) {
+			{
+				boost::mutex::scoped_lock tableLock(mutex_);
+				map<udp::endpoint, boost::shared_ptr<Channel> >::iterator iter = channels_.find(remoteEndpoint);
+				if (iter != channels_.end()) {
+					channel = iter->second;
+				} else if (create || admitted_.count(remoteEndpoint)) {
+					admitted_.insert(remoteEndpoint);
+					channel.reset(new Channel(remoteEndpoint, boost::posix_time::microsec_clock::universal_time()));
+					channels_[remoteEndpoint] = channel;
+				} else {
+					return false;
+				}
+			}
+			boost::mutex::scoped_lock channelLock(channel->mutex);
+			if (!channel->retired) {
+				lock.swap(channelLock);
+				return true;
+			}
+		}
+	}
+
+	// called with channel.mutex held: start a new session, which the peer takes as a fresh start
+	static void renewSession(Channel &channel) {
+		channel.session += 2;
+		channel.nextSequence = 0;
+		channel.recoveryPoint = 0;
+	}
+
+	// called with channel.mutex held: put as many waiting payloads on the wire as the window allows
+	void transmit(Channel &channel) {
+		while (!channel.waiting.empty() && channel.unacked.size() < (size_t)channel.cwnd) {
+			boost::uint32_t sequence = channel.nextSequence++;
+			Outstanding &outstanding = channel.unacked[sequence];
+			outstanding.frame = makeHeader(KIND_DATA, channel.session, sequence) + channel.waiting.front();
+			outstanding.transmissions = 0;
+			outstanding.laterAcks = 0;
+			channel.waiting.pop_front();
+			if (channel.unacked.size() == 1)
+				channel.timerStarted = boost::posix_time::microsec_clock::universal_time();
+			put(channel, outstanding);
+			++sent_;
+		}
+	}
+
+	// called with channel.mutex held
+	void put(Channel &channel, Outstanding &outstanding) {
+		outstanding.sentAt = boost::posix_time::microsec_clock::universal_time();
+		channel.lastSent = outstanding.sentAt;
+		++outstanding.transmissions;
+		wire_(outstanding.frame, channel.remoteEndpoint);
+	}
+
+	// called with channel.mutex held
+	void receiveAck(Channel &channel, boost::uint32_t next, boost::uint64_t selective) {
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		size_t outstanding = channel.unacked.size();
+		size_t newlyAcked = 0;
+		boost::uint32_t highestAcked = 0;
+		for (map<boost::uint32_t, Outstanding>::iterator iter = channel.unacked.begin(); iter != channel.unacked.end(); ) {
+			boost::uint32_t sequence = iter->first;
+			bool acked = sequence < next ||
+			             (sequence > next && sequence - next - 1 < 64 && (selective >> (sequence - next - 1)) & 1);
+			if (acked) {
+				// Karn: only frames sent once give an unambiguous round trip time
+				if (iter->second.transmissions == 1)
+					sampleRTT(channel, (now - iter->second.sentAt).total_microseconds() / 1000.0);
+				highestAcked = max(highestAcked, sequence);
+				channel.unacked.erase(iter++);
+				++newlyAcked;
+			} else {
+				++iter;
+			}
+		}
+		if (newlyAcked == 0)
+			return;
+		// new data got through: restart the timer and forget the exponential backoff of earlier timeouts
+		channel.timerStarted = now;
+		if (channel.srtt > 0)
+			channel.rto = min(max(channel.srtt + 4 * channel.rttvar, (double)minRTO_), 10000.0);
+		for (size_t i = 0; i < newlyAcked; ++i) {
+			channel.cwnd += channel.cwnd < channel.ssthresh ? 1.0 : 1.0 / channel.cwnd;
+		}
+		// fast retransmit: a frame three later frames have overtaken is lost; with fewer frames in
+		// flight fewer will do (early retransmit, RFC 5827), or a small window could only time out
+		size_t threshold = min<size_t>(3, max<size_t>(outstanding, 2) - 1);
+		for (map<boost::uint32_t, Outstanding>::iterator iter = channel.unacked.begin(); iter != channel.unacked.end(); ++iter) {
+			if (iter->first > highestAcked)
+				break;
+			iter->second.laterAcks += newlyAcked;
+			if (iter->second.laterAcks >= threshold && iter->second.transmissions == 1) {
+				onLoss(channel, iter->first, false);
+				put(channel, iter->second);
+				++retransmitted_;
+			}
+		}
+	}
+
+	// called with channel.mutex held
+	void sampleRTT(Channel &channel, double rtt) {
+		if (channel.srtt == 0) {
+			channel.srtt = rtt;
+			channel.rttvar = rtt / 2;
+		} else {
+			channel.rttvar = 0.75 * channel.rttvar + 0.25 * fabs(channel.srtt - rtt);
+			channel.srtt = 0.875 * channel.srtt + 0.125 * rtt;
+		}
+		channel.rto = min(max(channel.srtt + 4 * channel.rttvar, (double)minRTO_), 10000.0);
+	}
+
+	// called with channel.mutex held: cut the window at most once per window of data
+	void onLoss(Channel &channel, boost::uint32_t sequence, bool timeout) {
+		if (sequence < channel.recoveryPoint && !timeout)
+			return;
+		channel.recoveryPoint = channel.nextSequence;
+		channel.ssthresh = max(channel.cwnd / 2, 2.0);
+		channel.cwnd = timeout ? 1.0 : channel.ssthresh;
+	}
+
+	// called with channel.mutex held by lock, which is released to deliver
+	void receiveData(Channel &channel, boost::mutex::scoped_lock &lock, boost::uint32_t session, boost::uint32_t sequence,
+	                 const char *payload, size_t size, const udp::endpoint &remoteEndpoint) {
+		if (session != channel.peerSession) {
+			// a frame the peer sent before renewing its session arrives late
+			boost::int32_t age = (boost::int32_t)(channel.peerSession - session);
+			if (channel.peerSession != 0 && age > 0 && age <= 2 * staleSessions)
+				return;
+			// the peer has restarted or renewed its session, whatever we had from before is gone
+			channel.peerSession = session;
+			channel.expected = 0;
+			channel.outOfOrder.clear();
+		}
+		if (sequence >= channel.expected && sequence - channel.expected < receiveWindow) {
+			if (sequence == channel.expected) {
+				channel.ready.push_back(string(payload, size));
+				++channel.expected;
+				map<boost::uint32_t, string>::iterator iter;
+				while ((iter = channel.outOfOrder.find(channel.expected)) != channel.outOfOrder.end()) {
+					channel.ready.push_back(string());
+					channel.ready.back().swap(iter->second);
+					channel.outOfOrder.erase(iter);
+					++channel.expected;
+				}
+			} else {
+				channel.outOfOrder[sequence].assign(payload, size);
+			}
+		}
+		// acknowledge everything, duplicates included, their ack may have been lost
+		boost::uint64_t selective = 0;
+		for (map<boost::uint32_t, string>::const_iterator iter = channel.outOfOrder.begin(); iter != channel.outOfOrder.end(); ++iter) {
+			boost::uint32_t offset = iter->first - channel.expected - 1;
+			if (offset < 64)
+				selective |= (boost::uint64_t)1 << offset;
+		}
+		string ack = makeHeader(KIND_ACK, session, channel.expected);
+		ack.resize(headerSize + 8);
+		writeUint32(reinterpret_cast<unsigned char *>(&ack[headerSize]), (boost::uint32_t)(selective >> 32));
+		writeUint32(reinterpret_cast<unsigned char *>(&ack[headerSize + 4]), (boost::uint32_t)selective);
+		wire_(ack, remoteEndpoint);
+		if (channel.delivering)
+			return; // the thread already delivering will pick up what has just become ready
+		channel.delivering = true;
+		lock.unlock();
+		// deliver in order, one thread per channel at a time
+		while (true) {
+			string next;
+			lock.lock();
+			if (channel.ready.empty()) {
+				channel.delivering = false;
+				return;
+			}
+			next.swap(channel.ready.front());
+			channel.ready.pop_front();
+			lock.unlock();
+			++delivered_;
+			try {
+				deliver_(next.data(), next.size(), remoteEndpoint);
+			} catch (exception &e) {
+				// a faulty message must not stall the channel
+			}
+		}
+	}
+
+	void timerLoop() {
+		boost::mutex::scoped_lock lock(mutex_);
+		boost::posix_time::ptime lastSweep = boost::posix_time::microsec_clock::universal_time();
+		while (!stopping_) {
+			timerCondition_.timed_wait(lock, boost::posix_time::milliseconds(10));
+			vector<boost::shared_ptr<Channel> > channels;
+			for (map<udp::endpoint, boost::shared_ptr<Channel> >::iterator iter = channels_.begin(); iter != channels_.end(); ++iter) {
+				channels.push_back(iter->second);
+			}
+			lock.unlock();
+			for (size_t i = 0; i < channels.size(); ++i) {
+				retransmitExpired(*channels[i]);
+			}
+			lock.lock();
+			boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+			if (now - lastSweep > boost::posix_time::milliseconds(idleTimeout_ / 4 + 1)) {
+				lastSweep = now;
+				expireIdle(now);
+			}
+		}
+	}
+
+	// called with mutex_ held: forget the channels with nothing in flight that have been quiet for idleTimeout
+	void expireIdle(const boost::posix_time::ptime &now) {
+		for (map<udp::endpoint, boost::shared_ptr<Channel> >::iterator iter = channels_.begin(); iter != channels_.end(); ) {
+			Channel &channel = *iter->second;
+			boost::mutex::scoped_lock lock(channel.mutex);
+			if (channel.unacked.empty() && channel.waiting.empty() && channel.outOfOrder.empty() && channel.ready.empty() &&
+			    !channel.delivering && now - channel.lastActivity > boost::posix_time::milliseconds(idleTimeout_)) {
+				channel.retired = true;
+				lock.unlock();
+				channels_.erase(iter++);
+			} else {
+				++iter;
+			}
+		}
+	}
+
+	// one retransmission timer per channel, restarted whenever an acknowledgement makes progress
+	void retransmitExpired(Channel &channel) {
+		boost::mutex::scoped_lock lock(channel.mutex);
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		if (channel.unacked.empty() || (now - channel.timerStarted).total_milliseconds() < channel.rto) {
+			transmit(channel);
+			return;
+		}
+		if (channel.unacked.begin()->second.transmissions > maxRetransmissions_) {
+			// the peer is gone: drop everything queued for it and start over in a new session, so
+			// that it does not wait forever for the frames given up here
+			abandoned_ += channel.unacked.size() + channel.waiting.size();
+			channel.unacked.clear();
+			channel.waiting.clear();
+			renewSession(channel);
+			return;
+		}
+		onLoss(channel, channel.unacked.begin()->first, true);
+		// resend every frame that has waited a whole timeout, the oldest one at least
+		for (map<boost::uint32_t, Outstanding>::iterator iter = channel.unacked.begin(); iter != channel.unacked.end(); ++iter) {
+			if (iter != channel.unacked.begin() && (now - iter->second.sentAt).total_milliseconds() < channel.rto)
+				continue;
+			put(channel, iter->second);
+			++retransmitted_;
+		}
+		channel.rto = min(channel.rto * 2, 10000.0);
+		channel.timerStarted = now;
+	}
+
+	static string makeHeader(FrameKind kind, boost::uint32_t session, boost::uint32_t sequence) {
+		string header(headerSize, '\0');
+		unsigned char *p = reinterpret_cast<unsigned char *>(&header[0]);
+		p[0] = magic0;
+		p[1] = magic1;
+		p[2] = version;
+		p[3] = (unsigned char)kind;
+		writeUint32(p + 4, session);
+		writeUint32(p + 8, sequence);
+		return header;
+	}
+
+	static boost::uint32_t makeSession() {
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		boost::uint64_t seed = now.time_of_day().total_microseconds() ^ ((boost::uint64_t)(size_t)&now << 7);
+		seed ^= seed >> 33;
+		seed *= 0xff51afd7ed558ccdULL;
+		seed ^= seed >> 33;
+		return (boost::uint32_t)seed | 1;
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+	static void writeUint32(unsigned char *p, boost::uint32_t value) {
+		p[0] = (unsigned char)(value >> 24);
+		p[1] = (unsigned char)(value >> 16);
+		p[2] = (unsigned char)(value >> 8);
+		p[3] = (unsigned char)value;
+	}
+
+	wireType wire_;
+	deliveryType deliver_;
+	const long minRTO_;
+	const size_t maxRetransmissions_;
+	const size_t maxWaiting_;
+	const long idleTimeout_;
+
+	mutable boost::mutex mutex_;
+	boost::condition_variable timerCondition_;
+	map<udp::endpoint, boost::shared_ptr<Channel> > channels_;
+	set<udp::endpoint> admitted_;
+	bool stopping_;
+	boost::thread timer_;
+
+	boost::atomic<size_t> sent_;
+	boost::atomic<size_t> retransmitted_;
+	boost::atomic<size_t> delivered_;
+	boost::atomic<size_t> abandoned_;
+	boost::atomic<size_t> dropped_;
+	boost::atomic<size_t> rejected_;
+};
+
+}
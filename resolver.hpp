@@ -0,0 +1,152 @@
+/*
+ * resolver.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "workerpool.hpp"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+namespace openchat {
+
+/**
+ * Resolver turns hostname and port into an endpoint without blocking its callers.  Lookups run
+ * in parallel on a small pool of threads; results are cached, successes for cacheTimeout and
+ * failures for failureTimeout milliseconds, and concurrent requests for the same name share
+ * one lookup.
+ */
+class Resolver : private boost::noncopyable {
+public:
+	// called with the outcome of a lookup; the endpoint is only meaningful without an error
+	typedef boost::function<void (const boost::system::error_code &, const udp::endpoint &)> callbackType;
+
+	Resolver(size_t threadCount, long cacheTimeout, long failureTimeout)
+		: cacheTimeout_(cacheTimeout), failureTimeout_(failureTimeout),
+		  lookups_(threadCount, 1024, OVERFLOW_BLOCK, boost::bind(&Resolver::lookup, this, _1)),
+		  hits_(0), misses_(0), failures_(0) {
+		lookups_.start();
+	}
+
+	~Resolver() {
+		stop();
+	}
+
+	// finish the lookups in progress, their callbacks included
+	void stop() {
+		lookups_.stop();
+	}
+
+	/**
+	 * Resolve hostname and port.  A cached answer is handed to callback right away, on the
+	 * calling thread; otherwise callback runs on a resolver thread once the lookup is done.
+	 */
+	void resolve(const string &hostname, const string &port, callbackType callback) {
+		Key key(hostname, port);
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		boost::system::error_code error;
+		udp::endpoint endpoint;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			Entry &entry = cache_[key];
+			if (entry.lookingUp) {
+				entry.waiting.push_back(callback);
+				return;
+			}
+			if (entry.expires.is_special() || entry.expires <= now) {
+				++misses_;
+				entry.lookingUp = true;
+				entry.waiting.push_back(callback);
+				lock.unlock();
+				if (!lookups_.submit(key)) {
+					// stopping: nobody is going to answer
+					lock.lock();
+					entry.lookingUp = false;
+					entry.waiting.clear();
+				}
+				return;
+			}
+			++hits_;
+			error = entry.error;
+			endpoint = entry.endpoint;
+		}
+		callback(error, endpoint);
+	}
+
+	// statistics
+	size_t getHitCount() const { return hits_.load(); }
+	size_t getMissCount() const { return misses_.load(); }
+	size_t getFailureCount() const { return failures_.load(); }
+private:
+	typedef pair<string, string> Key;
+
+	struct Entry {
+		Entry() : lookingUp(false) { }
+		udp::endpoint endpoint;
+		boost::system::error_code error;
+		boost::posix_time::ptime expires; // not_a_date_time until the first lookup finishes
+		bool lookingUp;
+		vector<callbackType> waiting;
+	};
+
+	void lookup(const Key &key) {
+		boost::asio::io_service ioService;
+		udp::resolver resolver(ioService);
+		udp::resolver::query query(udp::v4(), key.first, key.second);
+		boost::system::error_code error;
+		udp::endpoint endpoint;
+		udp::resolver::iterator iter = resolver.resolve(query, error);
+		if (!error) {
+			if (iter == udp::resolver::iterator()) {
+				error = boost::asio::error::host_not_found;
+			} else {
+				endpoint = *iter;
+			}
+		}
+		if (error)
+			++failures_;
+
+		vector<callbackType> waiting;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			Entry &entry = cache_[key];
+			entry.endpoint = endpoint;
+			entry.error = error;
+			entry.expires = boost::posix_time::microsec_clock::universal_time() +
+			                boost::posix_time::milliseconds(error ? failureTimeout_ : cacheTimeout_);
+			entry.lookingUp = false;
+			waiting.swap(entry.waiting);
+		}
+		for (size_t i = 0; i < waiting.size(); ++i) {
+			waiting[i](error, endpoint);
+		}
+	}
+
+	const long cacheTimeout_;
+	const long failureTimeout_;
+
+	boost::mutex mutex_;
+	map<Key, Entry> cache_;
+	WorkerPool<Key> lookups_;
+
+	boost::atomic<size_t> hits_;
+	boost::atomic<size_t> misses_;
+	boost::atomic<size_t> failures_;
+};
+
+}
@@ -0,0 +1,90 @@
+/*
+ * scriptreader.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "mappedfile.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * ScriptReader hands out the lines of a command script without copying them: a file is mapped
+ * and split in place, a stream ("-") is read bufferSize bytes at a time and split in its buffer.
+ * A line is valid until the next one is asked for.
+ */
+class ScriptReader : private boost::noncopyable {
+public:
+	static const size_t bufferSize = 1 << 20;
+
+	ScriptReader(const string &source, istream &is)
+		: is_(is), fromStream_(source == "-"), file_(fromStream_ ? string() : source), data_(file_.data()), position_(0),
+		  end_(file_.size()), endOfStream_(false), lineNumber_(0) { }
+
+	// false if the script is a file that cannot be read
+	bool isOpen() const { return fromStream_ || file_.exists(); }
+
+	// the next line, without its line break; false at the end of the script
+	bool next(boost::string_ref &line) {
+		for (;;) {
+			const char *begin = data_ + position_;
+			const char *newline = position_ < end_ ? static_cast<const char *>(memchr(begin, '\n', end_ - position_)) : 0;
+			if (newline != 0) {
+				line = boost::string_ref(begin, newline - begin);
+				position_ += line.size() + 1;
+				break;
+			}
+			if (!fromStream_ || endOfStream_) {
+				// the last line may have no line break
+				if (position_ == end_)
+					return false;
+				line = boost::string_ref(begin, end_ - position_);
+				position_ = end_;
+				break;
+			}
+			fill();
+		}
+		++lineNumber_;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.remove_suffix(1);
+		return true;
+	}
+
+	// of the line last handed out, from 1
+	size_t getLineNumber() const { return lineNumber_; }
+private:
+	// read on into the buffer, after the part of a line still in it
+	void fill() {
+		buffer_.erase(0, position_);
+		end_ -= position_;
+		position_ = 0;
+		buffer_.resize(end_ + bufferSize);
+		is_.read(&buffer_[end_], bufferSize);
+		size_t count = (size_t)is_.gcount();
+		end_ += count;
+		endOfStream_ = count == 0 || !is_;
+		data_ = buffer_.data();
+	}
+
+	istream &is_;
+	bool fromStream_;
+	MappedFile file_;
+	string buffer_;
+	const char *data_;
+	size_t position_;
+	size_t end_;
+	bool endOfStream_;
+	size_t lineNumber_;
+};
+
+}
@@ -0,0 +1,637 @@
+/*
+ * searchindex.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "mappedfile.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * SearchIndex is an incremental inverted index over numbered documents, the messages of the
+ * history.  Documents are added in increasing order; they are indexed in memory until flushSize
+ * of them have been added, then written out as an immutable segment that is memory-mapped for
+ * searching.  Whenever mergeFactor segments of the same size class pile up they are merged into
+ * one, so there are only a few segments per size class and a query looks at few of them.
+ *
+ * In a segment the posting list of a term, the documents it occurs in, is split into blocks of
+ * blockSize documents, each encoded as varint deltas.  A table of each block's last document and
+ * position lets a search decode just the blocks it needs: the newest ones first, for results are
+ * ranked by recency, and only those that may hold a candidate when checking the other terms.
+ *
+ * Searching never waits for indexing, apart from a brief lock to look at the in-memory part.
+ */
+class SearchIndex : private boost::noncopyable {
+public:
+	typedef boost::uint32_t DocID;
+
+	static const size_t blockSize = 128;
+	static const size_t maxTokenSize = 64;
+
+	SearchIndex(const string &directory, size_t flushSize = 1 << 16, size_t mergeFactor = 4)
+		: directory_(directory), flushSize_(flushSize), mergeFactor_(mergeFactor), nextSegment_(0),
+		  memoryBegin_(0), memoryEnd_(0), indexed_(0), indexingTime_(0), merges_(0) { }
+
+	/**
+	 * Load the segments listed in the manifest; returns the number of the first document not
+	 * covered by them, where adding is to resume.
+	 */
+	DocID open() {
+		vector<boost::shared_ptr<const Segment> > segments;
+		ifstream manifest((directory_ + "/search.manifest").c_str());
+		boost::uint32_t number;
+		DocID end = 0;
+		while (manifest >> number) {
+			boost::shared_ptr<Segment> segment = boost::make_shared<Segment>(getSegmentFileName(number), number);
+			if (!segment->isValid() || segment->getBegin() != end)
+				break; // what follows is indexed again
+			end = segment->getEnd();
+			segments.push_back(segment);
+			nextSegment_ = max(nextSegment_, number + 1);
+		}
+		boost::mutex::scoped_lock lock(mutex_);
+		segments_.swap(segments);
+		memory_.clear();
+		memoryBegin_ = memoryEnd_ = end;
+		return end;
+	}
+
+	// write out what is indexed in memory
+	void close() {
+		flush();
+	}
+
+	// forget everything indexed, on disk too; adding starts over at document 0
+	void clear() {
+		vector<boost::shared_ptr<const Segment> > segments;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			segments.swap(segments_);
+			memory_.clear();
+			memoryBegin_ = memoryEnd_ = 0;
+		}
+		writeManifest();
+		for (size_t i = 0; i < segments.size(); ++i) {
+			remove(getSegmentFileName(segments[i]->getNumber()).c_str());
+		}
+	}
+
+	// index a document; documents are to be added in increasing order, without gaps
+	void add(DocID doc, const string &text) {
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		vector<string> tokens;
+		tokenize(text, tokens);
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			for (vector<string>::const_iterator iter = tokens.begin(); iter != tokens.end(); ++iter) {
+				vector<DocID> &postings = memory_[*iter];
+				if (postings.empty() || postings.back() != doc)
+					postings.push_back(doc);
+			}
+			memoryEnd_ = doc + 1;
+		}
+		++indexed_;
+		if (memoryEnd_ - memoryBegin_ >= flushSize_)
+			flush();
+		indexingTime_ += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+	}
+
+	/**
+	 * The documents containing every term of query, newest first, at most limit of them.  Terms
+	 * are tokenized as documents are.
+	 */
+	vector<DocID> search(const string &query, size_t limit) const {
+		vector<DocID> results;
+		vector<string> terms;
+		tokenize(query, terms);
+		sort(terms.begin(), terms.end());
+		terms.erase(unique(terms.begin(), terms.end()), terms.end());
+		if (terms.empty() || limit == 0)
+			return results;
+
+		vector<boost::shared_ptr<const Segment> > segments;
+		vector<vector<DocID> > memoryPostings(terms.size());
+		bool inMemory = true;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			segments = segments_;
+			for (size_t i = 0; i < terms.size() && inMemory; ++i) {
+				map<string, vector<DocID> >::const_iterator iter = memory_.find(terms[i]);
+				if (iter == memory_.end()) {
+					inMemory = false;
+				} else {
+					memoryPostings[i] = iter->second;
+				}
+			}
+		}
+
+		// the newest documents are in memory
+		if (inMemory) {
+			size_t driver = 0;
+			for (size_t i = 1; i < terms.size(); ++i) {
+				if (memoryPostings[i].size() < memoryPostings[driver].size())
+					driver = i;
+			}
+			const vector<DocID> &candidates = memoryPostings[driver];
+			for (vector<DocID>::const_reverse_iterator iter = candidates.rbegin(); iter != candidates.rend() && results.size() < limit; ++iter) {
+				bool everywhere = true;
+				for (size_t i = 0; i < terms.size() && everywhere; ++i) {
+					everywhere = i == driver || binary_search(memoryPostings[i].begin(), memoryPostings[i].end(), *iter);
+				}
+				if (everywhere)
+					results.push_back(*iter);
+			}
+		}
+
+		// then the segments, newest first
+		for (size_t s = segments.size(); s-- > 0 && results.size() < limit;) {
+			vector<PostingCursor> cursors;
+			cursors.reserve(terms.size());
+			for (size_t i = 0; i < terms.size(); ++i) {
+				PostingList list;
+				if (!segments[s]->find(terms[i], list))
+					break;
+				cursors.push_back(PostingCursor(list));
+			}
+			if (cursors.size() != terms.size())
+				continue; // some term does not occur in this segment
+			size_t driver = 0;
+			for (size_t i = 1; i < cursors.size(); ++i) {
+				if (cursors[i].getCount() < cursors[driver].getCount())
+					driver = i;
+			}
+			vector<DocID> block;
+			for (size_t b = cursors[driver].getBlockCount(); b-- > 0 && results.size() < limit;) {
+				cursors[driver].decodeBlock(b, block);
+				for (vector<DocID>::const_reverse_iterator iter = block.rbegin(); iter != block.rend() && results.size() < limit; ++iter) {
+					bool everywhere = true;
+					for (size_t i = 0; i < cursors.size() && everywhere; ++i) {
+						everywhere = i == driver || cursors[i].contains(*iter);
+					}
+					if (everywhere)
+						results.push_back(*iter);
+				}
+			}
+		}
+		return results;
+	}
+
+	/**
+	 * Split text into terms: runs of ASCII letters and digits, folded to lower case, and of any
+	 * non-ASCII bytes, so UTF-8 words stay whole.  Terms longer than maxTokenSize are cut.
+	 */
+	static void tokenize(const string &text, vector<string> &tokens) {
+		string token;
+		for (size_t i = 0; i <= text.size(); ++i) {
+			unsigned char c = i < text.size() ? text[i] : ' ';
+			if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+				if (token.size() < maxTokenSize)
+					token.push_back(c);
+			} else if (c >= 'A' && c <= 'Z') {
+				if (token.size() < maxTokenSize)
+					token.push_back(c - 'A' + 'a');
+			} else if (!token.empty()) {
+				tokens.push_back(token);
+				token.clear();
+			}
+		}
+	}
+
+	// statistics
+	size_t getIndexedCount() const { return indexed_.load(); }
+	size_t getIndexingTime() const { return indexingTime_.load(); } // microseconds, flushes and merges included
+	size_t getMergeCount() const { return merges_.load(); }
+	size_t getSegmentCount() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return segments_.size();
+	}
+private:
+	// a posting list inside a segment: block count, block table, then the blocks
+	struct PostingList {
+		const unsigned char *data;
+		size_t size;
+		boost::uint32_t count;
+	};
+
+	class PostingCursor {
+	public:
+		explicit PostingCursor(const PostingList &list) : list_(list), cachedBlock_((size_t)-1) {
+			blockCount_ = readUint32(list.data);
+		}
+
+		boost::uint32_t getCount() const { return list_.count; }
+		size_t getBlockCount() const { return blockCount_; }
+
+		void decodeBlock(size_t block, vector<DocID> &docs) const {
+			docs.clear();
+			const unsigned char *table = list_.data + 4;
+			size_t begin = readUint32(table + block * 8 + 4);
+			size_t end = block + 1 < blockCount_ ? readUint32(table + (block + 1) * 8 + 4) : list_.size - 4 - blockCount_ * 8;
+			const unsigned char *p = table + blockCount_ * 8 + begin;
+			const unsigned char *limit = table + blockCount_ * 8 + end;
+			DocID doc = block > 0 ? readUint32(table + (block - 1) * 8) : 0;
+			while (p < limit) {
+				doc += readVarint(p, limit);
+				docs.push_back(doc);
+			}
+		}
+
+		bool contains(DocID doc) {
+			// the first block whose last document is not below doc
+			const unsigned char *table = list_.data + 4;
+			size_t first = 0, count = blockCount_;
+			while (count > 0) {
+				size_t half = count / 2;
+				if (readUint32(table + (first + half) * 8) < doc) {
+					first += half + 1;
+					count -= half + 1;
+				} else {
+					count = half;
+				}
+			}
+			if (first == blockCount_)
+				return false;
+			if (first != cachedBlock_) {
+				decodeBlock(first, cache_);
+				cachedBlock_ = first;
+			}
+			return binary_search(cache_.begin(), cache_.end(), doc);
+		}
+	private:
+		PostingList list_;
+		size_t blockCount_;
+		size_t cachedBlock_;
+		vector<DocID> cache_;
+	};
+
+	/**
+	 * An immutable, memory-mapped segment:
+	 *   "OCSI", version, posting lists, terms, dictionary, footer
+	 * where the dictionary holds, for each term in ascending order, 24 bytes: the term's offset and
+	 * length among the terms, and its posting list's offset, size and document count; and the
+	 * footer, 32 bytes: the documents covered, the term count, the offsets of terms and
+	 * dictionary, and "OCSI" again.
+	 */
+	class Segment : private boost::noncopyable {
+	public:
+		Segment(const string &fileName, boost::uint32_t number) : file_(fileName), number_(number), valid_(false) {
+			const unsigned char *data = (const unsigned char *)file_.data();
+			size_t size = file_.size();
+			if (size < 8 + footerSize || memcmp(data, "OCSI", 4) != 0 || readUint32(data + 4) != version ||
+			    memcmp(data + size - 4, "OCSI", 4) != 0)
+				return;
+			const unsigned char *footer = data + size - footerSize;
+			begin_ = readUint32(footer);
+			end_ = readUint32(footer + 4);
+			termCount_ = readUint32(footer + 8);
+			termsOffset_ = (size_t)readUint64(footer + 12);
+			dictionaryOffset_ = (size_t)readUint64(footer + 20);
+			valid_ = termsOffset_ <= dictionaryOffset_ && dictionaryOffset_ + (size_t)termCount_ * dictionaryEntrySize + footerSize == size;
+		}
+
+		bool isValid() const { return valid_; }
+		boost::uint32_t getNumber() const { return number_; }
+		DocID getBegin() const { return begin_; }
+		DocID getEnd() const { return end_; }
+		size_t getTermCount() const { return termCount_; }
+
+		// the i-th term, in ascending order, and its posting list
+		string getTerm(size_t i, PostingList &list) const {
+			const unsigned char *entry = (const unsigned char *)file_.data() + dictionaryOffset_ + i * dictionaryEntrySize;
+			list.data = (const unsigned char *)file_.data() + (size_t)readUint64(entry + 8);
+			list.size = readUint32(entry + 16);
+			list.count = readUint32(entry + 20);
+			return string(file_.data() + termsOffset_ + readUint32(entry), readUint32(entry + 4));
+		}
+
+		bool find(const string &term, PostingList &list) const {
+			size_t first = 0, count = termCount_;
+			while (count > 0) {
+				size_t half = count / 2;
+				if (compareTerm(first + half, term) < 0) {
+					first += half + 1;
+					count -= half + 1;
+				} else {
+					count = half;
+				}
+			}
+			if (first == termCount_ || compareTerm(first, term) != 0)
+				return false;
+			getTerm(first, list);
+			return true;
+		}
+	private:
+		int compareTerm(size_t i, const string &term) const {
+			const unsigned char *entry = (const unsigned char *)file_.data() + dictionaryOffset_ + i * dictionaryEntrySize;
+			size_t length = readUint32(entry + 4);
+			int result = memcmp(file_.data() + termsOffset_ + readUint32(entry), term.data(), min(length, term.size()));
+			if (result != 0)
+				return result;
+			return length < term.size() ? -1 : (length > term.size() ? 1 : 0);
+		}
+
+		MappedFile file_;
+		boost::uint32_t number_;
+		bool valid_;
+		DocID begin_;
+		DocID end_;
+		boost::uint32_t termCount_;
+		size_t termsOffset_;
+		size_t dictionaryOffset_;
+	};
+
+	// builds a segment file, one term at a time in ascending order
+	class SegmentWriter {
+	public:
+		SegmentWriter(const string &fileName) : fileName_(fileName), file_(fopen((fileName + ".tmp").c_str(), "wb")), offset_(0), ok_(file_ != 0) {
+			string header("OCSI", 4);
+			appendUint32(header, version);
+			write(header);
+		}
+
+		~SegmentWriter() {
+			if (file_)
+				fclose(file_);
+		}
+
+		void add(const string &term, const vector<DocID> &docs) {
+			string list;
+			appendUint32(list, (boost::uint32_t)((docs.size() + blockSize - 1) / blockSize));
+			string blocks;
+			string table;
+			DocID previous = 0;
+			for (size_t i = 0; i < docs.size(); ++i) {
+				if (i % blockSize == 0)
+					appendUint32(table, 0), appendUint32(table, (boost::uint32_t)blocks.size());
+				appendVarint(blocks, docs[i] - previous);
+				previous = docs[i];
+				if (i % blockSize == blockSize - 1 || i + 1 == docs.size()) {
+					// the block's last document
+					table[table.size() - 8] = (char)(previous >> 24);
+					table[table.size() - 7] = (char)(previous >> 16);
+					table[table.size() - 6] = (char)(previous >> 8);
+					table[table.size() - 5] = (char)previous;
+				}
+			}
+			list.append(table);
+			list.append(blocks);
+
+			appendUint32(dictionary_, (boost::uint32_t)terms_.size());
+			appendUint32(dictionary_, (boost::uint32_t)term.size());
+			appendUint64(dictionary_, offset_);
+			appendUint32(dictionary_, (boost::uint32_t)list.size());
+			appendUint32(dictionary_, (boost::uint32_t)docs.size());
+			terms_.append(term);
+			write(list);
+		}
+
+		// finish the file and put it in place; false if it could not be written
+		bool finish(DocID begin, DocID end, size_t termCount) {
+			boost::uint64_t termsOffset = offset_;
+			write(terms_);
+			boost::uint64_t dictionaryOffset = offset_;
+			write(dictionary_);
+			string footer;
+			appendUint32(footer, begin);
+			appendUint32(footer, end);
+			appendUint32(footer, (boost::uint32_t)termCount);
+			appendUint64(footer, termsOffset);
+			appendUint64(footer, dictionaryOffset);
+			footer.append("OCSI", 4);
+			write(footer);
+			if (file_) {
+				ok_ = fclose(file_) == 0 && ok_;
+				file_ = 0;
+			}
+			if (!ok_ || rename((fileName_ + ".tmp").c_str(), fileName_.c_str()) != 0) {
+				remove((fileName_ + ".tmp").c_str());
+				return false;
+			}
+			return true;
+		}
+	private:
+		void write(const string &data) {
+			if (ok_ && fwrite(data.data(), 1, data.size(), file_) != data.size())
+				ok_ = false;
+			offset_ += data.size();
+		}
+
+		string fileName_;
+		FILE *file_;
+		boost::uint64_t offset_;
+		bool ok_;
+		string terms_;
+		string dictionary_;
+	};
+
+	static const boost::uint32_t version = 1;
+	static const size_t footerSize = 32;
+	static const size_t dictionaryEntrySize = 24;
+
+	// write the in-memory part out as a segment, then merge what has piled up
+	void flush() {
+		// only the indexing thread changes the in-memory part, so it reads it without locking; the
+		// part stays searchable until the segment replaces it
+		DocID begin = memoryBegin_, end = memoryEnd_;
+		if (end == begin)
+			return;
+		boost::uint32_t number = nextSegment_++;
+		SegmentWriter writer(getSegmentFileName(number));
+		for (map<string, vector<DocID> >::const_iterator iter = memory_.begin(); iter != memory_.end(); ++iter) {
+			writer.add(iter->first, iter->second);
+		}
+		if (!writer.finish(begin, end, memory_.size()))
+			return; // keep it in memory, try again at the next flush
+		boost::shared_ptr<Segment> segment = boost::make_shared<Segment>(getSegmentFileName(number), number);
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			segments_.push_back(segment);
+			memory_.clear();
+			memoryBegin_ = end;
+		}
+		merge();
+		writeManifest();
+	}
+
+	// merge the newest mergeFactor segments while they are of the same size class
+	void merge() {
+		for (;;) {
+			vector<boost::shared_ptr<const Segment> > segments;
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				segments = segments_;
+			}
+			if (segments.size() < mergeFactor_)
+				return;
+			size_t first = segments.size() - mergeFactor_;
+			size_t sizeClass = getSizeClass(*segments.back());
+			for (size_t i = first; i < segments.size(); ++i) {
+				if (getSizeClass(*segments[i]) != sizeClass)
+					return;
+			}
+			vector<boost::shared_ptr<const Segment> > inputs(segments.begin() + first, segments.end());
+			boost::uint32_t number = nextSegment_++;
+			if (!mergeSegments(inputs, number))
+				return;
+			boost::shared_ptr<Segment> merged = boost::make_shared<Segment>(getSegmentFileName(number), number);
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				segments_.erase(segments_.end() - mergeFactor_, segments_.end());
+				segments_.push_back(merged);
+			}
+			writeManifest();
+			// searches still using them keep their mappings
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				remove(getSegmentFileName(inputs[i]->getNumber()).c_str());
+			}
+			++merges_;
+		}
+	}
+
+	// a k-way merge of the segments' dictionaries; their documents do not overlap and ascend
+	bool mergeSegments(const vector<boost::shared_ptr<const Segment> > &inputs, boost::uint32_t number) {
+		SegmentWriter writer(getSegmentFileName(number));
+		vector<size_t> positions(inputs.size(), 0);
+		size_t termCount = 0;
+		vector<DocID> docs, block;
+		for (;;) {
+			string term;
+			bool found = false;
+			PostingList list;
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				if (positions[i] < inputs[i]->getTermCount()) {
+					string candidate = inputs[i]->getTerm(positions[i], list);
+					if (!found || candidate < term) {
+						term = candidate;
+						found = true;
+					}
+				}
+			}
+			if (!found)
+				break;
+			docs.clear();
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				if (positions[i] < inputs[i]->getTermCount() && inputs[i]->getTerm(positions[i], list) == term) {
+					PostingCursor cursor(list);
+					for (size_t b = 0; b < cursor.getBlockCount(); ++b) {
+						cursor.decodeBlock(b, block);
+						docs.insert(docs.end(), block.begin(), block.end());
+					}
+					++positions[i];
+				}
+			}
+			writer.add(term, docs);
+			++termCount;
+		}
+		return writer.finish(inputs.front()->getBegin(), inputs.back()->getEnd(), termCount);
+	}
+
+	// segments of about flushSize documents are of class 0, mergeFactor times as many of class 1...
+	size_t getSizeClass(const Segment &segment) const {
+		size_t size = (segment.getEnd() - segment.getBegin()) / max(flushSize_, (size_t)1);
+		size_t sizeClass = 0;
+		while (size >= mergeFactor_) {
+			size /= mergeFactor_;
+			++sizeClass;
+		}
+		return sizeClass;
+	}
+
+	void writeManifest() {
+		vector<boost::shared_ptr<const Segment> > segments;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			segments = segments_;
+		}
+		string fileName = directory_ + "/search.manifest";
+		{
+			ofstream ofs((fileName + ".tmp").c_str());
+			for (size_t i = 0; i < segments.size(); ++i) {
+				ofs << segments[i]->getNumber() << endl;
+			}
+		}
+		rename((fileName + ".tmp").c_str(), fileName.c_str());
+	}
+
+	string getSegmentFileName(boost::uint32_t number) const {
+		char name[32];
+		snprintf(name, sizeof(name), "/search-%08u.seg", (unsigned)number);
+		return directory_ + name;
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *p) {
+		return ((boost::uint32_t)p[0] << 24) | ((boost::uint32_t)p[1] << 16) | ((boost::uint32_t)p[2] << 8) | p[3];
+	}
+
+	static boost::uint64_t readUint64(const unsigned char *p) {
+		return ((boost::uint64_t)readUint32(p) << 32) | readUint32(p + 4);
+	}
+
+	static boost::uint32_t readVarint(const unsigned char *&p, const unsigned char *end) {
+		boost::uint32_t value = 0;
+		for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+			unsigned char byte = *p++;
+			value |= (boost::uint32_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				break;
+		}
+		return value;
+	}
+
+	static void appendVarint(string &buffer, boost::uint32_t value) {
+		while (value >= 0x80) {
+			buffer.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back((char)value);
+	}
+
+	static void appendUint32(string &buffer, boost::uint32_t value) {
+		buffer.push_back((char)(value >> 24));
+		buffer.push_back((char)(value >> 16));
+		buffer.push_back((char)(value >> 8));
+		buffer.push_back((char)value);
+	}
+
+	static void appendUint64(string &buffer, boost::uint64_t value) {
+		appendUint32(buffer, (boost::uint32_t)(value >> 32));
+		appendUint32(buffer, (boost::uint32_t)value);
+	}
+
+	const string directory_;
+	const size_t flushSize_;
+	const size_t mergeFactor_;
+	boost::uint32_t nextSegment_; // used by the indexing thread only
+
+	mutable boost::mutex mutex_;
+	vector<boost::shared_ptr<const Segment> > segments_; // ascending by document
+	map<string, vector<DocID> > memory_;
+	DocID memoryBegin_;
+	DocID memoryEnd_;
+
+	boost::atomic<size_t> indexed_;
+	boost::atomic<size_t> indexingTime_;
+	boost::atomic<size_t> merges_;
+};
+
+}
@@ -10,47 +10,216 @@
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <iostream>
 
+#include "batchedsocket.hpp"
+#include "coalescing.hpp"
+#include "datagrampool.hpp"
+#include "datagramsender.hpp"
+#include "fragmentation.hpp"
+#include "reliabletransport.hpp"
+#include "workerpool.hpp"
+
 using namespace std;
 using namespace boost::asio::ip;
 
 namespace openchat {
 
+/**
+ * ServerEngine selects how a Server drives its socket
+ */
+enum ServerEngine {
+	ENGINE_BLOCKING, // one thread blocks in receive_from, sends are synchronous
+	ENGINE_ASYNC,    // several receives kept posted on the io_service, run by a pool of io threads
+	ENGINE_BATCHED   // recvmmsg/sendmmsg on Linux, falling back to one syscall per datagram elsewhere
+};
+
+/**
+ * ServerOptions collects the tunables of a Server
+ */
+struct ServerOptions {
+	ServerOptions() : workerCount(4), queueCapacity(4096), overflowPolicy(OVERFLOW_DROP),
+		engine(ENGINE_ASYNC), ioThreadCount(boost::thread::hardware_concurrency()), pendingReceiveCount(4),
+		shutdownTimeout(1000), batchSize(32), flushLatency(200),
+		receiveBufferSize(8 << 10), maxDatagramSize(1400), maxMessageSize(16 << 20), maxReassemblyBytes(64 << 20),
+		reassemblyTimeout(5000), socketBufferSize(4 << 20),
+		reliableDelivery(true), minRetransmissionTimeout(100), maxRetransmissions(10), reliableBacklog(4096),
+		reliableIdleTimeout(300000), simulatedLossRate(0),
+		resolverThreadCount(4), resolverCacheTimeout(300000), resolverFailureTimeout(10000), maxStrangers(1024),
+		coalescingLatency(0), compression(true) { }
+
+	size_t workerCount;            // number of long-lived request handling threads
+	size_t queueCapacity;          // maximum number of received requests waiting for a worker
+	OverflowPolicy overflowPolicy; // what to do with a request when the queue is full
+
+	ServerEngine engine;
+	size_t ioThreadCount;          // threads running the io_service (ENGINE_ASYNC)
+	size_t pendingReceiveCount;    // receives kept posted at once (ENGINE_ASYNC)
+	long shutdownTimeout;          // milliseconds to wait for outstanding sends on stop (ENGINE_ASYNC)
+
+	size_t batchSize;              // datagrams received or sent per syscall (ENGINE_BATCHED)
+	long flushLatency;             // microseconds an outgoing datagram may wait for a batch to fill (ENGINE_BATCHED)
+
+	size_t receiveBufferSize;      // largest datagram received in one piece, longer ones are truncated
+	size_t maxDatagramSize;        // longer payloads are sent as fragments of at most this size
+	size_t maxMessageSize;         // largest message accepted from fragments
+	size_t maxReassemblyBytes;     // memory all partially received messages may take together
+	long reassemblyTimeout;        // milliseconds a partially received message may go without a fragment
+	int socketBufferSize;          // kernel send and receive buffer size, 0 leaves the system default
+
+	bool reliableDelivery;         // offer peers a reliable, ordered channel (negotiated per peer)
+	long minRetransmissionTimeout; // milliseconds, lower bound of the estimated retransmission timeout
+	size_t maxRetransmissions;     // a reliable message is given up after this many retransmissions
+	size_t reliableBacklog;        // reliable messages waiting for the window per peer, later ones are dropped
+	long reliableIdleTimeout;      // milliseconds a reliable channel, or coalescing to a peer, may go unused before it is forgotten
+	double simulatedLossRate;      // fraction of outgoing datagrams dropped on purpose, for loss experiments
+
+	size_t resolverThreadCount;    // hostname lookups run in parallel
+	long resolverCacheTimeout;     // milliseconds a resolved address is reused
+	long resolverFailureTimeout;   // milliseconds a failed lookup is remembered before it is retried
+	size_t maxStrangers;           // strangers kept at once, the oldest are forgotten beyond that
+
+	long coalescingLatency;        // microseconds a small datagram may wait to share one with others to the same peer, 0 never
+	bool compression;              // offer peers to compress large messages (negotiated per peer)
+};
+
 /**
  * Server is an abstract class that defines the interface of a basic concurrent server
  */
-class Server {
+class Server : public DatagramSender {
 public:
-	Server(int port) : port_(port), serverSocket_(ioService_, udp::endpoint(udp::v4(), port)) { }
+	Server(int port, const ServerOptions &options = ServerOptions())
+		: port_(port), serverSocket_(ioService_, udp::endpoint(udp::v4(), port)), options_(options),
+		  datagramPool_(options.receiveBufferSize),
+		  reassembler_(options.maxMessageSize, options.maxReassemblyBytes, options.reassemblyTimeout),
+		  workers_(options.workerCount, options.queueCapacity, options.overflowPolicy, boost::bind(&Server::dispatch, this, _1)),
+		  reliable_(boost::bind(&Server::sendDatagram, this, _1, _2), boost::bind(&Server::deliverReliable, this, _1, _2, _3),
+		            options.minRetransmissionTimeout, options.maxRetransmissions, options.reliableBacklog, options.reliableIdleTimeout),
+		  coalescer_(boost::bind(&Server::transmitDatagram, this, _1, _2), options.maxDatagramSize, options.coalescingLatency,
+		             options.reliableIdleTimeout),
+		  stopping_(false), postedReceives_(0), outstandingSends_(0), nextMessageID_(0), truncated_(0),
+		  lossState_(0x9E3779B97F4A7C15ULL ^ port), simulatedLosses_(0) {
+		if (options_.socketBufferSize > 0) {
+			// large bursts of fragments must not overflow the kernel buffers
+			boost::system::error_code ignored;
+			serverSocket_.set_option(boost::asio::socket_base::receive_buffer_size(options_.socketBufferSize), ignored);
+			serverSocket_.set_option(boost::asio::socket_base::send_buffer_size(options_.socketBufferSize), ignored);
+		}
+		if (options_.engine == ENGINE_BATCHED) {
+			batchedSender_.reset(new BatchedSender(serverSocket_, options_.batchSize, options_.flushLatency));
+		}
+	}
 	virtual ~Server() { }
 	void run() {
-		// main server loop
-		try {
-			while (true) {
-				boost::array<char, bufSize_> recvBuf;
-				boost::shared_ptr<udp::endpoint> remoteEndpoint(new udp::endpoint);
-				boost::system::error_code error;
-				size_t len = serverSocket_.receive_from(boost::asio::buffer(recvBuf), *remoteEndpoint, 0, error);
-				if (error && error != boost::asio::error::message_size)
-					throw boost::system::system_error(error);
-				// launch new thread to handle request
-				boost::thread(boost::bind(&Server::handleRequest, this, string(recvBuf.begin(), recvBuf.begin() + len), remoteEndpoint));
-			}
-		} catch (exception &e) {
-			// ignore this exception
+		workers_.start();
+		reliable_.start();
+		if (options_.coalescingLatency > 0)
+			coalescer_.start();
+		if (options_.engine == ENGINE_ASYNC) {
+			runAsync();
+		} else if (options_.engine == ENGINE_BATCHED) {
+			runBatched();
+		} else {
+			runBlocking();
+		}
+		// finish the requests already received before returning
+		reliable_.stop();
+		workers_.stop();
+		coalescer_.stop();
+		if (batchedSender_) {
+			// flush the replies of the drained requests before the socket goes away
+			batchedSender_->stop();
+			boost::system::error_code ignored;
+			serverSocket_.close(ignored);
 		}
 	}
 	void stop() {
-		// very brutal way to terminate the server, but it is OK in this program.
-		serverSocket_.close();
+		// nothing is retransmitted once we are going away
+		reliable_.stop();
+		if (options_.engine == ENGINE_ASYNC) {
+			// stop receiving, the thread in run() drains the in-flight work and shuts the socket down
+			boost::mutex::scoped_lock lock(drainMutex_);
+			stopping_ = true;
+			ioService_.post(boost::bind(&Server::cancelReceives, this));
+			drainCondition_.notify_all();
+		} else if (options_.engine == ENGINE_BATCHED) {
+			// the receive loop polls with a timeout and notices the flag by itself
+			boost::mutex::scoped_lock lock(drainMutex_);
+			stopping_ = true;
+#ifndef __linux__
+			serverSocket_.close();
+#endif
+		} else {
+			// very brutal way to terminate the server, but it is OK in this program.
+			serverSocket_.close();
+		}
 	}
 
 	// send a message to an endpoint
 	void sendTo(const string &rawMessage, boost::shared_ptr<udp::endpoint> remoteEndpoint) {
-		serverSocket_.send_to(boost::asio::buffer(rawMessage), *remoteEndpoint);
+		sendDatagram(rawMessage, *remoteEndpoint);
+	}
+
+	virtual void sendDatagram(const string &payload, const udp::endpoint &remoteEndpoint) {
+		if (payload.size() <= options_.maxDatagramSize || options_.maxDatagramSize <= FragmentProtocol::headerSize) {
+			sendWholeDatagram(payload, remoteEndpoint);
+			return;
+		}
+		// too large for one datagram: split it, the receiving server puts it back together
+		boost::uint32_t messageID = ++nextMessageID_;
+		size_t count = FragmentProtocol::getFragmentCount(payload.size(), options_.maxDatagramSize);
+		string fragment;
+		for (size_t i = 0; i < count; ++i) {
+			FragmentProtocol::makeFragment(payload, messageID, i, options_.maxDatagramSize, fragment);
+			sendWholeDatagram(fragment, remoteEndpoint);
+		}
+	}
+
+	virtual void sendReliableDatagram(const string &payload, const udp::endpoint &remoteEndpoint) {
+		reliable_.send(payload, remoteEndpoint);
+	}
+
+	/**
+	 * Coalesce small datagrams to remoteEndpoint from now on, if coalescingLatency allows; the peer
+	 * there must unpack bundles, see CoalescingProtocol
+	 */
+	void enableCoalescing(const udp::endpoint &remoteEndpoint) {
+		if (options_.coalescingLatency > 0)
+			coalescer_.enable(remoteEndpoint);
+	}
+
+	// stop coalescing to a peer that is no longer a contact
+	void disableCoalescing(const udp::endpoint &remoteEndpoint) {
+		coalescer_.disable(remoteEndpoint);
+	}
+
+	// take reliable frames from a peer that has agreed to a reliable channel
+	void enableReliableDelivery(const udp::endpoint &remoteEndpoint) {
+		if (options_.reliableDelivery)
+			reliable_.admit(remoteEndpoint);
+	}
+
+	virtual size_t sendDatagrams(const boost::shared_ptr<const string> &payload, const udp::endpoint *remoteEndpoints, size_t count) {
+		if (options_.engine != ENGINE_ASYNC || payload->size() > options_.maxDatagramSize)
+			return DatagramSender::sendDatagrams(payload, remoteEndpoints, count);
+		// every send refers to the same buffer instead of copying it
+		{
+			boost::mutex::scoped_lock lock(drainMutex_);
+			outstandingSends_ += count;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			if (isSimulatedLoss()) {
+				handleAsyncSend(payload, boost::system::error_code());
+				continue;
+			}
+			serverSocket_.async_send_to(boost::asio::buffer(*payload), remoteEndpoints[i],
+				boost::bind(&Server::handleAsyncSend, this, payload, boost::asio::placeholders::error));
+		}
+		return 0;
 	}
 
 	int getPort() const {
@@ -60,17 +229,297 @@ public:
 	string getHostname() const {
 		return boost::asio::ip::address().to_string();
 	}
+
+	// largest message accepted, however it arrives
+	size_t getMaxMessageSize() const {
+		return options_.maxMessageSize;
+	}
+
+	// request queue statistics
+	size_t getQueueDepth() const { return workers_.getQueueDepth(); }
+	size_t getDroppedRequestCount() const { return workers_.getDroppedCount(); }
+	size_t getHandledRequestCount() const { return workers_.getProcessedCount(); }
+
+	// receive buffer statistics: the heap allocation count stops growing once the pool has warmed up
+	size_t getReceivedDatagramCount() const { return datagramPool_.getAcquisitionCount(); }
+	size_t getReceiveBufferAllocationCount() const { return datagramPool_.getHeapAllocationCount(); }
+	size_t getReceiveBuffersInUse() const { return datagramPool_.getInUseCount(); }
+
+	// datagrams longer than the receive buffer, and fragmented messages put back together or given up
+	size_t getTruncatedDatagramCount() const { return truncated_.load(); }
+	size_t getReassembledMessageCount() const { return reassembler_.getCompletedCount(); }
+	size_t getAbandonedMessageCount() const { return reassembler_.getExpiredCount() + reassembler_.getRejectedCount(); }
+
+	// reliable channel statistics, and datagrams dropped by simulatedLossRate
+	size_t getReliableSentCount() const { return reliable_.getSentCount(); }
+	size_t getRetransmittedCount() const { return reliable_.getRetransmittedCount(); }
+	size_t getReliableDeliveredCount() const { return reliable_.getDeliveredCount(); }
+	size_t getReliableAbandonedCount() const { return reliable_.getAbandonedCount(); }
+	size_t getReliableDroppedCount() const { return reliable_.getDroppedCount(); }
+	size_t getSimulatedLossCount() const { return simulatedLosses_.load(); }
+
+	// datagrams sent inside bundles, and the bundles carrying them
+	size_t getCoalescedDatagramCount() const { return coalescer_.getCoalescedCount(); }
+	size_t getBundleCount() const { return coalescer_.getBundleCount(); }
 protected:
 	/**
 	 * this function is pure virtual and defines the behavior to handle incoming request.
 	 */
 	virtual void handleRequest(const string &rawMessage, boost::shared_ptr<udp::endpoint> remoteEndpoint) = 0;
 
+	/**
+	 * handle an incoming request in place, in the pooled buffer it was received into.
+	 * The default copies it out and calls the string version above, so subclasses that only
+	 * implement that one keep working; subclasses that care about copies override this one.
+	 */
+	virtual void handleRequest(const Datagram &datagram) {
+		boost::shared_ptr<udp::endpoint> remoteEndpoint(new udp::endpoint(datagram.getRemoteEndpoint()));
+		handleRequest(string(datagram.getData(), datagram.getSize()), remoteEndpoint);
+	}
+
 	int port_;
 	boost::asio::io_service ioService_;
 	udp::socket serverSocket_;
+	ServerOptions options_;
 private:
-	static const size_t bufSize_ = 1 << 10;
+	// a receive kept posted on the io_service, refilled with a fresh datagram after every completion
+	struct ReceiveSlot {
+		DatagramPointer datagram;
+	};
+
+	void dispatch(const DatagramPointer &datagram) {
+		if (datagram->isTruncated())
+			++truncated_;
+		if (CoalescingProtocol::isBundle(datagram->getData(), datagram->getSize())) {
+			unbundle(*datagram);
+			return;
+		}
+		if (FragmentProtocol::isFragment(datagram->getData(), datagram->getSize())) {
+			// a truncated fragment would leave a hole in the message, wait for it to time out instead
+			if (datagram->isTruncated())
+				return;
+			DatagramPointer message = reassembler_.add(*datagram);
+			if (message)
+				handleMessage(*message);
+			return;
+		}
+		handleMessage(*datagram);
+	}
+
+	// handle each datagram of a bundle as if it had arrived alone; bundles are never nested
+	void unbundle(const Datagram &bundle) {
+		CoalescingProtocol::Reader reader(bundle.getData(), bundle.getSize());
+		const char *data;
+		size_t size;
+		while (reader.next(data, size)) {
+			if (CoalescingProtocol::isBundle(data, size))
+				continue;
+			DatagramPointer datagram = datagramPool_.acquire();
+			memcpy(datagram->getBuffer(), data, size);
+			datagram->setSize(size);
+			datagram->getRemoteEndpoint() = bundle.getRemoteEndpoint();
+			dispatch(datagram);
+		}
+	}
+
+	// a whole message, either received in one datagram or reassembled from fragments
+	void handleMessage(const Datagram &message) {
+		if (ReliableTransport::isFrame(message.getData(), message.getSize())) {
+			reliable_.receive(message.getData(), message.getSize(), message.getRemoteEndpoint());
+			return;
+		}
+		handleRequest(message);
+	}
+
+	// called by the reliable transport with the next in-order payload of a channel
+	void deliverReliable(const char *data, size_t size, const udp::endpoint &remoteEndpoint) {
+		DatagramPointer message = size <= options_.receiveBufferSize ? datagramPool_.acquire() : DatagramPool::acquireOversized(size);
+		memcpy(message->getBuffer(), data, size);
+		message->setSize(size);
+		message->getRemoteEndpoint() = remoteEndpoint;
+		handleRequest(*message);
+	}
+
+	// true if simulatedLossRate says this datagram is to be dropped
+	bool isSimulatedLoss() {
+		if (options_.simulatedLossRate <= 0)
+			return false;
+		boost::uint64_t x = (lossState_ += 0x9E3779B97F4A7C15ULL);
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		x ^= x >> 31;
+		if ((double)(x >> 11) / (double)(1ULL << 53) >= options_.simulatedLossRate)
+			return false;
+		++simulatedLosses_;
+		return true;
+	}
+
+	// put one datagram on the wire, or in a bundle with the next ones to the same endpoint
+	void sendWholeDatagram(const string &payload, const udp::endpoint &remoteEndpoint) {
+		if (options_.coalescingLatency > 0 && coalescer_.send(payload, remoteEndpoint))
+			return;
+		transmitDatagram(payload, remoteEndpoint);
+	}
+
+	// put one datagram on the wire with whatever engine is in use
+	void transmitDatagram(const string &payload, const udp::endpoint &remoteEndpoint) {
+		if (isSimulatedLoss())
+			return;
+		if (options_.engine == ENGINE_ASYNC) {
+			boost::shared_ptr<string> buffer(new string(payload));
+			{
+				boost::mutex::scoped_lock lock(drainMutex_);
+				++outstandingSends_;
+			}
+			serverSocket_.async_send_to(boost::asio::buffer(*buffer), remoteEndpoint,
+				boost::bind(&Server::handleAsyncSend, this, buffer, boost::asio::placeholders::error));
+		} else if (options_.engine == ENGINE_BATCHED) {
+			batchedSender_->send(payload, remoteEndpoint);
+		} else {
+			serverSocket_.send_to(boost::asio::buffer(payload), remoteEndpoint);
+		}
+	}
+
+	void submit(const DatagramPointer &datagram) {
+		// hand the request over to the worker pool, the datagram goes back to the pool once handled
+		workers_.submit(datagram);
+	}
+
+	void runBlocking() {
+		// main server loop
+		try {
+			while (true) {
+				DatagramPointer datagram = datagramPool_.acquire();
+				boost::system::error_code error;
+				size_t len = serverSocket_.receive_from(boost::asio::buffer(datagram->getBuffer(), datagram->getCapacity()),
+				                                        datagram->getRemoteEndpoint(), 0, error);
+				if (error && error != boost::asio::error::message_size)
+					throw boost::system::system_error(error);
+				datagram->setSize(len, error == boost::asio::error::message_size);
+				submit(datagram);
+			}
+		} catch (exception &e) {
+			// ignore this exception
+		}
+	}
+
+	void runBatched() {
+		BatchedReceiver receiver(datagramPool_, options_.batchSize);
+		batchedSender_->start();
+		try {
+			while (!isStopping()) {
+				size_t count = receiver.receive(serverSocket_, 100);
+				for (size_t i = 0; i < count; ++i) {
+					submit(receiver.takeDatagram(i));
+				}
+			}
+		} catch (exception &e) {
+			// ignore this exception
+		}
+	}
+
+	bool isStopping() {
+		boost::mutex::scoped_lock lock(drainMutex_);
+		return stopping_;
+	}
+
+	void runAsync() {
+		boost::scoped_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ioService_));
+		for (size_t i = 0; i < max<size_t>(options_.pendingReceiveCount, 1); ++i) {
+			boost::shared_ptr<ReceiveSlot> slot(new ReceiveSlot);
+			postReceive(slot);
+		}
+		boost::thread_group ioThreads;
+		for (size_t i = 0; i < max<size_t>(options_.ioThreadCount, 1); ++i) {
+			ioThreads.create_thread(boost::bind(&boost::asio::io_service::run, &ioService_));
+		}
+
+		// wait for stop() and for the posted receives to be cancelled
+		{
+			boost::mutex::scoped_lock lock(drainMutex_);
+			while (!stopping_ || postedReceives_ > 0) {
+				drainCondition_.wait(lock);
+			}
+		}
+		// requests already queued may still answer, so the socket has to stay open for them
+		workers_.stop();
+		coalescer_.stop();
+		{
+			boost::mutex::scoped_lock lock(drainMutex_);
+			boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(options_.shutdownTimeout);
+			while (outstandingSends_ > 0) {
+				if (!drainCondition_.timed_wait(lock, deadline))
+					break;
+			}
+		}
+		boost::system::error_code ignored;
+		serverSocket_.close(ignored);
+		work.reset();
+		ioThreads.join_all();
+	}
+
+	void postReceive(boost::shared_ptr<ReceiveSlot> slot) {
+		boost::mutex::scoped_lock lock(drainMutex_);
+		if (stopping_) {
+			drainCondition_.notify_all();
+			return;
+		}
+		++postedReceives_;
+		slot->datagram = datagramPool_.acquire();
+		Datagram &datagram = *slot->datagram;
+		serverSocket_.async_receive_from(boost::asio::buffer(datagram.getBuffer(), datagram.getCapacity()), datagram.getRemoteEndpoint(),
+			boost::bind(&Server::handleAsyncReceive, this, slot, boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
+	}
+
+	void handleAsyncReceive(boost::shared_ptr<ReceiveSlot> slot, const boost::system::error_code &error, size_t len) {
+		if (!error || error == boost::asio::error::message_size) {
+			slot->datagram->setSize(len, error == boost::asio::error::message_size);
+			submit(slot->datagram);
+		}
+		slot->datagram.reset();
+		{
+			boost::mutex::scoped_lock lock(drainMutex_);
+			--postedReceives_;
+			if (stopping_) {
+				drainCondition_.notify_all();
+				return;
+			}
+		}
+		postReceive(slot);
+	}
+
+	void handleAsyncSend(boost::shared_ptr<const string> /* buffer kept alive until here */, const boost::system::error_code &) {
+		boost::mutex::scoped_lock lock(drainMutex_);
+		if (--outstandingSends_ == 0 && stopping_) {
+			drainCondition_.notify_all();
+		}
+	}
+
+	void cancelReceives() {
+		boost::system::error_code ignored;
+		serverSocket_.cancel(ignored);
+	}
+
+	DatagramPool datagramPool_;
+	Reassembler reassembler_;
+	WorkerPool<DatagramPointer> workers_;
+	ReliableTransport reliable_;
+	Coalescer coalescer_;
+
+	boost::scoped_ptr<BatchedSender> batchedSender_; // ENGINE_BATCHED only
+
+	// ENGINE_ASYNC and ENGINE_BATCHED bookkeeping, guarded by drainMutex_
+	boost::mutex drainMutex_;
+	boost::condition_variable drainCondition_;
+	bool stopping_;
+	size_t postedReceives_;
+	size_t outstandingSends_;
+
+	boost::atomic<boost::uint32_t> nextMessageID_;
+	boost::atomic<size_t> truncated_;
+	boost::atomic<boost::uint64_t> lossState_;
+	boost::atomic<size_t> simulatedLosses_;
 };
 
 }
@@ -0,0 +1,95 @@
+/*
+ * snapshotmap.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * SnapshotMap is a copy-on-write map for data that is read far more often than it is changed.
+ * Readers take an immutable snapshot with a single atomic load of a shared_ptr and never wait for
+ * writers; writers are serialized, copy the current map, change the copy and publish it.  A
+ * reader keeps seeing the snapshot it took, consistent, for as long as it holds on to it.
+ */
+template<typename Key, typename Value>
+class SnapshotMap {
+public:
+	typedef map<Key, Value> mapType;
+	typedef boost::shared_ptr<const mapType> snapshotType;
+
+	SnapshotMap() : current_(boost::make_shared<mapType>()) { }
+
+	// copies share the snapshot, not the writer lock
+	SnapshotMap(const SnapshotMap &other) : current_(other.snapshot()) { }
+
+	SnapshotMap &operator= (const SnapshotMap &other) {
+		if (this != &other) {
+			snapshotType snapshot = other.snapshot();
+			boost::mutex::scoped_lock lock(writeMutex_);
+			boost::atomic_store(&current_, snapshot);
+		}
+		return *this;
+	}
+
+	snapshotType snapshot() const {
+		return boost::atomic_load(&current_);
+	}
+
+	// false if key is already present
+	bool insert(const Key &key, const Value &value) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		snapshotType current = boost::atomic_load(&current_);
+		if (current->find(key) != current->end())
+			return false;
+		boost::shared_ptr<mapType> next = boost::make_shared<mapType>(*current);
+		next->insert(make_pair(key, value));
+		boost::atomic_store(&current_, snapshotType(next));
+		return true;
+	}
+
+	// false if key was not present
+	bool erase(const Key &key) {
+		boost::mutex::scoped_lock lock(writeMutex_);
+		snapshotType current = boost::atomic_load(&current_);
+		if (current->find(key) == current->end())
+			return false;
+		boost::shared_ptr<mapType> next = boost::make_shared<mapType>(*current);
+		next->erase(key);
+		boost::atomic_store(&current_, snapshotType(next));
+		return true;
+	}
+
+	// copy the value stored under key into value; false if there is none
+	bool find(const Key &key, Value &value) const {
+		snapshotType current = snapshot();
+		typename mapType::const_iterator iter = current->find(key);
+		if (iter == current->end())
+			return false;
+		value = iter->second;
+		return true;
+	}
+
+	bool contains(const Key &key) const {
+		snapshotType current = snapshot();
+		return current->find(key) != current->end();
+	}
+
+	size_t size() const {
+		return snapshot()->size();
+	}
+private:
+	snapshotType current_; // only accessed through atomic_load/atomic_store
+	boost::mutex writeMutex_;
+};
+
+}
@@ -18,26 +18,51 @@ using namespace std;
 namespace openchat {
 
 /**
- * StreamPrinter presents messages to an output stream
+ * StreamPrinter presents messages to an output stream, flushing it after each one unless told
+ * not to, as for output nobody watches line by line
  */
 class StreamPrinter : public ViewObserver {
 public:
-	StreamPrinter(ostream &os) : os_(os) { }
+	StreamPrinter(ostream &os, bool flushing = true) : os_(os), flushing_(flushing) { }
 	virtual ~StreamPrinter() { }
 
 	virtual void present(const string &message) {
 		// use lock to prevent messy output
 		stream_lock_.lock();
 		os_ << message;
-		os_.flush();
+		if (flushing_)
+			os_.flush();
 		stream_lock_.unlock();
 	}
 
 	virtual void presentLine(const string &message) {
 		present(message + "\n");
 	}
+
+	// formats an event straight into the stream, without a string in between for text
+	virtual void notify(const ViewEvent &event) {
+		if (event.getType() != ViewEvent::TEXT) {
+			ViewObserver::notify(event);
+			return;
+		}
+		const TextEvent &text = static_cast<const TextEvent &>(event);
+		stream_lock_.lock();
+		os_ << text.text;
+		if (text.line)
+			os_ << '\n';
+		if (flushing_)
+			os_.flush();
+		stream_lock_.unlock();
+	}
+
+	virtual void flush() {
+		stream_lock_.lock();
+		os_.flush();
+		stream_lock_.unlock();
+	}
 private:
 	ostream &os_;
+	bool flushing_;
 	boost::mutex stream_lock_;
 };
 
@@ -0,0 +1,153 @@
+/*
+ * losssweep.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Loss-injection harness for the reliable channel: two Servers on loopback, the sender pushing
+ * count messages over a reliable channel to the receiver while both drop outgoing datagrams at
+ * the given rate, acknowledgements included.  Prints, for every rate, how long delivery took,
+ * the throughput, the send-to-delivery latency and what the channel retransmitted.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -O2 -I. -o losssweep tools/losssweep.cpp -lboost_system -lboost_thread -lpthread
+ *
+ * Run as ./losssweep [count [payloadSize [basePort]]]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "server.hpp"
+
+using namespace std;
+using namespace openchat;
+
+// microseconds, on the clock both servers share
+static boost::int64_t now() {
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(2000, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+/**
+ * Endpoint is one side of the experiment; what it receives starts with the sequence number and
+ * the time it was sent at
+ */
+class Endpoint : public Server {
+public:
+	Endpoint(int port, const ServerOptions &options, size_t expected)
+		: Server(port, options), received_(0), outOfOrder_(0), next_(0) {
+		latencies_.reserve(expected);
+	}
+
+	void send(size_t sequence, size_t payloadSize, const udp::endpoint &remoteEndpoint) {
+		char header[64];
+		int length = sprintf(header, "%lu %lld ", (unsigned long)sequence, (long long)now());
+		string payload(header, length);
+		payload.resize(max(payload.size(), payloadSize), 'x');
+		sendReliableDatagram(payload, remoteEndpoint);
+	}
+
+	// wait until count messages have arrived or timeout milliseconds have passed
+	bool waitFor(size_t count, long timeout) {
+		boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+		boost::mutex::scoped_lock lock(mutex_);
+		while (received_ < count) {
+			if (!condition_.timed_wait(lock, deadline))
+				return false;
+		}
+		return true;
+	}
+
+	size_t getReceived() const { boost::mutex::scoped_lock lock(mutex_); return received_; }
+	size_t getOutOfOrder() const { boost::mutex::scoped_lock lock(mutex_); return outOfOrder_; }
+
+	// latencies in milliseconds: the one below which the given fraction falls, and the mean
+	double getLatency(double fraction) const {
+		boost::mutex::scoped_lock lock(mutex_);
+		if (latencies_.empty())
+			return 0;
+		vector<boost::int64_t> sorted(latencies_);
+		sort(sorted.begin(), sorted.end());
+		return sorted[min(sorted.size() - 1, (size_t)(fraction * sorted.size()))] / 1000.0;
+	}
+	double getMeanLatency() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		double sum = 0;
+		for (size_t i = 0; i < latencies_.size(); ++i) {
+			sum += latencies_[i];
+		}
+		return latencies_.empty() ? 0 : sum / latencies_.size() / 1000.0;
+	}
+protected:
+	virtual void handleRequest(const string &rawMessage, boost::shared_ptr<udp::endpoint>) {
+		unsigned long sequence;
+		long long sentAt;
+		if (sscanf(rawMessage.c_str(), "%lu %lld", &sequence, &sentAt) != 2)
+			return;
+		boost::int64_t latency = now() - sentAt;
+		boost::mutex::scoped_lock lock(mutex_);
+		if (sequence != next_)
+			++outOfOrder_;
+		next_ = sequence + 1;
+		latencies_.push_back(latency);
+		++received_;
+		condition_.notify_all();
+	}
+private:
+	mutable boost::mutex mutex_;
+	boost::condition_variable condition_;
+	size_t received_;
+	size_t outOfOrder_;
+	size_t next_;
+	vector<boost::int64_t> latencies_;
+};
+
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? strtoul(argv[1], 0, 10) : 2000;
+	size_t payloadSize = argc > 2 ? strtoul(argv[2], 0, 10) : 200;
+	int basePort = argc > 3 ? atoi(argv[3]) : 19400;
+	static const double rates[] = { 0, 0.01, 0.02, 0.05, 0.10 };
+
+	printf("%-6s %9s %9s %10s %9s %9s %9s %9s %11s %9s %9s %9s\n", "loss", "delivered", "seconds", "msgs/s",
+	       "mean_ms", "p50_ms", "p99_ms", "max_ms", "retransmits", "abandoned", "dropped", "reordered");
+	for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i) {
+		ServerOptions options;
+		options.simulatedLossRate = rates[i];
+		options.reliableBacklog = count;
+		int senderPort = basePort + 2 * (int)i, receiverPort = senderPort + 1;
+		Endpoint sender(senderPort, options, 0), receiver(receiverPort, options, count);
+		udp::endpoint senderEndpoint(address_v4::loopback(), senderPort), receiverEndpoint(address_v4::loopback(), receiverPort);
+		// as a hello would have negotiated it
+		sender.enableReliableDelivery(receiverEndpoint);
+		receiver.enableReliableDelivery(senderEndpoint);
+		boost::thread senderThread(boost::bind(&Server::run, &sender));
+		boost::thread receiverThread(boost::bind(&Server::run, &receiver));
+
+		boost::int64_t start = now();
+		for (size_t sequence = 0; sequence < count; ++sequence) {
+			sender.send(sequence, payloadSize, receiverEndpoint);
+		}
+		receiver.waitFor(count, 60000);
+		double seconds = (now() - start) / 1e6;
+
+		printf("%-6.2f %9lu %9.3f %10.0f %9.2f %9.2f %9.2f %9.2f %11lu %9lu %9lu %9lu\n", rates[i],
+		       (unsigned long)receiver.getReceived(), seconds, receiver.getReceived() / seconds,
+		       receiver.getMeanLatency(), receiver.getLatency(0.5), receiver.getLatency(0.99), receiver.getLatency(1.0),
+		       (unsigned long)(sender.getRetransmittedCount() + receiver.getRetransmittedCount()),
+		       (unsigned long)sender.getReliableAbandonedCount(), (unsigned long)sender.getReliableDroppedCount(),
+		       (unsigned long)receiver.getOutOfOrder());
+		fflush(stdout);
+
+		sender.stop();
+		receiver.stop();
+		senderThread.join();
+		receiverThread.join();
+	}
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * registrystress.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Stress test for the peer registry of BasicChatClient: threads add and delete friends, add and
+ * delete groups and their members, send to friends, groups and everyone, and read the lists, all
+ * at once, while a second client on loopback sends messages under ever new IDs, which the first
+ * one's handler threads add as strangers.  Meant to be run under ThreadSanitizer, which must not
+ * report anything; the program itself only checks at the end that the lists are consistent.
+ *
+ * Build from the repository root, with ThreadSanitizer:
+ *
+ *     g++ -O1 -g -fsanitize=thread -I. -o registrystress tools/registrystress.cpp basicchatclient.cpp controller.cpp \
+ *         -lboost_system -lboost_thread -lpthread
+ *
+ * Run as ./registrystress [iterations [basePort]]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+
+#include "basicchatclient.hpp"
+#include "controller.hpp"
+#include "view.hpp"
+#include "wiremessage.hpp"
+
+using namespace std;
+using namespace openchat;
+
+static const size_t friendIDs = 64;
+static const size_t groupIDs = 8;
+
+// a client with a controller and a view nobody watches, as ChatFramework would wire it
+struct Client {
+	Client(const string &id, int port, const ServerOptions &options, istream &is)
+		: model(new BasicChatClient(id, port, options)), view(new View(model)), controller(new Controller(model, view, is)) {
+		model->setMessageProcesser(controller);
+		thread = boost::thread(boost::bind(&BasicChatClient::run, model));
+	}
+
+	void stop() {
+		model->waitForBroadcasts();
+		model->stop();
+		thread.join();
+	}
+
+	boost::shared_ptr<BasicChatClient> model;
+	boost::shared_ptr<View> view;
+	boost::shared_ptr<Controller> controller;
+	boost::thread thread;
+};
+
+static string makeID(const char *prefix, size_t n) {
+	ostringstream os;
+	os << prefix << n;
+	return os.str();
+}
+
+// a small xorshift per thread, so that the threads do not contend on rand()
+struct Random {
+	explicit Random(boost::uint32_t seed) : state(seed * 2654435761u + 1) { }
+	size_t operator()(size_t n) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state % n;
+	}
+	boost::uint32_t state;
+};
+
+static void churnFriends(BasicChatClient &client, const string &port, size_t iterations) {
+	Random random(1);
+	for (size_t i = 0; i < iterations; ++i) {
+		string id = makeID("f", random(friendIDs));
+		if (client.hasFriend(id))
+			client.deleteFriend(id);
+		else
+			client.addFriend(id, "127.0.0.1", port);
+		if (random(16) == 0) {
+			vector<string> strangers = client.getStrangersIDs();
+			if (!strangers.empty())
+				client.deleteStranger(strangers[random(strangers.size())]);
+		}
+	}
+}
+
+static void churnGroups(BasicChatClient &client, size_t iterations) {
+	Random random(2);
+	for (size_t i = 0; i < iterations; ++i) {
+		string group = makeID("g", random(groupIDs));
+		string member = makeID("f", random(friendIDs));
+		switch (random(8)) {
+		case 0:
+			client.addGroup(group);
+			break;
+		case 1:
+			client.deleteGroup(group);
+			break;
+		case 2: case 3: case 4:
+			if (client.hasGroup(group) && client.hasFriend(member))
+				client.addGroupMember(group, member);
+			break;
+		default:
+			if (client.hasGroupMember(group, member))
+				client.deleteGroupMember(group, member);
+			break;
+		}
+	}
+}
+
+static void sendAround(BasicChatClient &client, size_t iterations) {
+	Random random(3);
+	// the message refers to these, see WireMessage
+	string id = client.getID(), text = "stress";
+	PlainChatWireMessage message(id, text);
+	for (size_t i = 0; i < iterations; ++i) {
+		switch (random(4)) {
+		case 0:
+			client.sendToFriend(makeID("f", random(friendIDs)), message);
+			break;
+		case 1:
+			client.sendToGroup(makeID("g", random(groupIDs)), message);
+			break;
+		case 2:
+			client.sendToAll(message);
+			break;
+		default:
+			client.sendToAllStrangers(message);
+			break;
+		}
+	}
+}
+
+static void readLists(BasicChatClient &client, size_t iterations, size_t &seen) {
+	Random random(4);
+	for (size_t i = 0; i < iterations; ++i) {
+		seen += client.getFriendsIDs().size() + client.getStrangersIDs().size();
+		seen += client.getGroupMemberIDs(makeID("g", random(groupIDs))).size();
+		seen += client.getFriendHostnameAndPort(makeID("f", random(friendIDs))).second.size();
+		if (random(64) == 0) {
+			ContactDatabase contacts;
+			client.exportContacts(contacts);
+			seen += contacts.contacts.size() + contacts.groups.size();
+		}
+	}
+}
+
+// messages under new IDs, each a stranger to the receiving client
+static void impersonate(BasicChatClient &client, const udp::endpoint &remoteEndpoint, size_t iterations) {
+	for (size_t i = 0; i < iterations; ++i) {
+		client.sendDatagram(ChatProtocol::wrapPlainChatMessage(makeID("s", i), "hello"), remoteEndpoint);
+		if (i % 256 == 0)
+			boost::this_thread::yield();
+	}
+}
+
+static size_t countDuplicates(const string &name, vector<string> ids) {
+	sort(ids.begin(), ids.end());
+	size_t duplicates = ids.end() - unique(ids.begin(), ids.end());
+	if (duplicates > 0)
+		printf("%s holds %lu IDs twice\n", name.c_str(), (unsigned long)duplicates);
+	return duplicates;
+}
+
+int main(int argc, char **argv) {
+	size_t iterations = argc > 1 ? strtoul(argv[1], 0, 10) : 20000;
+	int basePort = argc > 2 ? atoi(argv[2]) : 19500;
+	ostringstream peerPort;
+	peerPort << basePort + 1;
+
+	ServerOptions options;
+	options.maxStrangers = 128;
+	istringstream noInput;
+	Client hub("hub", basePort, options, noInput), peer("peer", basePort + 1, options, noInput);
+	udp::endpoint hubEndpoint(address_v4::loopback(), basePort);
+
+	size_t seen = 0;
+	boost::thread_group threads;
+	threads.create_thread(boost::bind(churnFriends, boost::ref(*hub.model), peerPort.str(), iterations));
+	threads.create_thread(boost::bind(churnGroups, boost::ref(*hub.model), iterations));
+	threads.create_thread(boost::bind(sendAround, boost::ref(*hub.model), iterations / 4));
+	threads.create_thread(boost::bind(readLists, boost::ref(*hub.model), iterations, boost::ref(seen)));
+	threads.create_thread(boost::bind(impersonate, boost::ref(*peer.model), hubEndpoint, iterations));
+	threads.join_all();
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+	hub.stop();
+	peer.stop();
+
+	// a group keeps its members' handles, so none may have been released under it; no list may
+	// hold an ID twice, and the strangers must be within their bound
+	BasicChatClient &client = *hub.model;
+	size_t failures = 0;
+	vector<string> groups = client.getGroupsIDs();
+	for (size_t i = 0; i < groups.size(); ++i) {
+		vector<string> members = client.getGroupMemberIDs(groups[i]);
+		for (size_t j = 0; j < members.size(); ++j) {
+			if (members[j].empty()) {
+				printf("group %s holds a released member\n", groups[i].c_str());
+				++failures;
+			}
+		}
+		failures += countDuplicates("group " + groups[i], members);
+	}
+	failures += countDuplicates("friends", client.getFriendsIDs());
+	failures += countDuplicates("strangers", client.getStrangersIDs());
+	if (client.getStrangersIDs().size() > options.maxStrangers) {
+		printf("%lu strangers, more than %lu\n", (unsigned long)client.getStrangersIDs().size(), (unsigned long)options.maxStrangers);
+		++failures;
+	}
+	printf("friends=%lu strangers=%lu groups=%lu handled=%lu seen=%lu %s\n", (unsigned long)client.getFriendsIDs().size(),
+	       (unsigned long)client.getStrangersIDs().size(), (unsigned long)groups.size(),
+	       (unsigned long)client.getHandledRequestCount(), (unsigned long)seen, failures == 0 ? "ok" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
@@ -10,10 +10,15 @@
 
 #include <vector>
 #include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "basicchatclient.hpp"
 #include "viewobserver.hpp"
+#include "boundedqueue.hpp"
 
 using namespace std;
 
@@ -23,30 +28,232 @@ namespace openchat {
  * View is the "view" in MVC architecture and is responsible for showing tbe results to users
  * It is also the Subject in Observer Pattern, maintaining a list of observers which do the
  * actual result-showing task.
+ *
+ * What is presented reaches the observers as a ViewEvent, plain text as a TextEvent.
+ *
+ * By default observers are called on the thread presenting, network handlers included.  Once
+ * startWriter has been called, presenting only queues a copy of the event in a BoundedQueue, and a
+ * writer thread hands the queued events to the observers in batches, flushing them when the queue runs
+ * empty, or every flushInterval milliseconds while it does not, so a slow terminal or log file
+ * holds up nobody but the writer.
  */
 class View {
 public:
-	View(boost::shared_ptr<BasicChatClient> model) : model_(model) { }
-	virtual ~View() { }
+	View(boost::shared_ptr<BasicChatClient> model)
+		: model_(model), writing_(false), stopping_(false), publishers_(0), idle_(false), policy_(OVERFLOW_BLOCK), flushInterval_(0),
+		  blockedPublishers_(0), dropped_(0), maxQueueDepth_(0), written_(0), writeLatency_(0), maxWriteLatency_(0), unflushedCount_(0), unflushedTimeSum_(0),
+		  oldestUnflushedTime_(0) { }
+	virtual ~View() {
+		stopWriter();
+	}
 
 	void present(const string &message) const {
-		for (size_t i = 0; i < observers_.size(); ++i) {
-			observers_[i]->present(message);
-		}
+		notify(TextEvent(message, false));
 	}
 
 	void presentLine(const string &message) const {
-		for (size_t i = 0; i < observers_.size(); ++i) {
-			observers_[i]->presentLine(message);
+		notify(TextEvent(message, true));
+	}
+
+	void notify(const ViewEvent &event) const {
+		// counted, so that stopWriter can wait for whoever saw the writer running
+		++publishers_;
+		if (writing_) {
+			publish(event);
+			--publishers_;
+			return;
 		}
+		--publishers_;
+		deliver(event);
 	}
 
 	void addObserver(boost::shared_ptr<ViewObserver> observer) {
 		observers_.push_back(observer);
 	}
+
+	/**
+	 * Present from a writer thread from now on, queueing up to capacity messages; when the queue
+	 * is full, policy decides whether presenting waits or the message is dropped.  Observers are
+	 * to be added before.
+	 */
+	void startWriter(size_t capacity, OverflowPolicy policy, long flushInterval) {
+		if (writing_)
+			return;
+		queue_.reset(new BoundedQueue<Event>(capacity));
+		policy_ = policy;
+		flushInterval_ = flushInterval;
+		stopping_ = false;
+		writing_ = true;
+		writer_ = boost::thread(boost::bind(&View::write, this));
+	}
+
+	// present what is still queued, then go back to presenting on the calling thread
+	void stopWriter() {
+		if (!writing_)
+			return;
+		// new events are presented on their own thread; those being published still reach the
+		// queue, for the writer goes on until they have, even when they wait for room
+		writing_ = false;
+		while (publishers_.load() > 0) {
+			boost::this_thread::yield();
+		}
+		stopping_ = true;
+		{
+			boost::mutex::scoped_lock lock(idleMutex_);
+			idleCondition_.notify_all();
+		}
+		writer_.join();
+		// what was queued as the writer left
+		Event event;
+		while (queue_->tryPop(event)) {
+			deliver(*event.event);
+		}
+		for (size_t i = 0; i < observers_.size(); ++i) {
+			observers_[i]->flush();
+		}
+	}
+
+	// writer counters; latencies in microseconds from queueing a message to flushing it
+	size_t getQueueDepth() const { return queue_ ? queue_->getSize() : 0; }
+	size_t getMaxQueueDepth() const { return maxQueueDepth_.load(); }
+	size_t getQueueCapacity() const { return queue_ ? queue_->getCapacity() : 0; }
+	size_t getDroppedCount() const { return dropped_.load(); }
+	size_t getWrittenCount() const { return written_.load(); }
+	size_t getWriteLatency() const { return writeLatency_.load(); }
+	size_t getMaxWriteLatency() const { return maxWriteLatency_.load(); }
 private:
+	struct Event {
+		Event() : time(0) { }
+		Event(const ViewEvent &event, boost::int64_t time) : event(event.clone()), time(time) { }
+		boost::shared_ptr<const ViewEvent> event;
+		boost::int64_t time;
+	};
+
+	void publish(const ViewEvent &viewEvent) const {
+		Event event(viewEvent, getTime());
+		if (!queue_->tryPush(event)) {
+			if (policy_ != OVERFLOW_BLOCK) {
+				++dropped_;
+				return;
+			}
+			waitForRoom(event);
+		}
+		size_t depth = queue_->getSize();
+		if (depth > maxQueueDepth_.load(boost::memory_order_relaxed))
+			maxQueueDepth_.store(depth, boost::memory_order_relaxed);
+		// pairs with the fence in write() so that a writer going to sleep either sees the message or gets woken
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (idle_.load()) {
+			boost::mutex::scoped_lock lock(idleMutex_);
+			idleCondition_.notify_one();
+		}
+	}
+
+	// push event once the writer has made room; stopWriter keeps the writer running until it has
+	void waitForRoom(const Event &event) const {
+		boost::mutex::scoped_lock lock(roomMutex_);
+		++blockedPublishers_;
+		// pairs with the fence in write() so that a publisher going to sleep either finds room or gets woken
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		while (!queue_->tryPush(event)) {
+			roomCondition_.timed_wait(lock, boost::posix_time::milliseconds(100));
+		}
+		--blockedPublishers_;
+	}
+
+	void deliver(const ViewEvent &event) const {
+		for (size_t i = 0; i < observers_.size(); ++i) {
+			observers_[i]->notify(event);
+		}
+	}
+
+	void write() {
+		Event event;
+		boost::int64_t lastFlush = getTime();
+		while (true) {
+			while (queue_->tryPop(event)) {
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+				if (blockedPublishers_.load() > 0) {
+					boost::mutex::scoped_lock lock(roomMutex_);
+					roomCondition_.notify_one();
+				}
+				deliver(*event.event);
+				if (unflushedCount_ == 0)
+					oldestUnflushedTime_ = event.time;
+				++unflushedCount_;
+				unflushedTimeSum_ += event.time;
+				event = Event();
+				// a queue that never runs empty is still flushed now and then
+				if (getTime() - lastFlush >= flushInterval_ * 1000)
+					lastFlush = flush();
+			}
+			if (unflushedCount_ > 0)
+				lastFlush = flush();
+
+			boost::mutex::scoped_lock lock(idleMutex_);
+			idle_ = true;
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			while (queue_->getSize() == 0) {
+				if (stopping_) {
+					idle_ = false;
+					return;
+				}
+				idleCondition_.timed_wait(lock, boost::posix_time::milliseconds(100));
+			}
+			idle_ = false;
+		}
+	}
+
+	// returns when it flushed
+	boost::int64_t flush() {
+		for (size_t i = 0; i < observers_.size(); ++i) {
+			observers_[i]->flush();
+		}
+		boost::int64_t now = getTime();
+		if (unflushedCount_ > 0) {
+			written_ += unflushedCount_;
+			writeLatency_ += (size_t)(now * (boost::int64_t)unflushedCount_ - unflushedTimeSum_);
+			size_t latency = (size_t)(now - oldestUnflushedTime_);
+			if (latency > maxWriteLatency_.load())
+				maxWriteLatency_ = latency;
+			unflushedCount_ = 0;
+			unflushedTimeSum_ = 0;
+		}
+		return now;
+	}
+
+	// microseconds, for latencies only
+	static boost::int64_t getTime() {
+		static const boost::posix_time::ptime epoch(boost::gregorian::date(2000, 1, 1));
+		return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+	}
+
 	boost::shared_ptr<BasicChatClient> model_;
 	vector<boost::shared_ptr<ViewObserver> > observers_;
+
+	boost::atomic<bool> writing_;
+	boost::atomic<bool> stopping_;
+	mutable boost::atomic<size_t> publishers_; // threads in notify, see stopWriter
+	mutable boost::atomic<bool> idle_;
+	OverflowPolicy policy_;
+	long flushInterval_;
+	boost::scoped_ptr<BoundedQueue<Event> > queue_;
+	boost::thread writer_;
+	mutable boost::mutex idleMutex_;
+	mutable boost::condition_variable idleCondition_;
+	mutable boost::atomic<size_t> blockedPublishers_;
+	mutable boost::mutex roomMutex_;
+	mutable boost::condition_variable roomCondition_;
+
+	mutable boost::atomic<size_t> dropped_;
+	mutable boost::atomic<size_t> maxQueueDepth_;
+	boost::atomic<size_t> written_;
+	boost::atomic<size_t> writeLatency_;
+	boost::atomic<size_t> maxWriteLatency_;
+	// kept by the writer thread only
+	size_t unflushedCount_;
+	boost::int64_t unflushedTimeSum_;
+	boost::int64_t oldestUnflushedTime_;
 };
 
 }
@@ -0,0 +1,258 @@
+/*
+ * viewevent.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <sstream>
+#include <boost/utility/string_ref.hpp>
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * ViewEvent is what the View hands its observers: what happened, with its fields, which refer to
+ * the presenter's data instead of copying them.  An observer showing text has an event format
+ * itself; one that does not (a log, metrics) reads the fields and skips formatting entirely.
+ * An event is only valid during the call it is passed to; clone gives one that owns its fields.
+ */
+class ViewEvent {
+public:
+	enum Type {
+		TEXT,                 // a message as is, see TextEvent
+		MESSAGE_RECEIVED,     // a chat message from a contact
+		STRANGER_ADDED,       // a message came from someone unknown, who is now a stranger
+		FRIEND_LIST_RECEIVED, // the whole friend list of a friend
+		FRIEND_LIST_CHANGED,  // the changes to the friend list of a friend since the last time
+		COMMAND_RESULT        // a command was run, or could not be
+	};
+
+	virtual ~ViewEvent() { }
+	virtual Type getType() const = 0;
+
+	// append the text the event reads as
+	virtual void format(string &text) const = 0;
+
+	virtual ViewEvent *clone() const = 0;
+};
+
+/**
+ * TextEvent is a message to show as it is, on a line of its own or not
+ */
+class TextEvent : public ViewEvent {
+public:
+	TextEvent(const string &text, bool line) : text(text), line(line) { }
+	virtual Type getType() const { return TEXT; }
+	virtual void format(string &out) const {
+		out += text;
+		if (line)
+			out += '\n';
+	}
+	virtual ViewEvent *clone() const;
+
+	const string &text;
+	const bool line;
+private:
+	struct Fields {
+		explicit Fields(const TextEvent &event) : textCopy(event.text) { }
+		string textCopy;
+	};
+	class Owned;
+};
+
+// the copies are a base, so they are made before the references to them
+class TextEvent::Owned : private TextEvent::Fields, public TextEvent {
+public:
+	explicit Owned(const TextEvent &event) : TextEvent::Fields(event), TextEvent(textCopy, event.line) { }
+};
+
+inline ViewEvent *TextEvent::clone() const {
+	return new Owned(*this);
+}
+
+class MessageReceivedEvent : public ViewEvent {
+public:
+	MessageReceivedEvent(boost::string_ref fromID, boost::string_ref message) : fromID(fromID), message(message) { }
+	virtual Type getType() const { return MESSAGE_RECEIVED; }
+	virtual void format(string &out) const {
+		out += "[From ";
+		out.append(fromID.data(), fromID.size());
+		out += "]: ";
+		out.append(message.data(), message.size());
+		out += '\n';
+	}
+	virtual ViewEvent *clone() const;
+
+	const boost::string_ref fromID;
+	const boost::string_ref message;
+private:
+	struct Fields {
+		explicit Fields(const MessageReceivedEvent &event) : fromIDCopy(event.fromID.to_string()), messageCopy(event.message.to_string()) { }
+		string fromIDCopy;
+		string messageCopy;
+	};
+	class Owned;
+};
+
+class MessageReceivedEvent::Owned : private MessageReceivedEvent::Fields, public MessageReceivedEvent {
+public:
+	explicit Owned(const MessageReceivedEvent &event) : MessageReceivedEvent::Fields(event), MessageReceivedEvent(fromIDCopy, messageCopy) { }
+};
+
+inline ViewEvent *MessageReceivedEvent::clone() const {
+	return new Owned(*this);
+}
+
+class StrangerAddedEvent : public ViewEvent {
+public:
+	explicit StrangerAddedEvent(const string &id) : id(id) { }
+	virtual Type getType() const { return STRANGER_ADDED; }
+	virtual void format(string &out) const {
+		out += "ID: " + id + " has been added to stranger list.\n";
+	}
+	virtual ViewEvent *clone() const;
+
+	const string &id;
+private:
+	struct Fields {
+		explicit Fields(const StrangerAddedEvent &event) : idCopy(event.id) { }
+		string idCopy;
+	};
+	class Owned;
+};
+
+class StrangerAddedEvent::Owned : private StrangerAddedEvent::Fields, public StrangerAddedEvent {
+public:
+	explicit Owned(const StrangerAddedEvent &event) : StrangerAddedEvent::Fields(event), StrangerAddedEvent(idCopy) { }
+};
+
+inline ViewEvent *StrangerAddedEvent::clone() const {
+	return new Owned(*this);
+}
+
+/**
+ * FriendListReceivedEvent carries a friend's friend list, (id, (hostname, port)) in ID order
+ */
+class FriendListReceivedEvent : public ViewEvent {
+public:
+	FriendListReceivedEvent(const string &id, const vector<pair<string, pair<string, string> > > &entries) : id(id), entries(entries) { }
+	virtual Type getType() const { return FRIEND_LIST_RECEIVED; }
+	virtual void format(string &out) const {
+		out += "Friend list of [ID=" + id + "]:\n";
+		for (size_t i = 0; i != entries.size(); ++i) {
+			out += "[ID=" + entries[i].first + "], [hostname=" + entries[i].second.first + "], [port=" + entries[i].second.second + "]\n";
+		}
+	}
+	virtual ViewEvent *clone() const;
+
+	const string &id;
+	const vector<pair<string, pair<string, string> > > &entries;
+private:
+	struct Fields {
+		explicit Fields(const FriendListReceivedEvent &event) : idCopy(event.id), entriesCopy(event.entries) { }
+		string idCopy;
+		vector<pair<string, pair<string, string> > > entriesCopy;
+	};
+	class Owned;
+};
+
+class FriendListReceivedEvent::Owned : private FriendListReceivedEvent::Fields, public FriendListReceivedEvent {
+public:
+	explicit Owned(const FriendListReceivedEvent &event) : FriendListReceivedEvent::Fields(event), FriendListReceivedEvent(idCopy, entriesCopy) { }
+};
+
+inline ViewEvent *FriendListReceivedEvent::clone() const {
+	return new Owned(*this);
+}
+
+/**
+ * FriendListChangedEvent carries the changes to a friend's friend list, a removal having an
+ * empty hostname, and how many friends it has now
+ */
+class FriendListChangedEvent : public ViewEvent {
+public:
+	FriendListChangedEvent(const string &id, const vector<pair<string, pair<string, string> > > &changes, size_t friendCount)
+		: id(id), changes(changes), friendCount(friendCount) { }
+	virtual Type getType() const { return FRIEND_LIST_CHANGED; }
+	virtual void format(string &out) const {
+		if (changes.empty()) {
+			ostringstream oss;
+			oss << "Friend list of [ID=" << id << "] has not changed, " << friendCount << " friends.\n";
+			out += oss.str();
+			return;
+		}
+		out += "Friend list of [ID=" + id + "] has changed:\n";
+		for (size_t i = 0; i != changes.size(); ++i) {
+			if (changes[i].second.first.empty()) {
+				out += "[removed] [ID=" + changes[i].first + "]\n";
+			} else {
+				out += "[added] [ID=" + changes[i].first + "], [hostname=" + changes[i].second.first + "], [port=" + changes[i].second.second + "]\n";
+			}
+		}
+	}
+	virtual ViewEvent *clone() const;
+
+	const string &id;
+	const vector<pair<string, pair<string, string> > > &changes;
+	const size_t friendCount;
+private:
+	struct Fields {
+		explicit Fields(const FriendListChangedEvent &event) : idCopy(event.id), changesCopy(event.changes) { }
+		string idCopy;
+		vector<pair<string, pair<string, string> > > changesCopy;
+	};
+	class Owned;
+};
+
+class FriendListChangedEvent::Owned : private FriendListChangedEvent::Fields, public FriendListChangedEvent {
+public:
+	explicit Owned(const FriendListChangedEvent &event) : FriendListChangedEvent::Fields(event), FriendListChangedEvent(idCopy, changesCopy, event.friendCount) { }
+};
+
+inline ViewEvent *FriendListChangedEvent::clone() const {
+	return new Owned(*this);
+}
+
+/**
+ * CommandResultEvent tells that a command has been run, or if error is not empty, why it could not
+ * be; only the latter reads as text
+ */
+class CommandResultEvent : public ViewEvent {
+public:
+	CommandResultEvent(const string &command, const string &error) : command(command), error(error) { }
+	virtual Type getType() const { return COMMAND_RESULT; }
+	virtual void format(string &out) const {
+		if (!error.empty())
+			out += error + "\n";
+	}
+	virtual ViewEvent *clone() const;
+
+	bool succeeded() const { return error.empty(); }
+
+	const string &command;
+	const string &error;
+private:
+	struct Fields {
+		explicit Fields(const CommandResultEvent &event) : commandCopy(event.command), errorCopy(event.error) { }
+		string commandCopy;
+		string errorCopy;
+	};
+	class Owned;
+};
+
+class CommandResultEvent::Owned : private CommandResultEvent::Fields, public CommandResultEvent {
+public:
+	explicit Owned(const CommandResultEvent &event) : CommandResultEvent::Fields(event), CommandResultEvent(commandCopy, errorCopy) { }
+};
+
+inline ViewEvent *CommandResultEvent::clone() const {
+	return new Owned(*this);
+}
+
+}
@@ -10,6 +10,8 @@
 
 #include <string>
 
+#include "viewevent.hpp"
+
 using namespace std;
 
 namespace openchat {
@@ -25,6 +27,29 @@ public:
 	 */
 	virtual void present(const string &message) = 0;
 	virtual void presentLine(const string &message) = 0;
+
+	/**
+	 * What the View hands over.  By default an event is formatted and presented as text, so text
+	 * observers need nothing more; others override this and read the fields of the event instead.
+	 */
+	virtual void notify(const ViewEvent &event) {
+		if (event.getType() == ViewEvent::TEXT) {
+			const TextEvent &text = static_cast<const TextEvent &>(event);
+			if (text.line) {
+				presentLine(text.text);
+			} else {
+				present(text.text);
+			}
+			return;
+		}
+		string text;
+		event.format(text);
+		if (!text.empty())
+			present(text);
+	}
+
+	// make what has been presented visible, for observers that buffer it
+	virtual void flush() { }
 };
 
 }
@@ -0,0 +1,254 @@
+/*
+ * wiremessage.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "chatprotocol.hpp"
+#include "binaryprotocol.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * Features a peer announces in its hello message
+ */
+enum PeerFeature {
+	FEATURE_BINARY = 1 << 0,     // understands BinaryProtocol
+	FEATURE_RELIABLE = 1 << 1,   // accepts messages over a ReliableTransport channel
+	FEATURE_COALESCING = 1 << 2, // unpacks datagrams bundled by a Coalescer
+	FEATURE_COMPRESSION = 1 << 3, // accepts BinaryProtocol messages with compressed fields
+	FEATURE_FRIEND_SYNC = 1 << 4  // answers friend list sync requests (see FriendLog)
+};
+
+/**
+ * WireMessage is an outgoing protocol message that can be put on the wire in either format.
+ * Each format (text, binary, or binary compressed when large enough) is encoded at most once, the
+ * first time a recipient needs it, and then shared by all recipients of the message.  Messages
+ * refer to their fields instead of copying them, so a message must not outlive the strings it
+ * was built from.
+ */
+class WireMessage : private boost::noncopyable {
+public:
+	enum Format {
+		FORMAT_TEXT,
+		FORMAT_BINARY,
+		FORMAT_COMPRESSED,
+		formatCount
+	};
+
+	WireMessage() : textEncoded_(false), binaryEncoded_(false), compressedEncoded_(false) { }
+	virtual ~WireMessage() { }
+
+	// the format to send to a peer with the given negotiated features
+	static Format getFormat(unsigned features) {
+		if (!(features & FEATURE_BINARY))
+			return FORMAT_TEXT;
+		return (features & FEATURE_COMPRESSION) ? FORMAT_COMPRESSED : FORMAT_BINARY;
+	}
+
+	// the encoding to send to a peer with the given negotiated features
+	const string &getEncoding(unsigned features) const {
+		switch (getFormat(features)) {
+		case FORMAT_COMPRESSED:
+			return getCompressed();
+		case FORMAT_BINARY:
+			return getBinary();
+		default:
+			return getText();
+		}
+	}
+
+	const string &getText() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return getTextLocked();
+	}
+
+	const string &getBinary() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return getBinaryLocked();
+	}
+
+	// see BinaryProtocol::compressMessage
+	const string &getCompressed() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!compressedEncoded_) {
+			const string &binary = getBinaryLocked();
+			compressed_ = BinaryProtocol::isBinaryMessage(binary.data(), binary.size()) ? BinaryProtocol::compressMessage(binary) : string();
+			compressedEncoded_ = true;
+		}
+		return compressed_.empty() ? getBinaryLocked() : compressed_;
+	}
+protected:
+	virtual string encodeText() const = 0;
+	virtual string encodeBinary() const = 0;
+private:
+	const string &getBinaryLocked() const {
+		if (!binaryEncoded_) {
+			binary_ = encodeBinary();
+			binaryEncoded_ = true;
+		}
+		// a message that cannot be framed in binary still reaches the peer as text
+		return binary_.empty() ? getTextLocked() : binary_;
+	}
+
+	const string &getTextLocked() const {
+		if (!textEncoded_) {
+			text_ = encodeText();
+			textEncoded_ = true;
+		}
+		return text_;
+	}
+
+	mutable boost::mutex mutex_;
+	mutable bool textEncoded_;
+	mutable bool binaryEncoded_;
+	mutable bool compressedEncoded_;
+	mutable string text_;
+	mutable string binary_;
+	mutable string compressed_;
+};
+
+/**
+ * PlainChatWireMessage carries a chat message
+ */
+class PlainChatWireMessage : public WireMessage {
+public:
+	PlainChatWireMessage(const string &fromID, const string &message) : fromID_(fromID), message_(message) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapPlainChatMessage(fromID_, message_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::getPlainChatMessageSize(fromID_, message_), '\0');
+		buffer.resize(BinaryProtocol::encodePlainChatMessage(&buffer[0], buffer.size(), fromID_, message_));
+		return buffer;
+	}
+private:
+	const string &fromID_;
+	const string &message_;
+};
+
+/**
+ * FriendListExtractionWireMessage asks a friend for its friend list
+ */
+class FriendListExtractionWireMessage : public WireMessage {
+public:
+	FriendListExtractionWireMessage(const string &id) : id_(id) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapFriendListExtractionMessage(id_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::headerSize + 2 + id_.size(), '\0');
+		buffer.resize(BinaryProtocol::encodeFriendListExtractionMessage(&buffer[0], buffer.size(), id_));
+		return buffer;
+	}
+private:
+	const string &id_;
+};
+
+/**
+ * FriendListExtractionResponseWireMessage returns the friend list information
+ */
+class FriendListExtractionResponseWireMessage : public WireMessage {
+public:
+	FriendListExtractionResponseWireMessage(const string &id, const vector<pair<string, pair<string, string> > > &info)
+		: id_(id), info_(info) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapFriendListExtractionResponseMessage(id_, info_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::getFriendListExtractionResponseMessageSize(id_, info_), '\0');
+		buffer.resize(BinaryProtocol::encodeFriendListExtractionResponseMessage(&buffer[0], buffer.size(), id_, info_));
+		return buffer;
+	}
+private:
+	const string &id_;
+	const vector<pair<string, pair<string, string> > > &info_;
+};
+
+/**
+ * FriendSyncWireMessage asks a friend for the changes to its friend list since a version, or for
+ * the next page of a full sync
+ */
+class FriendSyncWireMessage : public WireMessage {
+public:
+	FriendSyncWireMessage(unsigned epoch, unsigned version, const string &after) : epoch_(epoch), version_(version), after_(after) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapFriendSyncMessage(epoch_, version_, after_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::headerSize + 10 + after_.size(), '\0');
+		buffer.resize(BinaryProtocol::encodeFriendSyncMessage(&buffer[0], buffer.size(), epoch_, version_, after_));
+		return buffer;
+	}
+private:
+	unsigned epoch_;
+	unsigned version_;
+	const string &after_;
+};
+
+/**
+ * FriendDeltaWireMessage returns the changes to the friend list from version base to version
+ */
+class FriendDeltaWireMessage : public WireMessage {
+public:
+	FriendDeltaWireMessage(const string &id, unsigned epoch, unsigned base, unsigned version,
+	                       const vector<pair<string, pair<string, string> > > &changes)
+		: id_(id), epoch_(epoch), base_(base), version_(version), changes_(changes) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapFriendDeltaMessage(id_, epoch_, base_, version_, changes_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::getFriendSyncResponseMessageSize(id_, changes_), '\0');
+		buffer.resize(BinaryProtocol::encodeFriendDeltaMessage(&buffer[0], buffer.size(), id_, epoch_, base_, version_, changes_));
+		return buffer;
+	}
+private:
+	const string &id_;
+	unsigned epoch_;
+	unsigned base_;
+	unsigned version_;
+	const vector<pair<string, pair<string, string> > > &changes_;
+};
+
+/**
+ * FriendPageWireMessage returns a page of the friend list in a full sync
+ */
+class FriendPageWireMessage : public WireMessage {
+public:
+	FriendPageWireMessage(const string &id, unsigned epoch, unsigned version, bool first, bool more,
+	                      const vector<pair<string, pair<string, string> > > &entries)
+		: id_(id), epoch_(epoch), version_(version), first_(first), more_(more), entries_(entries) { }
+protected:
+	virtual string encodeText() const {
+		return ChatProtocol::wrapFriendPageMessage(id_, epoch_, version_, first_, more_, entries_);
+	}
+	virtual string encodeBinary() const {
+		string buffer(BinaryProtocol::getFriendSyncResponseMessageSize(id_, entries_), '\0');
+		buffer.resize(BinaryProtocol::encodeFriendPageMessage(&buffer[0], buffer.size(), id_, epoch_, version_, first_, more_, entries_));
+		return buffer;
+	}
+private:
+	const string &id_;
+	unsigned epoch_;
+	unsigned version_;
+	bool first_;
+	bool more_;
+	const vector<pair<string, pair<string, string> > > &entries_;
+};
+
+}
@@ -0,0 +1,172 @@
+/*
+ * workerpool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "boundedqueue.hpp"
+
+using namespace std;
+
+namespace openchat {
+
+/**
+ * WorkerPool runs a fixed number of long-lived threads that take jobs from a BoundedQueue
+ * and pass them to a handler.  Producers never wait on a lock unless the queue is full and
+ * the policy is OVERFLOW_BLOCK, in which case they sleep until a worker makes room; idle
+ * workers sleep on a condition variable.
+ */
+template <typename Job>
+class WorkerPool : private boost::noncopyable {
+public:
+	typedef boost::function<void (const Job &)> handlerType;
+
+	WorkerPool(size_t workerCount, size_t capacity, OverflowPolicy policy, handlerType handler)
+		: workerCount_(workerCount == 0 ? 1 : workerCount), policy_(policy), handler_(handler), queue_(capacity),
+		  stopping_(false), idleWorkers_(0), blockedProducers_(0), dropped_(0), processed_(0) { }
+
+	~WorkerPool() {
+		stop();
+	}
+
+	void start() {
+		stopping_.store(false);
+		for (size_t i = 0; i < workerCount_; ++i) {
+			workers_.create_thread(boost::bind(&WorkerPool::work, this));
+		}
+	}
+
+	// let the workers drain the queue, then wait for them to finish
+	void stop() {
+		stopping_.store(true);
+		{
+			boost::mutex::scoped_lock lock(idleMutex_);
+			idleCondition_.notify_all();
+		}
+		{
+			boost::mutex::scoped_lock lock(roomMutex_);
+			roomCondition_.notify_all();
+		}
+		workers_.join_all();
+	}
+
+	// returns false if the job (or an older one, when shedding) has been dropped
+	bool submit(const Job &job) {
+		bool accepted = true;
+		while (!queue_.tryPush(job)) {
+			if (policy_ == OVERFLOW_DROP) {
+				++dropped_;
+				return false;
+			} else if (policy_ == OVERFLOW_SHED_OLDEST) {
+				Job oldest;
+				if (queue_.tryPop(oldest)) {
+					++dropped_;
+					accepted = false;
+				}
+			} else if (!waitForRoom(job)) { // OVERFLOW_BLOCK
+				++dropped_;
+				return false;
+			} else {
+				break;
+			}
+		}
+		// pairs with the fence in work() so that a worker going to sleep either sees the job or gets woken
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (idleWorkers_.load() > 0) {
+			boost::mutex::scoped_lock lock(idleMutex_);
+			idleCondition_.notify_one();
+		}
+		return accepted;
+	}
+
+	// counters
+	size_t getQueueDepth() const { return queue_.getSize(); }
+	size_t getQueueCapacity() const { return queue_.getCapacity(); }
+	size_t getDroppedCount() const { return dropped_.load(); }
+	size_t getProcessedCount() const { return processed_.load(); }
+	size_t getWorkerCount() const { return workerCount_; }
+private:
+	// push job once a worker has made room; false if the pool stops first
+	bool waitForRoom(const Job &job) {
+		boost::mutex::scoped_lock lock(roomMutex_);
+		++blockedProducers_;
+		// pairs with the fence in madeRoom() so that a producer going to sleep either finds room or gets woken
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		bool pushed;
+		while (!(pushed = queue_.tryPush(job)) && !stopping_.load()) {
+			roomCondition_.timed_wait(lock, boost::posix_time::milliseconds(100));
+		}
+		--blockedProducers_;
+		return pushed;
+	}
+
+	// called after each pop
+	void madeRoom() {
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (blockedProducers_.load() > 0) {
+			boost::mutex::scoped_lock lock(roomMutex_);
+			roomCondition_.notify_one();
+		}
+	}
+
+	void work() {
+		Job job;
+		while (true) {
+			if (queue_.tryPop(job)) {
+				madeRoom();
+				handle(job);
+				continue;
+			}
+			boost::mutex::scoped_lock lock(idleMutex_);
+			++idleWorkers_;
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			while (!queue_.tryPop(job)) {
+				if (stopping_.load()) {
+					--idleWorkers_;
+					return;
+				}
+				idleCondition_.timed_wait(lock, boost::posix_time::milliseconds(100));
+			}
+			--idleWorkers_;
+			lock.unlock();
+			madeRoom();
+			handle(job);
+		}
+	}
+
+	void handle(Job &job) {
+		try {
+			handler_(job);
+		} catch (exception &e) {
+			// a faulty request must not take the worker down with it
+		}
+		job = Job();
+		++processed_;
+	}
+
+	const size_t workerCount_;
+	const OverflowPolicy policy_;
+	handlerType handler_;
+	BoundedQueue<Job> queue_;
+	boost::thread_group workers_;
+
+	boost::atomic<bool> stopping_;
+	boost::atomic<size_t> idleWorkers_;
+	boost::mutex idleMutex_;
+	boost::condition_variable idleCondition_;
+	boost::atomic<size_t> blockedProducers_;
+	boost::mutex roomMutex_;
+	boost::condition_variable roomCondition_;
+
+	boost::atomic<size_t> dropped_;
+	boost::atomic<size_t> processed_;
+};
+
+}